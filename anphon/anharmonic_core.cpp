@@ -19,18 +19,115 @@ or http://opensource.org/licenses/mit-license.php for information.
 #include "mathfunctions.h"
 #include "memory.h"
 #include "mode_analysis.h"
+#include "parsephon.h"
 #include "system.h"
 #include "thermodynamics.h"
 #include <boost/lexical_cast.hpp>
+#include <sys/stat.h>
 #include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <sstream>
 #include <vector>
 
 #ifdef _OPENMP
 #include <omp.h>
 #endif
 
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// The phase-sum kernels below are compiled for AVX-512, AVX2 and the baseline
+// instruction set, and the best one is selected at run time (GCC, Clang).
+#if defined(__x86_64__) && defined(__linux__) && defined(__has_attribute)
+#if __has_attribute(target_clones)
+#define ANPHON_SIMD_DISPATCH __attribute__((target_clones("avx512f", "avx2", "default")))
+#endif
+#endif
+#ifndef ANPHON_SIMD_DISPATCH
+#define ANPHON_SIMD_DISPATCH
+#endif
+
 using namespace PHON_NS;
 
+namespace
+{
+    // index[j] += coef * latvec[j]
+    ANPHON_SIMD_DISPATCH
+    void add_phase_index(const unsigned int n,
+                         const int coef,
+                         const int *latvec,
+                         int *index)
+    {
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+        for (unsigned int j = 0; j < n; ++j) {
+            index[j] += coef * latvec[j];
+        }
+    }
+
+    // index[j] = table[index[j]]
+    ANPHON_SIMD_DISPATCH
+    void lookup_phase_index(const unsigned int n,
+                            const int *table,
+                            int *index)
+    {
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+        for (unsigned int j = 0; j < n; ++j) {
+            index[j] = table[index[j]];
+        }
+    }
+
+    // index0[j] = table0[index0[j]] + table1[index1[j]] + table2[index2[j]]
+    ANPHON_SIMD_DISPATCH
+    void lookup_phase_index3(const unsigned int n,
+                             const int *table0,
+                             const int *table1,
+                             const int *table2,
+                             int *index0,
+                             const int *index1,
+                             const int *index2)
+    {
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+        for (unsigned int j = 0; j < n; ++j) {
+            index0[j] = table0[index0[j]] + table1[index1[j]] + table2[index2[j]];
+        }
+    }
+
+    // Returns sum_j fcs[j] * exp_table[index[j]]
+    ANPHON_SIMD_DISPATCH
+    std::complex<double> gather_phase_sum(const unsigned int n,
+                                          const double *fcs,
+                                          const int *index,
+                                          const std::complex<double> *exp_table)
+    {
+        const auto table = reinterpret_cast<const double *>(exp_table);
+        double re = 0.0;
+        double im = 0.0;
+
+#ifdef _OPENMP
+#pragma omp simd reduction(+:re, im)
+#endif
+        for (unsigned int j = 0; j < n; ++j) {
+            re += fcs[j] * table[2 * index[j]];
+            im += fcs[j] * table[2 * index[j] + 1];
+        }
+        return std::complex<double>(re, im);
+    }
+}
+
 AnharmonicCore::AnharmonicCore(PHON *phon) : Pointers(phon)
 {
     set_default_variables();
@@ -47,28 +144,28 @@ void AnharmonicCore::set_default_variables()
     quartic_mode = 0;
     use_tuned_ver = true;
     use_triplet_symmetry = true;
-    relvec_v3 = nullptr;
-    relvec_v4 = nullptr;
+    v3_store = 0;
+    v3store_ready = false;
+    hash_v3store = 0;
+    for (int i = 0; i < 2; ++i) {
+        nscreen_pair[i] = 0;
+        nscreen_triplet[i] = 0;
+    }
     invmass_v3 = nullptr;
     invmass_v4 = nullptr;
     evec_index_v3 = nullptr;
     evec_index_v4 = nullptr;
-    fcs_group_v3 = nullptr;
-    fcs_group_v4 = nullptr;
-    exp_phase = nullptr;
-    exp_phase3 = nullptr;
+    phase_index_v3 = nullptr;
+    phase_index_v4 = nullptr;
     phi3_reciprocal = nullptr;
     phi4_reciprocal = nullptr;
+    kindex_phi3_stored = nullptr;
+    kindex_phi4_stored = nullptr;
+    nthreads = 1;
 }
 
 void AnharmonicCore::deallocate_variables()
 {
-    if (relvec_v3) {
-        memory->deallocate(relvec_v3);
-    }
-    if (relvec_v4) {
-        memory->deallocate(relvec_v4);
-    }
     if (invmass_v3) {
         memory->deallocate(invmass_v3);
     }
@@ -81,17 +178,11 @@ void AnharmonicCore::deallocate_variables()
     if (evec_index_v4) {
         memory->deallocate(evec_index_v4);
     }
-    if (fcs_group_v3) {
-        memory->deallocate(fcs_group_v3);
+    if (phase_index_v3) {
+        memory->deallocate(phase_index_v3);
     }
-    if (fcs_group_v4) {
-        memory->deallocate(fcs_group_v4);
-    }
-    if (exp_phase) {
-        memory->deallocate(exp_phase);
-    }
-    if (exp_phase3) {
-        memory->deallocate(exp_phase3);
+    if (phase_index_v4) {
+        memory->deallocate(phase_index_v4);
     }
     if (phi3_reciprocal) {
         memory->deallocate(phi3_reciprocal);
@@ -99,11 +190,24 @@ void AnharmonicCore::deallocate_variables()
     if (phi4_reciprocal) {
         memory->deallocate(phi4_reciprocal);
     }
+    if (kindex_phi3_stored) {
+        memory->deallocate(kindex_phi3_stored);
+    }
+    if (kindex_phi4_stored) {
+        memory->deallocate(kindex_phi4_stored);
+    }
+    finish_v3store();
 }
 
 
 void AnharmonicCore::setup()
 {
+#ifdef _OPENMP
+    nthreads = omp_get_max_threads();
+#else
+    nthreads = 1;
+#endif
+
     if (fcs_phonon->maxorder >= 2) setup_cubic();
     if (fcs_phonon->maxorder >= 3) setup_quartic();
 
@@ -111,118 +215,57 @@ void AnharmonicCore::setup()
     use_tuned_ver = true;
 
     if (!mode_analysis->calc_fstate_k && kpoint->kpoint_mode == 2) {
-        int nk_tmp[3];
-        nk_tmp[0] = kpoint->nkx;
-        nk_tmp[1] = kpoint->nky;
-        nk_tmp[2] = kpoint->nkz;
-        store_exponential_for_acceleration(nk_tmp,
-                                           nk_represent,
-                                           exp_phase,
-                                           exp_phase3);
-    }
-}
-
-
-void AnharmonicCore::prepare_relative_vector(const std::vector<FcsArrayWithCell> &fcs_in,
-                                             const unsigned int N,
-                                             double ***vec_out)
-{
-    int i, j, k;
-    int ix, iy, iz;
-
-    double vec[3];
-    double **xshift_s;
-
-    std::vector<unsigned int> atm_super, atm_prim;
-    std::vector<unsigned int> xyz;
-    std::vector<unsigned int> cells;
-
-    double mat_convert[3][3];
-
-    for (i = 0; i < 3; ++i) {
-        for (j = 0; j < 3; ++j) {
-            mat_convert[i][j] = 0.0;
-            for (k = 0; k < 3; ++k) {
-                mat_convert[i][j] += system->rlavec_p[i][k] * system->lavec_s_anharm[k][j];
-            }
-        }
+        MPI_Bcast(&use_tuned_ver, 1, MPI_LOGICAL, 0, MPI_COMM_WORLD);
+        if (use_tuned_ver && fcs_phonon->maxorder >= 2) setup_phase_factor();
     }
 
-    memory->allocate(xshift_s, 27, 3);
-
-    for (i = 0; i < 3; ++i) xshift_s[0][i] = 0.0;
-
-    unsigned int icell = 0;
-
-    for (ix = -1; ix <= 1; ++ix) {
-        for (iy = -1; iy <= 1; ++iy) {
-            for (iz = -1; iz <= 1; ++iz) {
-                if (ix == 0 && iy == 0 && iz == 0) continue;
+    MPI_Bcast(&v3_store, 1, MPI_INT, 0, MPI_COMM_WORLD);
 
-                ++icell;
-
-                xshift_s[icell][0] = static_cast<double>(ix);
-                xshift_s[icell][1] = static_cast<double>(iy);
-                xshift_s[icell][2] = static_cast<double>(iz);
+    if (v3_store && fcs_phonon->maxorder >= 2) {
+        if (kpoint->kpoint_mode == 2) {
+            const unsigned int kmesh[3] = {kpoint->nkx, kpoint->nky, kpoint->nkz};
+            if (mympi->my_rank == 0) hash_v3store = get_hash_force_constants(kmesh);
+            MPI_Bcast(&hash_v3store, 1, MPI_UNSIGNED_LONG_LONG, 0, MPI_COMM_WORLD);
+        } else {
+            v3_store = 0;
+            if (mympi->my_rank == 0) {
+                std::cout << " V3STORE = 1 is ignored because the k points are not on a uniform mesh." << std::endl;
             }
         }
     }
+}
 
-    unsigned int atm_p, atm_s;
-    unsigned int tran_tmp;
-    unsigned int icount = 0;
-
-    for (const auto &it : fcs_in) {
-
-        atm_super.clear();
-        atm_prim.clear();
-        xyz.clear();
-        cells.clear();
-
-        for (i = 0; i < it.pairs.size(); ++i) {
-            atm_p = it.pairs[i].index / 3;
-            tran_tmp = it.pairs[i].tran;
-            atm_s = system->map_p2s_anharm[atm_p][tran_tmp];
-
-            atm_prim.push_back(atm_p);
-            atm_super.push_back(atm_s);
-            cells.push_back(it.pairs[i].cell_s);
-        }
-
-
-        for (i = 0; i < N - 1; ++i) {
-
-            for (j = 0; j < 3; ++j) {
-                vec[j] = system->xr_s_anharm[atm_super[i + 1]][j] + xshift_s[cells[i + 1]][j]
-                    - system->xr_s_anharm[system->map_p2s_anharm[atm_prim[i + 1]][0]][j];
-            }
-
-            rotvec(vec, vec, mat_convert);
 
-            for (j = 0; j < 3; ++j) {
-                vec_out[icount][i][j] = vec[j];
-            }
-        }
-        ++icount;
+int AnharmonicCore::get_thread_index() const
+{
+    // Returns the index of the scratch arrays (phi3_reciprocal, phi4_reciprocal)
+    // to be used by the calling thread.
+#ifdef _OPENMP
+    const int ithread = omp_get_thread_num();
+    if (ithread >= nthreads) {
+        error->exit("get_thread_index",
+                    "The number of OpenMP threads exceeds that at the setup stage.");
     }
-    memory->deallocate(xshift_s);
+    return ithread;
+#else
+    return 0;
+#endif
 }
 
-void AnharmonicCore::prepare_relative_vector(const std::vector<FcsArrayWithCell> &fcs_in,
-                                             const unsigned int N,
-                                             const int number_of_groups,
-                                             std::vector<double> *fcs_group,
-                                             std::vector<RelativeVector> *&vec_out)
-{
-    int i, j, k;
-    int ix, iy, iz;
 
-    double vecs[3][3];
-    double **xshift_s;
+void AnharmonicCore::prepare_fcs_csr(const std::vector<FcsArrayWithCell> &fcs_in,
+                                     const unsigned int N,
+                                     FcsArrayCSR &csr) const
+{
+    // Pack the force constants and the relative vectors of each element
+    // into the CSR layout. fcs_in must be sorted beforehand so that
+    // the elements having the same atom-xyz indices are consecutive.
 
-    std::vector<unsigned int> atm_super, atm_prim;
-    std::vector<unsigned int> cells;
+    unsigned int i, j, k;
+    int ix, iy, iz;
 
+    double vec[3], xlat;
+    double xshift_s[27][3];
     double mat_convert[3][3];
 
     for (i = 0; i < 3; ++i) {
@@ -234,8 +277,6 @@ void AnharmonicCore::prepare_relative_vector(const std::vector<FcsArrayWithCell>
         }
     }
 
-    memory->allocate(xshift_s, 27, 3);
-
     for (i = 0; i < 3; ++i) xshift_s[0][i] = 0.0;
 
     unsigned int icell = 0;
@@ -254,108 +295,55 @@ void AnharmonicCore::prepare_relative_vector(const std::vector<FcsArrayWithCell>
         }
     }
 
-    unsigned int tran_tmp;
-    unsigned int nsize_group;
-
-    atm_prim.resize(N);
-    cells.resize(N);
-    atm_super.resize(N);
-
-    unsigned int icount = 0;
-
-    for (auto igroup = 0; igroup < number_of_groups; ++igroup) {
-
-        nsize_group = fcs_group[igroup].size();
-
-        for (j = 0; j < nsize_group; ++j) {
-
-            for (i = 0; i < N; ++i) {
-                atm_prim[i] = fcs_in[icount].pairs[i].index / 3;
-                tran_tmp = fcs_in[icount].pairs[i].tran;
-                cells[i] = fcs_in[icount].pairs[i].cell_s;
-                atm_super[i] = system->map_p2s_anharm[atm_prim[i]][tran_tmp];
-            }
-
-            for (i = 0; i < N - 1; ++i) {
-                for (k = 0; k < 3; ++k) {
-                    vecs[i][k] = system->xr_s_anharm[atm_super[i + 1]][k] + xshift_s[cells[i + 1]][k]
-                        - system->xr_s_anharm[system->map_p2s_anharm[atm_prim[i + 1]][0]][k];
-                }
-                rotvec(vecs[i], vecs[i], mat_convert);
-            }
-
-            if (N == 3) {
-                vec_out[igroup].emplace_back(vecs[0], vecs[1]);
-            } else if (N == 4) {
-                vec_out[igroup].emplace_back(vecs[0], vecs[1], vecs[2]);
-            }
-            ++icount;
-        }
-    }
-
-    memory->deallocate(xshift_s);
-}
-
-
-void AnharmonicCore::prepare_group_of_force_constants(const std::vector<FcsArrayWithCell> &fcs_in,
-                                                      const unsigned int N,
-                                                      int &number_of_groups,
-                                                      std::vector<double> *&fcs_group_out)
-{
-    // Find the number of groups which has different evecs.
-
-    unsigned int i;
-    std::vector<int> arr_old, arr_tmp;
+    const auto nelem = fcs_in.size();
 
-    number_of_groups = 0;
+    csr.nvec = N - 1;
+    csr.offset.clear();
+    csr.fcs.resize(nelem);
+    csr.relvec.assign(3 * csr.nvec, std::vector<double>(nelem));
+    csr.latvec.assign(3 * csr.nvec, std::vector<int>(nelem));
+    csr.is_lattice_vector = true;
 
-    arr_old.clear();
-    for (i = 0; i < N; ++i) {
-        arr_old.push_back(-1);
-    }
+    unsigned int atm_p, atm_s;
+    std::vector<int> arr_old(N, -1), arr_tmp(N);
+    unsigned int ielem = 0;
 
     for (const auto &it : fcs_in) {
 
-        arr_tmp.clear();
-
-        for (i = 0; i < it.pairs.size(); ++i) {
-            arr_tmp.push_back(it.pairs[i].index);
-        }
+        for (i = 0; i < N; ++i) arr_tmp[i] = it.pairs[i].index;
 
         if (arr_tmp != arr_old) {
-            ++number_of_groups;
-            arr_old.clear();
-            arr_old.reserve(arr_tmp.size());
-            std::copy(arr_tmp.begin(), arr_tmp.end(), std::back_inserter(arr_old));
+            csr.offset.push_back(ielem);
+            arr_old = arr_tmp;
         }
-    }
-
-    memory->allocate(fcs_group_out, number_of_groups);
 
-    int igroup = -1;
+        csr.fcs[ielem] = it.fcs_val;
 
-    arr_old.clear();
-    for (i = 0; i < N; ++i) {
-        arr_old.push_back(-1);
-    }
-
-    for (const auto &it : fcs_in) {
+        for (i = 0; i < N - 1; ++i) {
+            atm_p = it.pairs[i + 1].index / 3;
+            atm_s = system->map_p2s_anharm[atm_p][it.pairs[i + 1].tran];
 
-        arr_tmp.clear();
+            for (j = 0; j < 3; ++j) {
+                vec[j] = system->xr_s_anharm[atm_s][j] + xshift_s[it.pairs[i + 1].cell_s][j]
+                    - system->xr_s_anharm[system->map_p2s_anharm[atm_p][0]][j];
+            }
 
-        for (i = 0; i < it.pairs.size(); ++i) {
-            arr_tmp.push_back(it.pairs[i].index);
-        }
+            rotvec(vec, vec, mat_convert);
 
-        if (arr_tmp != arr_old) {
-            ++igroup;
-            arr_old.clear();
-            arr_old.reserve(arr_tmp.size());
-            std::copy(arr_tmp.begin(), arr_tmp.end(), std::back_inserter(arr_old));
+            for (j = 0; j < 3; ++j) {
+                csr.relvec[3 * i + j][ielem] = vec[j];
+                xlat = vec[j] / (2.0 * pi);
+                csr.latvec[3 * i + j][ielem] = nint(xlat);
+                if (std::abs(xlat - static_cast<double>(nint(xlat))) > eps6) {
+                    csr.is_lattice_vector = false;
+                }
+            }
         }
-
-        fcs_group_out[igroup].push_back(it.fcs_val);
+        ++ielem;
     }
+
+    csr.ngroup = csr.offset.size();
+    csr.offset.push_back(ielem);
 }
 
 std::complex<double> AnharmonicCore::V3(const unsigned int ks[3])
@@ -395,10 +383,14 @@ std::complex<double> AnharmonicCore::V3(const unsigned int ks[3],
     // Return zero if any of the involving phonon has imaginary frequency
     if (omega[0] < eps8 || omega[1] < eps8 || omega[2] < eps8) return 0.0;
 
-    if (kn[1] != kindex_phi3_stored[0] || kn[2] != kindex_phi3_stored[1]) {
-        calc_phi3_reciprocal(kn[1], kn[2], phi3_reciprocal);
-        kindex_phi3_stored[0] = kn[1];
-        kindex_phi3_stored[1] = kn[2];
+    const int ithread = get_thread_index();
+    std::complex<double> *phi3 = phi3_reciprocal[ithread];
+    int *kindex_stored = kindex_phi3_stored[ithread];
+
+    if (kn[1] != kindex_stored[0] || kn[2] != kindex_stored[1]) {
+        calc_phi3_reciprocal(kn[1], kn[2], phi3);
+        kindex_stored[0] = kn[1];
+        kindex_stored[1] = kn[2];
     }
 #ifdef _OPENMP
 #pragma omp parallel for private(ret), reduction(+: ret_re, ret_im)
@@ -407,7 +399,7 @@ std::complex<double> AnharmonicCore::V3(const unsigned int ks[3],
         ret = evec_phonon[kn[0]][sn[0]][evec_index_v3[i][0]]
             * evec_phonon[kn[1]][sn[1]][evec_index_v3[i][1]]
             * evec_phonon[kn[2]][sn[2]][evec_index_v3[i][2]]
-            * invmass_v3[i] * phi3_reciprocal[i];
+            * invmass_v3[i] * phi3[i];
         ret_re += ret.real();
         ret_im += ret.imag();
     }
@@ -421,91 +413,321 @@ void AnharmonicCore::calc_phi3_reciprocal(const unsigned int ik1,
                                           const unsigned int ik2,
                                           std::complex<double> *ret)
 {
-    unsigned int iloc;
-    int i, j;
+    int i;
+    unsigned int j, k;
     double phase;
-    double dnk_represent = static_cast<double>(nk_represent) / (2.0 * pi);
+    double xk_tmp[6];
     std::complex<double> ret_in;
-    unsigned int nsize_group;
-
-    unsigned int ielem = 0;
 
     if (use_tuned_ver) {
 
-        if (tune_type == 0) {
+        int coef[6];
+        for (j = 0; j < 3; ++j) {
+            coef[j] = kmesh_int[3 * ik1 + j];
+            coef[j + 3] = kmesh_int[3 * ik2 + j];
+        }
+        const auto index = phase_index_v3[get_thread_index()];
+
+        phase_factor.calc_phase_index(fcs_csr_v3, coef, index);
+
+#pragma omp parallel for
+        for (i = 0; i < ngroup_v3; ++i) {
+            ret[i] = phase_factor.sum_phase_factor(fcs_csr_v3, i, index);
+        }
+
+    } else {
+        // Original version
+        for (k = 0; k < 3; ++k) {
+            xk_tmp[k] = kpoint->xk[ik1][k];
+            xk_tmp[k + 3] = kpoint->xk[ik2][k];
+        }
 
-#pragma omp parallel for private(ret_in, nsize_group, j, phase, iloc)
-            for (i = 0; i < ngroup_v3; ++i) {
+#pragma omp parallel for private(ret_in, j, k, phase)
+        for (i = 0; i < ngroup_v3; ++i) {
 
-                ret_in = std::complex<double>(0.0, 0.0);
-                nsize_group = fcs_group_v3[i].size();
+            ret_in = std::complex<double>(0.0, 0.0);
 
-                for (j = 0; j < nsize_group; ++j) {
+            for (j = fcs_csr_v3.offset[i]; j < fcs_csr_v3.offset[i + 1]; ++j) {
 
-                    phase = relvec_v3[i][j].vecs[0][0] * kpoint->xk[ik1][0]
-                        + relvec_v3[i][j].vecs[0][1] * kpoint->xk[ik1][1]
-                        + relvec_v3[i][j].vecs[0][2] * kpoint->xk[ik1][2]
-                        + relvec_v3[i][j].vecs[1][0] * kpoint->xk[ik2][0]
-                        + relvec_v3[i][j].vecs[1][1] * kpoint->xk[ik2][1]
-                        + relvec_v3[i][j].vecs[1][2] * kpoint->xk[ik2][2];
+                phase = 0.0;
+                for (k = 0; k < 6; ++k) phase += fcs_csr_v3.relvec[k][j] * xk_tmp[k];
 
-                    iloc = nint(phase * dnk_represent) % nk_represent + nk_represent - 1;
-                    ret_in += fcs_group_v3[i][j] * exp_phase[iloc];
-                }
-                ret[i] = ret_in;
+                ret_in += fcs_csr_v3.fcs[j] * std::exp(im * phase);
             }
+            ret[i] = ret_in;
+        }
+    }
+}
+
+
+void AnharmonicCore::calc_V3_block(const unsigned int ks0,
+                                   const unsigned int kn1,
+                                   const unsigned int kn2,
+                                   double **eval_phonon,
+                                   std::complex<double> ***evec_phonon,
+                                   std::complex<double> *ret)
+{
+    // Returns V3(ks0, ns*kn1+is, ns*kn2+js) for all (is, js) pairs
+    // in ret[ns * is + js].
+    // The cubic force constants in reciprocal space are first contracted
+    // with the eigenvector of the mode ks0, giving an ns x ns matrix A.
+    // Then, all elements are obtained at once as V3 = E1 * A * E2^T,
+    // where E1 and E2 are the eigenvector matrices at kn1 and kn2.
+
+    int i, is, js;
+    int ns = dynamical->neval;
+    int ns2 = ns * ns;
+    unsigned int kn0 = ks0 / ns;
+    unsigned int sn0 = ks0 % ns;
+    double omega0, omega_prod;
 
-        } else if (tune_type == 1) {
+    std::complex<double> *amat, *evec1, *evec2, *mat_tmp;
+    std::complex<double> alpha = std::complex<double>(1.0, 0.0);
+    std::complex<double> beta = std::complex<double>(0.0, 0.0);
+    char TRANSN[] = "N";
+    char TRANST[] = "T";
 
-            // Tuned version is used when nk1=nk2=nk3 doesn't hold.
+    omega0 = eval_phonon[kn0][sn0];
+
+    if (omega0 < eps8) {
+        for (i = 0; i < ns2; ++i) ret[i] = std::complex<double>(0.0, 0.0);
+        return;
+    }
 
-            int loc[3];
-            double phase3[3];
-            const auto inv2pi = 1.0 / (2.0 * pi);
+    const int ithread = get_thread_index();
+    std::complex<double> *phi3 = phi3_reciprocal[ithread];
+    int *kindex_stored = kindex_phi3_stored[ithread];
 
-#pragma omp parallel for private(ret_in, nsize_group, j, phase3, loc)
-            for (i = 0; i < ngroup_v3; ++i) {
+    if (kn1 != kindex_stored[0] || kn2 != kindex_stored[1]) {
+        calc_phi3_reciprocal(kn1, kn2, phi3);
+        kindex_stored[0] = kn1;
+        kindex_stored[1] = kn2;
+    }
 
-                ret_in = std::complex<double>(0.0, 0.0);
-                nsize_group = fcs_group_v3[i].size();
+    memory->allocate(amat, ns2);
+    memory->allocate(evec1, ns2);
+    memory->allocate(evec2, ns2);
+    memory->allocate(mat_tmp, ns2);
 
-                for (j = 0; j < nsize_group; ++j) {
+    for (i = 0; i < ns2; ++i) amat[i] = std::complex<double>(0.0, 0.0);
 
-                    for (auto ii = 0; ii < 3; ++ii) {
-                        phase3[ii]
-                            = relvec_v3[i][j].vecs[0][ii] * kpoint->xk[ik1][ii]
-                            + relvec_v3[i][j].vecs[1][ii] * kpoint->xk[ik2][ii];
+    for (i = 0; i < ngroup_v3; ++i) {
+        amat[ns * evec_index_v3[i][1] + evec_index_v3[i][2]]
+            += evec_phonon[kn0][sn0][evec_index_v3[i][0]]
+            * invmass_v3[i] * phi3[i];
+    }
 
-                        loc[ii] = nint(phase3[ii] * dnk[ii] * inv2pi) % nk_grid[ii] + nk_grid[ii] - 1;
-                    }
+    for (is = 0; is < ns; ++is) {
+        for (js = 0; js < ns; ++js) {
+            evec1[ns * is + js] = evec_phonon[kn1][is][js];
+            evec2[ns * is + js] = evec_phonon[kn2][is][js];
+        }
+    }
+
+    // The arrays are stored in the row-major order, so that zgemm sees
+    // the transposed matrices. mat_tmp = E2 * A^T and ret = mat_tmp * E1^T = V3^T
+    // in the column-major order, which is V3 in the row-major order.
+
+    zgemm_(TRANST, TRANSN, &ns, &ns, &ns, &alpha,
+           evec2, &ns, amat, &ns, &beta, mat_tmp, &ns);
+    zgemm_(TRANSN, TRANSN, &ns, &ns, &ns, &alpha,
+           mat_tmp, &ns, evec1, &ns, &beta, ret, &ns);
+
+    for (is = 0; is < ns; ++is) {
+        for (js = 0; js < ns; ++js) {
+            omega_prod = omega0 * eval_phonon[kn1][is] * eval_phonon[kn2][js];
+            if (eval_phonon[kn1][is] < eps8 || eval_phonon[kn2][js] < eps8) {
+                ret[ns * is + js] = std::complex<double>(0.0, 0.0);
+            } else {
+                ret[ns * is + js] /= std::sqrt(omega_prod);
+            }
+        }
+    }
+
+    memory->deallocate(amat);
+    memory->deallocate(evec1);
+    memory->deallocate(evec2);
+    memory->deallocate(mat_tmp);
+}
+
+
+void AnharmonicCore::calc_V3_block_all(const unsigned int kn0,
+                                       const unsigned int kn1,
+                                       const unsigned int kn2,
+                                       double **eval_phonon,
+                                       std::complex<double> ***evec_phonon,
+                                       std::complex<double> *ret)
+{
+    // Returns V3(ns*kn0+s0, ns*kn1+is, ns*kn2+js) for all branches
+    // in ret[ns * ns * s0 + ns * is + js].
+    // The cubic force constants are stored in an ns x ns x ns tensor
+    // and contracted with the eigenvectors at kn0, kn1 and kn2 by zgemm.
+
+    int i, is, js, ks;
+    int ns = dynamical->neval;
+    int ns2 = ns * ns;
+    double omega_prod;
+
+    std::complex<double> *phi3_tensor, *mat_a;
+    std::complex<double> *evec0, *evec1, *evec2, *mat_tmp;
+    std::complex<double> alpha = std::complex<double>(1.0, 0.0);
+    std::complex<double> beta = std::complex<double>(0.0, 0.0);
+    char TRANSN[] = "N";
+    char TRANST[] = "T";
+
+    const int ithread = get_thread_index();
+    std::complex<double> *phi3 = phi3_reciprocal[ithread];
+    int *kindex_stored = kindex_phi3_stored[ithread];
+
+    if (kn1 != kindex_stored[0] || kn2 != kindex_stored[1]) {
+        calc_phi3_reciprocal(kn1, kn2, phi3);
+        kindex_stored[0] = kn1;
+        kindex_stored[1] = kn2;
+    }
+
+    memory->allocate(phi3_tensor, ns * ns2);
+    memory->allocate(mat_a, ns * ns2);
+    memory->allocate(evec0, ns2);
+    memory->allocate(evec1, ns2);
+    memory->allocate(evec2, ns2);
+    memory->allocate(mat_tmp, ns2);
+
+    for (i = 0; i < ns * ns2; ++i) phi3_tensor[i] = std::complex<double>(0.0, 0.0);
+
+    for (i = 0; i < ngroup_v3; ++i) {
+        phi3_tensor[ns2 * evec_index_v3[i][0]
+            + ns * evec_index_v3[i][1] + evec_index_v3[i][2]]
+            += invmass_v3[i] * phi3[i];
+    }
+
+    for (is = 0; is < ns; ++is) {
+        for (js = 0; js < ns; ++js) {
+            evec0[ns * is + js] = evec_phonon[kn0][is][js];
+            evec1[ns * is + js] = evec_phonon[kn1][is][js];
+            evec2[ns * is + js] = evec_phonon[kn2][is][js];
+        }
+    }
+
+    // mat_a[ns2 * s0 + ns * a + b] = sum_c evec0[s0][c] * phi3_tensor[c][a][b]
+
+    zgemm_(TRANSN, TRANSN, &ns2, &ns, &ns, &alpha,
+           phi3_tensor, &ns2, evec0, &ns, &beta, mat_a, &ns2);
 
-                    ret_in += fcs_group_v3[i][j] * exp_phase3[loc[0]][loc[1]][loc[2]];
+    for (ks = 0; ks < ns; ++ks) {
+        zgemm_(TRANST, TRANSN, &ns, &ns, &ns, &alpha,
+               evec2, &ns, mat_a + ns2 * ks, &ns, &beta, mat_tmp, &ns);
+        zgemm_(TRANSN, TRANSN, &ns, &ns, &ns, &alpha,
+               mat_tmp, &ns, evec1, &ns, &beta, ret + ns2 * ks, &ns);
+    }
+
+    for (ks = 0; ks < ns; ++ks) {
+        for (is = 0; is < ns; ++is) {
+            for (js = 0; js < ns; ++js) {
+                if (eval_phonon[kn0][ks] < eps8
+                    || eval_phonon[kn1][is] < eps8
+                    || eval_phonon[kn2][js] < eps8) {
+                    ret[ns2 * ks + ns * is + js] = std::complex<double>(0.0, 0.0);
+                } else {
+                    omega_prod = eval_phonon[kn0][ks] * eval_phonon[kn1][is] * eval_phonon[kn2][js];
+                    ret[ns2 * ks + ns * is + js] /= std::sqrt(omega_prod);
                 }
-                ret[i] = ret_in;
             }
         }
+    }
 
-    } else {
-        // Original version
-#pragma omp parallel for private(ret_in, nsize_group, phase)
-        for (i = 0; i < ngroup_v3; ++i) {
+    memory->deallocate(phi3_tensor);
+    memory->deallocate(mat_a);
+    memory->deallocate(evec0);
+    memory->deallocate(evec1);
+    memory->deallocate(evec2);
+    memory->deallocate(mat_tmp);
+}
 
-            ret_in = std::complex<double>(0.0, 0.0);
-            nsize_group = fcs_group_v3[i].size();
 
-            for (j = 0; j < nsize_group; ++j) {
+void AnharmonicCore::calc_V3norm2_block(const unsigned int ks0,
+                                        const unsigned int kn1,
+                                        const unsigned int kn2,
+                                        double **eval,
+                                        std::complex<double> ***evec,
+                                        double *ret)
+{
+    // Returns |V3(ks0, ns * kn1 + is, ns * kn2 + js)|^2 in ret[ns * is + js].
+    // When the |V3|^2 store is active and the harmonic eigenvectors are given,
+    // the stored values are used if available, and new values are added to the store.
+
+    const unsigned int ns = dynamical->neval;
+    const unsigned int ns2 = ns * ns;
+    const bool use_store = v3store_ready && eval == dynamical->eval_phonon
+        && evec == dynamical->evec_phonon;
+    std::complex<double> *v3_block;
+
+    if (use_store) {
+        const double *ptr = find_v3store(ks0 / ns, ks0 % ns, kn1, kn2);
+        if (ptr) {
+            for (unsigned int ib = 0; ib < ns2; ++ib) ret[ib] = ptr[ib];
+            return;
+        }
+    }
+
+    memory->allocate(v3_block, ns2);
+
+    calc_V3_block(ks0, kn1, kn2, eval, evec, v3_block);
+
+    for (unsigned int ib = 0; ib < ns2; ++ib) ret[ib] = std::norm(v3_block[ib]);
 
-                phase
-                    = relvec_v3[i][j].vecs[0][0] * kpoint->xk[ik1][0]
-                    + relvec_v3[i][j].vecs[0][1] * kpoint->xk[ik1][1]
-                    + relvec_v3[i][j].vecs[0][2] * kpoint->xk[ik1][2]
-                    + relvec_v3[i][j].vecs[1][0] * kpoint->xk[ik2][0]
-                    + relvec_v3[i][j].vecs[1][1] * kpoint->xk[ik2][1]
-                    + relvec_v3[i][j].vecs[1][2] * kpoint->xk[ik2][2];
+    memory->deallocate(v3_block);
 
-                ret_in += fcs_group_v3[i][j] * std::exp(im * phase);
+    if (use_store) append_v3store(ks0 / ns, ks0 % ns, kn1, kn2, ret);
+}
+
+
+void AnharmonicCore::calc_V3norm2_block_all(const unsigned int kn0,
+                                            const unsigned int kn1,
+                                            const unsigned int kn2,
+                                            double **eval,
+                                            std::complex<double> ***evec,
+                                            double *ret)
+{
+    // Returns |V3(ns * kn0 + s0, ns * kn1 + is, ns * kn2 + js)|^2
+    // in ret[ns * ns * s0 + ns * is + js].
+
+    unsigned int s0;
+    const unsigned int ns = dynamical->neval;
+    const unsigned int ns2 = ns * ns;
+    const bool use_store = v3store_ready && eval == dynamical->eval_phonon
+        && evec == dynamical->evec_phonon;
+    std::complex<double> *v3_block;
+
+    if (use_store) {
+        bool found_all = true;
+        for (s0 = 0; s0 < ns; ++s0) {
+            if (!find_v3store(kn0, s0, kn1, kn2)) {
+                found_all = false;
+                break;
+            }
+        }
+        if (found_all) {
+            for (s0 = 0; s0 < ns; ++s0) {
+                const double *ptr = find_v3store(kn0, s0, kn1, kn2);
+                for (unsigned int ib = 0; ib < ns2; ++ib) ret[ns2 * s0 + ib] = ptr[ib];
+            }
+            return;
+        }
+    }
+
+    memory->allocate(v3_block, ns * ns2);
+
+    calc_V3_block_all(kn0, kn1, kn2, eval, evec, v3_block);
+
+    for (unsigned int ib = 0; ib < ns * ns2; ++ib) ret[ib] = std::norm(v3_block[ib]);
+
+    memory->deallocate(v3_block);
+
+    if (use_store) {
+        for (s0 = 0; s0 < ns; ++s0) {
+            if (!find_v3store(kn0, s0, kn1, kn2)) {
+                append_v3store(kn0, s0, kn1, kn2, &ret[ns2 * s0]);
             }
-            ret[i] = ret_in;
         }
     }
 }
@@ -531,18 +753,22 @@ std::complex<double> AnharmonicCore::V4(const unsigned int ks[4],
     // Return zero if any of the involving phonon has imaginary frequency
     if (omega[0] < eps8 || omega[1] < eps8 || omega[2] < eps8 || omega[3] < eps8) return 0.0;
 
-    if (kn[1] != kindex_phi4_stored[0]
-        || kn[2] != kindex_phi4_stored[1]
-        || kn[3] != kindex_phi4_stored[2]) {
+    const int ithread = get_thread_index();
+    std::complex<double> *phi4 = phi4_reciprocal[ithread];
+    int *kindex_stored = kindex_phi4_stored[ithread];
+
+    if (kn[1] != kindex_stored[0]
+        || kn[2] != kindex_stored[1]
+        || kn[3] != kindex_stored[2]) {
 
         calc_phi4_reciprocal(kn[1],
                              kn[2],
                              kn[3],
-                             phi4_reciprocal);
+                             phi4);
 
-        kindex_phi4_stored[0] = kn[1];
-        kindex_phi4_stored[1] = kn[2];
-        kindex_phi4_stored[2] = kn[3];
+        kindex_stored[0] = kn[1];
+        kindex_stored[1] = kn[2];
+        kindex_stored[2] = kn[3];
     }
 
 #ifdef _OPENMP
@@ -553,7 +779,7 @@ std::complex<double> AnharmonicCore::V4(const unsigned int ks[4],
             * evec_phonon[kn[1]][sn[1]][evec_index_v4[i][1]]
             * evec_phonon[kn[2]][sn[2]][evec_index_v4[i][2]]
             * evec_phonon[kn[3]][sn[3]][evec_index_v4[i][3]]
-            * invmass_v4[i] * phi4_reciprocal[i];
+            * invmass_v4[i] * phi4[i];
         ret_re += ret.real();
         ret_im += ret.imag();
     }
@@ -568,96 +794,48 @@ void AnharmonicCore::calc_phi4_reciprocal(const unsigned int ik1,
                                           const unsigned int ik3,
                                           std::complex<double> *ret)
 {
-    unsigned int iloc;
-    int i, j;
+    int i;
+    unsigned int j, k;
     double phase;
-    double dnk_represent = static_cast<double>(nk_represent) / (2.0 * pi);
+    double xk_tmp[9];
     std::complex<double> ret_in;
-    unsigned int nsize_group;
-
-    unsigned int ielem = 0;
 
     if (use_tuned_ver) {
 
-        if (tune_type == 0) {
+        int coef[9];
+        for (j = 0; j < 3; ++j) {
+            coef[j] = kmesh_int[3 * ik1 + j];
+            coef[j + 3] = kmesh_int[3 * ik2 + j];
+            coef[j + 6] = kmesh_int[3 * ik3 + j];
+        }
+        const auto index = phase_index_v4[get_thread_index()];
 
-#pragma omp parallel for private(ret_in, nsize_group, j, phase, iloc)
-            for (i = 0; i < ngroup_v4; ++i) {
+        phase_factor.calc_phase_index(fcs_csr_v4, coef, index);
 
-                ret_in = std::complex<double>(0.0, 0.0);
-                nsize_group = fcs_group_v4[i].size();
+#pragma omp parallel for
+        for (i = 0; i < ngroup_v4; ++i) {
+            ret[i] = phase_factor.sum_phase_factor(fcs_csr_v4, i, index);
+        }
 
-                for (j = 0; j < nsize_group; ++j) {
+    } else {
+        // Original version
+        for (k = 0; k < 3; ++k) {
+            xk_tmp[k] = kpoint->xk[ik1][k];
+            xk_tmp[k + 3] = kpoint->xk[ik2][k];
+            xk_tmp[k + 6] = kpoint->xk[ik3][k];
+        }
 
-                    phase = relvec_v4[i][j].vecs[0][0] * kpoint->xk[ik1][0]
-                        + relvec_v4[i][j].vecs[0][1] * kpoint->xk[ik1][1]
-                        + relvec_v4[i][j].vecs[0][2] * kpoint->xk[ik1][2]
-                        + relvec_v4[i][j].vecs[1][0] * kpoint->xk[ik2][0]
-                        + relvec_v4[i][j].vecs[1][1] * kpoint->xk[ik2][1]
-                        + relvec_v4[i][j].vecs[1][2] * kpoint->xk[ik2][2]
-                        + relvec_v4[i][j].vecs[2][0] * kpoint->xk[ik3][0]
-                        + relvec_v4[i][j].vecs[2][1] * kpoint->xk[ik3][1]
-                        + relvec_v4[i][j].vecs[2][2] * kpoint->xk[ik3][2];
+#pragma omp parallel for private(ret_in, j, k, phase)
+        for (i = 0; i < ngroup_v4; ++i) {
 
-                    iloc = nint(phase * dnk_represent) % nk_represent + nk_represent - 1;
-                    ret_in += fcs_group_v4[i][j] * exp_phase[iloc];
-                }
-                ret[i] = ret_in;
-            }
-
-        } else if (tune_type == 1) {
-
-            // Tuned version is used when nk1=nk2=nk3 doesn't hold.
-
-            int loc[3];
-            double phase3[3];
-            const auto inv2pi = 1.0 / (2.0 * pi);
-
-#pragma omp parallel for private(ret_in, nsize_group, j, phase3, loc)
-            for (i = 0; i < ngroup_v4; ++i) {
-
-                ret_in = std::complex<double>(0.0, 0.0);
-                nsize_group = fcs_group_v4[i].size();
-
-                for (j = 0; j < nsize_group; ++j) {
-
-                    for (auto ii = 0; ii < 3; ++ii) {
-                        phase3[ii]
-                            = relvec_v4[i][j].vecs[0][ii] * kpoint->xk[ik1][ii]
-                            + relvec_v4[i][j].vecs[1][ii] * kpoint->xk[ik2][ii]
-                            + relvec_v4[i][j].vecs[2][ii] * kpoint->xk[ik3][ii];
-
-                        loc[ii] = nint(phase3[ii] * dnk[ii] * inv2pi) % nk_grid[ii] + nk_grid[ii] - 1;
-                    }
+            ret_in = std::complex<double>(0.0, 0.0);
 
-                    ret_in += fcs_group_v4[i][j] * exp_phase3[loc[0]][loc[1]][loc[2]];
-                }
-                ret[i] = ret_in;
-            }
-        }
+            for (j = fcs_csr_v4.offset[i]; j < fcs_csr_v4.offset[i + 1]; ++j) {
 
-    } else {
-        // Original version
-#pragma omp parallel for private(ret_in, nsize_group, phase)
-        for (i = 0; i < ngroup_v4; ++i) {
+                phase = 0.0;
+                for (k = 0; k < 9; ++k) phase += fcs_csr_v4.relvec[k][j] * xk_tmp[k];
 
-            ret_in = std::complex<double>(0.0, 0.0);
-            nsize_group = fcs_group_v4[i].size();
-
-            for (j = 0; j < nsize_group; ++j) {
-
-                phase
-                    = relvec_v4[i][j].vecs[0][0] * kpoint->xk[ik1][0]
-                    + relvec_v4[i][j].vecs[0][1] * kpoint->xk[ik1][1]
-                    + relvec_v4[i][j].vecs[0][2] * kpoint->xk[ik1][2]
-                    + relvec_v4[i][j].vecs[1][0] * kpoint->xk[ik2][0]
-                    + relvec_v4[i][j].vecs[1][1] * kpoint->xk[ik2][1]
-                    + relvec_v4[i][j].vecs[1][2] * kpoint->xk[ik2][2]
-                    + relvec_v4[i][j].vecs[2][0] * kpoint->xk[ik3][0]
-                    + relvec_v4[i][j].vecs[2][1] * kpoint->xk[ik3][1]
-                    + relvec_v4[i][j].vecs[2][2] * kpoint->xk[ik3][2];
-
-                ret_in += fcs_group_v4[i][j] * std::exp(im * phase);
+                ret_in += fcs_csr_v4.fcs[j] * std::exp(im * phase);
             }
             ret[i] = ret_in;
         }
@@ -673,17 +851,21 @@ std::complex<double> AnharmonicCore::V3_mode(int mode,
                                              double **eval,
                                              std::complex<double> ***evec)
 {
-    int i, j;
-    int nsize_group;
+    int i;
+    unsigned int j, k;
 
     double phase;
+    double xk_tmp[6];
     std::complex<double> ctmp = std::complex<double>(0.0, 0.0);
     std::complex<double> vec_tmp, ret_in;
 
     // Return zero if any of the involving phonon has imaginary frequency
     if (eval[0][mode] < eps8 || eval[1][is] < eps8 || eval[2][js] < eps8) return 0.0;
 
-    unsigned int ielem = 0;
+    for (k = 0; k < 3; ++k) {
+        xk_tmp[k] = xk2[k];
+        xk_tmp[k + 3] = xk3[k];
+    }
 
     for (i = 0; i < ngroup_v3; ++i) {
 
@@ -695,21 +877,12 @@ std::complex<double> AnharmonicCore::V3_mode(int mode,
 
         ret_in = std::complex<double>(0.0, 0.0);
 
-        nsize_group = fcs_group_v3[i].size();
-
-        for (j = 0; j < nsize_group; ++j) {
-
-            phase
-                = relvec_v3[i][j].vecs[0][0] * xk2[0]
-                + relvec_v3[i][j].vecs[0][1] * xk2[1]
-                + relvec_v3[i][j].vecs[0][2] * xk2[2]
-                + relvec_v3[i][j].vecs[1][0] * xk3[0]
-                + relvec_v3[i][j].vecs[1][1] * xk3[1]
-                + relvec_v3[i][j].vecs[1][2] * xk3[2];
+        for (j = fcs_csr_v3.offset[i]; j < fcs_csr_v3.offset[i + 1]; ++j) {
 
-            ret_in += fcs_group_v3[i][j] * std::exp(im * phase);
+            phase = 0.0;
+            for (k = 0; k < 6; ++k) phase += fcs_csr_v3.relvec[k][j] * xk_tmp[k];
 
-            ++ielem;
+            ret_in += fcs_csr_v3.fcs[j] * std::exp(im * phase);
         }
         ctmp += ret_in * vec_tmp;
     }
@@ -723,7 +896,8 @@ void AnharmonicCore::calc_damping_smearing(const unsigned int N,
                                            const double omega,
                                            const unsigned int ik_in,
                                            const unsigned int snum,
-                                           double *ret)
+                                           double *ret,
+                                           DampingKernel *kernel)
 {
     // This function returns the imaginary part of phonon self-energy 
     // for the given frequency omega.
@@ -736,7 +910,6 @@ void AnharmonicCore::calc_damping_smearing(const unsigned int N,
     unsigned int i;
     int ik;
     unsigned int is, js;
-    unsigned int arr[3];
 
     int k1, k2;
 
@@ -752,10 +925,14 @@ void AnharmonicCore::calc_damping_smearing(const unsigned int N,
     double **v3_arr;
     double ***delta_arr;
     double ret_tmp;
+    double *v3norm_block;
 
     double f1, f2;
 
     double epsilon = integration->epsilon;
+    const double window = get_window_smearing();
+    unsigned long long npair_kept = 0;
+    unsigned long long ntriplet_kept = 0;
 
     std::vector<KsListGroup> triplet;
 
@@ -772,22 +949,18 @@ void AnharmonicCore::calc_damping_smearing(const unsigned int N,
     knum = kpoint->kpoint_irred_all[ik_in][0].knum;
     knum_minus = kpoint->knum_minus[knum];
 #ifdef _OPENMP
-#pragma omp parallel for private(multi, arr, k1, k2, is, js, omega_inner)
+#pragma omp parallel for private(multi, k1, k2, is, js, omega_inner)
 #endif
     for (ik = 0; ik < npair_uniq; ++ik) {
         multi = static_cast<double>(triplet[ik].group.size());
 
-        arr[0] = ns * knum_minus + snum;
-
         k1 = triplet[ik].group[0].ks[0];
         k2 = triplet[ik].group[0].ks[1];
 
         for (is = 0; is < ns; ++is) {
-            arr[1] = ns * k1 + is;
             omega_inner[0] = dynamical->eval_phonon[k1][is];
 
             for (js = 0; js < ns; ++js) {
-                arr[2] = ns * k2 + js;
                 omega_inner[1] = dynamical->eval_phonon[k2][js];
 
                 if (integration->ismear == 0) {
@@ -798,36 +971,99 @@ void AnharmonicCore::calc_damping_smearing(const unsigned int N,
                         = delta_lorentz(omega - omega_inner[0] + omega_inner[1], epsilon)
                         - delta_lorentz(omega + omega_inner[0] - omega_inner[1], epsilon);
                 } else if (integration->ismear == 1) {
-                    delta_arr[ik][ns * is + js][0]
-                        = delta_gauss(omega - omega_inner[0] - omega_inner[1], epsilon)
-                        - delta_gauss(omega + omega_inner[0] + omega_inner[1], epsilon);
-                    delta_arr[ik][ns * is + js][1]
-                        = delta_gauss(omega - omega_inner[0] + omega_inner[1], epsilon)
-                        - delta_gauss(omega + omega_inner[0] - omega_inner[1], epsilon);
+                    if (is_screened_out(omega, omega_inner[0], omega_inner[1], window)) {
+                        delta_arr[ik][ns * is + js][0] = 0.0;
+                        delta_arr[ik][ns * is + js][1] = 0.0;
+                    } else {
+                        delta_arr[ik][ns * is + js][0]
+                            = delta_gauss(omega - omega_inner[0] - omega_inner[1], epsilon)
+                            - delta_gauss(omega + omega_inner[0] + omega_inner[1], epsilon);
+                        delta_arr[ik][ns * is + js][1]
+                            = delta_gauss(omega - omega_inner[0] + omega_inner[1], epsilon)
+                            - delta_gauss(omega + omega_inner[0] - omega_inner[1], epsilon);
+                    }
                 }
             }
         }
     }
 
-    for (ik = 0; ik < npair_uniq; ++ik) {
+#ifdef _OPENMP
+#pragma omp parallel private(k1, k2, multi, v3norm_block)
+#endif
+    {
+        memory->allocate(v3norm_block, ns2);
 
-        k1 = triplet[ik].group[0].ks[0];
-        k2 = triplet[ik].group[0].ks[1];
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic) reduction(+:npair_kept, ntriplet_kept)
+#endif
+        for (ik = 0; ik < npair_uniq; ++ik) {
 
-        multi = static_cast<double>(triplet[ik].group.size());
+            k1 = triplet[ik].group[0].ks[0];
+            k2 = triplet[ik].group[0].ks[1];
 
-        for (int ib = 0; ib < ns2; ++ib) {
-            is = ib / ns;
-            js = ib % ns;
+            multi = static_cast<double>(triplet[ik].group.size());
+
+            // Skip the triplet if the delta functions of all the band pairs vanish.
+            int npair_in = 0;
+            for (int ib = 0; ib < ns2; ++ib) {
+                if (delta_arr[ik][ib][0] != 0.0 || delta_arr[ik][ib][1] != 0.0) ++npair_in;
+            }
+
+            npair_kept += npair_in;
+
+            if (npair_in == 0) {
+                for (int ib = 0; ib < ns2; ++ib) v3_arr[ik][ib] = 0.0;
+                continue;
+            }
 
-            arr[0] = ns * knum_minus + snum;
-            arr[1] = ns * k1 + is;
-            arr[2] = ns * k2 + js;
+            ++ntriplet_kept;
 
-            v3_arr[ik][ib] = std::norm(V3(arr,
-                                          dynamical->eval_phonon,
-                                          dynamical->evec_phonon)) * multi;
+            calc_V3norm2_block(ns * knum_minus + snum, k1, k2,
+                               dynamical->eval_phonon,
+                               dynamical->evec_phonon,
+                               v3norm_block);
+
+            for (int ib = 0; ib < ns2; ++ib) {
+                v3_arr[ik][ib] = v3norm_block[ib] * multi;
+            }
+        }
+
+        memory->deallocate(v3norm_block);
+    }
+
+    nscreen_pair[0] += static_cast<unsigned long long>(npair_uniq) * ns2;
+    nscreen_pair[1] += npair_kept;
+    nscreen_triplet[0] += npair_uniq;
+    nscreen_triplet[1] += ntriplet_kept;
+
+    if (kernel) {
+        // The temperature-independent kernel is returned instead.
+        // ret is then evaluated from the kernel.
+        std::vector<int> kmap_irred;
+        std::unordered_map<int, double> kernel_sum;
+        double kernel_c0 = 0.0;
+        get_kmap_irreducible(kmap_irred);
+
+        for (ik = 0; ik < npair_uniq; ++ik) {
+            k1 = triplet[ik].group[0].ks[0];
+            k2 = triplet[ik].group[0].ks[1];
+
+            for (int ib = 0; ib < ns2; ++ib) {
+                reduce_damping_kernel(kmap_irred, k1, k2, ib / ns, ib % ns,
+                                      v3_arr[ik][ib],
+                                      delta_arr[ik][ib][0],
+                                      delta_arr[ik][ib][1],
+                                      kernel_c0, kernel_sum);
+            }
         }
+
+        memory->deallocate(v3_arr);
+        memory->deallocate(delta_arr);
+        triplet.clear();
+
+        pack_damping_kernel(kernel_c0, kernel_sum, pi * std::pow(0.5, 4) / static_cast<double>(nk), *kernel);
+        evaluate_damping_kernel(N, T, *kernel, ret);
+        return;
     }
 
     for (i = 0; i < N; ++i) {
@@ -885,7 +1121,8 @@ void AnharmonicCore::calc_damping_tetrahedron(const unsigned int N,
                                               const double omega,
                                               const unsigned int ik_in,
                                               const unsigned int snum,
-                                              double *ret)
+                                              double *ret,
+                                              DampingKernel *kernel)
 {
     // This function returns the imaginary part of phonon self-energy 
     // for the given frequency omega.
@@ -902,14 +1139,12 @@ void AnharmonicCore::calc_damping_tetrahedron(const unsigned int N,
     unsigned int jk;
     unsigned int is, js;
     unsigned int k1, k2;
-    unsigned int arr[3];
 
     double T_tmp;
     double n1, n2;
     double f1, f2;
     double multi;
 
-    double xk_tmp[3];
     double omega_inner[2];
 
     double ret_tmp;
@@ -919,6 +1154,7 @@ void AnharmonicCore::calc_damping_tetrahedron(const unsigned int N,
     double **weight_tetra;
     double **v3_arr;
     double ***delta_arr;
+    double *v3norm_block;
 
     std::vector<KsListGroup> triplet;
 
@@ -943,7 +1179,7 @@ void AnharmonicCore::calc_damping_tetrahedron(const unsigned int N,
 
 
 #ifdef _OPENMP
-#pragma omp parallel private(is, js, k1, k2, xk_tmp, energy_tmp, i, weight_tetra, ik, jk, arr)
+#pragma omp parallel private(is, js, k1, k2, energy_tmp, i, weight_tetra, ik, jk)
 #endif
     {
         memory->allocate(energy_tmp, 3, nk);
@@ -960,9 +1196,7 @@ void AnharmonicCore::calc_damping_tetrahedron(const unsigned int N,
 
                 // Prepare two-phonon frequency for the tetrahedron method
 
-                for (i = 0; i < 3; ++i) xk_tmp[i] = kpoint->xk[knum][i] - kpoint->xk[k1][i];
-
-                k2 = kpoint->get_knum(xk_tmp[0], xk_tmp[1], xk_tmp[2]);
+                k2 = kpoint->knum_sum(knum, k1, 1, -1);
 
                 energy_tmp[0][k1] = dynamical->eval_phonon[k1][is] + dynamical->eval_phonon[k2][js];
                 energy_tmp[1][k1] = dynamical->eval_phonon[k1][is] - dynamical->eval_phonon[k2][js];
@@ -988,31 +1222,82 @@ void AnharmonicCore::calc_damping_tetrahedron(const unsigned int N,
         memory->deallocate(weight_tetra);
     }
 
-    for (ik = 0; ik < npair_uniq; ++ik) {
+#ifdef _OPENMP
+#pragma omp parallel private(k1, k2, multi, ib, v3norm_block)
+#endif
+    {
+        memory->allocate(v3norm_block, ns2);
 
-        k1 = triplet[ik].group[0].ks[0];
-        k2 = triplet[ik].group[0].ks[1];
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+        for (ik = 0; ik < npair_uniq; ++ik) {
 
-        multi = static_cast<double>(triplet[ik].group.size());
+            k1 = triplet[ik].group[0].ks[0];
+            k2 = triplet[ik].group[0].ks[1];
 
-        for (ib = 0; ib < ns2; ++ib) {
-            is = ib / ns;
-            js = ib % ns;
+            multi = static_cast<double>(triplet[ik].group.size());
+
+            // Skip the triplet if none of the band pairs satisfies the energy conservation.
+            bool is_needed = false;
+            for (ib = 0; ib < ns2; ++ib) {
+                if (delta_arr[ik][ib][0] > 0.0 || std::abs(delta_arr[ik][ib][1]) > 0.0) {
+                    is_needed = true;
+                    break;
+                }
+            }
+
+            if (!is_needed) {
+                for (ib = 0; ib < ns2; ++ib) v3_arr[ik][ib] = 0.0;
+                continue;
+            }
+
+            calc_V3norm2_block(ns * knum_minus + snum, k1, k2,
+                               dynamical->eval_phonon,
+                               dynamical->evec_phonon,
+                               v3norm_block);
+
+            for (ib = 0; ib < ns2; ++ib) {
+                if (delta_arr[ik][ib][0] > 0.0 || std::abs(delta_arr[ik][ib][1]) > 0.0) {
+                    v3_arr[ik][ib] = v3norm_block[ib] * multi;
+                } else {
+                    v3_arr[ik][ib] = 0.0;
+                }
+            }
+        }
 
-            if (delta_arr[ik][ib][0] > 0.0 || std::abs(delta_arr[ik][ib][1]) > 0.0) {
+        memory->deallocate(v3norm_block);
+    }
 
-                arr[0] = ns * knum_minus + snum;
-                arr[1] = ns * k1 + is;
-                arr[2] = ns * k2 + js;
+    if (kernel) {
+        // The temperature-independent kernel is returned instead.
+        // ret is then evaluated from the kernel.
+        std::vector<int> kmap_irred;
+        std::unordered_map<int, double> kernel_sum;
+        double kernel_c0 = 0.0;
+        get_kmap_irreducible(kmap_irred);
 
-                v3_arr[ik][ib] = std::norm(V3(arr,
-                                              dynamical->eval_phonon,
-                                              dynamical->evec_phonon)) * multi;
+        for (ik = 0; ik < npair_uniq; ++ik) {
+            k1 = triplet[ik].group[0].ks[0];
+            k2 = triplet[ik].group[0].ks[1];
 
-            } else {
-                v3_arr[ik][ib] = 0.0;
+            for (ib = 0; ib < ns2; ++ib) {
+                if (v3_arr[ik][ib] == 0.0) continue;
+                reduce_damping_kernel(kmap_irred, k1, k2, ib / ns, ib % ns,
+                                      v3_arr[ik][ib],
+                                      delta_arr[ik][ib][0],
+                                      delta_arr[ik][ib][1],
+                                      kernel_c0, kernel_sum);
             }
         }
+
+        memory->deallocate(v3_arr);
+        memory->deallocate(delta_arr);
+        memory->deallocate(kmap_identity);
+
+        pack_damping_kernel(kernel_c0, kernel_sum, pi * std::pow(0.5, 4), *kernel);
+        evaluate_damping_kernel(N, T, *kernel, ret);
+        return;
     }
 
     for (i = 0; i < N; ++i) {
@@ -1065,247 +1350,1004 @@ void AnharmonicCore::calc_damping_tetrahedron(const unsigned int N,
 }
 
 
-void AnharmonicCore::setup_cubic()
+void AnharmonicCore::calc_damping_smearing_kpoint(const unsigned int N,
+                                                  double *T,
+                                                  const unsigned int ik_in,
+                                                  double **ret,
+                                                  DampingKernel *kernel)
 {
-    int i, j, k;
-    double *invsqrt_mass_p;
-
-    // Sort force_constant[1] using the operator defined in fcs_phonons.h
-    // This sorting is necessary.
-    std::sort(fcs_phonon->force_constant_with_cell[1].begin(),
-              fcs_phonon->force_constant_with_cell[1].end());
-    prepare_group_of_force_constants(fcs_phonon->force_constant_with_cell[1],
-                                     3, ngroup_v3, fcs_group_v3);
-
-    memory->allocate(invmass_v3, ngroup_v3);
-    memory->allocate(evec_index_v3, ngroup_v3, 3);
-    memory->allocate(relvec_v3, ngroup_v3);
-    memory->allocate(phi3_reciprocal, ngroup_v3);
-
-    prepare_relative_vector(fcs_phonon->force_constant_with_cell[1],
-                            3,
-                            ngroup_v3,
-                            fcs_group_v3,
-                            relvec_v3);
-
-    memory->allocate(invsqrt_mass_p, system->natmin);
+    // This function returns the imaginary part of phonon self-energy
+    // of all branches at the irreducible k point ik_in in ret[ns][N].
+    // The frequency of each branch is used as omega.
+    // Lorentzian or Gaussian smearing will be used.
+    // The triplet list and the cubic force constants in reciprocal space
+    // are shared by all branches.
 
-    for (i = 0; i < system->natmin; ++i) {
-        invsqrt_mass_p[i] = std::sqrt(1.0 / system->mass[system->map_p2s[i][0]]);
-    }
+    int nk = kpoint->nk;
+    int ns = dynamical->neval;
+    int ns2 = ns * ns;
+    unsigned int i;
+    int ik;
+    unsigned int is, js, snum;
+    unsigned int k1, k2;
+    int knum, knum_minus;
 
-    k = 0;
-    for (i = 0; i < ngroup_v3; ++i) {
-        for (j = 0; j < 3; ++j) {
-            evec_index_v3[i][j] = fcs_phonon->force_constant_with_cell[1][k].pairs[j].index;
-        }
-        invmass_v3[i]
-            = invsqrt_mass_p[evec_index_v3[i][0] / 3]
-            * invsqrt_mass_p[evec_index_v3[i][1] / 3]
-            * invsqrt_mass_p[evec_index_v3[i][2] / 3];
-        k += fcs_group_v3[i].size();
-    }
+    double multi;
+    double v3_tmp;
+    double delta0, delta1;
+    double omega_inner[2];
+    double n1, n2;
+    double *omega0;
+    double **f1_arr, **f2_arr;
+    double **ret_omp;
+    double *v3norm_block;
+    std::vector<int> kmap_irred;
+    std::vector<std::unordered_map<int, double>> kernel_sum;
+    std::vector<double> kernel_c0;
 
-    memory->deallocate(invsqrt_mass_p);
-}
+    double epsilon = integration->epsilon;
+    const double window = get_window_smearing();
+    unsigned long long npair_kept = 0;
+    unsigned long long ntriplet_kept = 0;
+    // The "1" in (1 + f1 + f2) is absent in the classical limit.
+    const double nadd = thermodynamics->classical ? 0.0 : 1.0;
 
-void AnharmonicCore::setup_quartic()
-{
-    int i, j, k;
-    double *invsqrt_mass_p;
-    std::sort(fcs_phonon->force_constant_with_cell[2].begin(),
-              fcs_phonon->force_constant_with_cell[2].end());
-    prepare_group_of_force_constants(fcs_phonon->force_constant_with_cell[2],
-                                     4, ngroup_v4, fcs_group_v4);
+    std::vector<KsListGroup> triplet;
 
-    memory->allocate(invmass_v4, ngroup_v4);
-    memory->allocate(evec_index_v4, ngroup_v4, 4);
-    memory->allocate(relvec_v4, ngroup_v4);
-    memory->allocate(phi4_reciprocal, ngroup_v4);
+    kpoint->get_unique_triplet_k(ik_in,
+                                 use_triplet_symmetry,
+                                 sym_permutation,
+                                 triplet);
 
-    prepare_relative_vector(fcs_phonon->force_constant_with_cell[2],
-                            4,
-                            ngroup_v4,
-                            fcs_group_v4,
-                            relvec_v4);
+    int npair_uniq = triplet.size();
 
-    memory->allocate(invsqrt_mass_p, system->natmin);
+    knum = kpoint->kpoint_irred_all[ik_in][0].knum;
+    knum_minus = kpoint->knum_minus[knum];
 
-    for (i = 0; i < system->natmin; ++i) {
-        invsqrt_mass_p[i] = std::sqrt(1.0 / system->mass[system->map_p2s[i][0]]);
+    memory->allocate(omega0, ns);
+    for (snum = 0; snum < ns; ++snum) {
+        omega0[snum] = dynamical->eval_phonon[knum][snum];
+        for (i = 0; i < N; ++i) ret[snum][i] = 0.0;
     }
 
-    k = 0;
-    for (i = 0; i < ngroup_v4; ++i) {
-        for (j = 0; j < 4; ++j) {
-            evec_index_v4[i][j] = fcs_phonon->force_constant_with_cell[2][k].pairs[j].index;
-        }
-        invmass_v4[i]
-            = invsqrt_mass_p[evec_index_v4[i][0] / 3]
-            * invsqrt_mass_p[evec_index_v4[i][1] / 3]
-            * invsqrt_mass_p[evec_index_v4[i][2] / 3]
-            * invsqrt_mass_p[evec_index_v4[i][3] / 3];
-        k += fcs_group_v4[i].size();
+    if (kernel) {
+        get_kmap_irreducible(kmap_irred);
+        kernel_sum.resize(ns);
+        kernel_c0.resize(ns, 0.0);
     }
 
-    memory->deallocate(invsqrt_mass_p);
-}
+#ifdef _OPENMP
+#pragma omp parallel private(i, k1, k2, is, js, snum, multi, v3_tmp, delta0, delta1, \
+                             omega_inner, n1, n2, f1_arr, f2_arr, ret_omp, v3norm_block)
+#endif
+    {
+        memory->allocate(v3norm_block, ns * ns2);
+        memory->allocate(f1_arr, ns, N);
+        memory->allocate(f2_arr, ns, N);
+        memory->allocate(ret_omp, ns, N);
 
-void AnharmonicCore::store_exponential_for_acceleration(const int nk_in[3],
-                                                        int &nkrep_out,
-                                                        std::complex<double> *exp_out,
-                                                        std::complex<double> ***exp3_out)
-{
-    // For accelerating function V3 and V4 by avoiding continual call of std::exp.
+        for (snum = 0; snum < ns; ++snum) {
+            for (i = 0; i < N; ++i) ret_omp[snum][i] = 0.0;
+        }
 
-    int i;
+        // The kernels are accumulated sparsely in each thread.
+        std::vector<std::unordered_map<int, double>> kernel_sum_omp(kernel ? ns : 0);
+        std::vector<double> kernel_c0_omp(kernel ? ns : 0, 0.0);
 
-    MPI_Bcast(&use_tuned_ver, 1, MPI_LOGICAL, 0, MPI_COMM_WORLD);
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic) reduction(+:npair_kept, ntriplet_kept)
+#endif
+        for (ik = 0; ik < npair_uniq; ++ik) {
 
-    if (use_tuned_ver) {
+            k1 = triplet[ik].group[0].ks[0];
+            k2 = triplet[ik].group[0].ks[1];
 
-        nk_grid[0] = nk_in[0];
-        nk_grid[1] = nk_in[1];
-        nk_grid[2] = nk_in[2];
+            multi = static_cast<double>(triplet[ik].group.size());
+
+            // Skip the triplet if all the band pairs are out of the energy window.
+            int npair_in = 0;
+            for (snum = 0; snum < ns; ++snum) {
+                for (is = 0; is < ns; ++is) {
+                    for (js = 0; js < ns; ++js) {
+                        if (!is_screened_out(omega0[snum],
+                                             dynamical->eval_phonon[k1][is],
+                                             dynamical->eval_phonon[k2][js],
+                                             window)) {
+                            ++npair_in;
+                        }
+                    }
+                }
+            }
 
-        for (i = 0; i < 3; ++i) dnk[i] = static_cast<double>(nk_grid[i]);
+            npair_kept += npair_in;
 
-        if (nk_grid[0] == nk_grid[1] && nk_grid[1] == nk_grid[2]) {
-            nkrep_out = nk_grid[0];
-            tune_type = 0;
+            if (npair_in == 0) continue;
 
-        } else if (nk_grid[0] == nk_grid[1] && nk_grid[2] == 1) {
-            nkrep_out = nk_grid[0];
-            tune_type = 0;
+            ++ntriplet_kept;
 
-        } else if (nk_grid[1] == nk_grid[2] && nk_grid[0] == 1) {
-            nkrep_out = nk_grid[1];
-            tune_type = 0;
+            calc_V3norm2_block_all(knum_minus, k1, k2,
+                                   dynamical->eval_phonon,
+                                   dynamical->evec_phonon,
+                                   v3norm_block);
 
-        } else if (nk_grid[2] == nk_grid[0] && nk_grid[1] == 1) {
-            nkrep_out = nk_grid[2];
-            tune_type = 0;
+            if (!kernel) {
+                for (is = 0; is < ns; ++is) {
+                    for (i = 0; i < N; ++i) {
+                        if (thermodynamics->classical) {
+                            f1_arr[is][i] = thermodynamics->fC(dynamical->eval_phonon[k1][is], T[i]);
+                            f2_arr[is][i] = thermodynamics->fC(dynamical->eval_phonon[k2][is], T[i]);
+                        } else {
+                            f1_arr[is][i] = thermodynamics->fB(dynamical->eval_phonon[k1][is], T[i]);
+                            f2_arr[is][i] = thermodynamics->fB(dynamical->eval_phonon[k2][is], T[i]);
+                        }
+                    }
+                }
+            }
 
-        } else if (nk_grid[0] == 1 && nk_grid[1] == 1) {
-            nkrep_out = nk_grid[2];
-            tune_type = 0;
+            for (snum = 0; snum < ns; ++snum) {
+                for (is = 0; is < ns; ++is) {
+                    omega_inner[0] = dynamical->eval_phonon[k1][is];
 
-        } else if (nk_grid[1] == 1 && nk_grid[2] == 1) {
-            nkrep_out = nk_grid[0];
-            tune_type = 0;
+                    for (js = 0; js < ns; ++js) {
+                        omega_inner[1] = dynamical->eval_phonon[k2][js];
 
-        } else if (nk_grid[2] == 1 && nk_grid[0] == 1) {
-            nkrep_out = nk_grid[1];
-            tune_type = 0;
+                        if (is_screened_out(omega0[snum], omega_inner[0], omega_inner[1], window)) continue;
 
-        } else {
-            tune_type = 1;
-        }
+                        if (integration->ismear == 0) {
+                            delta0 = delta_lorentz(omega0[snum] - omega_inner[0] - omega_inner[1], epsilon)
+                                - delta_lorentz(omega0[snum] + omega_inner[0] + omega_inner[1], epsilon);
+                            delta1 = delta_lorentz(omega0[snum] - omega_inner[0] + omega_inner[1], epsilon)
+                                - delta_lorentz(omega0[snum] + omega_inner[0] - omega_inner[1], epsilon);
+                        } else {
+                            delta0 = delta_gauss(omega0[snum] - omega_inner[0] - omega_inner[1], epsilon)
+                                - delta_gauss(omega0[snum] + omega_inner[0] + omega_inner[1], epsilon);
+                            delta1 = delta_gauss(omega0[snum] - omega_inner[0] + omega_inner[1], epsilon)
+                                - delta_gauss(omega0[snum] + omega_inner[0] - omega_inner[1], epsilon);
+                        }
 
-        int ii, jj, kk;
+                        v3_tmp = v3norm_block[ns2 * snum + ns * is + js] * multi;
 
-        if (tune_type == 0) {
+                        if (kernel) {
+                            reduce_damping_kernel(kmap_irred, k1, k2, is, js,
+                                                  v3_tmp, delta0, delta1,
+                                                  kernel_c0_omp[snum], kernel_sum_omp[snum]);
+                            continue;
+                        }
 
-            double phase;
+                        for (i = 0; i < N; ++i) {
+                            n1 = f1_arr[is][i] + f2_arr[js][i] + nadd;
+                            n2 = f1_arr[is][i] - f2_arr[js][i];
+                            ret_omp[snum][i] += v3_tmp * (n1 * delta0 - n2 * delta1);
+                        }
+                    }
+                }
+            }
+        }
 
-            memory->allocate(exp_phase, 2 * nkrep_out - 1);
 #ifdef _OPENMP
-#pragma omp parallel for private(phase)
+#pragma omp critical
 #endif
-            for (ii = 0; ii < 2 * nkrep_out - 1; ++ii) {
-                phase = 2.0 * pi * static_cast<double>(ii - nkrep_out + 1)
-                    / static_cast<double>(nkrep_out);
-                exp_phase[ii] = std::exp(im * phase);
+        {
+            for (snum = 0; snum < ns; ++snum) {
+                for (i = 0; i < N; ++i) ret[snum][i] += ret_omp[snum][i];
+            }
+            if (kernel) {
+                for (snum = 0; snum < ns; ++snum) {
+                    kernel_c0[snum] += kernel_c0_omp[snum];
+                    for (const auto &it : kernel_sum_omp[snum]) kernel_sum[snum][it.first] += it.second;
+                }
             }
+        }
 
-        } else if (tune_type == 1) {
+        memory->deallocate(v3norm_block);
+        memory->deallocate(f1_arr);
+        memory->deallocate(f2_arr);
+        memory->deallocate(ret_omp);
+    }
 
-            double phase[3];
+    nscreen_pair[0] += static_cast<unsigned long long>(npair_uniq) * ns * ns2;
+    nscreen_pair[1] += npair_kept;
+    nscreen_triplet[0] += npair_uniq;
+    nscreen_triplet[1] += ntriplet_kept;
 
-            memory->allocate(exp_phase3,
-                             2 * nk_grid[0] - 1,
-                             2 * nk_grid[1] - 1,
-                             2 * nk_grid[2] - 1);
-#ifdef _OPENMP
-#pragma omp parallel for private(phase, jj, kk)
-#endif
-            for (ii = 0; ii < 2 * nk_grid[0] - 1; ++ii) {
-                phase[0] = 2.0 * pi * static_cast<double>(ii - nk_grid[0] + 1) / dnk[0];
-                for (jj = 0; jj < 2 * nk_grid[1] - 1; ++jj) {
-                    phase[1] = 2.0 * pi * static_cast<double>(jj - nk_grid[1] + 1) / dnk[1];
-                    for (kk = 0; kk < 2 * nk_grid[2] - 1; ++kk) {
-                        phase[2] = 2.0 * pi * static_cast<double>(kk - nk_grid[2] + 1) / dnk[2];
-                        exp_phase3[ii][jj][kk] = std::exp(im * (phase[0] + phase[1] + phase[2]));
-                    }
-                }
-            }
+    if (kernel) {
+        for (snum = 0; snum < ns; ++snum) {
+            pack_damping_kernel(kernel_c0[snum], kernel_sum[snum],
+                                pi * std::pow(0.5, 4) / static_cast<double>(nk), kernel[snum]);
+            evaluate_damping_kernel(N, T, kernel[snum], ret[snum]);
+        }
+    } else {
+        for (snum = 0; snum < ns; ++snum) {
+            for (i = 0; i < N; ++i) ret[snum][i] *= pi * std::pow(0.5, 4) / static_cast<double>(nk);
         }
     }
+
+    memory->deallocate(omega0);
 }
 
 
-void AnharmonicCore::calc_self3omega_tetrahedron(const double Temp,
-                                                 double **eval,
-                                                 std::complex<double> ***evec,
-                                                 const unsigned int ik_in,
-                                                 const unsigned int snum,
-                                                 const unsigned int nomega,
-                                                 double *omega,
-                                                 double *ret)
+void AnharmonicCore::calc_damping_tetrahedron_kpoint(const unsigned int N,
+                                                     double *T,
+                                                     const unsigned int ik_in,
+                                                     double **ret,
+                                                     DampingKernel *kernel)
 {
-    // This function returns the imaginary part of phonon self-energy 
-    // for the given frequency range of omega, phonon frequency (eval) and phonon eigenvectors (evec).
-    // The tetrahedron method will be used.
-    // This version employs the crystal symmetry to reduce the computational cost
-    // In addition, both MPI and OpenMP parallizations are used in a hybrid way inside this function.
+    // This function returns the imaginary part of phonon self-energy
+    // of all branches at the irreducible k point ik_in in ret[ns][N].
+    // The frequency of each branch is used as omega.
+    // Tetrahedron method will be used.
+    // Only the nonzero tetrahedron weights are kept, and V3 is evaluated
+    // once for each triplet for all branches.
 
     int nk = kpoint->nk;
     int ns = dynamical->neval;
-
-    int ik, ib, iomega;
     int ns2 = ns * ns;
 
-    unsigned int i;
-    unsigned int is, js;
+    int ik, ib;
+    unsigned int i, jk;
+    unsigned int is, js, snum;
     unsigned int k1, k2;
-    unsigned int arr[3];
-    unsigned int npair_uniq;
-    unsigned int nk_tmp;
-
-    int ik_now;
+    int knum, knum_minus;
 
+    double multi;
+    double v3_tmp;
     double n1, n2;
-    double f1, f2;
-    double omega_inner[2];
-
-    int *kmap_identity, **kpairs;
+    double *omega0;
     double **energy_tmp;
     double **weight_tetra;
-    double **v3_arr, *v3_arr_loc;
-    double *ret_private;
+    double **f1_arr, **f2_arr;
+    double **ret_omp;
+    int *kmap_identity;
+    double *v3norm_block;
+    std::vector<int> kmap_irred;
+    std::vector<std::unordered_map<int, double>> kernel_sum;
+    std::vector<double> kernel_c0;
 
-    std::vector<KsListGroup> triplet;
-    std::vector<int> vk_l;
+    const double nadd = thermodynamics->classical ? 0.0 : 1.0;
 
-    int knum = kpoint->kpoint_irred_all[ik_in][0].knum;
-    int knum_minus = kpoint->knum_minus[knum];
-    double omega0 = eval[knum_minus][snum];
+    std::vector<KsListGroup> triplet;
+    std::vector<std::vector<DeltaWeight>> delta_list;
+    std::vector<std::vector<DeltaWeight>> delta_list_omp;
 
     kpoint->get_unique_triplet_k(ik_in,
-                                 false,
-                                 false,
+                                 use_triplet_symmetry,
+                                 sym_permutation,
                                  triplet);
 
-    npair_uniq = triplet.size();
+    int npair_uniq = triplet.size();
+
+    knum = kpoint->kpoint_irred_all[ik_in][0].knum;
+    knum_minus = kpoint->knum_minus[knum];
+
+    memory->allocate(omega0, ns);
+    for (snum = 0; snum < ns; ++snum) {
+        omega0[snum] = dynamical->eval_phonon[knum][snum];
+        for (i = 0; i < N; ++i) ret[snum][i] = 0.0;
+    }
+
+    memory->allocate(kmap_identity, nk);
+    for (i = 0; i < nk; ++i) kmap_identity[i] = i;
+
+    delta_list.resize(npair_uniq);
+
+    // Compute the tetrahedron weights and keep the nonzero ones
+    // in delta_list[triplet] with the index ns2 * snum + ns * is + js.
+
+#ifdef _OPENMP
+#pragma omp parallel private(i, is, js, k1, k2, jk, ik, snum, energy_tmp, weight_tetra, delta_list_omp)
+#endif
+    {
+        memory->allocate(energy_tmp, 3, nk);
+        memory->allocate(weight_tetra, 3, nk);
+        delta_list_omp.resize(npair_uniq);
+
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+        for (ib = 0; ib < ns2; ++ib) {
+            is = ib / ns;
+            js = ib % ns;
+
+            for (k1 = 0; k1 < nk; ++k1) {
+                k2 = kpoint->knum_sum(knum, k1, 1, -1);
+
+                energy_tmp[0][k1] = dynamical->eval_phonon[k1][is] + dynamical->eval_phonon[k2][js];
+                energy_tmp[1][k1] = dynamical->eval_phonon[k1][is] - dynamical->eval_phonon[k2][js];
+                energy_tmp[2][k1] = -energy_tmp[1][k1];
+            }
+
+            for (snum = 0; snum < ns; ++snum) {
+                for (i = 0; i < 3; ++i) {
+                    integration->calc_weight_tetrahedron(nk,
+                                                         kmap_identity,
+                                                         weight_tetra[i],
+                                                         energy_tmp[i],
+                                                         omega0[snum]);
+                }
+
+                for (ik = 0; ik < npair_uniq; ++ik) {
+                    jk = triplet[ik].group[0].ks[0];
+                    if (weight_tetra[0][jk] > 0.0
+                        || std::abs(weight_tetra[1][jk] - weight_tetra[2][jk]) > 0.0) {
+                        delta_list_omp[ik].emplace_back(ns2 * snum + ib,
+                                                        weight_tetra[0][jk],
+                                                        weight_tetra[1][jk] - weight_tetra[2][jk]);
+                    }
+                }
+            }
+        }
+
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+        {
+            for (ik = 0; ik < npair_uniq; ++ik) {
+                delta_list[ik].insert(delta_list[ik].end(),
+                                      delta_list_omp[ik].begin(),
+                                      delta_list_omp[ik].end());
+            }
+        }
+
+        delta_list_omp.clear();
+        memory->deallocate(energy_tmp);
+        memory->deallocate(weight_tetra);
+    }
+
+    // Sort the entries so that the result does not depend on the number of threads.
+    for (ik = 0; ik < npair_uniq; ++ik) {
+        std::sort(delta_list[ik].begin(), delta_list[ik].end());
+    }
+
+    if (kernel) {
+        get_kmap_irreducible(kmap_irred);
+        kernel_sum.resize(ns);
+        kernel_c0.resize(ns, 0.0);
+    }
+
+#ifdef _OPENMP
+#pragma omp parallel private(i, is, js, k1, k2, ib, snum, multi, v3_tmp, n1, n2, f1_arr, f2_arr, ret_omp, v3norm_block)
+#endif
+    {
+        memory->allocate(v3norm_block, ns * ns2);
+        memory->allocate(f1_arr, ns, N);
+        memory->allocate(f2_arr, ns, N);
+        memory->allocate(ret_omp, ns, N);
+
+        for (snum = 0; snum < ns; ++snum) {
+            for (i = 0; i < N; ++i) ret_omp[snum][i] = 0.0;
+        }
+
+        // The kernels are accumulated sparsely in each thread.
+        std::vector<std::unordered_map<int, double>> kernel_sum_omp(kernel ? ns : 0);
+        std::vector<double> kernel_c0_omp(kernel ? ns : 0, 0.0);
+
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+        for (ik = 0; ik < npair_uniq; ++ik) {
+
+            if (delta_list[ik].empty()) continue;
+
+            k1 = triplet[ik].group[0].ks[0];
+            k2 = triplet[ik].group[0].ks[1];
+
+            multi = static_cast<double>(triplet[ik].group.size());
+
+            calc_V3norm2_block_all(knum_minus, k1, k2,
+                                   dynamical->eval_phonon,
+                                   dynamical->evec_phonon,
+                                   v3norm_block);
+
+            if (!kernel) {
+                for (is = 0; is < ns; ++is) {
+                    for (i = 0; i < N; ++i) {
+                        if (thermodynamics->classical) {
+                            f1_arr[is][i] = thermodynamics->fC(dynamical->eval_phonon[k1][is], T[i]);
+                            f2_arr[is][i] = thermodynamics->fC(dynamical->eval_phonon[k2][is], T[i]);
+                        } else {
+                            f1_arr[is][i] = thermodynamics->fB(dynamical->eval_phonon[k1][is], T[i]);
+                            f2_arr[is][i] = thermodynamics->fB(dynamical->eval_phonon[k2][is], T[i]);
+                        }
+                    }
+                }
+            }
+
+            for (const auto &it : delta_list[ik]) {
+                snum = it.index / ns2;
+                ib = it.index % ns2;
+                is = ib / ns;
+                js = ib % ns;
+
+                v3_tmp = v3norm_block[it.index] * multi;
+
+                if (kernel) {
+                    reduce_damping_kernel(kmap_irred, k1, k2, is, js,
+                                          v3_tmp, it.delta[0], it.delta[1],
+                                          kernel_c0_omp[snum], kernel_sum_omp[snum]);
+                    continue;
+                }
+
+                for (i = 0; i < N; ++i) {
+                    n1 = f1_arr[is][i] + f2_arr[js][i] + nadd;
+                    n2 = f1_arr[is][i] - f2_arr[js][i];
+                    ret_omp[snum][i] += v3_tmp * (n1 * it.delta[0] - n2 * it.delta[1]);
+                }
+            }
+        }
+
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+        {
+            for (snum = 0; snum < ns; ++snum) {
+                for (i = 0; i < N; ++i) ret[snum][i] += ret_omp[snum][i];
+            }
+            if (kernel) {
+                for (snum = 0; snum < ns; ++snum) {
+                    kernel_c0[snum] += kernel_c0_omp[snum];
+                    for (const auto &it : kernel_sum_omp[snum]) kernel_sum[snum][it.first] += it.second;
+                }
+            }
+        }
+
+        memory->deallocate(v3norm_block);
+        memory->deallocate(f1_arr);
+        memory->deallocate(f2_arr);
+        memory->deallocate(ret_omp);
+    }
+
+    if (kernel) {
+        for (snum = 0; snum < ns; ++snum) {
+            pack_damping_kernel(kernel_c0[snum], kernel_sum[snum],
+                                pi * std::pow(0.5, 4), kernel[snum]);
+            evaluate_damping_kernel(N, T, kernel[snum], ret[snum]);
+        }
+    } else {
+        for (snum = 0; snum < ns; ++snum) {
+            for (i = 0; i < N; ++i) ret[snum][i] *= pi * std::pow(0.5, 4);
+        }
+    }
+
+    memory->deallocate(omega0);
+    memory->deallocate(kmap_identity);
+}
+
+
+double AnharmonicCore::get_window_smearing() const
+{
+    // Half width of the energy window outside of which the Gaussian is
+    // smaller than delta_cutoff times its peak height.
+    // A negative value is returned when the screening is disabled.
+
+    if (integration->ismear != 1 || integration->delta_cutoff <= 0.0) return -1.0;
+
+    return integration->epsilon * std::sqrt(-std::log(integration->delta_cutoff));
+}
+
+bool AnharmonicCore::is_screened_out(const double omega,
+                                     const double omega1,
+                                     const double omega2,
+                                     const double window) const
+{
+    // Returns true if all the energy differences entering the delta functions
+    // of the band pair are out of the window.
+
+    if (window < 0.0) return false;
+
+    return std::abs(omega - omega1 - omega2) >= window
+        && std::abs(omega + omega1 + omega2) >= window
+        && std::abs(omega - omega1 + omega2) >= window
+        && std::abs(omega + omega1 - omega2) >= window;
+}
+
+void AnharmonicCore::print_delta_screening()
+{
+    // Print the fraction of the band pairs and triplets screened out by
+    // the energy window, summed over all MPI processes.
+
+    unsigned long long nloc[4], nsum[4];
+
+    nloc[0] = nscreen_pair[0];
+    nloc[1] = nscreen_pair[1];
+    nloc[2] = nscreen_triplet[0];
+    nloc[3] = nscreen_triplet[1];
+
+    MPI_Reduce(nloc, nsum, 4, MPI_UNSIGNED_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+
+    if (mympi->my_rank == 0 && nsum[0] > 0 && nsum[2] > 0) {
+        std::cout << std::endl;
+        std::cout << " Energy-window screening of the band pairs :" << std::endl;
+        std::cout << "  " << std::setw(14) << nsum[1] << " of " << std::setw(14) << nsum[0]
+            << " band pairs (" << std::fixed << std::setprecision(1)
+            << 100.0 * static_cast<double>(nsum[0] - nsum[1]) / static_cast<double>(nsum[0])
+            << " % screened out)" << std::endl;
+        std::cout << "  " << std::setw(14) << nsum[3] << " of " << std::setw(14) << nsum[2]
+            << " triplets   (" << std::fixed << std::setprecision(1)
+            << 100.0 * static_cast<double>(nsum[2] - nsum[3]) / static_cast<double>(nsum[2])
+            << " % screened out, V3 not computed)" << std::endl;
+    }
+}
+
+void AnharmonicCore::get_kmap_irreducible(std::vector<int> &kmap_out) const
+{
+    // kmap_out[k] is the index of the irreducible k point equivalent to k.
+
+    kmap_out.resize(kpoint->nk);
+
+    for (unsigned int ik = 0; ik < kpoint->nk_irred; ++ik) {
+        for (const auto &it : kpoint->kpoint_irred_all[ik]) {
+            kmap_out[it.knum] = ik;
+        }
+    }
+}
+
+void AnharmonicCore::reduce_damping_kernel(const std::vector<int> &kmap_irred,
+                                           const unsigned int k1,
+                                           const unsigned int k2,
+                                           const unsigned int is,
+                                           const unsigned int js,
+                                           const double v3_in,
+                                           const double delta0,
+                                           const double delta1,
+                                           double &kernel_c0,
+                                           std::unordered_map<int, double> &kernel_sum) const
+{
+    // Add the contribution of the triplet (k1 is, k2 js) to the kernel using
+    //   n1 * delta0 - n2 * delta1 = delta0 + f1 * (delta0 - delta1) + f2 * (delta0 + delta1)
+    // with n1 = f1 + f2 + 1 and n2 = f1 - f2.
+    // The occupations f1 and f2 depend only on the frequencies, so that the
+    // terms of symmetrically equivalent modes are reduced into one.
+    // kernel_sum holds the coefficients of the irreducible modes touched so far.
+
+    const unsigned int ns = dynamical->neval;
+
+    kernel_c0 += v3_in * delta0;
+    kernel_sum[ns * kmap_irred[k1] + is] += v3_in * (delta0 - delta1);
+    kernel_sum[ns * kmap_irred[k2] + js] += v3_in * (delta0 + delta1);
+}
+
+void AnharmonicCore::pack_damping_kernel(const double kernel_c0,
+                                         const std::unordered_map<int, double> &kernel_sum,
+                                         const double factor,
+                                         DampingKernel &kernel) const
+{
+    // Store the nonzero coefficients multiplied by factor
+    // in the ascending order of the mode index.
+
+    kernel.c0 = factor * kernel_c0;
+    kernel.index.clear();
+    kernel.coef.clear();
+
+    for (const auto &it : kernel_sum) {
+        if (it.second != 0.0) kernel.index.push_back(it.first);
+    }
+    std::sort(kernel.index.begin(), kernel.index.end());
+
+    kernel.coef.reserve(kernel.index.size());
+    for (const auto iks : kernel.index) {
+        kernel.coef.push_back(factor * kernel_sum.at(iks));
+    }
+}
+
+void AnharmonicCore::evaluate_damping_kernel(const unsigned int N,
+                                             const double *T,
+                                             const DampingKernel &kernel,
+                                             double *ret) const
+{
+    // Evaluate the damping at the temperatures T[N] from the kernel.
+    // The constant term is absent in the classical limit.
+
+    unsigned int i;
+    const unsigned int ns = dynamical->neval;
+    const double nadd = thermodynamics->classical ? 0.0 : 1.0;
+
+    for (i = 0; i < N; ++i) ret[i] = nadd * kernel.c0;
+
+    for (size_t j = 0; j < kernel.index.size(); ++j) {
+        const int iks = kernel.index[j];
+        const double omega = dynamical->eval_phonon[kpoint->kpoint_irred_all[iks / ns][0].knum][iks % ns];
+
+        for (i = 0; i < N; ++i) {
+            if (thermodynamics->classical) {
+                ret[i] += kernel.coef[j] * thermodynamics->fC(omega, T[i]);
+            } else {
+                ret[i] += kernel.coef[j] * thermodynamics->fB(omega, T[i]);
+            }
+        }
+    }
+}
+
+
+void AnharmonicCore::setup_cubic()
+{
+    int i, j, k;
+    double *invsqrt_mass_p;
+
+    // Sort force_constant[1] using the operator defined in fcs_phonons.h
+    // This sorting is necessary.
+    std::sort(fcs_phonon->force_constant_with_cell[1].begin(),
+              fcs_phonon->force_constant_with_cell[1].end());
+    prepare_fcs_csr(fcs_phonon->force_constant_with_cell[1], 3, fcs_csr_v3);
+    ngroup_v3 = fcs_csr_v3.ngroup;
+
+    memory->allocate(invmass_v3, ngroup_v3);
+    memory->allocate(evec_index_v3, ngroup_v3, 3);
+    memory->allocate(phi3_reciprocal, nthreads, ngroup_v3);
+    memory->allocate(kindex_phi3_stored, nthreads, 2);
+
+    for (i = 0; i < nthreads; ++i) {
+        kindex_phi3_stored[i][0] = -1;
+        kindex_phi3_stored[i][1] = -1;
+    }
+
+    memory->allocate(invsqrt_mass_p, system->natmin);
+
+    for (i = 0; i < system->natmin; ++i) {
+        invsqrt_mass_p[i] = std::sqrt(1.0 / system->mass[system->map_p2s[i][0]]);
+    }
+
+    for (i = 0; i < ngroup_v3; ++i) {
+        k = fcs_csr_v3.offset[i];
+        for (j = 0; j < 3; ++j) {
+            evec_index_v3[i][j] = fcs_phonon->force_constant_with_cell[1][k].pairs[j].index;
+        }
+        invmass_v3[i]
+            = invsqrt_mass_p[evec_index_v3[i][0] / 3]
+            * invsqrt_mass_p[evec_index_v3[i][1] / 3]
+            * invsqrt_mass_p[evec_index_v3[i][2] / 3];
+    }
+
+    memory->deallocate(invsqrt_mass_p);
+}
+
+void AnharmonicCore::setup_quartic()
+{
+    int i, j, k;
+    double *invsqrt_mass_p;
+    std::sort(fcs_phonon->force_constant_with_cell[2].begin(),
+              fcs_phonon->force_constant_with_cell[2].end());
+    prepare_fcs_csr(fcs_phonon->force_constant_with_cell[2], 4, fcs_csr_v4);
+    ngroup_v4 = fcs_csr_v4.ngroup;
+
+    memory->allocate(invmass_v4, ngroup_v4);
+    memory->allocate(evec_index_v4, ngroup_v4, 4);
+    memory->allocate(phi4_reciprocal, nthreads, ngroup_v4);
+    memory->allocate(kindex_phi4_stored, nthreads, 3);
+
+    for (i = 0; i < nthreads; ++i) {
+        for (j = 0; j < 3; ++j) kindex_phi4_stored[i][j] = -1;
+    }
+
+    memory->allocate(invsqrt_mass_p, system->natmin);
+
+    for (i = 0; i < system->natmin; ++i) {
+        invsqrt_mass_p[i] = std::sqrt(1.0 / system->mass[system->map_p2s[i][0]]);
+    }
+
+    for (i = 0; i < ngroup_v4; ++i) {
+        k = fcs_csr_v4.offset[i];
+        for (j = 0; j < 4; ++j) {
+            evec_index_v4[i][j] = fcs_phonon->force_constant_with_cell[2][k].pairs[j].index;
+        }
+        invmass_v4[i]
+            = invsqrt_mass_p[evec_index_v4[i][0] / 3]
+            * invsqrt_mass_p[evec_index_v4[i][1] / 3]
+            * invsqrt_mass_p[evec_index_v4[i][2] / 3]
+            * invsqrt_mass_p[evec_index_v4[i][3] / 3];
+    }
+
+    memory->deallocate(invsqrt_mass_p);
+}
+
+
+void AnharmonicCore::setup_phase_factor()
+{
+    // Prepare the phase factor table for the tuned version of phi3 and phi4.
+
+    int nk_tmp[3];
+
+    nk_tmp[0] = kpoint->nkx;
+    nk_tmp[1] = kpoint->nky;
+    nk_tmp[2] = kpoint->nkz;
+
+    phase_factor.setup(nk_tmp, {&fcs_csr_v3, &fcs_csr_v4});
+
+    kmesh_int.resize(3 * kpoint->nk);
+
+    for (auto ik = 0; ik < kpoint->nk && phase_factor.ready; ++ik) {
+        phase_factor.ready = phase_factor.get_mesh_coordinate(kpoint->xk[ik], &kmesh_int[3 * ik]);
+    }
+
+    if (!phase_factor.ready) {
+        use_tuned_ver = false;
+        if (mympi->my_rank == 0) {
+            std::cout << " Some relative vectors of anharmonic force constants are not lattice vectors." << std::endl;
+            std::cout << " The phase factors will be computed without the lookup table." << std::endl;
+        }
+        return;
+    }
+
+    memory->allocate(phase_index_v3, nthreads, 3 * std::max(fcs_csr_v3.nelem(), 1u));
+    if (fcs_phonon->maxorder >= 3) {
+        memory->allocate(phase_index_v4, nthreads, 3 * std::max(fcs_csr_v4.nelem(), 1u));
+    }
+}
+
+
+PhaseFactorTable::PhaseFactorTable()
+{
+    ready = false;
+    tune_type = 0;
+    for (int i = 0; i < 3; ++i) {
+        nk_grid[i] = 1;
+        nk_phase[i] = 1;
+        phase_shift[i] = 0;
+    }
+}
+
+
+void PhaseFactorTable::setup(const int nk_in[3],
+                             const std::vector<const FcsArrayCSR *> &csr_list)
+{
+    // For accelerating the Fourier transform of anharmonic force constants
+    // by avoiding continual call of std::exp.
+    // When the mesh is cubic-like (nk1=nk2=nk3 or some of them are 1),
+    // the phase is 2*pi*s/nk_represent with s = sum_{iv,i} latvec * m (tune_type = 0).
+    // Otherwise, each of the three components is treated separately (tune_type = 1).
+    // phase_table[i][s + phase_shift[i]] gives the location of the phase factor in exp_table.
+
+    int i, j, k;
+    int nk_represent = 0;
+    unsigned int ielem, iv;
+    int stride[3], smax[3], ssum[3];
+
+    for (i = 0; i < 3; ++i) nk_grid[i] = nk_in[i];
+
+    ready = true;
+    for (const auto csr : csr_list) {
+        if (!csr->is_lattice_vector) ready = false;
+    }
+    if (!ready) return;
+
+    if (nk_grid[0] == nk_grid[1] && nk_grid[1] == nk_grid[2]) {
+        nk_represent = nk_grid[0];
+        tune_type = 0;
+
+    } else if (nk_grid[0] == nk_grid[1] && nk_grid[2] == 1) {
+        nk_represent = nk_grid[0];
+        tune_type = 0;
+
+    } else if (nk_grid[1] == nk_grid[2] && nk_grid[0] == 1) {
+        nk_represent = nk_grid[1];
+        tune_type = 0;
+
+    } else if (nk_grid[2] == nk_grid[0] && nk_grid[1] == 1) {
+        nk_represent = nk_grid[2];
+        tune_type = 0;
+
+    } else if (nk_grid[0] == 1 && nk_grid[1] == 1) {
+        nk_represent = nk_grid[2];
+        tune_type = 0;
+
+    } else if (nk_grid[1] == 1 && nk_grid[2] == 1) {
+        nk_represent = nk_grid[0];
+        tune_type = 0;
+
+    } else if (nk_grid[2] == 1 && nk_grid[0] == 1) {
+        nk_represent = nk_grid[1];
+        tune_type = 0;
+
+    } else {
+        tune_type = 1;
+    }
+
+    const std::complex<double> im(0.0, 1.0);
+    double phase[3];
+
+    if (tune_type == 0) {
+
+        for (i = 0; i < 3; ++i) {
+            nk_phase[i] = nk_represent;
+            stride[i] = 1;
+        }
+
+        exp_table.resize(2 * nk_represent - 1);
+        for (i = 0; i < 2 * nk_represent - 1; ++i) {
+            phase[0] = 2.0 * pi * static_cast<double>(i - nk_represent + 1)
+                / static_cast<double>(nk_represent);
+            exp_table[i] = std::exp(im * phase[0]);
+        }
+
+    } else {
+
+        for (i = 0; i < 3; ++i) nk_phase[i] = nk_grid[i];
+
+        stride[2] = 1;
+        stride[1] = 2 * nk_grid[2] - 1;
+        stride[0] = stride[1] * (2 * nk_grid[1] - 1);
+
+        exp_table.resize(stride[0] * (2 * nk_grid[0] - 1));
+        for (i = 0; i < 2 * nk_grid[0] - 1; ++i) {
+            phase[0] = 2.0 * pi * static_cast<double>(i - nk_grid[0] + 1) / static_cast<double>(nk_grid[0]);
+            for (j = 0; j < 2 * nk_grid[1] - 1; ++j) {
+                phase[1] = 2.0 * pi * static_cast<double>(j - nk_grid[1] + 1) / static_cast<double>(nk_grid[1]);
+                for (k = 0; k < 2 * nk_grid[2] - 1; ++k) {
+                    phase[2] = 2.0 * pi * static_cast<double>(k - nk_grid[2] + 1) / static_cast<double>(nk_grid[2]);
+                    exp_table[stride[0] * i + stride[1] * j + k]
+                        = std::exp(im * (phase[0] + phase[1] + phase[2]));
+                }
+            }
+        }
+    }
+
+    // Upper bound of |s|. The mesh coordinates m satisfy |m| < nk_phase
+    // (see get_mesh_coordinate), and they may be multiplied by -1 by the caller.
+
+    for (i = 0; i < 3; ++i) smax[i] = 0;
+
+    for (const auto csr : csr_list) {
+        for (ielem = 0; ielem < csr->nelem(); ++ielem) {
+            for (i = 0; i < 3; ++i) {
+                ssum[i] = 0;
+                for (iv = 0; iv < csr->nvec; ++iv) {
+                    ssum[i] += std::abs(csr->latvec[3 * iv + i][ielem]) * (nk_phase[i] - 1);
+                }
+            }
+            if (tune_type == 0) {
+                smax[0] = std::max(smax[0], ssum[0] + ssum[1] + ssum[2]);
+            } else {
+                for (i = 0; i < 3; ++i) smax[i] = std::max(smax[i], ssum[i]);
+            }
+        }
+    }
+
+    const auto ntable = tune_type == 0 ? 1 : 3;
+
+    for (i = 0; i < ntable; ++i) {
+        phase_shift[i] = smax[i];
+        phase_table[i].resize(2 * smax[i] + 1);
+        for (j = -smax[i]; j <= smax[i]; ++j) {
+            phase_table[i][j + smax[i]] = (j % nk_phase[i] + nk_phase[i] - 1) * stride[i];
+        }
+    }
+}
+
+
+bool PhaseFactorTable::get_mesh_coordinate(const double *xk,
+                                           int *kint) const
+{
+    // Returns the integer coordinates of xk in units of 1/nk_phase,
+    // folded into (-nk_phase, nk_phase). False is returned when xk is not on the mesh.
+
+    double xtmp;
+
+    for (int i = 0; i < 3; ++i) {
+        xtmp = xk[i] * static_cast<double>(nk_grid[i]);
+        if (std::abs(xtmp - static_cast<double>(nint(xtmp))) > eps6) return false;
+
+        kint[i] = nint(xk[i] * static_cast<double>(nk_phase[i])) % nk_phase[i];
+    }
+    return true;
+}
+
+
+void PhaseFactorTable::calc_phase_index(const FcsArrayCSR &csr,
+                                        const int *coef,
+                                        int *index) const
+{
+    // Returns the location of the phase factor of each element of csr in exp_table,
+    // where the phase is sum_{iv,i} coef[3 * iv + i] * latvec[3 * iv + i] in units of 2*pi/nk.
+    // The index array should have 3 * csr.nelem() entries.
+
+    unsigned int iv, icrd;
+    const auto nelem = csr.nelem();
+
+    if (nelem == 0) return;
+
+    if (tune_type == 0) {
+
+        std::fill(index, index + nelem, phase_shift[0]);
+
+        for (iv = 0; iv < csr.nvec; ++iv) {
+            for (icrd = 0; icrd < 3; ++icrd) {
+                if (coef[3 * iv + icrd] == 0) continue;
+                add_phase_index(nelem, coef[3 * iv + icrd], &csr.latvec[3 * iv + icrd][0], index);
+            }
+        }
+        lookup_phase_index(nelem, &phase_table[0][0], index);
+
+    } else {
+
+        for (icrd = 0; icrd < 3; ++icrd) {
+
+            std::fill(index + icrd * nelem, index + (icrd + 1) * nelem, phase_shift[icrd]);
+
+            for (iv = 0; iv < csr.nvec; ++iv) {
+                if (coef[3 * iv + icrd] == 0) continue;
+                add_phase_index(nelem, coef[3 * iv + icrd], &csr.latvec[3 * iv + icrd][0],
+                                index + icrd * nelem);
+            }
+        }
+        lookup_phase_index3(nelem,
+                            &phase_table[0][0], &phase_table[1][0], &phase_table[2][0],
+                            index, index + nelem, index + 2 * nelem);
+    }
+}
+
+
+std::complex<double> PhaseFactorTable::sum_phase_factor(const FcsArrayCSR &csr,
+                                                        const unsigned int igroup,
+                                                        const int *index) const
+{
+    // Returns sum_{j in igroup} fcs[j] * exp(i * phase[j]),
+    // where index is given by calc_phase_index.
+
+    const auto j = csr.offset[igroup];
+
+    return gather_phase_sum(csr.offset[igroup + 1] - j,
+                            &csr.fcs[j],
+                            index + j,
+                            &exp_table[0]);
+}
+
+
+void AnharmonicCore::calc_self3omega_tetrahedron(const double Temp,
+                                                 double **eval,
+                                                 std::complex<double> ***evec,
+                                                 const unsigned int ik_in,
+                                                 const unsigned int snum,
+                                                 const unsigned int nomega,
+                                                 double *omega,
+                                                 double *ret)
+{
+    // This function returns the imaginary part of phonon self-energy 
+    // for the given frequency range of omega, phonon frequency (eval) and phonon eigenvectors (evec).
+    // The tetrahedron method will be used.
+    // This version employs the crystal symmetry to reduce the computational cost
+    // In addition, both MPI and OpenMP parallizations are used in a hybrid way inside this function.
+
+    int nk = kpoint->nk;
+    int ns = dynamical->neval;
+
+    int ik, ib, iomega;
+    int ns2 = ns * ns;
+
+    unsigned int i;
+    unsigned int is, js;
+    unsigned int k1, k2;
+    unsigned int npair_uniq;
+    unsigned int nk_tmp;
+
+    int ik_now;
+
+    double n1, n2;
+    double f1, f2;
+    double omega_inner[2];
+
+    int **kpairs;
+    double **energy_tmp;
+    double **v3_arr, *v3_arr_loc;
+    double *ret_private;
+
+    std::vector<KsListGroup> triplet;
+    std::vector<int> vk_l;
+
+    int knum = kpoint->kpoint_irred_all[ik_in][0].knum;
+    int knum_minus = kpoint->knum_minus[knum];
+    double omega0 = eval[knum_minus][snum];
+
+    kpoint->get_unique_triplet_k(ik_in,
+                                 false,
+                                 false,
+                                 triplet);
+
+    npair_uniq = triplet.size();
 
     if (npair_uniq != nk) {
         error->exit("hoge", "Something is wrong.");
     }
 
     memory->allocate(kpairs, nk, 2);
-    memory->allocate(kmap_identity, nk);
-
-    for (i = 0; i < nk; ++i) kmap_identity[i] = i;
 
     for (iomega = 0; iomega < nomega; ++iomega) ret[iomega] = 0.0;
 
@@ -1344,22 +2386,12 @@ void AnharmonicCore::calc_self3omega_tetrahedron(const double Temp,
             for (ib = 0; ib < ns2; ++ib) v3_arr_loc[ib] = 0.0; // do nothing
 
         } else {
-#ifdef _OPENMP
-#pragma omp parallel for private(is, js, arr)
-#endif
-            for (ib = 0; ib < ns2; ++ib) {
-
-                is = ib / ns;
-                js = ib % ns;
-
-                arr[0] = ns * knum_minus + snum;
-                arr[1] = ns * kpairs[ik_now][0] + is;
-                arr[2] = ns * kpairs[ik_now][1] + js;
-
-                v3_arr_loc[ib] = std::norm(V3(arr,
-                                              dynamical->eval_phonon,
-                                              dynamical->evec_phonon));
-            }
+            calc_V3norm2_block(ns * knum_minus + snum,
+                               kpairs[ik_now][0],
+                               kpairs[ik_now][1],
+                               dynamical->eval_phonon,
+                               dynamical->evec_phonon,
+                               v3_arr_loc);
         }
         MPI_Gather(&v3_arr_loc[0], ns2, MPI_DOUBLE,
                    v3_arr[ik * mympi->nprocs], ns2,
@@ -1369,17 +2401,23 @@ void AnharmonicCore::calc_self3omega_tetrahedron(const double Temp,
 
     if (mympi->my_rank == 0) {
 
+        // The occupation factors do not depend on omega, so the omega
+        // dependence enters only through the tetrahedron weights. The sum over
+        // k for all omega is then done in one sweep over the tetrahedra.
+
 #ifdef _OPENMP
-#pragma omp parallel private(is, js, k1, k2, energy_tmp, i, \
-                             iomega, weight_tetra, ik, \
-                             omega_inner, f1, f2, n1, n2) 
+#pragma omp parallel private(is, js, k1, k2, i, iomega, ik, \
+                             omega_inner, f1, f2, n1, n2)
 #endif
         {
+            double **func_tmp, **ret_tmp;
+
             memory->allocate(energy_tmp, 2, nk);
-            memory->allocate(weight_tetra, 2, nk);
+            memory->allocate(func_tmp, 2, nk);
+            memory->allocate(ret_tmp, 2, nomega);
 #ifdef _OPENMP
-        const int nthreads = omp_get_num_threads();
-        const int ithread = omp_get_thread_num();
+            const int nthreads = omp_get_num_threads();
+            const int ithread = omp_get_thread_num();
 #else
             const int nthreads = 1;
             const int ithread = 0;
@@ -1406,38 +2444,32 @@ void AnharmonicCore::calc_self3omega_tetrahedron(const double Temp,
 
                     energy_tmp[0][ik] = eval[k1][is] + eval[k2][js];
                     energy_tmp[1][ik] = eval[k1][is] - eval[k2][js];
-                }
-                for (iomega = 0; iomega < nomega; ++iomega) {
-                    for (i = 0; i < 2; ++i) {
-                        integration->calc_weight_tetrahedron(nk,
-                                                             kmap_identity,
-                                                             weight_tetra[i],
-                                                             energy_tmp[i],
-                                                             omega[iomega]);
-                    }
 
-                    for (ik = 0; ik < nk; ++ik) {
-                        k1 = kpairs[ik][0];
-                        k2 = kpairs[ik][1];
+                    omega_inner[0] = eval[k1][is];
+                    omega_inner[1] = eval[k2][js];
+                    if (thermodynamics->classical) {
+                        f1 = thermodynamics->fC(omega_inner[0], Temp);
+                        f2 = thermodynamics->fC(omega_inner[1], Temp);
+                        n1 = f1 + f2;
+                        n2 = f1 - f2;
+                    } else {
+                        f1 = thermodynamics->fB(omega_inner[0], Temp);
+                        f2 = thermodynamics->fB(omega_inner[1], Temp);
+                        n1 = f1 + f2 + 1.0;
+                        n2 = f1 - f2;
+                    }
+                    func_tmp[0][ik] = v3_arr[ik][ib] * n1;
+                    func_tmp[1][ik] = v3_arr[ik][ib] * n2;
+                }
 
-                        omega_inner[0] = eval[k1][is];
-                        omega_inner[1] = eval[k2][js];
-                        if (thermodynamics->classical) {
-                            f1 = thermodynamics->fC(omega_inner[0], Temp);
-                            f2 = thermodynamics->fC(omega_inner[1], Temp);
-                            n1 = f1 + f2;
-                            n2 = f1 - f2;
-                        } else {
-                            f1 = thermodynamics->fB(omega_inner[0], Temp);
-                            f2 = thermodynamics->fB(omega_inner[1], Temp);
-                            n1 = f1 + f2 + 1.0;
-                            n2 = f1 - f2;
-                        }
+                for (i = 0; i < 2; ++i) {
+                    integration->integrate_tetrahedron_multi(energy_tmp[i], func_tmp[i],
+                                                             nomega, omega, ret_tmp[i]);
+                }
 
-                        //#pragma omp critical
-                        ret_private[nomega * ithread + iomega]
-                            += v3_arr[ik][ib] * (n1 * weight_tetra[0][ik] - 2.0 * n2 * weight_tetra[1][ik]);
-                    }
+                for (iomega = 0; iomega < nomega; ++iomega) {
+                    ret_private[nomega * ithread + iomega]
+                        += ret_tmp[0][iomega] - 2.0 * ret_tmp[1][iomega];
                 }
             }
 #ifdef _OPENMP
@@ -1449,7 +2481,8 @@ void AnharmonicCore::calc_self3omega_tetrahedron(const double Temp,
                 }
             }
             memory->deallocate(energy_tmp);
-            memory->deallocate(weight_tetra);
+            memory->deallocate(func_tmp);
+            memory->deallocate(ret_tmp);
         }
 #ifdef _OPENMP
 #pragma omp parallel for
@@ -1461,6 +2494,345 @@ void AnharmonicCore::calc_self3omega_tetrahedron(const double Temp,
     }
 
     memory->deallocate(v3_arr);
-    memory->deallocate(kmap_identity);
     memory->deallocate(kpairs);
 }
+
+
+// The |V3|^2 store consists of the shards PREFIX.v3store.0, PREFIX.v3store.1, ...
+// Each MPI process appends new records to its own shard and reads all the
+// shards at the setup stage. Each shard has a header
+//   char[8] "ANPHV3ST", int version, int nk, int ns, int (reserved), uint64 hash,
+//   double fingerprint[3]
+// followed by fixed-size records
+//   int kn0, int s0, int kn1, int kn2, double |V3(kn0 s0, kn1 is, kn2 js)|^2 [ns * ns].
+// The hash is computed from the force constant files, the masses, the k mesh,
+// and ns. Since the phases of the eigenvectors are not fixed by these inputs,
+// the header also holds a fingerprint of the eigenvalues and eigenvectors
+// (see calc_v3store_fingerprint), and the store is reset when it differs
+// from that of the present eigenvectors.
+
+static const char v3store_magic[8] = {'A', 'N', 'P', 'H', 'V', '3', 'S', 'T'};
+static const int v3store_version = 3;
+static const size_t v3store_header_size = 8 + 4 * sizeof(int) + sizeof(unsigned long long)
+    + 3 * sizeof(double);
+static const size_t v3store_size_buffer = 16 * 1024 * 1024;
+static const double v3store_tol_evec = 1.0e-8;
+
+void AnharmonicCore::setup_v3store()
+{
+    // Open the |V3|^2 store for the present phonon eigenvectors.
+    // This function must be called outside of parallel regions after the
+    // eigenvectors are fixed, since ModeAnalysis may change their phases.
+    // It does nothing when the store is disabled or already opened.
+
+    size_t nrecord_own = 0;
+    struct stat st;
+    double fingerprint[3];
+
+    if (!v3_store || v3store_ready || !dynamical->eigenvectors) return;
+
+    const unsigned long long hash = hash_v3store;
+    const size_t nk = kpoint->nk;
+    const size_t ns = dynamical->neval;
+    const int ival_header[4] = {v3store_version, static_cast<int>(nk), static_cast<int>(ns), 0};
+
+    file_v3store = input->job_title + ".v3store";
+
+    calc_v3store_fingerprint(fingerprint);
+
+    // Only the headers of the shards are compared by rank 0, and the store
+    // is reset if any of them was written for different inputs or eigenvectors.
+    // The fingerprints are sums over nk * ns * ns terms of order one,
+    // so that the tolerance is scaled accordingly.
+
+    if (mympi->my_rank == 0) {
+        int ival[4];
+        char magic[8];
+        unsigned long long hash_file;
+        double fingerprint_file[3];
+        auto is_valid = true;
+        const double tol = v3store_tol_evec * std::sqrt(static_cast<double>(nk * ns * ns));
+
+        for (int ishard = 0; is_valid; ++ishard) {
+            const std::string file_shard = file_v3store + "." + std::to_string(ishard);
+            if (stat(file_shard.c_str(), &st) != 0) break;
+
+            std::ifstream ifs_shard(file_shard.c_str(), std::ios::in | std::ios::binary);
+            ifs_shard.read(magic, 8);
+            ifs_shard.read(reinterpret_cast<char *>(ival), 4 * sizeof(int));
+            ifs_shard.read(reinterpret_cast<char *>(&hash_file), sizeof(unsigned long long));
+            ifs_shard.read(reinterpret_cast<char *>(fingerprint_file), 3 * sizeof(double));
+
+            if (!ifs_shard || std::memcmp(magic, v3store_magic, 8) != 0
+                || !std::equal(ival, ival + 3, ival_header) || hash_file != hash) {
+                is_valid = false;
+            }
+            for (auto i = 0; i < 3; ++i) {
+                if (!(std::abs(fingerprint_file[i] - fingerprint[i]) < tol)) is_valid = false;
+            }
+        }
+
+        if (!is_valid) {
+            std::cout << " V3STORE = 1: " << file_v3store
+                << ".* was computed with different force constants or eigenvectors"
+                << " and is discarded." << std::endl;
+
+            for (int ishard = 0;; ++ishard) {
+                const std::string file_shard = file_v3store + "." + std::to_string(ishard);
+                if (stat(file_shard.c_str(), &st) != 0) break;
+                std::remove(file_shard.c_str());
+            }
+        }
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    // Load all the existing shards
+
+    index_v3store.clear();
+
+    for (int ishard = 0;; ++ishard) {
+        const std::string file_shard = file_v3store + "." + std::to_string(ishard);
+        if (stat(file_shard.c_str(), &st) != 0) break;
+
+        const size_t nrecord = load_v3store_shard(file_shard, hash);
+        if (ishard == mympi->my_rank) nrecord_own = nrecord;
+    }
+
+    if (mympi->my_rank == 0) {
+        std::cout << std::endl;
+        std::cout << " V3STORE = 1: |V3|^2 is read from and saved to " << file_v3store << ".*" << std::endl;
+        std::cout << "              Number of stored entries : " << index_v3store.size() << std::endl;
+        std::cout << std::endl;
+    }
+
+    // Open the own shard for appending new records
+
+    const std::string file_own = file_v3store + "." + std::to_string(mympi->my_rank);
+
+    if (stat(file_own.c_str(), &st) == 0) {
+        fs_v3store.open(file_own.c_str(), std::ios::in | std::ios::out | std::ios::binary);
+        if (!fs_v3store) {
+            error->exit("setup_v3store", "Could not open the V3 store file");
+        }
+        // A truncated record at the end, if any, is overwritten.
+        fs_v3store.seekp(v3store_header_size
+                         + nrecord_own * (4 * sizeof(int) + ns * ns * sizeof(double)));
+    } else {
+        fs_v3store.open(file_own.c_str(), std::ios::out | std::ios::binary);
+        if (!fs_v3store) {
+            error->exit("setup_v3store", "Could not open the V3 store file");
+        }
+        fs_v3store.write(v3store_magic, 8);
+        fs_v3store.write(reinterpret_cast<const char *>(ival_header), 4 * sizeof(int));
+        fs_v3store.write(reinterpret_cast<const char *>(&hash), sizeof(unsigned long long));
+        fs_v3store.write(reinterpret_cast<const char *>(fingerprint), 3 * sizeof(double));
+        fs_v3store.flush();
+    }
+
+    buffer_v3store.clear();
+    v3store_ready = true;
+}
+
+void AnharmonicCore::calc_v3store_fingerprint(double *fingerprint) const
+{
+    // Fingerprint of the eigenvalues and eigenvectors used for |V3|^2:
+    //   fingerprint[0] = \sum w_i omega_i (i over nk * ns),
+    //   fingerprint[1] + i fingerprint[2] = \sum w_i e_i (i over nk * ns * ns),
+    // with fixed pseudo-random weights w_i in [-1, 1).
+    // A change of the phase of a single eigenvector changes the fingerprint by
+    // an amount of order one, while the rounding errors are much smaller.
+
+    const auto weight = [](const unsigned long long i) {
+        const auto x = i * 6364136223846793005ULL + 1442695040888963407ULL;
+        return static_cast<double>(x >> 11) / static_cast<double>(1ULL << 52) - 1.0;
+    };
+
+    const long long nk = kpoint->nk;
+    const unsigned long long ns = dynamical->neval;
+    double sum_eval = 0.0;
+    double sum_re = 0.0;
+    double sum_im = 0.0;
+
+#ifdef _OPENMP
+#pragma omp parallel for reduction(+: sum_eval, sum_re, sum_im)
+#endif
+    for (long long ik = 0; ik < nk; ++ik) {
+        for (unsigned long long is = 0; is < ns; ++is) {
+            const auto i = ik * ns + is;
+            sum_eval += weight(i) * dynamical->eval_phonon[ik][is];
+            for (unsigned long long j = 0; j < ns; ++j) {
+                const auto w = weight(nk * ns + i * ns + j);
+                sum_re += w * dynamical->evec_phonon[ik][is][j].real();
+                sum_im += w * dynamical->evec_phonon[ik][is][j].imag();
+            }
+        }
+    }
+
+    fingerprint[0] = sum_eval;
+    fingerprint[1] = sum_re;
+    fingerprint[2] = sum_im;
+}
+
+unsigned long long AnharmonicCore::get_hash_force_constants(const unsigned int kmesh[3]) const
+{
+    // 64-bit FNV-1a hash of the inputs which determine the anharmonic matrix
+    // elements on the k mesh kmesh: the force constant files, the masses, and ns.
+
+    unsigned long long hash = 14695981039346656037ULL;
+    std::vector<char> bytes;
+
+    const auto add_bytes = [&hash](const char *ptr, const size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            hash ^= static_cast<unsigned char>(ptr[i]);
+            hash *= 1099511628211ULL;
+        }
+    };
+    const auto add_file = [&add_bytes, &bytes, this](const std::string &file_in) {
+        std::ifstream ifs(file_in.c_str(), std::ios::in | std::ios::binary);
+        if (!ifs) error->exit("get_hash_force_constants", "cannot open file ", file_in.c_str());
+        bytes.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+        if (!bytes.empty()) add_bytes(&bytes[0], bytes.size());
+    };
+
+    add_file(fcs_phonon->file_fcs);
+    if (!fcs_phonon->file_fc2.empty()) add_file(fcs_phonon->file_fc2);
+    if (dynamical->nonanalytic) {
+        add_file(dynamical->file_born);
+        add_bytes(reinterpret_cast<const char *>(&dynamical->nonanalytic), sizeof(unsigned int));
+        add_bytes(reinterpret_cast<const char *>(&dynamical->na_sigma), sizeof(double));
+    }
+
+    add_bytes(reinterpret_cast<const char *>(system->mass_kd), system->nkd * sizeof(double));
+
+    const unsigned int nk_tmp[4] = {kmesh[0], kmesh[1], kmesh[2], dynamical->neval};
+    add_bytes(reinterpret_cast<const char *>(nk_tmp), 4 * sizeof(unsigned int));
+
+    return hash;
+}
+
+size_t AnharmonicCore::load_v3store_shard(const std::string &file_shard,
+                                          const unsigned long long hash)
+{
+    // Map a shard and add its records to the index. Returns the number of
+    // complete records in the shard.
+
+    struct stat st;
+    int ival[4];
+    unsigned long long hash_file;
+    const char *data;
+    const int ns = dynamical->neval;
+    const size_t size_record = 4 * sizeof(int) + ns * ns * sizeof(double);
+
+    stat(file_shard.c_str(), &st);
+    const size_t size_file = static_cast<size_t>(st.st_size);
+
+    if (size_file < v3store_header_size) {
+        error->exit("load_v3store_shard", "The V3 store file is broken: ", file_shard.c_str());
+    }
+
+#if defined(_WIN32)
+    loaded_v3store.emplace_back(size_file);
+    std::ifstream ifs_shard(file_shard.c_str(), std::ios::in | std::ios::binary);
+    ifs_shard.read(&loaded_v3store.back()[0], size_file);
+    ifs_shard.close();
+    data = &loaded_v3store.back()[0];
+#else
+    const int fd = open(file_shard.c_str(), O_RDONLY);
+    if (fd == -1) {
+        error->exit("load_v3store_shard", "cannot open file ", file_shard.c_str());
+    }
+    void *addr = mmap(nullptr, size_file, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        error->exit("load_v3store_shard", "mmap failed for file ", file_shard.c_str());
+    }
+    mapped_v3store.emplace_back(addr, size_file);
+    data = static_cast<const char *>(addr);
+#endif
+
+    std::memcpy(ival, data + 8, 4 * sizeof(int));
+    std::memcpy(&hash_file, data + 8 + 4 * sizeof(int), sizeof(unsigned long long));
+
+    if (std::memcmp(data, v3store_magic, 8) != 0 || ival[0] != v3store_version
+        || ival[1] != kpoint->nk || ival[2] != ns || hash_file != hash) {
+        error->exit("load_v3store_shard", "The V3 store file is broken: ", file_shard.c_str());
+    }
+
+    const size_t nrecord = (size_file - v3store_header_size) / size_record;
+    const unsigned long long nk = kpoint->nk;
+
+    for (size_t irec = 0; irec < nrecord; ++irec) {
+        const char *ptr = data + v3store_header_size + irec * size_record;
+        std::memcpy(ival, ptr, 4 * sizeof(int));
+
+        const unsigned long long key = ((static_cast<unsigned long long>(ival[0]) * ns + ival[1]) * nk
+            + ival[2]) * nk + ival[3];
+        index_v3store[key] = reinterpret_cast<const double *>(ptr + 4 * sizeof(int));
+    }
+
+    return nrecord;
+}
+
+const double *AnharmonicCore::find_v3store(const unsigned int kn0,
+                                           const unsigned int s0,
+                                           const unsigned int kn1,
+                                           const unsigned int kn2) const
+{
+    // The index is not modified after the setup stage, so that
+    // this function can be called from multiple threads.
+
+    const unsigned long long nk = kpoint->nk;
+    const unsigned long long key = ((static_cast<unsigned long long>(kn0) * dynamical->neval + s0) * nk
+        + kn1) * nk + kn2;
+
+    const auto it = index_v3store.find(key);
+    if (it == index_v3store.end()) return nullptr;
+    return it->second;
+}
+
+void AnharmonicCore::append_v3store(const unsigned int kn0,
+                                    const unsigned int s0,
+                                    const unsigned int kn1,
+                                    const unsigned int kn2,
+                                    const double *v3norm2)
+{
+    const int ival[4] = {static_cast<int>(kn0), static_cast<int>(s0),
+                         static_cast<int>(kn1), static_cast<int>(kn2)};
+    const size_t ns2 = dynamical->neval * dynamical->neval;
+
+#ifdef _OPENMP
+#pragma omp critical(v3store)
+#endif
+    {
+        const char *ptr = reinterpret_cast<const char *>(ival);
+        buffer_v3store.insert(buffer_v3store.end(), ptr, ptr + 4 * sizeof(int));
+        ptr = reinterpret_cast<const char *>(v3norm2);
+        buffer_v3store.insert(buffer_v3store.end(), ptr, ptr + ns2 * sizeof(double));
+
+        if (buffer_v3store.size() >= v3store_size_buffer) {
+            fs_v3store.write(&buffer_v3store[0], buffer_v3store.size());
+            fs_v3store.flush();
+            buffer_v3store.clear();
+        }
+    }
+}
+
+void AnharmonicCore::finish_v3store()
+{
+    if (fs_v3store.is_open()) {
+        if (!buffer_v3store.empty()) {
+            fs_v3store.write(&buffer_v3store[0], buffer_v3store.size());
+            buffer_v3store.clear();
+        }
+        fs_v3store.close();
+    }
+
+    index_v3store.clear();
+    v3store_ready = false;
+
+#if !defined(_WIN32)
+    for (auto &it : mapped_v3store) munmap(it.first, it.second);
+#endif
+    mapped_v3store.clear();
+    loaded_v3store.clear();
+}
@@ -12,11 +12,27 @@ or http://opensource.org/licenses/mit-license.php for information.
 
 #include "pointers.h"
 #include <complex>
+#include <fstream>
+#include <string>
+#include <unordered_map>
 #include <vector>
 #include "fcs_phonon.h"
 
 namespace PHON_NS
 {
+    class DampingKernel
+    {
+    public:
+        // Temperature-independent kernel of the damping function of a mode.
+        // The damping at T is c0 + \sum_{i} coef[i] * n(omega_{index[i]}, T),
+        // where index[i] = ns * ik_irred + is in ascending order.
+        double c0;
+        std::vector<int> index;
+        std::vector<double> coef;
+
+        DampingKernel() : c0(0.0) {};
+    };
+
     class KsListMode
     {
     public:
@@ -57,37 +73,98 @@ namespace PHON_NS
         }
     };
 
-    class RelativeVector
+    class FcsArrayCSR
     {
     public:
-        double vecs[3][3];
-
-        RelativeVector();
+        // Anharmonic force constants packed group by group, where a group is
+        // a set of consecutive elements sharing the same atom-xyz indices.
+        // The elements of the group i are stored in [offset[i], offset[i + 1]).
+        // The relative vectors are stored as separate component streams:
+        // relvec[3 * iv + ixyz][ielem] is the ixyz component of the iv-th
+        // relative vector (2*pi times the fractional coordinates in the
+        // primitive cell), and latvec holds the same vectors as integers.
+        unsigned int ngroup;
+        unsigned int nvec;
+        std::vector<unsigned int> offset;
+        std::vector<double> fcs;
+        std::vector<std::vector<double>> relvec;
+        std::vector<std::vector<int>> latvec;
+        bool is_lattice_vector;
+
+        FcsArrayCSR()
+        {
+            ngroup = 0;
+            nvec = 0;
+            is_lattice_vector = true;
+        };
 
-        // Constructor for cubic term
-        RelativeVector(const double vec1[3],
-                       const double vec2[3])
+        unsigned int nelem() const
         {
-            for (int i = 0; i < 3; ++i) {
-                vecs[0][i] = vec1[i];
-                vecs[1][i] = vec2[i];
-                vecs[2][i] = 0.0;
-            }
+            return fcs.size();
         }
+    };
+
+
+    class PhaseFactorTable
+    {
+    public:
+        // Lookup table of the phase factors exp(i * sum_{iv} relvec_{iv} . xk_{iv})
+        // for k points on a uniform mesh. Since the relative vectors are
+        // lattice vectors, the phase is 2*pi*s/nk with an integer s, which is
+        // obtained from FcsArrayCSR::latvec and the integer mesh coordinates
+        // of the k points without floating-point rounding.
+        bool ready;
+        int tune_type;
+
+        PhaseFactorTable();
+
+        void setup(const int [3],
+                   const std::vector<const FcsArrayCSR *> &);
+
+        bool get_mesh_coordinate(const double *,
+                                 int *) const;
+
+        void calc_phase_index(const FcsArrayCSR &,
+                              const int *,
+                              int *) const;
 
-        // Constructor for quartic term
-        RelativeVector(const double vec1[3],
-                       const double vec2[3],
-                       const double vec3[3])
+        std::complex<double> sum_phase_factor(const FcsArrayCSR &,
+                                              unsigned int,
+                                              const int *) const;
+
+    private:
+        int nk_grid[3];
+        int nk_phase[3];
+        int phase_shift[3];
+        std::vector<int> phase_table[3];
+        std::vector<std::complex<double>> exp_table;
+    };
+
+
+    class DeltaWeight
+    {
+    public:
+        unsigned int index;
+        double delta[2];
+
+        DeltaWeight();
+
+        DeltaWeight(const unsigned int index_in,
+                    const double delta0,
+                    const double delta1)
         {
-            for (int i = 0; i < 3; ++i) {
-                vecs[0][i] = vec1[i];
-                vecs[1][i] = vec2[i];
-                vecs[2][i] = vec3[i];
-            }
+            index = index_in;
+            delta[0] = delta0;
+            delta[1] = delta1;
         }
     };
 
+    inline bool operator<(const DeltaWeight &a,
+                          const DeltaWeight &b)
+    {
+        return a.index < b.index;
+    }
+
 
     class AnharmonicCore : protected Pointers
     {
@@ -98,23 +175,51 @@ namespace PHON_NS
 
         void setup();
 
+        // When the last argument is given, the damping functions also return
+        // the temperature-independent kernel of each mode, in which only the
+        // nonzero coefficients of n(omega, T) of the irreducible modes are kept.
+        // The _kpoint versions return the kernels of all ns branches.
         void calc_damping_smearing(unsigned int,
                                    double *,
                                    double,
                                    unsigned int,
                                    unsigned int,
-                                   double *);
+                                   double *,
+                                   DampingKernel * = nullptr);
 
         void calc_damping_tetrahedron(unsigned int,
                                       double *,
                                       double,
                                       unsigned int,
                                       unsigned int,
-                                      double *);
+                                      double *,
+                                      DampingKernel * = nullptr);
+
+        void calc_damping_smearing_kpoint(unsigned int,
+                                          double *,
+                                          unsigned int,
+                                          double **,
+                                          DampingKernel * = nullptr);
+
+        void calc_damping_tetrahedron_kpoint(unsigned int,
+                                             double *,
+                                             unsigned int,
+                                             double **,
+                                             DampingKernel * = nullptr);
+
+        void evaluate_damping_kernel(unsigned int,
+                                     const double *,
+                                     const DampingKernel &,
+                                     double *) const;
+
+        unsigned long long get_hash_force_constants(const unsigned int [3]) const;
+
+        void print_delta_screening();
 
         int quartic_mode;
         bool use_tuned_ver;
         bool use_triplet_symmetry;
+        int v3_store;
 
         std::complex<double> V3(const unsigned int [3]);
         std::complex<double> V4(const unsigned int [4]);
@@ -127,6 +232,36 @@ namespace PHON_NS
                                 double **,
                                 std::complex<double> ***);
 
+        void calc_V3_block(unsigned int,
+                           unsigned int,
+                           unsigned int,
+                           double **,
+                           std::complex<double> ***,
+                           std::complex<double> *);
+
+        void calc_V3_block_all(unsigned int,
+                               unsigned int,
+                               unsigned int,
+                               double **,
+                               std::complex<double> ***,
+                               std::complex<double> *);
+
+        void setup_v3store();
+
+        void calc_V3norm2_block(unsigned int,
+                                unsigned int,
+                                unsigned int,
+                                double **,
+                                std::complex<double> ***,
+                                double *);
+
+        void calc_V3norm2_block_all(unsigned int,
+                                    unsigned int,
+                                    unsigned int,
+                                    double **,
+                                    std::complex<double> ***,
+                                    double *);
+
         std::complex<double> V3_mode(int,
                                      double *,
                                      double *,
@@ -135,20 +270,9 @@ namespace PHON_NS
                                      double **,
                                      std::complex<double> ***);
 
-        void prepare_relative_vector(const std::vector<FcsArrayWithCell> &,
-                                     unsigned int,
-                                     double ***);
-
-        void prepare_relative_vector(const std::vector<FcsArrayWithCell> &,
-                                     unsigned int,
-                                     int,
-                                     std::vector<double> *,
-                                     std::vector<RelativeVector> *&);
-
-        void prepare_group_of_force_constants(const std::vector<FcsArrayWithCell> &,
-                                              unsigned int,
-                                              int &,
-                                              std::vector<double> *&);
+        void prepare_fcs_csr(const std::vector<FcsArrayWithCell> &,
+                             unsigned int,
+                             FcsArrayCSR &) const;
 
 
         void calc_self3omega_tetrahedron(double,
@@ -173,29 +297,85 @@ namespace PHON_NS
         int **evec_index_v4;
         int ngroup_v3;
         int ngroup_v4;
-        std::vector<double> *fcs_group_v3;
-        std::vector<double> *fcs_group_v4;
-        std::complex<double> *exp_phase, ***exp_phase3;
-        std::complex<double> *phi3_reciprocal, *phi4_reciprocal;
-        std::vector<RelativeVector> *relvec_v3, *relvec_v4;
-
-        int nk_grid[3];
-        int nk_represent;
-        unsigned int tune_type;
-        double dnk[3];
+        FcsArrayCSR fcs_csr_v3, fcs_csr_v4;
+        // Scratch arrays and cache indices of phi3/phi4 in reciprocal space.
+        // One set is allocated for each OpenMP thread so that V3 and V4
+        // can be called concurrently from a parallel region.
+        int nthreads;
+        std::complex<double> **phi3_reciprocal, **phi4_reciprocal;
+        int **kindex_phi3_stored;
+        int **kindex_phi4_stored;
+
+        // Phase factors of the tuned version of phi3 and phi4.
+        // kmesh_int holds the integer mesh coordinates of the k points,
+        // and phase_index_v3(v4) are the scratch arrays of each thread.
+        PhaseFactorTable phase_factor;
+        std::vector<int> kmesh_int;
+        int **phase_index_v3, **phase_index_v4;
 
         bool sym_permutation;
 
-        int kindex_phi3_stored[2] = {-1, -1};
-        int kindex_phi4_stored[3] = {-1, -1, -1};
+        // Number of band pairs and triplets before [0] and after [1]
+        // the energy-window screening of the smearing methods.
+        unsigned long long nscreen_pair[2];
+        unsigned long long nscreen_triplet[2];
+
+        // On-disk store of |V3|^2 (V3STORE = 1).
+        // The records of all shards are indexed by (kn0, s0, kn1, kn2).
+        bool v3store_ready;
+        unsigned long long hash_v3store;
+        std::string file_v3store;
+        std::fstream fs_v3store;
+        std::vector<char> buffer_v3store;
+        std::unordered_map<unsigned long long, const double *> index_v3store;
+        std::vector<std::pair<void *, size_t>> mapped_v3store;
+        std::vector<std::vector<char>> loaded_v3store;
 
         void setup_cubic();
         void setup_quartic();
 
-        void store_exponential_for_acceleration(const int nk_in[3],
-                                                int &,
-                                                std::complex<double> *,
-                                                std::complex<double> ***);
+        void finish_v3store();
+        void calc_v3store_fingerprint(double *) const;
+        size_t load_v3store_shard(const std::string &,
+                                  unsigned long long);
+        const double *find_v3store(unsigned int,
+                                   unsigned int,
+                                   unsigned int,
+                                   unsigned int) const;
+        void append_v3store(unsigned int,
+                            unsigned int,
+                            unsigned int,
+                            unsigned int,
+                            const double *);
+
+        int get_thread_index() const;
+
+        void get_kmap_irreducible(std::vector<int> &) const;
+
+        double get_window_smearing() const;
+
+        bool is_screened_out(double,
+                             double,
+                             double,
+                             double) const;
+
+        void reduce_damping_kernel(const std::vector<int> &,
+                                   unsigned int,
+                                   unsigned int,
+                                   unsigned int,
+                                   unsigned int,
+                                   double,
+                                   double,
+                                   double,
+                                   double &,
+                                   std::unordered_map<int, double> &) const;
+
+        void pack_damping_kernel(double,
+                                 const std::unordered_map<int, double> &,
+                                 double,
+                                 DampingKernel &) const;
+
+        void setup_phase_factor();
 
         void calc_phi3_reciprocal(unsigned int,
                                   unsigned int,
@@ -18,18 +18,29 @@
 #include "kpoint.h"
 #include "mathfunctions.h"
 #include "memory.h"
+#include "parsephon.h"
 #include "phonon_dos.h"
 #include "thermodynamics.h"
 #include "phonon_velocity.h"
 #include "anharmonic_core.h"
 #include "system.h"
+#include "timer.h"
 #include "write_phonons.h"
+#include <sys/stat.h>
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 #include <fstream>
 #include <iomanip>
 #include <set>
 #include <vector>
 
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
 using namespace PHON_NS;
 
 Conductivity::Conductivity(PHON *phon): Pointers(phon)
@@ -45,6 +56,9 @@ Conductivity::~Conductivity()
 void Conductivity::set_default_variables()
 {
     calc_kappa_spec = 0;
+    rta_unit = 0;
+    rta_checkpoint = 0;
+    rta_kernel = 0;
     ntemp = 0;
     damping3 = nullptr;
     kappa = nullptr;
@@ -80,6 +94,10 @@ void Conductivity::setup_kappa()
     nk = kpoint->nk;
     ns = dynamical->neval;
 
+    MPI_Bcast(&rta_unit, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&rta_checkpoint, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&rta_kernel, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
     ntemp = static_cast<unsigned int>((system->Tmax - system->Tmin) / system->dT) + 1;
     memory->allocate(Temperature, ntemp);
 
@@ -88,27 +106,17 @@ void Conductivity::setup_kappa()
     }
 
     unsigned int nks_total = kpoint->nk_irred * ns;
-    unsigned int nks_each_thread = nks_total / mympi->nprocs;
-    unsigned int nrem = nks_total - nks_each_thread * mympi->nprocs;
 
-    if (nrem > 0) {
-        memory->allocate(damping3, (nks_each_thread + 1) * mympi->nprocs, ntemp);
-    } else {
-        memory->allocate(damping3, nks_total, ntemp);
-    }
-
-    if (mympi->my_rank == 0) {
-        memory->allocate(vel, nk, ns, 3);
+    memory->allocate(damping3, nks_total, ntemp);
 
-        for (i = 0; i < nk; ++i) {
-            phonon_velocity->phonon_vel_k(kpoint->xk[i], vel[i]);
+    // Phonon velocity in Cartesian coordinate, computed in parallel
+    // and shared by all MPI processes.
+    memory->allocate(vel, nk, ns, 3);
+    phonon_velocity->calc_phonon_vel_mesh(nullptr, vel);
 
-            // Generate phonon velocity in Cartesian coordinate
-            for (j = 0; j < ns; ++j) {
-                rotvec(vel[i][j], vel[i][j], system->lavec_p);
-                for (k = 0; k < 3; ++k) vel[i][j][k] /= 2.0 * pi;
-                for (k = 0; k < 3; ++k) vel[i][j][k] *= Bohr_in_Angstrom * 1.0e-10 / time_ry;
-            }
+    for (i = 0; i < nk; ++i) {
+        for (j = 0; j < ns; ++j) {
+            for (k = 0; k < 3; ++k) vel[i][j][k] *= Bohr_in_Angstrom * 1.0e-10 / time_ry;
         }
     }
 
@@ -158,6 +166,13 @@ void Conductivity::prepare_restart()
             writes->fs_result << "##END Phonon Frequency" << std::endl << std::endl;
             writes->fs_result << "##Phonon Relaxation Time" << std::endl;
 
+            if (rta_checkpoint) open_checkpoint(false);
+
+        } else if (rta_checkpoint && load_checkpoint()) {
+
+            std::cout << " Phonon lifetimes of " << vks_done.size()
+                << " modes are loaded from " << file_checkpoint << std::endl;
+
         } else {
 
             while (writes->fs_result >> line_tmp) {
@@ -180,6 +195,15 @@ void Conductivity::prepare_restart()
                     vks_done.push_back(nks_tmp);
                 }
             }
+
+            if (rta_checkpoint) {
+                // The modes found in the result file are copied to the new checkpoint
+                // so that the next restart can skip parsing the result file.
+                open_checkpoint(false);
+                for (i = 0; i < vks_done.size(); ++i) append_checkpoint(vks_done[i]);
+                append_checkpoint(-1);
+                flush_checkpoint();
+            }
         }
 
         writes->fs_result.close();
@@ -226,144 +250,719 @@ void Conductivity::prepare_restart()
 
 void Conductivity::calc_anharmonic_imagself()
 {
-    unsigned int i, j;
-    unsigned int knum, snum;
-    unsigned int *nks_thread;
-    int iks;
-    double omega;
-    double *damping3_loc;
+    // Phonon linewidths are computed for the modes (or irreducible k points
+    // when rta_unit = 1) remaining in vks_job.
+    // When more than one MPI process is used, the jobs are dispensed
+    // on demand by rank 0, which also computes jobs between the requests,
+    // so that slow modes do not stall the others.
 
+    std::vector<int> vjob;
 
-    // Distribute (k,s) to individual MPI threads
+    anharmonic_core->setup_v3store();
 
-    unsigned int nks_g = vks_job.size();
-    vks_l.clear();
+    // When rta_kernel = 1, the kernel of each mode is returned together with
+    // the damping, and the modes found in the kernel file are not computed again.
 
-    unsigned int icount = 0;
+    if (rta_kernel) load_kernel();
 
-    for (auto it = vks_job.begin(); it != vks_job.end(); ++it) {
-        if (icount % mympi->nprocs == mympi->my_rank) {
-            vks_l.push_back(*it);
-        }
-        ++icount;
-    }
+    vjob.clear();
 
-    if (mympi->my_rank == 0) {
-        memory->allocate(nks_thread, mympi->nprocs);
+    if (rta_unit == 1) {
+        std::set<int> vk_job;
+        for (auto it = vks_job.begin(); it != vks_job.end(); ++it) {
+            vk_job.insert(*it / ns);
+        }
+        for (auto it = vk_job.begin(); it != vk_job.end(); ++it) {
+            vjob.push_back(*it);
+        }
+    } else {
+        for (auto it = vks_job.begin(); it != vks_job.end(); ++it) {
+            vjob.push_back(*it);
+        }
     }
 
-    unsigned int nks_tmp = vks_l.size();
-    MPI_Gather(&nks_tmp, 1, MPI_UNSIGNED, &nks_thread[mympi->my_rank],
-               1, MPI_UNSIGNED, 0, MPI_COMM_WORLD);
-
     if (mympi->my_rank == 0) {
         std::cout << std::endl;
         std::cout << " Start calculating anharmonic phonon self-energies ... " << std::endl;
-        std::cout << " Total Number of phonon modes to be calculated : " << nks_g << std::endl;
-        std::cout << " All modes are distributed to MPI threads as the following :" << std::endl;
-        for (i = 0; i < mympi->nprocs; ++i) {
-            std::cout << " RANK: " << std::setw(5) << i + 1;
-            std::cout << std::setw(8) << "MODES: " << std::setw(5) << nks_thread[i] << std::endl;
+        std::cout << " Total Number of phonon modes to be calculated : " << vks_job.size() << std::endl;
+        if (rta_unit == 1) {
+            std::cout << " Total Number of irreducible k points : " << vjob.size() << std::endl;
+        }
+        if (mympi->nprocs > 1) {
+            std::cout << " The jobs are dispensed on demand to " << mympi->nprocs
+                << " MPI processes including the master." << std::endl;
         }
         std::cout << std::endl << std::flush;
-
-        memory->deallocate(nks_thread);
     }
 
-    unsigned int nk_tmp = nks_g / mympi->nprocs + 1;
+    if (mympi->nprocs == 1) {
+
+        std::vector<double> buf;
+
+        for (unsigned int i = 0; i < vjob.size(); ++i) {
+            compute_damping_job(vjob[i], buf);
+            store_damping_job(&buf[0]);
+            print_progress_job(i + 1);
+        }
 
-    if (nks_g % mympi->nprocs != 0) {
-        nk_tmp = nks_g / mympi->nprocs + 1;
+    } else if (mympi->my_rank == 0) {
+        dispense_damping_jobs(vjob);
     } else {
-        nk_tmp = nks_g / mympi->nprocs;
+        receive_damping_jobs();
     }
 
-    if (vks_l.size() < nk_tmp) {
-        vks_l.push_back(-1);
+    if (integration->ismear == 1) {
+        anharmonic_core->print_delta_screening();
     }
 
-    memory->allocate(damping3_loc, ntemp);
+    if (mympi->my_rank == 0 && rta_kernel) {
+        fs_kernel.close();
+    }
 
+    if (mympi->my_rank == 0 && rta_checkpoint) {
+        export_result_gamma();
+    }
+}
 
-    for (i = 0; i < nk_tmp; ++i) {
+void Conductivity::dispense_damping_jobs(const std::vector<int> &vjob)
+{
+    // Rank 0 hands out jobs, collects the results, and computes jobs
+    // itself in between. Each worker holds up to two jobs so that the next
+    // one is already at hand when the current one is finished, which keeps
+    // the workers busy while rank 0 is computing.
+    // The size of a result varies with the number of nonzero kernel
+    // coefficients and is obtained by MPI_Probe.
+
+    int irank;
+    int job;
+    int nworker_active;
+    int flag;
+    int count;
+    const int depth_prefetch = 2;
+    unsigned int njob_sent = 0;
+    unsigned int njob_done = 0;
+    std::vector<double> buf;
+    MPI_Status status;
+    std::vector<int> is_active(mympi->nprocs, 0);
+
+    nworker_active = 0;
+
+    for (int j = 0; j < depth_prefetch; ++j) {
+        for (irank = 1; irank < mympi->nprocs; ++irank) {
+            if (j > 0 && !is_active[irank]) continue;
+
+            if (njob_sent < vjob.size()) {
+                job = vjob[njob_sent++];
+                if (j == 0) {
+                    is_active[irank] = 1;
+                    ++nworker_active;
+                }
+            } else {
+                job = -1;
+                if (is_active[irank]) {
+                    is_active[irank] = 0;
+                    --nworker_active;
+                }
+            }
+            MPI_Send(&job, 1, MPI_INT, irank, 0, MPI_COMM_WORLD);
+        }
+    }
 
-        iks = vks_l[i];
+    while (njob_done < vjob.size()) {
 
-        if (iks == -1) {
+        // Results of the workers are served first. When none is pending,
+        // rank 0 computes the next job by itself, or waits for a result
+        // if all the jobs have been sent.
 
-            for (j = 0; j < ntemp; ++j) damping3_loc[j] = eps; // do nothing
+        MPI_Iprobe(MPI_ANY_SOURCE, 1, MPI_COMM_WORLD, &flag, &status);
 
-        } else {
+        if (!flag && njob_sent < vjob.size()) {
+            job = vjob[njob_sent++];
+            compute_damping_job(job, buf);
+            store_damping_job(&buf[0]);
+            print_progress_job(++njob_done);
+            continue;
+        }
 
-            knum = kpoint->kpoint_irred_all[iks / ns][0].knum;
-            snum = iks % ns;
+        if (!flag) MPI_Probe(MPI_ANY_SOURCE, 1, MPI_COMM_WORLD, &status);
 
-            omega = dynamical->eval_phonon[knum][snum];
+        irank = status.MPI_SOURCE;
+        MPI_Get_count(&status, MPI_DOUBLE, &count);
+        buf.resize(count);
+        MPI_Recv(&buf[0], count, MPI_DOUBLE, irank, 1,
+                 MPI_COMM_WORLD, MPI_STATUS_IGNORE);
 
-            if (integration->ismear == 0 || integration->ismear == 1) {
-                anharmonic_core->calc_damping_smearing(ntemp,
-                                                       Temperature,
-                                                       omega,
-                                                       iks / ns,
-                                                       snum,
-                                                       damping3_loc);
-            } else if (integration->ismear == -1) {
-                anharmonic_core->calc_damping_tetrahedron(ntemp,
-                                                          Temperature,
-                                                          omega,
-                                                          iks / ns,
-                                                          snum,
-                                                          damping3_loc);
+        if (is_active[irank]) {
+            if (njob_sent < vjob.size()) {
+                job = vjob[njob_sent++];
+            } else {
+                job = -1;
+                is_active[irank] = 0;
+                --nworker_active;
             }
+            MPI_Send(&job, 1, MPI_INT, irank, 0, MPI_COMM_WORLD);
         }
 
-        MPI_Gather(&damping3_loc[0], ntemp, MPI_DOUBLE,
-                   damping3[nshift_restart + i * mympi->nprocs], ntemp,
-                   MPI_DOUBLE, 0, MPI_COMM_WORLD);
+        store_damping_job(&buf[0]);
+        print_progress_job(++njob_done);
+    }
 
-        if (mympi->my_rank == 0) {
-            write_result_gamma(i, nshift_restart, vel, damping3);
-            std::cout << " MODE " << std::setw(5) << i + 1 << " done." << std::endl << std::flush;
+    if (nworker_active != 0) {
+        error->exit("dispense_damping_jobs", "This cannot happen");
+    }
+}
+
+void Conductivity::receive_damping_jobs()
+{
+    // Workers compute the job at hand while the next one is
+    // being received with a nonblocking request.
+
+    int job, job_next;
+    std::vector<double> buf;
+    MPI_Request request;
+
+    MPI_Recv(&job, 1, MPI_INT, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+
+    if (job != -1) {
+        MPI_Irecv(&job_next, 1, MPI_INT, 0, 0, MPI_COMM_WORLD, &request);
+    }
+
+    while (job != -1) {
+
+        compute_damping_job(job, buf);
+
+        MPI_Send(&buf[0], buf.size(), MPI_DOUBLE, 0, 1, MPI_COMM_WORLD);
+
+        MPI_Wait(&request, MPI_STATUS_IGNORE);
+        job = job_next;
+
+        if (job != -1) {
+            MPI_Irecv(&job_next, 1, MPI_INT, 0, 0, MPI_COMM_WORLD, &request);
+        }
+    }
+}
+
+void Conductivity::compute_damping_job(const int job,
+                                       std::vector<double> &buf)
+{
+    // Compute a job and pack the result into buf as
+    //   job, followed by [damping(ntemp), kernel] of each mode,
+    // where the mode is the single mode iks = job, or all the branches of
+    // the irreducible k point job when rta_unit = 1.
+    // The kernel, present only when rta_kernel = 1, is packed as
+    //   c0, nnz, index[nnz], coef[nnz].
+
+    unsigned int is, i;
+    unsigned int nmode;
+    double **damping3_loc;
+    std::vector<DampingKernel> kernel_loc;
+
+    if (rta_unit == 1) {
+
+        nmode = ns;
+        memory->allocate(damping3_loc, ns, ntemp);
+        if (rta_kernel) kernel_loc.resize(ns);
+
+        if (integration->ismear == 0 || integration->ismear == 1) {
+            anharmonic_core->calc_damping_smearing_kpoint(ntemp,
+                                                          Temperature,
+                                                          job,
+                                                          damping3_loc,
+                                                          rta_kernel ? &kernel_loc[0] : nullptr);
+        } else if (integration->ismear == -1) {
+            anharmonic_core->calc_damping_tetrahedron_kpoint(ntemp,
+                                                             Temperature,
+                                                             job,
+                                                             damping3_loc,
+                                                             rta_kernel ? &kernel_loc[0] : nullptr);
+        }
+
+    } else {
+
+        const unsigned int knum = kpoint->kpoint_irred_all[job / ns][0].knum;
+        const unsigned int snum = job % ns;
+        const double omega = dynamical->eval_phonon[knum][snum];
+
+        nmode = 1;
+        memory->allocate(damping3_loc, 1, ntemp);
+        if (rta_kernel) kernel_loc.resize(1);
+
+        if (integration->ismear == 0 || integration->ismear == 1) {
+            anharmonic_core->calc_damping_smearing(ntemp,
+                                                   Temperature,
+                                                   omega,
+                                                   job / ns,
+                                                   snum,
+                                                   damping3_loc[0],
+                                                   rta_kernel ? &kernel_loc[0] : nullptr);
+        } else if (integration->ismear == -1) {
+            anharmonic_core->calc_damping_tetrahedron(ntemp,
+                                                      Temperature,
+                                                      omega,
+                                                      job / ns,
+                                                      snum,
+                                                      damping3_loc[0],
+                                                      rta_kernel ? &kernel_loc[0] : nullptr);
+        }
+    }
+
+    buf.clear();
+    buf.push_back(static_cast<double>(job));
+
+    for (is = 0; is < nmode; ++is) {
+        for (i = 0; i < ntemp; ++i) buf.push_back(damping3_loc[is][i]);
+        if (rta_kernel) {
+            const auto &kernel = kernel_loc[is];
+            buf.push_back(kernel.c0);
+            buf.push_back(static_cast<double>(kernel.index.size()));
+            for (const auto iks : kernel.index) buf.push_back(static_cast<double>(iks));
+            buf.insert(buf.end(), kernel.coef.begin(), kernel.coef.end());
         }
     }
 
     memory->deallocate(damping3_loc);
 }
 
-void Conductivity::write_result_gamma(const unsigned int ik,
-                                      const unsigned int nshift,
+void Conductivity::store_damping_job(const double *buf)
+{
+    // Store the result of a job packed by compute_damping_job in damping3
+    // and write it to the result file.
+    // Modes already computed in the previous run are kept as they are.
+
+    unsigned int is, i;
+    int iks;
+    size_t pos = 1;
+    DampingKernel kernel;
+
+    const int job = static_cast<int>(buf[0]);
+    const unsigned int nmode = rta_unit == 1 ? ns : 1;
+
+    for (is = 0; is < nmode; ++is) {
+        iks = rta_unit == 1 ? job * ns + is : job;
+
+        const double *damp_in = &buf[pos];
+        pos += ntemp;
+
+        if (rta_kernel) {
+            kernel.c0 = buf[pos];
+            const size_t nnz = static_cast<size_t>(buf[pos + 1]);
+            kernel.index.resize(nnz);
+            kernel.coef.resize(nnz);
+            for (i = 0; i < nnz; ++i) {
+                kernel.index[i] = static_cast<int>(buf[pos + 2 + i]);
+                kernel.coef[i] = buf[pos + 2 + nnz + i];
+            }
+            pos += 2 + 2 * nnz;
+        }
+
+        if (vks_job.find(iks) == vks_job.end()) continue;
+
+        for (i = 0; i < ntemp; ++i) damping3[iks][i] = damp_in[i];
+        if (rta_kernel) append_kernel(iks, kernel);
+        if (rta_checkpoint) {
+            append_checkpoint(iks);
+        } else {
+            write_result_gamma(iks, vel, damping3);
+        }
+    }
+}
+
+void Conductivity::print_progress_job(const unsigned int njob_done) const
+{
+    if (rta_unit == 1) {
+        std::cout << " KPOINT " << std::setw(5) << njob_done << " done." << std::endl << std::flush;
+    } else {
+        std::cout << " MODE " << std::setw(5) << njob_done << " done." << std::endl << std::flush;
+    }
+}
+
+void Conductivity::write_result_gamma(const unsigned int iks_g,
                                       double ***vel_in,
                                       double **damp_in)
 {
-    unsigned int np = mympi->nprocs;
-    unsigned int k, iks_g;
+    unsigned int k;
     unsigned int nk_equiv;
     unsigned int ktmp;
 
-    for (unsigned int j = 0; j < np; ++j) {
+    writes->fs_result << "#GAMMA_EACH" << std::endl;
+    writes->fs_result << iks_g / ns + 1 << " " << iks_g % ns + 1 << std::endl;
+
+    nk_equiv = kpoint->kpoint_irred_all[iks_g / ns].size();
+
+    writes->fs_result << nk_equiv << std::endl;
+    for (k = 0; k < nk_equiv; ++k) {
+        ktmp = kpoint->kpoint_irred_all[iks_g / ns][k].knum;
+        writes->fs_result << std::setw(15) << vel_in[ktmp][iks_g % ns][0];
+        writes->fs_result << std::setw(15) << vel_in[ktmp][iks_g % ns][1];
+        writes->fs_result << std::setw(15) << vel_in[ktmp][iks_g % ns][2] << std::endl;
+    }
 
-        iks_g = ik * np + j + nshift;
+    for (k = 0; k < ntemp; ++k) {
+        writes->fs_result << std::setw(15)
+            << damp_in[iks_g][k] * Hz_to_kayser / time_ry << std::endl;
+    }
+    writes->fs_result << "#END GAMMA_EACH" << std::endl;
+}
 
-        if (iks_g >= kpoint->nk_irred * ns) break;
+// The checkpoint file PREFIX.rta_ckpt consists of a header
+//   char[8] "ANPHCKPT", int version, int nk_irred, int ns, int ntemp,
+//   double Tmin, double Tmax, double dT
+// followed by fixed-size records
+//   int iks, int (reserved), double damping3[iks][0:ntemp-1].
+// A record with iks = -1 indicates that all the preceding records
+// have been exported to the result file.
 
-        writes->fs_result << "#GAMMA_EACH" << std::endl;
-        writes->fs_result << iks_g / ns + 1 << " " << iks_g % ns + 1 << std::endl;
+static const char checkpoint_magic[8] = {'A', 'N', 'P', 'H', 'C', 'K', 'P', 'T'};
+static const int checkpoint_version = 1;
+static const size_t checkpoint_header_size = 8 + 4 * sizeof(int) + 3 * sizeof(double);
 
-        nk_equiv = kpoint->kpoint_irred_all[iks_g / ns].size();
+void Conductivity::open_checkpoint(const bool append)
+{
+    // Open the checkpoint file. When append = true, the existing file is
+    // opened and the write position has to be set by the caller.
 
-        writes->fs_result << nk_equiv << std::endl;
-        for (k = 0; k < nk_equiv; ++k) {
-            ktmp = kpoint->kpoint_irred_all[iks_g / ns][k].knum;
-            writes->fs_result << std::setw(15) << vel_in[ktmp][iks_g % ns][0];
-            writes->fs_result << std::setw(15) << vel_in[ktmp][iks_g % ns][1];
-            writes->fs_result << std::setw(15) << vel_in[ktmp][iks_g % ns][2] << std::endl;
+    file_checkpoint = input->job_title + ".rta_ckpt";
+
+    if (append) {
+        fs_checkpoint.open(file_checkpoint.c_str(), std::ios::in | std::ios::out | std::ios::binary);
+        if (!fs_checkpoint) {
+            error->exit("open_checkpoint", "Could not open the checkpoint file");
+        }
+    } else {
+        int ival[4] = {checkpoint_version,
+                       static_cast<int>(kpoint->nk_irred),
+                       static_cast<int>(ns),
+                       static_cast<int>(ntemp)};
+        double dval[3] = {system->Tmin, system->Tmax, system->dT};
+
+        fs_checkpoint.open(file_checkpoint.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!fs_checkpoint) {
+            error->exit("open_checkpoint", "Could not open the checkpoint file");
         }
+        fs_checkpoint.write(checkpoint_magic, 8);
+        fs_checkpoint.write(reinterpret_cast<const char *>(ival), 4 * sizeof(int));
+        fs_checkpoint.write(reinterpret_cast<const char *>(dval), 3 * sizeof(double));
+        fs_checkpoint.flush();
+    }
+
+    buffer_checkpoint.clear();
+    time_flush_checkpoint = timer->elapsed();
+}
 
-        for (k = 0; k < ntemp; ++k) {
-            writes->fs_result << std::setw(15)
-                << damp_in[iks_g][k] * Hz_to_kayser / time_ry << std::endl;
+bool Conductivity::load_checkpoint()
+{
+    // Load the finished modes from the checkpoint file.
+    // Returns false when the checkpoint file does not exist.
+    // A truncated record at the end of the file, which may remain when
+    // the previous run was killed while writing, is ignored and overwritten.
+
+    struct stat st;
+    size_t irec;
+    int iks;
+    int ival[4];
+    double dval[3];
+
+    file_checkpoint = input->job_title + ".rta_ckpt";
+
+    if (stat(file_checkpoint.c_str(), &st) != 0) return false;
+
+    const size_t size_file = static_cast<size_t>(st.st_size);
+    const size_t size_record = 2 * sizeof(int) + ntemp * sizeof(double);
+
+    if (size_file < checkpoint_header_size) {
+        error->exit("load_checkpoint", "The checkpoint file is broken");
+    }
+
+    const char *data;
+
+#if defined(_WIN32)
+    std::vector<char> data_vec(size_file);
+    std::ifstream ifs_checkpoint(file_checkpoint.c_str(), std::ios::in | std::ios::binary);
+    ifs_checkpoint.read(&data_vec[0], size_file);
+    ifs_checkpoint.close();
+    data = &data_vec[0];
+#else
+    const int fd = open(file_checkpoint.c_str(), O_RDONLY);
+    if (fd == -1) {
+        error->exit("load_checkpoint", "Could not open the checkpoint file");
+    }
+    void *addr = mmap(nullptr, size_file, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) {
+        error->exit("load_checkpoint", "mmap of the checkpoint file failed");
+    }
+    data = static_cast<const char *>(addr);
+#endif
+
+    std::memcpy(ival, data + 8, 4 * sizeof(int));
+    std::memcpy(dval, data + 8 + 4 * sizeof(int), 3 * sizeof(double));
+
+    if (std::memcmp(data, checkpoint_magic, 8) != 0 || ival[0] != checkpoint_version) {
+        error->exit("load_checkpoint", "The checkpoint file is broken");
+    }
+    if (ival[1] != kpoint->nk_irred || ival[2] != ns || ival[3] != ntemp
+        || dval[0] != system->Tmin || dval[1] != system->Tmax || dval[2] != system->dT) {
+        error->exit("load_checkpoint",
+                    "The checkpoint file is not consistent with the present calculation");
+    }
+
+    const size_t nrecord = (size_file - checkpoint_header_size) / size_record;
+    std::vector<int> is_done(kpoint->nk_irred * ns, 0);
+
+    vks_done.clear();
+    vks_unexported.clear();
+
+    for (irec = 0; irec < nrecord; ++irec) {
+        const char *ptr = data + checkpoint_header_size + irec * size_record;
+
+        std::memcpy(&iks, ptr, sizeof(int));
+
+        if (iks == -1) {
+            vks_unexported.clear();
+            continue;
+        }
+        if (iks < 0 || iks >= kpoint->nk_irred * ns) {
+            error->exit("load_checkpoint", "The checkpoint file is broken");
         }
-        writes->fs_result << "#END GAMMA_EACH" << std::endl;
+
+        std::memcpy(damping3[iks], ptr + 2 * sizeof(int), ntemp * sizeof(double));
+
+        if (!is_done[iks]) {
+            is_done[iks] = 1;
+            vks_done.push_back(iks);
+            vks_unexported.push_back(iks);
+        }
+    }
+
+#if !defined(_WIN32)
+    munmap(addr, size_file);
+    close(fd);
+#endif
+
+    // Subsequent records are appended after the last complete record.
+
+    open_checkpoint(true);
+    fs_checkpoint.seekp(checkpoint_header_size + nrecord * size_record);
+
+    return true;
+}
+
+void Conductivity::append_checkpoint(const int iks)
+{
+    // Records are buffered and written to the file at most every 10 seconds
+    // so that rank 0 can go back to dispensing jobs immediately.
+
+    const int ireserved = 0;
+    const char *ptr;
+
+    ptr = reinterpret_cast<const char *>(&iks);
+    buffer_checkpoint.insert(buffer_checkpoint.end(), ptr, ptr + sizeof(int));
+    ptr = reinterpret_cast<const char *>(&ireserved);
+    buffer_checkpoint.insert(buffer_checkpoint.end(), ptr, ptr + sizeof(int));
+
+    if (iks == -1) {
+        buffer_checkpoint.insert(buffer_checkpoint.end(), ntemp * sizeof(double), 0);
+        vks_unexported.clear();
+    } else {
+        ptr = reinterpret_cast<const char *>(damping3[iks]);
+        buffer_checkpoint.insert(buffer_checkpoint.end(), ptr, ptr + ntemp * sizeof(double));
+        vks_unexported.push_back(iks);
+    }
+
+    if (timer->elapsed() - time_flush_checkpoint > 10.0) flush_checkpoint();
+}
+
+void Conductivity::flush_checkpoint()
+{
+    if (!buffer_checkpoint.empty()) {
+        fs_checkpoint.write(&buffer_checkpoint[0], buffer_checkpoint.size());
+        fs_checkpoint.flush();
+        buffer_checkpoint.clear();
+    }
+    time_flush_checkpoint = timer->elapsed();
+}
+
+void Conductivity::export_result_gamma()
+{
+    // Write the modes stored only in the checkpoint to the result file
+    // and mark them as exported.
+
+    std::sort(vks_unexported.begin(), vks_unexported.end());
+
+    for (auto it = vks_unexported.begin(); it != vks_unexported.end(); ++it) {
+        write_result_gamma(*it, vel, damping3);
+    }
+    writes->fs_result.flush();
+
+    append_checkpoint(-1);
+    flush_checkpoint();
+    fs_checkpoint.close();
+}
+
+// The kernel file PREFIX.rta_kernel consists of a header
+//   char[8] "ANPHKERN", int version, int nk_irred, int ns, int ismear, int classical,
+//   double epsilon, double delta_cutoff, unsigned long long hash of the force constants
+// followed by variable-size records
+//   int iks, int nnz, double kernel[0], int index[nnz], double kernel[index + 1][nnz]
+// where only the nonzero coefficients of n(omega, T) are kept.
+// The damping at any temperature can be evaluated from the kernel
+// without computing V3 again.
+
+static const char kernel_magic[8] = {'A', 'N', 'P', 'H', 'K', 'E', 'R', 'N'};
+static const int kernel_version = 2;
+static const size_t kernel_header_size = 8 + 5 * sizeof(int) + 2 * sizeof(double) + sizeof(unsigned long long);
+
+void Conductivity::load_kernel()
+{
+    // Evaluate the damping of the modes found in the kernel file
+    // for the present temperatures and remove them from vks_job.
+    // The kernel file is then opened on rank 0 for appending new records.
+    // A truncated record at the end of the file is ignored and overwritten.
+
+    int i;
+    int nks_loaded = 0;
+    std::vector<int> vks_loaded;
+
+    if (mympi->my_rank == 0) {
+
+        struct stat st;
+        int ival[5];
+        double dval[2];
+        unsigned long long hash_tmp;
+        char magic_tmp[8];
+
+        const int nks = kpoint->nk_irred * ns;
+        const unsigned int kmesh[3] = {kpoint->nkx, kpoint->nky, kpoint->nkz};
+        const unsigned long long hash = anharmonic_core->get_hash_force_constants(kmesh);
+
+        file_kernel = input->job_title + ".rta_kernel";
+
+        if (stat(file_kernel.c_str(), &st) == 0) {
+
+            int iks, nnz;
+            std::streamoff pos_end = kernel_header_size;
+            std::vector<int> is_loaded(nks, 0);
+            DampingKernel kernel;
+
+            std::ifstream ifs_kernel(file_kernel.c_str(), std::ios::in | std::ios::binary);
+
+            ifs_kernel.read(magic_tmp, 8);
+            ifs_kernel.read(reinterpret_cast<char *>(ival), 5 * sizeof(int));
+            ifs_kernel.read(reinterpret_cast<char *>(dval), 2 * sizeof(double));
+            ifs_kernel.read(reinterpret_cast<char *>(&hash_tmp), sizeof(unsigned long long));
+
+            if (!ifs_kernel || std::memcmp(magic_tmp, kernel_magic, 8) != 0 || ival[0] != kernel_version) {
+                error->exit("load_kernel", "The kernel file is broken");
+            }
+            if (ival[1] != kpoint->nk_irred || ival[2] != ns || ival[3] != integration->ismear
+                || ival[4] != static_cast<int>(thermodynamics->classical)
+                || (integration->ismear != -1 && dval[0] != integration->epsilon)
+                || (integration->ismear == 1 && dval[1] != integration->delta_cutoff)
+                || hash_tmp != hash) {
+                error->exit("load_kernel",
+                            "The kernel file is not consistent with the present calculation");
+            }
+
+            while (ifs_kernel.read(reinterpret_cast<char *>(&iks), sizeof(int))
+                && ifs_kernel.read(reinterpret_cast<char *>(&nnz), sizeof(int))) {
+
+                if (iks < 0 || iks >= nks || nnz < 0 || nnz > nks) {
+                    error->exit("load_kernel", "The kernel file is broken");
+                }
+
+                kernel.index.resize(nnz);
+                kernel.coef.resize(nnz);
+
+                ifs_kernel.read(reinterpret_cast<char *>(&kernel.c0), sizeof(double));
+                if (nnz > 0) {
+                    ifs_kernel.read(reinterpret_cast<char *>(&kernel.index[0]), nnz * sizeof(int));
+                    ifs_kernel.read(reinterpret_cast<char *>(&kernel.coef[0]), nnz * sizeof(double));
+                }
+                if (!ifs_kernel) break;
+
+                pos_end = ifs_kernel.tellg();
+
+                if (is_loaded[iks] || vks_job.find(iks) == vks_job.end()) continue;
+
+                for (i = 0; i < nnz; ++i) {
+                    if (kernel.index[i] < 0 || kernel.index[i] >= nks) {
+                        error->exit("load_kernel", "The kernel file is broken");
+                    }
+                }
+
+                anharmonic_core->evaluate_damping_kernel(ntemp, Temperature, kernel, damping3[iks]);
+
+                if (rta_checkpoint) {
+                    append_checkpoint(iks);
+                } else {
+                    write_result_gamma(iks, vel, damping3);
+                }
+
+                is_loaded[iks] = 1;
+                vks_loaded.push_back(iks);
+            }
+            ifs_kernel.close();
+
+            fs_kernel.open(file_kernel.c_str(), std::ios::in | std::ios::out | std::ios::binary);
+            if (!fs_kernel) {
+                error->exit("load_kernel", "Could not open the kernel file");
+            }
+            fs_kernel.seekp(pos_end);
+
+            std::cout << " Phonon lifetimes of " << vks_loaded.size()
+                << " modes are evaluated from " << file_kernel << std::endl;
+
+        } else {
+            ival[0] = kernel_version;
+            ival[1] = kpoint->nk_irred;
+            ival[2] = ns;
+            ival[3] = integration->ismear;
+            ival[4] = static_cast<int>(thermodynamics->classical);
+            dval[0] = integration->epsilon;
+            dval[1] = integration->delta_cutoff;
+
+            fs_kernel.open(file_kernel.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+            if (!fs_kernel) {
+                error->exit("load_kernel", "Could not open the kernel file");
+            }
+            fs_kernel.write(kernel_magic, 8);
+            fs_kernel.write(reinterpret_cast<const char *>(ival), 5 * sizeof(int));
+            fs_kernel.write(reinterpret_cast<const char *>(dval), 2 * sizeof(double));
+            fs_kernel.write(reinterpret_cast<const char *>(&hash), sizeof(unsigned long long));
+            fs_kernel.flush();
+
+            std::cout << " The kernels of phonon linewidths are saved to " << file_kernel << std::endl;
+        }
+
+        time_flush_kernel = timer->elapsed();
+        nks_loaded = vks_loaded.size();
+    }
+
+    MPI_Bcast(&nks_loaded, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+    if (nks_loaded > 0) {
+        vks_loaded.resize(nks_loaded);
+        MPI_Bcast(&vks_loaded[0], nks_loaded, MPI_INT, 0, MPI_COMM_WORLD);
+
+        for (i = 0; i < nks_loaded; ++i) vks_job.erase(vks_loaded[i]);
+    }
+}
+
+void Conductivity::append_kernel(const int iks,
+                                 const DampingKernel &kernel)
+{
+    const int nnz = kernel.index.size();
+
+    fs_kernel.write(reinterpret_cast<const char *>(&iks), sizeof(int));
+    fs_kernel.write(reinterpret_cast<const char *>(&nnz), sizeof(int));
+    fs_kernel.write(reinterpret_cast<const char *>(&kernel.c0), sizeof(double));
+    if (nnz > 0) {
+        fs_kernel.write(reinterpret_cast<const char *>(&kernel.index[0]), nnz * sizeof(int));
+        fs_kernel.write(reinterpret_cast<const char *>(&kernel.coef[0]), nnz * sizeof(double));
+    }
+
+    if (timer->elapsed() - time_flush_kernel > 10.0) {
+        fs_kernel.flush();
+        time_flush_kernel = timer->elapsed();
     }
 }
 
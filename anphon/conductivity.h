@@ -11,6 +11,9 @@
 #pragma once
 
 #include "pointers.h"
+#include "anharmonic_core.h"
+#include <fstream>
+#include <string>
 #include <vector>
 #include <set>
 
@@ -29,6 +32,9 @@ namespace PHON_NS
         void compute_kappa();
 
         int calc_kappa_spec;
+        int rta_unit;
+        int rta_checkpoint;
+        int rta_kernel;
         unsigned int ntemp;
         double **damping3;
         double ***kappa;
@@ -42,11 +48,41 @@ namespace PHON_NS
         double ***vel;
         unsigned int nk, ns;
         int nshift_restart;
-        std::vector<int> vks, vks_l, vks_done;
+        std::vector<int> vks, vks_done;
         std::set<int> vks_job;
 
+        std::string file_checkpoint;
+        std::fstream fs_checkpoint;
+        std::vector<char> buffer_checkpoint;
+        std::vector<int> vks_unexported;
+        double time_flush_checkpoint;
+
+        std::string file_kernel;
+        std::fstream fs_kernel;
+        double time_flush_kernel;
+
+        void open_checkpoint(bool);
+        bool load_checkpoint();
+        void append_checkpoint(int);
+        void flush_checkpoint();
+        void export_result_gamma();
+
+        void load_kernel();
+        void append_kernel(int,
+                           const DampingKernel &);
+
+        void dispense_damping_jobs(const std::vector<int> &);
+
+        void receive_damping_jobs();
+
+        void compute_damping_job(int,
+                                 std::vector<double> &);
+
+        void store_damping_job(const double *);
+
+        void print_progress_job(unsigned int) const;
+
         void write_result_gamma(unsigned int,
-                                unsigned int,
                                 double ***,
                                 double **);
 
@@ -52,6 +52,7 @@ void Dynamical::set_default_variables()
     nonanalytic = 0;
     participation_ratio = false;
     band_connection = 0;
+    diag_irreducible = false;
     na_sigma = 0.0;
     file_born = "";
     UPLO = 'U';
@@ -152,6 +153,7 @@ void Dynamical::setup_dynamical(std::string mode)
     MPI_Bcast(&eigenvectors, 1, MPI_LOGICAL, 0, MPI_COMM_WORLD);
     MPI_Bcast(&nonanalytic, 1, MPI_UNSIGNED, 0, MPI_COMM_WORLD);
     MPI_Bcast(&band_connection, 1, MPI_UNSIGNED, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&diag_irreducible, 1, MPI_LOGICAL, 0, MPI_COMM_WORLD);
 
     if (nonanalytic) {
         memory->allocate(borncharge, system->natmin, 3, 3);
@@ -752,11 +754,23 @@ void Dynamical::diagonalize_dynamical_all()
         memory->allocate(evec_phonon, nk, 1, 1);
     }
 
-    // Calculate phonon eigenvalues and eigenvectors for all k-points
+    // With DIAG_IRRED = 1, only the irreducible k points are diagonalized
+    // and the other k points are obtained by symmetry operations.
+    const auto use_symmetry = diag_irreducible && kpoint->kpoint_mode == 2;
+    const int nk_diag = use_symmetry ? kpoint->nk_irred : nk;
+
+    // Calculate phonon eigenvalues and eigenvectors for all k-points.
+    // The k points are divided into contiguous blocks over MPI processes
+    // and the results are gathered afterwards.
+    unsigned int ibegin, iend;
+    mympi->get_block_range(nk_diag, ibegin, iend);
+
 #ifdef _OPENMP
-#pragma omp parallel for private (is)
+#pragma omp parallel for private (ik, is)
 #endif
-    for (ik = 0; ik < nk; ++ik) {
+    for (int i = ibegin; i < static_cast<int>(iend); ++i) {
+        ik = use_symmetry ? kpoint->kpoint_irred_all[i][0].knum : i;
+
         if (nonanalytic == 3) {
             eval_k_ewald(kpoint->xk[ik], kpoint->kvec_na[ik], ewald->fc2_without_dipole,
                          eval_phonon[ik], evec_phonon[ik], require_evec, ik);
@@ -770,6 +784,10 @@ void Dynamical::diagonalize_dynamical_all()
         }
     }
 
+    if (mympi->nprocs > 1) gather_eigen_blocks(nk_diag, use_symmetry);
+
+    if (use_symmetry) replicate_eigen_for_star();
+
     if (band_connection > 0 && kpoint->kpoint_mode == 1) {
         memory->allocate(index_bconnect, nk, neval);
         connect_band_by_eigen_similarity(evec_phonon, index_bconnect);
@@ -785,6 +803,195 @@ void Dynamical::diagonalize_dynamical_all()
 }
 
 
+void Dynamical::gather_eigen_blocks(const unsigned int nk_diag,
+                                    const bool use_symmetry)
+{
+    // Share the eigenvalues and eigenvectors computed by each MPI process.
+    // When only the irreducible k points are diagonalized, they are not
+    // contiguous in eval_phonon, so they are packed into temporary arrays
+    // before the communication.
+
+    unsigned int i, ibegin, iend;
+    const int nevec = eigenvectors ? neval * neval : 1;
+#ifdef MPI_CXX_DOUBLE_COMPLEX
+    const auto mpi_complex_type = MPI_CXX_DOUBLE_COMPLEX;
+#else
+    const auto mpi_complex_type = MPI_COMPLEX16;
+#endif
+
+    if (!use_symmetry) {
+        mympi->MPI_Allgather_blocks(&eval_phonon[0][0], nk_diag,
+                                    neval, MPI_DOUBLE);
+        mympi->MPI_Allgather_blocks(&evec_phonon[0][0][0], nk_diag,
+                                    nevec, mpi_complex_type);
+        return;
+    }
+
+    double **eval_tmp;
+    std::complex<double> **evec_tmp;
+
+    memory->allocate(eval_tmp, nk_diag, neval);
+    memory->allocate(evec_tmp, nk_diag, nevec);
+
+    mympi->get_block_range(nk_diag, ibegin, iend);
+
+    for (i = ibegin; i < iend; ++i) {
+        const auto ik = kpoint->kpoint_irred_all[i][0].knum;
+        std::copy(eval_phonon[ik], eval_phonon[ik] + neval, eval_tmp[i]);
+        std::copy(&evec_phonon[ik][0][0], &evec_phonon[ik][0][0] + nevec, evec_tmp[i]);
+    }
+
+    mympi->MPI_Allgather_blocks(&eval_tmp[0][0], nk_diag, neval, MPI_DOUBLE);
+    mympi->MPI_Allgather_blocks(&evec_tmp[0][0], nk_diag, nevec, mpi_complex_type);
+
+    for (i = 0; i < nk_diag; ++i) {
+        const auto ik = kpoint->kpoint_irred_all[i][0].knum;
+        std::copy(eval_tmp[i], eval_tmp[i] + neval, eval_phonon[ik]);
+        std::copy(evec_tmp[i], evec_tmp[i] + nevec, &evec_phonon[ik][0][0]);
+    }
+
+    memory->deallocate(eval_tmp);
+    memory->deallocate(evec_tmp);
+}
+
+
+void Dynamical::replicate_eigen_for_star()
+{
+    // Generate eigenvalues and eigenvectors at all k points in the star of
+    // each irreducible k point from those at the irreducible point.
+    // If S k = k', e(k') = Gamma(S, k) e(k). If S k = -k', the time-reversal
+    // symmetry gives e(k') = [Gamma(S, k) e(k)]^*.
+
+    const auto ns = neval;
+    const int nk_irred = kpoint->nk_irred;
+    const auto &symlist = symmetry->SymmListWithMap;
+
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+    {
+        unsigned int is, js, ks;
+        double xk[3], Sk[3], S_recip[3][3];
+        std::complex<double> **gamma;
+
+        memory->allocate(gamma, ns, ns);
+
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+        for (int ik = 0; ik < nk_irred; ++ik) {
+
+            const auto knum = kpoint->kpoint_irred_all[ik][0].knum;
+            for (auto j = 0; j < 3; ++j) xk[j] = kpoint->xk[knum][j];
+
+            for (auto i = 1; i < kpoint->kpoint_irred_all[ik].size(); ++i) {
+
+                const auto knum_star = kpoint->kpoint_irred_all[ik][i].knum;
+                const auto xk_star = kpoint->xk[knum_star];
+
+                int isym_found = -1;
+                auto time_reversal = false;
+
+                for (auto isym = 0; isym < symlist.size() && isym_found == -1; ++isym) {
+                    for (auto j = 0; j < 3; ++j) {
+                        for (auto k = 0; k < 3; ++k) {
+                            S_recip[j][k] = symlist[isym].rot_reciprocal[3 * j + k];
+                        }
+                    }
+                    rotvec(Sk, xk, S_recip);
+
+                    auto diff = 0.0, diff_minus = 0.0;
+                    for (auto j = 0; j < 3; ++j) {
+                        diff += std::abs(Sk[j] - xk_star[j] - nint(Sk[j] - xk_star[j]));
+                        diff_minus += std::abs(Sk[j] + xk_star[j] - nint(Sk[j] + xk_star[j]));
+                    }
+                    if (diff < eps8) {
+                        isym_found = isym;
+                    } else if (diff_minus < eps8) {
+                        isym_found = isym;
+                        time_reversal = true;
+                    }
+                }
+
+                if (isym_found == -1) {
+                    error->exit("replicate_eigen_for_star",
+                                "Symmetry operation connecting k points is not found.");
+                }
+
+                for (is = 0; is < ns; ++is) {
+                    eval_phonon[knum_star][is] = eval_phonon[knum][is];
+                }
+
+                if (!eigenvectors) continue;
+
+                calc_symmetry_transform(xk, symlist[isym_found], gamma);
+
+                for (is = 0; is < ns; ++is) {
+                    for (js = 0; js < ns; ++js) {
+                        auto ctmp = std::complex<double>(0.0, 0.0);
+                        for (ks = 0; ks < ns; ++ks) {
+                            ctmp += gamma[js][ks] * evec_phonon[knum][is][ks];
+                        }
+                        evec_phonon[knum_star][is][js] = time_reversal ? std::conj(ctmp) : ctmp;
+                    }
+                }
+            }
+        }
+
+        memory->deallocate(gamma);
+    }
+}
+
+void Dynamical::calc_symmetry_transform(const double *xk_in,
+                                        const SymmetryOperationWithMapping &symop,
+                                        std::complex<double> **gamma_out) const
+{
+    // Matrix Gamma(S, k) which transforms the dynamical matrix at k
+    // to that at Sk as D(Sk) = Gamma D(k) Gamma^{dagger}.
+
+    unsigned int iat, jat, icrd, jcrd;
+    double x1[3], x2[3], xtmp[3];
+    double S_frac[3][3], S_frac_inv[3][3];
+    const std::complex<double> im(0.0, 1.0);
+
+    for (icrd = 0; icrd < 3; ++icrd) {
+        for (jcrd = 0; jcrd < 3; ++jcrd) {
+            S_frac[icrd][jcrd] = symop.rot_real[3 * icrd + jcrd];
+        }
+    }
+    invmat3(S_frac_inv, S_frac);
+
+    for (iat = 0; iat < neval; ++iat) {
+        for (jat = 0; jat < neval; ++jat) {
+            gamma_out[iat][jat] = std::complex<double>(0.0, 0.0);
+        }
+    }
+
+    for (jat = 0; jat < system->natmin; ++jat) {
+        iat = symop.mapping[jat];
+
+        // Fractional coordinates of x1 and x2
+        for (icrd = 0; icrd < 3; ++icrd) {
+            x1[icrd] = system->xr_p[system->map_p2s[iat][0]][icrd];
+            x2[icrd] = system->xr_p[system->map_p2s[jat][0]][icrd];
+        }
+
+        rotvec(xtmp, x1, S_frac_inv);
+        for (icrd = 0; icrd < 3; ++icrd) {
+            xtmp[icrd] = xtmp[icrd] - x2[icrd];
+        }
+
+        const auto phase = 2.0 * pi * (xk_in[0] * xtmp[0] + xk_in[1] * xtmp[1] + xk_in[2] * xtmp[2]);
+        const auto exp_phase = std::exp(im * phase);
+
+        for (icrd = 0; icrd < 3; ++icrd) {
+            for (jcrd = 0; jcrd < 3; ++jcrd) {
+                gamma_out[3 * iat + icrd][3 * jat + jcrd] = symop.rot[3 * icrd + jcrd] * exp_phase;
+            }
+        }
+    }
+}
+
 void Dynamical::modify_eigenvectors()
 {
     bool *flag_done;
@@ -18,6 +18,8 @@
 
 namespace PHON_NS
 {
+    class SymmetryOperationWithMapping;
+
     class DistWithCell
     {
     public:
@@ -50,6 +52,7 @@ namespace PHON_NS
         unsigned int nonanalytic;
         bool participation_ratio;
         unsigned int band_connection;
+        bool diag_irreducible;
 
         std::string file_born;
         double na_sigma;
@@ -106,6 +109,10 @@ namespace PHON_NS
                                    std::vector<FcsClassExtent>,
                                    std::complex<double> **);
 
+        void calc_symmetry_transform(const double *,
+                                     const SymmetryOperationWithMapping &,
+                                     std::complex<double> **) const;
+
     private:
         void set_default_variables();
         void deallocate_variables();
@@ -123,6 +130,11 @@ namespace PHON_NS
 
         void detect_imaginary_branches(double **);
 
+        void gather_eigen_blocks(unsigned int,
+                                 bool);
+
+        void replicate_eigen_for_star();
+
 
         double **xshift_s;
         char UPLO;
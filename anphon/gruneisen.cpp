@@ -98,6 +98,16 @@ void Gruneisen::setup()
     }
     if (print_gruneisen) {
         memory->allocate(gruneisen, kpoint->nk, dynamical->neval);
+
+        anharmonic_core->prepare_fcs_csr(delta_fc2, 2, delta_fc2_csr);
+
+        if (kpoint->kpoint_mode == 2) {
+            int nk_tmp[3];
+            nk_tmp[0] = kpoint->nkx;
+            nk_tmp[1] = kpoint->nky;
+            nk_tmp[2] = kpoint->nkz;
+            phase_factor.setup(nk_tmp, {&delta_fc2_csr});
+        }
     }
 
     if (mympi->my_rank == 0) {
@@ -188,6 +198,32 @@ void Gruneisen::calc_dfc2_reciprocal(std::complex<double> **dphi2,
         }
     }
 
+    int kint[3];
+
+    if (phase_factor.ready && phase_factor.get_mesh_coordinate(xk_in, kint)) {
+
+        // The k point is on the uniform mesh. Use the phase factor table.
+
+        std::vector<int> phase_index(3 * std::max(delta_fc2_csr.nelem(), 1u));
+
+        phase_factor.calc_phase_index(delta_fc2_csr, kint, &phase_index[0]);
+
+        for (i = 0; i < delta_fc2_csr.ngroup; ++i) {
+
+            const auto &it = delta_fc2[delta_fc2_csr.offset[i]];
+
+            atm1 = it.pairs[0].index / 3;
+            atm2 = it.pairs[1].index / 3;
+            atm1_s = system->map_p2s_anharm[atm1][0];
+            atm2_s = system->map_p2s_anharm[atm2][0];
+
+            dphi2[it.pairs[0].index][it.pairs[1].index]
+                += phase_factor.sum_phase_factor(delta_fc2_csr, i, &phase_index[0])
+                / std::sqrt(system->mass_anharm[atm1_s] * system->mass_anharm[atm2_s]);
+        }
+        return;
+    }
+
     for (const auto &it : delta_fc2) {
 
         atm1 = it.pairs[0].index / 3;
@@ -15,6 +15,7 @@
 #include <complex>
 #include <vector>
 #include "fcs_phonon.h"
+#include "anharmonic_core.h"
 
 namespace PHON_NS
 {
@@ -112,6 +113,10 @@ namespace PHON_NS
         double **xshift_s;
         std::vector<FcsArrayWithCell> delta_fc2, delta_fc3;
 
+        // delta_fc2 in the CSR layout and its phase factors on the uniform k mesh
+        FcsArrayCSR delta_fc2_csr;
+        PhaseFactorTable phase_factor;
+
         void prepare_delta_fcs(const std::vector<FcsArrayWithCell> &,
                                std::vector<FcsArrayWithCell> &);
 
@@ -19,6 +19,7 @@
 #include <vector>
 #include <algorithm>
 #include <cmath>
+#include <limits>
 
 using namespace PHON_NS;
 
@@ -37,8 +38,10 @@ void Integration::set_default_variables()
     use_tetrahedron = true;
     ismear = -1;
     epsilon = 0.0;
+    delta_cutoff = 0.0;
     ntetra = 0;
     tetras = nullptr;
+    vol_tetra_tot = 0.0;
 }
 
 void Integration::deallocate_variables()
@@ -68,6 +71,11 @@ void Integration::setup_integration()
         } else if (ismear == 1) {
             std::cout << " ISMEAR = 1: Gaussian broadening with epsilon = "
                 << std::fixed << std::setprecision(2) << epsilon << " (cm^-1)" << std::endl;
+            if (delta_cutoff > 0.0) {
+                std::cout << " Band pairs with Gaussian weights below "
+                    << std::scientific << std::setprecision(2) << delta_cutoff
+                    << " times the peak height are neglected." << std::fixed << std::endl;
+            }
         } else {
             error->exit("setup_relaxation", "Invalid ksum_mode");
         }
@@ -78,10 +86,19 @@ void Integration::setup_integration()
         ntetra = 6 * nk;
         memory->allocate(tetras, ntetra, 4);
         prepare_tetrahedron(nkx, nky, nkz);
+
+        // Volumes of the tetrahedra do not depend on the band energies
+        vol_tetra.resize(ntetra);
+        vol_tetra_tot = 0.0;
+        for (auto i = 0; i < ntetra; ++i) {
+            vol_tetra[i] = volume(tetras[i]);
+            vol_tetra_tot += vol_tetra[i];
+        }
     }
 
     epsilon *= time_ry / Hz_to_kayser;
     MPI_Bcast(&epsilon, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&delta_cutoff, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
 }
 
 
@@ -208,7 +225,7 @@ double Integration::do_tetrahedron(double *energy,
         f3 = tetra_data[2].f;
         f4 = tetra_data[3].f;
 
-        vol = volume(tetras[i]);
+        vol = vol_tetra[i];
         vol_tot += vol;
 
         if (e3 <= e_ref && e_ref < e4) {
@@ -273,7 +290,7 @@ double Integration::dos_integration(double *energy,
         e3 = e_tetra[2];
         e4 = e_tetra[3];
 
-        vol = volume(tetras[i]);
+        vol = vol_tetra[i];
         vol_tot += vol;
 
         if (e3 <= e_ref && e_ref < e4) {
@@ -297,85 +314,196 @@ void Integration::calc_weight_tetrahedron(const int nk_irreducible,
                                           const double e_ref)
 {
     int i, j;
-    double vol;
-    double vol_tot;
-
-    double g;
-    double I1, I2, I3, I4;
-    int k1, k2, k3, k4;
-    double e1, e2, e3, e4;
-
-    vol_tot = 0.0;
-    // std::vector<TetraWithKnum> tetra_data;
-    // TetraWithKnum pair;
-    double e_tmp[4];
+    double e_tmp[4], I[4];
     int sort_arg[4], kindex[4];
 
     for (i = 0; i < nk_irreducible; ++i) weight[i] = 0.0;
 
     for (i = 0; i < ntetra; ++i) {
 
+        for (j = 0; j < 4; ++j) e_tmp[j] = energy[tetras[i][j]];
+
+        // The weights vanish unless e1 <= e_ref < e4
+        if (e_ref < std::min(std::min(e_tmp[0], e_tmp[1]), std::min(e_tmp[2], e_tmp[3]))
+            || e_ref >= std::max(std::max(e_tmp[0], e_tmp[1]), std::max(e_tmp[2], e_tmp[3]))) continue;
+
+        for (j = 0; j < 4; ++j) kindex[j] = map_to_irreducible_k[tetras[i][j]];
+
+        insertion_sort(e_tmp, sort_arg, 4);
+
+        weight_tetra_sorted(e_tmp, e_ref, I);
+
         for (j = 0; j < 4; ++j) {
-            e_tmp[j] = energy[tetras[i][j]];
-            kindex[j] = map_to_irreducible_k[tetras[i][j]];
+            weight[kindex[sort_arg[j]]] += vol_tetra[i] * I[j];
         }
+    }
+
+    for (i = 0; i < nk_irreducible; ++i) weight[i] /= vol_tetra_tot;
+}
+
+void Integration::calc_weight_tetrahedron_multi(const int nk_irreducible,
+                                                const int *map_to_irreducible_k,
+                                                const double *energy,
+                                                const unsigned int n_energy,
+                                                const double *e_ref,
+                                                double **weight)
+{
+    // Same as calc_weight_tetrahedron but for all the reference energies
+    // e_ref[0], ..., e_ref[n_energy - 1] in one sweep over the tetrahedra.
+    // e_ref must be in ascending order. The corner energies of each
+    // tetrahedron are sorted once, and only the reference energies in
+    // [e1, e4) of the tetrahedron are visited.
+    // weight[ie][ik] corresponds to the weight for e_ref[ie].
+
+    int i, j;
+    unsigned int ie;
+    double e_tmp[4], I[4];
+    int sort_arg[4], kindex[4];
+
+    check_energy_grid(n_energy, e_ref);
+
+    for (ie = 0; ie < n_energy; ++ie) {
+        for (i = 0; i < nk_irreducible; ++i) weight[ie][i] = 0.0;
+    }
+
+    for (i = 0; i < ntetra; ++i) {
+
+        for (j = 0; j < 4; ++j) e_tmp[j] = energy[tetras[i][j]];
+
+        const auto emin = std::min(std::min(e_tmp[0], e_tmp[1]), std::min(e_tmp[2], e_tmp[3]));
+        const auto emax = std::max(std::max(e_tmp[0], e_tmp[1]), std::max(e_tmp[2], e_tmp[3]));
+
+        const auto ie_begin = std::lower_bound(e_ref, e_ref + n_energy, emin) - e_ref;
+        const auto ie_end = std::lower_bound(e_ref, e_ref + n_energy, emax) - e_ref;
+
+        if (ie_begin == ie_end) continue;
+
+        for (j = 0; j < 4; ++j) kindex[j] = map_to_irreducible_k[tetras[i][j]];
 
         insertion_sort(e_tmp, sort_arg, 4);
-        e1 = e_tmp[0];
-        e2 = e_tmp[1];
-        e3 = e_tmp[2];
-        e4 = e_tmp[3];
 
-        k1 = kindex[sort_arg[0]];
-        k2 = kindex[sort_arg[1]];
-        k3 = kindex[sort_arg[2]];
-        k4 = kindex[sort_arg[3]];
+        for (auto ie2 = ie_begin; ie2 < ie_end; ++ie2) {
+            weight_tetra_sorted(e_tmp, e_ref[ie2], I);
 
-        vol = volume(tetras[i]);
-        vol_tot += vol;
+            for (j = 0; j < 4; ++j) {
+                weight[ie2][kindex[sort_arg[j]]] += vol_tetra[i] * I[j];
+            }
+        }
+    }
 
-        I1 = 0.0;
-        I2 = 0.0;
-        I3 = 0.0;
-        I4 = 0.0;
+    const auto inv_vol = 1.0 / vol_tetra_tot;
+    for (ie = 0; ie < n_energy; ++ie) {
+        for (i = 0; i < nk_irreducible; ++i) weight[ie][i] *= inv_vol;
+    }
+}
 
-        if (e3 <= e_ref && e_ref < e4) {
-            // g = 3.0 * std::pow(e4 - e_ref, 2) / ((e4 - e1) * (e4 - e2) * (e4 - e3));
-            g = std::pow(e4 - e_ref, 2) / ((e4 - e1) * (e4 - e2) * (e4 - e3));
+void Integration::integrate_tetrahedron_multi(const double *energy,
+                                              const double *f,
+                                              const unsigned int n_energy,
+                                              const double *e_ref,
+                                              double *ret)
+{
+    // ret[ie] = \sum_{k} f(k) w_{k}(e_ref[ie]), where w_{k} is the weight of
+    // calc_weight_tetrahedron. When f is nullptr, f(k) = 1 is assumed.
+    // e_ref must be in ascending order. This avoids storing the weights
+    // when only their sum over k is needed, e.g. for the DOS.
 
-            I1 = g * fij(e1, e4, e_ref);
-            I2 = g * fij(e2, e4, e_ref);
-            I3 = g * fij(e3, e4, e_ref);
-            I4 = g * (fij(e4, e1, e_ref) + fij(e4, e2, e_ref) + fij(e4, e3, e_ref));
+    int i, j;
+    unsigned int ie;
+    double e_tmp[4], f_tmp[4], I[4];
+    int sort_arg[4];
 
-        } else if (e2 <= e_ref && e_ref < e3) {
-            //  g = 3.0 * ((e2 - e1) + 2.0 * (e_ref - e2) - (e4 + e3 - e2 - e1)
-            //      * std::pow((e_ref - e2), 2) / ((e3 - e2) * (e4 - e2))) / ((e3 - e1) * (e4 - e1));
-            g = ((e2 - e1) + 2.0 * (e_ref - e2) - (e4 + e3 - e2 - e1)
-                * std::pow((e_ref - e2), 2) / ((e3 - e2) * (e4 - e2))) / ((e3 - e1) * (e4 - e1));
+    check_energy_grid(n_energy, e_ref);
 
-            I1 = g * fij(e1, e4, e_ref) + fij(e1, e3, e_ref) * fij(e3, e1, e_ref) * fij(e2, e3, e_ref) / (e4 - e1);
-            I2 = g * fij(e2, e3, e_ref) + std::pow(fij(e2, e4, e_ref), 2) * fij(e3, e2, e_ref) / (e4 - e1);
-            I3 = g * fij(e3, e2, e_ref) + std::pow(fij(e3, e1, e_ref), 2) * fij(e2, e3, e_ref) / (e4 - e1);
-            I4 = g * fij(e4, e1, e_ref) + fij(e4, e2, e_ref) * fij(e2, e4, e_ref) * fij(e3, e2, e_ref) / (e4 - e1);
+    for (ie = 0; ie < n_energy; ++ie) ret[ie] = 0.0;
 
-        } else if (e1 <= e_ref && e_ref < e2) {
-            //  g = 3.0 * std::pow(e_ref - e1, 2) / ((e2 - e1) * (e3 - e1) * (e4 - e1));
-            g = std::pow(e_ref - e1, 2) / ((e2 - e1) * (e3 - e1) * (e4 - e1));
+    for (i = 0; i < ntetra; ++i) {
+
+        for (j = 0; j < 4; ++j) e_tmp[j] = energy[tetras[i][j]];
+
+        const auto emin = std::min(std::min(e_tmp[0], e_tmp[1]), std::min(e_tmp[2], e_tmp[3]));
+        const auto emax = std::max(std::max(e_tmp[0], e_tmp[1]), std::max(e_tmp[2], e_tmp[3]));
+
+        const auto ie_begin = std::lower_bound(e_ref, e_ref + n_energy, emin) - e_ref;
+        const auto ie_end = std::lower_bound(e_ref, e_ref + n_energy, emax) - e_ref;
 
-            I1 = g * (fij(e1, e2, e_ref) + fij(e1, e3, e_ref) + fij(e1, e4, e_ref));
-            I2 = g * fij(e2, e1, e_ref);
-            I3 = g * fij(e3, e1, e_ref);
-            I4 = g * fij(e4, e1, e_ref);
+        if (ie_begin == ie_end) continue;
 
+        insertion_sort(e_tmp, sort_arg, 4);
+
+        for (j = 0; j < 4; ++j) {
+            f_tmp[j] = f ? f[tetras[i][sort_arg[j]]] : 1.0;
+        }
+
+        for (auto ie2 = ie_begin; ie2 < ie_end; ++ie2) {
+            weight_tetra_sorted(e_tmp, e_ref[ie2], I);
+            ret[ie2] += vol_tetra[i] * (I[0] * f_tmp[0] + I[1] * f_tmp[1]
+                + I[2] * f_tmp[2] + I[3] * f_tmp[3]);
         }
-        weight[k1] += vol * I1;
-        weight[k2] += vol * I2;
-        weight[k3] += vol * I3;
-        weight[k4] += vol * I4;
     }
 
-    for (i = 0; i < nk_irreducible; ++i) weight[i] /= vol_tot;
+    const auto inv_vol = 1.0 / vol_tetra_tot;
+    for (ie = 0; ie < n_energy; ++ie) ret[ie] *= inv_vol;
+}
+
+void Integration::weight_tetra_sorted(const double *e,
+                                      const double e_ref,
+                                      double *I)
+{
+    // Integration weights of the four corners of a tetrahedron
+    // whose corner energies e[0] <= e[1] <= e[2] <= e[3] are sorted.
+
+    double g;
+    const auto e1 = e[0];
+    const auto e2 = e[1];
+    const auto e3 = e[2];
+    const auto e4 = e[3];
+
+    I[0] = 0.0;
+    I[1] = 0.0;
+    I[2] = 0.0;
+    I[3] = 0.0;
+
+    if (e3 <= e_ref && e_ref < e4) {
+        // g = 3.0 * std::pow(e4 - e_ref, 2) / ((e4 - e1) * (e4 - e2) * (e4 - e3));
+        g = std::pow(e4 - e_ref, 2) / ((e4 - e1) * (e4 - e2) * (e4 - e3));
+
+        I[0] = g * fij(e1, e4, e_ref);
+        I[1] = g * fij(e2, e4, e_ref);
+        I[2] = g * fij(e3, e4, e_ref);
+        I[3] = g * (fij(e4, e1, e_ref) + fij(e4, e2, e_ref) + fij(e4, e3, e_ref));
+
+    } else if (e2 <= e_ref && e_ref < e3) {
+        //  g = 3.0 * ((e2 - e1) + 2.0 * (e_ref - e2) - (e4 + e3 - e2 - e1)
+        //      * std::pow((e_ref - e2), 2) / ((e3 - e2) * (e4 - e2))) / ((e3 - e1) * (e4 - e1));
+        g = ((e2 - e1) + 2.0 * (e_ref - e2) - (e4 + e3 - e2 - e1)
+            * std::pow((e_ref - e2), 2) / ((e3 - e2) * (e4 - e2))) / ((e3 - e1) * (e4 - e1));
+
+        I[0] = g * fij(e1, e4, e_ref) + fij(e1, e3, e_ref) * fij(e3, e1, e_ref) * fij(e2, e3, e_ref) / (e4 - e1);
+        I[1] = g * fij(e2, e3, e_ref) + std::pow(fij(e2, e4, e_ref), 2) * fij(e3, e2, e_ref) / (e4 - e1);
+        I[2] = g * fij(e3, e2, e_ref) + std::pow(fij(e3, e1, e_ref), 2) * fij(e2, e3, e_ref) / (e4 - e1);
+        I[3] = g * fij(e4, e1, e_ref) + fij(e4, e2, e_ref) * fij(e2, e4, e_ref) * fij(e3, e2, e_ref) / (e4 - e1);
+
+    } else if (e1 <= e_ref && e_ref < e2) {
+        //  g = 3.0 * std::pow(e_ref - e1, 2) / ((e2 - e1) * (e3 - e1) * (e4 - e1));
+        g = std::pow(e_ref - e1, 2) / ((e2 - e1) * (e3 - e1) * (e4 - e1));
+
+        I[0] = g * (fij(e1, e2, e_ref) + fij(e1, e3, e_ref) + fij(e1, e4, e_ref));
+        I[1] = g * fij(e2, e1, e_ref);
+        I[2] = g * fij(e3, e1, e_ref);
+        I[3] = g * fij(e4, e1, e_ref);
+    }
+}
+
+void Integration::check_energy_grid(const unsigned int n_energy,
+                                    const double *e_ref)
+{
+    for (unsigned int ie = 1; ie < n_energy; ++ie) {
+        if (e_ref[ie] < e_ref[ie - 1]) {
+            error->exit("check_energy_grid",
+                        "The reference energies must be given in ascending order.");
+        }
+    }
 }
 
 void Integration::calc_weight_smearing(const std::vector<std::vector<KpointList>> &kpinfo,
@@ -430,6 +558,106 @@ void Integration::calc_weight_smearing(const int nk,
     for (i = 0; i < nk_irreducible; ++i) weight[i] *= invnk;
 }
 
+double Integration::smearing_window(const int smearing_method,
+                                    const double epsilon) const
+{
+    // Half width of the energy window outside which the smearing function
+    // is neglected. The Gaussian is truncated where it falls below
+    // delta_cutoff (or eps15 if not given) times its peak height.
+    // The Lorentzian decays too slowly to be truncated.
+
+    if (smearing_method == 1) {
+        const auto tol = delta_cutoff > 0.0 ? delta_cutoff : eps15;
+        return epsilon * std::sqrt(-std::log(tol));
+    }
+    return std::numeric_limits<double>::infinity();
+}
+
+void Integration::calc_weight_smearing_multi(const int nk,
+                                             const double *energy,
+                                             const unsigned int n_energy,
+                                             const double *e_ref,
+                                             const int smearing_method,
+                                             double **weight)
+{
+    // Same as calc_weight_smearing (without symmetry reduction) but for all
+    // the reference energies e_ref[0], ..., e_ref[n_energy - 1].
+    // e_ref must be in ascending order. Each energy[k] only contributes to
+    // the reference energies within the window of the smearing function,
+    // which are located by a binary search.
+    // weight[ie][ik] corresponds to the weight for e_ref[ie].
+
+    int i;
+    unsigned int ie;
+
+    const auto epsilon = this->epsilon * Hz_to_kayser / time_ry;
+    const auto invnk = 1.0 / static_cast<double>(nk);
+    const auto de = smearing_window(smearing_method, epsilon);
+
+    check_energy_grid(n_energy, e_ref);
+
+    for (ie = 0; ie < n_energy; ++ie) {
+        for (i = 0; i < nk; ++i) weight[ie][i] = 0.0;
+    }
+
+    for (i = 0; i < nk; ++i) {
+        const auto ie_begin = std::lower_bound(e_ref, e_ref + n_energy, energy[i] - de) - e_ref;
+        const auto ie_end = std::upper_bound(e_ref, e_ref + n_energy, energy[i] + de) - e_ref;
+
+        if (smearing_method == 0) {
+            for (auto ie2 = ie_begin; ie2 < ie_end; ++ie2) {
+                weight[ie2][i] = invnk * delta_lorentz(e_ref[ie2] - energy[i], epsilon);
+            }
+        } else if (smearing_method == 1) {
+            for (auto ie2 = ie_begin; ie2 < ie_end; ++ie2) {
+                weight[ie2][i] = invnk * delta_gauss(e_ref[ie2] - energy[i], epsilon);
+            }
+        }
+    }
+}
+
+void Integration::integrate_smearing_multi(const int nk,
+                                           const double *energy,
+                                           const double *f,
+                                           const unsigned int n_energy,
+                                           const double *e_ref,
+                                           const int smearing_method,
+                                           double *ret)
+{
+    // ret[ie] = \sum_{k} f(k) w_{k}(e_ref[ie]), where w_{k} is the weight of
+    // calc_weight_smearing_multi. When f is nullptr, f(k) = 1 is assumed.
+    // Each energy[k] is deposited into the nearby bins of e_ref only.
+
+    int i;
+    unsigned int ie;
+
+    const auto epsilon = this->epsilon * Hz_to_kayser / time_ry;
+    const auto de = smearing_window(smearing_method, epsilon);
+
+    check_energy_grid(n_energy, e_ref);
+
+    for (ie = 0; ie < n_energy; ++ie) ret[ie] = 0.0;
+
+    for (i = 0; i < nk; ++i) {
+        const auto f_tmp = f ? f[i] : 1.0;
+        const auto ie_begin = std::lower_bound(e_ref, e_ref + n_energy, energy[i] - de) - e_ref;
+        const auto ie_end = std::upper_bound(e_ref, e_ref + n_energy, energy[i] + de) - e_ref;
+
+        if (smearing_method == 0) {
+            for (auto ie2 = ie_begin; ie2 < ie_end; ++ie2) {
+                ret[ie2] += f_tmp * delta_lorentz(e_ref[ie2] - energy[i], epsilon);
+            }
+        } else if (smearing_method == 1) {
+            for (auto ie2 = ie_begin; ie2 < ie_end; ++ie2) {
+                ret[ie2] += f_tmp * delta_gauss(e_ref[ie2] - energy[i], epsilon);
+            }
+        }
+    }
+
+    const auto invnk = 1.0 / static_cast<double>(nk);
+    for (ie = 0; ie < n_energy; ++ie) ret[ie] *= invnk;
+}
+
 
 double Integration::volume(const int *klist)
 {
@@ -50,6 +50,7 @@ namespace PHON_NS
         bool use_tetrahedron;
         int ismear;
         double epsilon;
+        double delta_cutoff;
 
         void setup_integration();
 
@@ -66,6 +67,19 @@ namespace PHON_NS
                                      const double *,
                                      double);
 
+        void calc_weight_tetrahedron_multi(int,
+                                           const int *,
+                                           const double *,
+                                           unsigned int,
+                                           const double *,
+                                           double **);
+
+        void integrate_tetrahedron_multi(const double *,
+                                         const double *,
+                                         unsigned int,
+                                         const double *,
+                                         double *);
+
         void calc_weight_smearing(const std::vector<std::vector<KpointList>> &,
                                   double *,
                                   double *,
@@ -80,12 +94,29 @@ namespace PHON_NS
                                   double,
                                   int);
 
+        void calc_weight_smearing_multi(int,
+                                        const double *,
+                                        unsigned int,
+                                        const double *,
+                                        int,
+                                        double **);
+
+        void integrate_smearing_multi(int,
+                                      const double *,
+                                      const double *,
+                                      unsigned int,
+                                      const double *,
+                                      int,
+                                      double *);
+
     private:
         void set_default_variables();
         void deallocate_variables();
 
         unsigned int ntetra;
         int **tetras;
+        std::vector<double> vol_tetra;
+        double vol_tetra_tot;
 
         void prepare_tetrahedron(int,
                                  int,
@@ -97,6 +128,16 @@ namespace PHON_NS
 
         inline double volume(const int *);
 
+        inline void weight_tetra_sorted(const double *,
+                                        double,
+                                        double *);
+
+        void check_energy_grid(unsigned int,
+                               const double *);
+
+        double smearing_window(int,
+                               double) const;
+
         std::vector<tetra_pair> tetra_data;
 
         inline double refold(double);
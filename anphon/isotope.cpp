@@ -17,6 +17,7 @@
 #include "kpoint.h"
 #include "memory.h"
 #include "system.h"
+#include <algorithm>
 #include <iomanip>
 #include <complex>
 
@@ -89,123 +90,190 @@ void Isotope::setup_isotope_scattering()
     }
 }
 
-void Isotope::calc_isotope_selfenergy(const int knum,
-                                      const int snum,
-                                      const double omega,
-                                      double &ret)
+void Isotope::calc_isotope_overlap(const int knum,
+                                   const int is_begin,
+                                   const int nbranch,
+                                   double ***prod)
 {
-    // Compute phonon selfenergy of phonon (knum, snum) 
-    // due to phonon-isotope scatterings.
-    // Delta functions are replaced by smearing functions with width EPSILON.
-
-    int iat, icrd;
-    int ik, is;
-    double prod;
-    std::complex<double> dprod;
+    // Compute the mass-weighted overlaps
+    // prod[snum][ib][ik] = \sum_{iat} g_{iat} |e^{*}(ik, is) . e(knum, snum)|^2
+    // for the branches is = is_begin + ib (ib < nbranch),
+    // where the dot product runs over the three components of atom iat.
+    // For each ik, the overlaps of all the branch pairs are obtained
+    // by a ZGEMM per atom block.
+
+    int ik;
     int nk = kpoint->nk;
     int ns = dynamical->neval;
     int natmin = system->natmin;
 
-    double omega1;
-    double epsilon = integration->epsilon;
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+    {
+        int iat, ib, snum;
+        int m = nbranch;
+        int n = ns;
+        int k = 3;
+        int lda = ns;
+        std::complex<double> alpha(1.0, 0.0);
+        std::complex<double> beta(0.0, 0.0);
+        std::complex<double> *evec_prod;
+        char TRANSC[] = "C";
+        char TRANSN[] = "N";
+        double fac;
+
+        memory->allocate(evec_prod, nbranch * ns);
+
+#ifdef _OPENMP
+#pragma omp for
+#endif
+        for (ik = 0; ik < nk; ++ik) {
+
+            for (snum = 0; snum < ns; ++snum) {
+                for (ib = 0; ib < nbranch; ++ib) {
+                    prod[snum][ib][ik] = 0.0;
+                }
+            }
 
-    ret = 0.0;
+            for (iat = 0; iat < natmin; ++iat) {
 
-    for (ik = 0; ik < nk; ++ik) {
-        for (is = 0; is < ns; ++is) {
+                // The eigenvectors are stored in the row-major order, i.e.,
+                // evec_phonon[ik] is the column-major matrix of (component, mode).
+                // evec_prod[snum * nbranch + ib] = e^{*}(ik, is) . e(knum, snum) for atom iat.
 
-            prod = 0.0;
+                zgemm_(TRANSC, TRANSN, &m, &n, &k, &alpha,
+                       &dynamical->evec_phonon[ik][is_begin][3 * iat], &lda,
+                       &dynamical->evec_phonon[knum][0][3 * iat], &lda,
+                       &beta, evec_prod, &m);
 
-            for (iat = 0; iat < natmin; ++iat) {
+                fac = isotope_factor[system->kd[system->map_p2s[iat][0]]];
 
-                dprod = std::complex<double>(0.0, 0.0);
-                for (icrd = 0; icrd < 3; ++icrd) {
-                    dprod += std::conj(dynamical->evec_phonon[ik][is][3 * iat + icrd])
-                        * dynamical->evec_phonon[knum][snum][3 * iat + icrd];
+                for (snum = 0; snum < ns; ++snum) {
+                    for (ib = 0; ib < nbranch; ++ib) {
+                        prod[snum][ib][ik] += fac * std::norm(evec_prod[snum * nbranch + ib]);
+                    }
                 }
-                prod += isotope_factor[system->kd[system->map_p2s[iat][0]]] * std::norm(dprod);
             }
+        }
+
+        memory->deallocate(evec_prod);
+    }
+}
+
+void Isotope::calc_isotope_selfenergy(const int knum,
+                                      const int is_begin,
+                                      const int nbranch,
+                                      double ***prod,
+                                      double *ret)
+{
+    // Add the contributions of the branches is_begin, ..., is_begin + nbranch - 1
+    // to the phonon selfenergies of phonons (knum, snum) for all snum
+    // due to phonon-isotope scatterings from the overlaps prod.
+    // Delta functions are replaced by smearing functions with width EPSILON.
+
+    int ik, ib, snum;
+    int nk = kpoint->nk;
+    int ns = dynamical->neval;
+
+    double omega, omega1;
+    double epsilon = integration->epsilon;
+    double ret_tmp;
 
-            omega1 = dynamical->eval_phonon[ik][is];
+    for (snum = 0; snum < ns; ++snum) {
 
-            if (integration->ismear == 0) {
-                ret += omega1 * delta_lorentz(omega - omega1, epsilon) * prod;
-            } else {
-                ret += omega1 * delta_gauss(omega - omega1, epsilon) * prod;
+        omega = dynamical->eval_phonon[knum][snum];
+        ret_tmp = 0.0;
+
+#ifdef _OPENMP
+#pragma omp parallel for private(ib, omega1), reduction(+: ret_tmp)
+#endif
+        for (ik = 0; ik < nk; ++ik) {
+            for (ib = 0; ib < nbranch; ++ib) {
+
+                omega1 = dynamical->eval_phonon[ik][is_begin + ib];
+
+                if (integration->ismear == 0) {
+                    ret_tmp += omega1 * delta_lorentz(omega - omega1, epsilon) * prod[snum][ib][ik];
+                } else {
+                    ret_tmp += omega1 * delta_gauss(omega - omega1, epsilon) * prod[snum][ib][ik];
+                }
             }
         }
-    }
 
-    ret *= pi * omega * 0.25 / static_cast<double>(nk);
+        ret[snum] += ret_tmp * pi * omega * 0.25 / static_cast<double>(nk);
+    }
 }
 
 
 void Isotope::calc_isotope_selfenergy_tetra(const int knum,
-                                            const int snum,
-                                            const double omega,
-                                            double &ret)
+                                            const int is_begin,
+                                            const int nbranch,
+                                            double ***prod,
+                                            double *ret)
 {
-    // Compute phonon selfenergy of phonon (knum, snum) 
-    // due to phonon-isotope scatterings.
+    // Add the contributions of the branches is_begin, ..., is_begin + nbranch - 1
+    // to the phonon selfenergies of phonons (knum, snum) for all snum
+    // due to phonon-isotope scatterings from the overlaps prod.
     // This version employs the tetrahedron method.
 
-    int iat, icrd;
-    int ik, is;
-    double prod;
-    std::complex<double> dprod;
+    int ik, ib, snum;
     int nk = kpoint->nk;
     int ns = dynamical->neval;
-    int natmin = system->natmin;
-
-    ret = 0.0;
 
     double **eval;
-    double **weight;
 
-    memory->allocate(eval, ns, nk);
-    memory->allocate(weight, ns, nk);
+    memory->allocate(eval, nbranch, nk);
 
     for (ik = 0; ik < nk; ++ik) {
-        for (is = 0; is < ns; ++is) {
-            eval[is][ik] = dynamical->eval_phonon[ik][is];
+        for (ib = 0; ib < nbranch; ++ib) {
+            eval[ib][ik] = dynamical->eval_phonon[ik][is_begin + ib];
         }
     }
 
-    for (ik = 0; ik < nk; ++ik) {
-        for (is = 0; is < ns; ++is) {
+#ifdef _OPENMP
+#pragma omp parallel private(ik, ib)
+#endif
+    {
+        double omega, ret_tmp;
+        double *weight;
 
-            prod = 0.0;
+        memory->allocate(weight, nk);
 
-            for (iat = 0; iat < natmin; ++iat) {
+#ifdef _OPENMP
+#pragma omp for
+#endif
+        for (snum = 0; snum < ns; ++snum) {
 
-                dprod = std::complex<double>(0.0, 0.0);
-                for (icrd = 0; icrd < 3; ++icrd) {
-                    dprod += std::conj(dynamical->evec_phonon[ik][is][3 * iat + icrd])
-                        * dynamical->evec_phonon[knum][snum][3 * iat + icrd];
+            omega = dynamical->eval_phonon[knum][snum];
+
+            for (ib = 0; ib < nbranch; ++ib) {
+                for (ik = 0; ik < nk; ++ik) {
+                    weight[ik] = prod[snum][ib][ik] * eval[ib][ik];
                 }
-                prod += isotope_factor[system->kd[system->map_p2s[iat][0]]] * std::norm(dprod);
+                integration->integrate_tetrahedron_multi(eval[ib], weight, 1, &omega, &ret_tmp);
+                ret[snum] += ret_tmp * pi * omega * 0.25;
             }
-            weight[is][ik] = prod * eval[is][ik];
         }
-    }
 
-    for (is = 0; is < ns; ++is) {
-        ret += integration->do_tetrahedron(eval[is], weight[is], omega);
+        memory->deallocate(weight);
     }
 
-    ret *= pi * omega * 0.25;
+    memory->deallocate(eval);
 }
 
 
 void Isotope::calc_isotope_selfenergy_all()
 {
     int i, j;
+    int is_begin, nbranch;
     int nk = kpoint->nk;
     int ns = dynamical->neval;
-    int nks = kpoint->nk_irred * ns;
-    int knum, snum;
-    double tmp, omega;
+    int nk_irred = kpoint->nk_irred;
+    int nks = nk_irred * ns;
+    int knum;
     double *gamma_tmp, *gamma_loc;
+    double ***prod;
 
     if (include_isotope) {
 
@@ -213,27 +281,41 @@ void Isotope::calc_isotope_selfenergy_all()
             std::cout << " Calculating self-energies from isotope scatterings ... ";
         }
 
+        // The overlaps are computed for blocks of nbranch_block scattered
+        // branches so that at most 2^25 doubles (256 MB) of them are kept.
+
+        const int nbranch_block = std::max(1, std::min(ns, static_cast<int>(
+                                               (1UL << 25) / (static_cast<unsigned long>(ns) * nk))));
+
         memory->allocate(gamma_tmp, nks);
         memory->allocate(gamma_loc, nks);
+        memory->allocate(prod, ns, nbranch_block, nk);
 
         for (i = 0; i < nks; ++i) gamma_loc[i] = 0.0;
 
-        for (i = mympi->my_rank; i < nks; i += mympi->nprocs) {
-            knum = kpoint->kpoint_irred_all[i / ns][0].knum;
-            snum = i % ns;
-            omega = dynamical->eval_phonon[knum][snum];
-            if (integration->ismear == -1) {
-                calc_isotope_selfenergy_tetra(knum, snum, omega, tmp);
-            } else {
-                calc_isotope_selfenergy(knum, snum, omega, tmp);
+        // The overlaps of the eigenvectors at an irreducible k point are
+        // computed once and shared by all the branches at that point.
+
+        for (i = mympi->my_rank; i < nk_irred; i += mympi->nprocs) {
+            knum = kpoint->kpoint_irred_all[i][0].knum;
+
+            for (is_begin = 0; is_begin < ns; is_begin += nbranch_block) {
+                nbranch = std::min(nbranch_block, ns - is_begin);
+
+                calc_isotope_overlap(knum, is_begin, nbranch, prod);
+
+                if (integration->ismear == -1) {
+                    calc_isotope_selfenergy_tetra(knum, is_begin, nbranch, prod, &gamma_loc[ns * i]);
+                } else {
+                    calc_isotope_selfenergy(knum, is_begin, nbranch, prod, &gamma_loc[ns * i]);
+                }
             }
-            gamma_loc[i] = tmp;
         }
 
         MPI_Reduce(&gamma_loc[0], &gamma_tmp[0], nks,
                    MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
 
-        for (i = 0; i < kpoint->nk_irred; ++i) {
+        for (i = 0; i < nk_irred; ++i) {
             for (j = 0; j < ns; ++j) {
                 gamma_isotope[i][j] = gamma_tmp[ns * i + j];
             }
@@ -241,6 +323,7 @@ void Isotope::calc_isotope_selfenergy_all()
 
         memory->deallocate(gamma_tmp);
         memory->deallocate(gamma_loc);
+        memory->deallocate(prod);
 
         if (mympi->my_rank == 0) {
             std::cout << "done!" << std::endl;
@@ -32,15 +32,22 @@ namespace PHON_NS
         void set_default_variables();
         void deallocate_variables();
 
+        void calc_isotope_overlap(int,
+                                  int,
+                                  int,
+                                  double ***);
+
         void calc_isotope_selfenergy(int,
                                      int,
-                                     double,
-                                     double &);
+                                     int,
+                                     double ***,
+                                     double *);
 
         void calc_isotope_selfenergy_tetra(int,
                                            int,
-                                           double,
-                                           double &);
+                                           int,
+                                           double ***,
+                                           double *);
 
         void set_isotope_factor_from_database(const int,
                                               const std::string *,
@@ -21,6 +21,7 @@ or http://opensource.org/licenses/mit-license.php for information.
 #include <cmath>
 #include <set>
 #include <map>
+#include <algorithm>
 #include "parsephon.h"
 #include "mathfunctions.h"
 
@@ -50,6 +51,7 @@ void Kpoint::set_default_variables()
     kp_planes = nullptr;
     kp_planes_tri = nullptr;
     small_group_of_k = nullptr;
+    knum_sym_table = nullptr;
 }
 
 
@@ -76,6 +78,9 @@ void Kpoint::deallocate_variables()
     if (small_group_of_k) {
         memory->deallocate(small_group_of_k);
     }
+    if (knum_sym_table) {
+        memory->deallocate(knum_sym_table);
+    }
 }
 
 
@@ -203,7 +208,9 @@ void Kpoint::kpoint_setups(const std::string mode)
                 kmap_to_irreducible.insert(std::map<int, int>::value_type(kpoint_irred_all[i][j].knum, i));
             }
         }
-        // Compute small group of every irreducible k points for later use
+        // Tabulate the action of the symmetry operations on the mesh and
+        // compute small group of every irreducible k points for later use
+        setup_knum_sym_table();
         memory->allocate(small_group_of_k, nk_irred);
         calc_small_groups_k_irred(small_group_of_k);
 
@@ -1127,6 +1134,8 @@ int Kpoint::knum_sym(const int ik_in,
         error->exit("knum_sym", "Invalid symop_num");
     }
 
+    if (knum_sym_table) return knum_sym_table[symop_num][ik_in];
+
     for (i = 0; i < 3; ++i) {
         for (j = 0; j < 3; ++j) {
             srot[i][j] = static_cast<double>(symmetry->SymmList[symop_num].rot[i][j]);
@@ -1146,6 +1155,62 @@ int Kpoint::knum_sym(const int ik_in,
     return get_knum(xk_sym[0], xk_sym[1], xk_sym[2]);
 }
 
+int Kpoint::knum_sum(const int ik1,
+                     const int ik2,
+                     const int sign1,
+                     const int sign2) const
+{
+    // Returns kpoint index of sign1 * xk[ik1] + sign2 * xk[ik2]
+    // using the integer coordinates of the gamma-centered mesh.
+
+    const int n1 = nkx;
+    const int n2 = nky;
+    const int n3 = nkz;
+
+    const int ix = (sign1 * (ik1 / (n2 * n3)) + sign2 * (ik2 / (n2 * n3))) % n1;
+    const int iy = (sign1 * ((ik1 / n3) % n2) + sign2 * ((ik2 / n3) % n2)) % n2;
+    const int iz = (sign1 * (ik1 % n3) + sign2 * (ik2 % n3)) % n3;
+
+    return (iz + n3) % n3 + n3 * ((iy + n2) % n2) + n2 * n3 * ((ix + n1) % n1);
+}
+
+void Kpoint::setup_knum_sym_table()
+{
+    // Tabulate knum_sym for all symmetry operations and k points
+    // so that the later calls become a table lookup.
+
+    const int nsym = symmetry->nsym;
+
+    memory->allocate(knum_sym_table, nsym, nk);
+
+    for (auto isym = 0; isym < nsym; ++isym) {
+
+        double srot[3][3], srot_inv[3][3], srot_inv_t[3][3];
+
+        for (auto i = 0; i < 3; ++i) {
+            for (auto j = 0; j < 3; ++j) {
+                srot[i][j] = static_cast<double>(symmetry->SymmList[isym].rot[i][j]);
+            }
+        }
+
+        invmat3(srot_inv, srot);
+        transpose3(srot_inv_t, srot_inv);
+
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+        for (int ik = 0; ik < nk; ++ik) {
+            double xk_orig[3], xk_sym[3];
+
+            for (auto i = 0; i < 3; ++i) xk_orig[i] = xk[ik][i];
+            rotvec(xk_sym, xk_orig, srot_inv_t);
+            for (auto i = 0; i < 3; ++i) xk_sym[i] = xk_sym[i] - nint(xk_sym[i]);
+
+            knum_sym_table[isym][ik] = get_knum(xk_sym[0], xk_sym[1], xk_sym[2]);
+        }
+    }
+}
+
 void Kpoint::get_commensurate_kpoints(const double lavec_super[3][3],
                                       const double lavec_prim[3][3],
                                       std::vector<std::vector<double>> &klist)
@@ -1271,70 +1336,123 @@ void Kpoint::get_unique_triplet_k(const int ik,
     // When sign = -1 (default), pairs satisfying - k1 + k2 + k3 = G are returned.
     // When sign =  1, pairs satisfying k1 + k2 + k3 = G are returned.
     //
+    // With the triplet symmetry, the first k2 of each group is taken from
+    // a cache built once for each irreducible k point, and the members
+    // of the group are generated by the small group of k.
 
-    int i, ik1, ik2, isym;
-    int num_group_k, tmp;
+    int ik1, ik2;
     int ks_in[2];
-    int knum = kpoint_irred_all[ik][0].knum;
-    bool *flag_found;
+    const int knum = kpoint_irred_all[ik][0].knum;
     std::vector<KsList> kslist;
-    double xk[3], xk1[3], xk2[3];
-
-    memory->allocate(flag_found, nk);
 
-    if (use_triplet_symmetry) {
-        num_group_k = small_group_of_k[ik].size();
-    } else {
-        num_group_k = 1;
+    if (sign != -1 && sign != 1) {
+        error->exit("get_unituq_triplet_k", "Invalid sign");
     }
 
-    for (i = 0; i < 3; ++i) xk[i] = this->xk[knum][i];
-    for (i = 0; i < nk; ++i) flag_found[i] = false;
-
     triplet.clear();
 
-    for (ik1 = 0; ik1 < nk; ++ik1) {
+    if (!use_triplet_symmetry) {
+        const auto isym0 = small_group_of_k[ik][0];
+        for (ik1 = 0; ik1 < nk; ++ik1) {
+            ik2 = knum_sum(knum, ik1, -sign, -1);
+            if (ik1 > ik2 && use_permutation_symmetry) continue;
 
-        for (i = 0; i < 3; ++i) xk1[i] = this->xk[ik1][i];
+            kslist.clear();
+            ks_in[0] = knum_sym_table[isym0][ik1];
+            ks_in[1] = knum_sym_table[isym0][ik2];
+            kslist.emplace_back(2, ks_in, isym0);
 
-        if (sign == -1) {
-            for (i = 0; i < 3; ++i) xk2[i] = xk[i] - xk1[i];
-        } else if (sign == 1) {
-            for (i = 0; i < 3; ++i) xk2[i] = -xk[i] - xk1[i];
-        } else {
-            error->exit("get_unituq_triplet_k", "Invalid sign");
+            if (ks_in[0] != ks_in[1] && use_permutation_symmetry) {
+                std::swap(ks_in[0], ks_in[1]);
+                kslist.emplace_back(2, ks_in, isym0);
+            }
+            triplet.emplace_back(kslist);
         }
+        return;
+    }
 
-        ik2 = get_knum(xk2[0], xk2[1], xk2[2]);
+    const auto icache = 2 * static_cast<int>(use_permutation_symmetry) + (sign == 1);
 
-        kslist.clear();
+#ifdef _OPENMP
+#pragma omp critical (triplet_cache)
+#endif
+    {
+        if (triplet_rep_ready[icache].empty()) {
+            triplet_rep_k1[icache].resize(nk_irred);
+            triplet_rep_ready[icache].resize(nk_irred, 0);
+        }
+        if (!triplet_rep_ready[icache][ik]) {
+            find_triplet_representatives(ik, use_permutation_symmetry, sign,
+                                         triplet_rep_k1[icache][ik]);
+            triplet_rep_ready[icache][ik] = 1;
+        }
+    }
 
-        if (ik1 > ik2 && use_permutation_symmetry) continue;
+    const auto &symlist = small_group_of_k[ik];
+    std::vector<int> found;
+
+    triplet.reserve(triplet_rep_k1[icache][ik].size());
+
+    for (const auto k1_rep : triplet_rep_k1[icache][ik]) {
+
+        ik2 = knum_sum(knum, k1_rep, -sign, -1);
+
+        kslist.clear();
+        found.clear();
 
         // Add symmety-connected triplets to kslist
-        for (isym = 0; isym < num_group_k; ++isym) {
+        for (const auto isym : symlist) {
 
-            ks_in[0] = knum_sym(ik1, small_group_of_k[ik][isym]);
-            ks_in[1] = knum_sym(ik2, small_group_of_k[ik][isym]);
+            ks_in[0] = knum_sym_table[isym][k1_rep];
+            ks_in[1] = knum_sym_table[isym][ik2];
 
-            if (!flag_found[ks_in[0]]) {
-                kslist.emplace_back(2, ks_in, small_group_of_k[ik][isym]);
-                flag_found[ks_in[0]] = true;
+            if (std::find(found.begin(), found.end(), ks_in[0]) == found.end()) {
+                kslist.emplace_back(2, ks_in, isym);
+                found.push_back(ks_in[0]);
             }
 
-            if (ks_in[0] != ks_in[1] && use_permutation_symmetry && (!flag_found[ks_in[1]])) {
-                tmp = ks_in[0];
-                ks_in[0] = ks_in[1];
-                ks_in[1] = tmp;
-
-                kslist.emplace_back(2, ks_in, small_group_of_k[ik][isym]);
-                flag_found[ks_in[0]] = true;
+            if (ks_in[0] != ks_in[1] && use_permutation_symmetry
+                && std::find(found.begin(), found.end(), ks_in[1]) == found.end()) {
+                std::swap(ks_in[0], ks_in[1]);
+                kslist.emplace_back(2, ks_in, isym);
+                found.push_back(ks_in[0]);
             }
         }
-        if (!kslist.empty()) {
-            triplet.emplace_back(kslist);
+        triplet.emplace_back(kslist);
+    }
+}
+
+void Kpoint::find_triplet_representatives(const int ik,
+                                          const bool use_permutation_symmetry,
+                                          const int sign,
+                                          std::vector<int> &k1_rep)
+{
+    // The k points related to k1 by the small group of k (and to k2 when
+    // the permutation symmetry is used) form one group of triplets.
+    // The representative is the smallest k index in the group, which is the
+    // k1 at which the group is first found in the sequential search.
+    // The test is independent for each k1 and is done in parallel.
+
+    const int knum = kpoint_irred_all[ik][0].knum;
+    const auto &symlist = small_group_of_k[ik];
+    std::vector<char> is_rep(nk);
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (int ik1 = 0; ik1 < nk; ++ik1) {
+        const auto ik2 = knum_sum(knum, ik1, -sign, -1);
+        auto flag = !(use_permutation_symmetry && ik2 < ik1);
+
+        for (auto it = symlist.begin(); it != symlist.end() && flag; ++it) {
+            if (knum_sym_table[*it][ik1] < ik1) flag = false;
+            if (use_permutation_symmetry && knum_sym_table[*it][ik2] < ik1) flag = false;
         }
+        is_rep[ik1] = flag;
     }
 
-    memory->deallocate(flag_found);
+    k1_rep.clear();
+    for (auto ik1 = 0; ik1 < nk; ++ik1) {
+        if (is_rep[ik1]) k1_rep.push_back(ik1);
+    }
 }
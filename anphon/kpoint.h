@@ -199,6 +199,11 @@ namespace PHON_NS
         int knum_sym(int,
                      int);
 
+        int knum_sum(int,
+                     int,
+                     int,
+                     int) const;
+
         void get_commensurate_kpoints(const double [3][3],
                                       const double [3][3],
                                       std::vector<std::vector<double>> &);
@@ -210,9 +215,25 @@ namespace PHON_NS
                                   const int sign = -1);
 
     private:
+        // knum_sym_table[isym][ik] = index of S(isym) * xk[ik] on the mesh
+        int **knum_sym_table;
+
+        // Representative k1 of each unique triplet group at irreducible
+        // k points, filled on the first request. The index of the arrays is
+        // 2 * use_permutation_symmetry + (sign == 1).
+        std::vector<std::vector<int>> triplet_rep_k1[4];
+        std::vector<char> triplet_rep_ready[4];
+
         void set_default_variables();
         void deallocate_variables();
 
+        void setup_knum_sym_table();
+
+        void find_triplet_representatives(int,
+                                          bool,
+                                          int,
+                                          std::vector<int> &);
+
         void setup_kpoint_given(const std::vector<KpointInp> &,
                                 unsigned int &,
                                 double **&,
@@ -258,6 +258,8 @@ void ModeAnalysis::run_mode_analysis()
 
     double epsilon = integration->epsilon;
 
+    anharmonic_core->setup_v3store();
+
     if (calc_fstate_k) {
 
         // Momentum-resolved final state amplitude
@@ -785,7 +787,6 @@ void ModeAnalysis::calc_frequency_resolved_final_state_tetrahedron(const unsigne
     double omega_inner[2];
     double n1, n2;
     double f1, f2;
-    double xk_tmp[3];
     double v3_tmp;
     int nk = kpoint->nk;
     int ns = dynamical->neval;
@@ -828,7 +829,7 @@ void ModeAnalysis::calc_frequency_resolved_final_state_tetrahedron(const unsigne
 
 
 #ifdef _OPENMP
-#pragma omp parallel private(is, js, k1, k2, xk_tmp, energy_tmp, i, weight_tetra, ik, jk, arr)
+#pragma omp parallel private(is, js, k1, k2, energy_tmp, i, weight_tetra, ik, jk, arr)
 #endif
     {
         memory->allocate(energy_tmp, 3, nk);
@@ -844,9 +845,7 @@ void ModeAnalysis::calc_frequency_resolved_final_state_tetrahedron(const unsigne
             for (k1 = 0; k1 < nk; ++k1) {
                 // Prepare two-phonon frequency for the tetrahedron method
 
-                for (i = 0; i < 3; ++i) xk_tmp[i] = kpoint->xk[knum][i] - kpoint->xk[k1][i];
-
-                k2 = kpoint->get_knum(xk_tmp[0], xk_tmp[1], xk_tmp[2]);
+                k2 = kpoint->knum_sum(knum, k1, 1, -1);
 
                 energy_tmp[0][k1] = dynamical->eval_phonon[k1][is] + dynamical->eval_phonon[k2][js];
                 energy_tmp[1][k1] = dynamical->eval_phonon[k1][is] - dynamical->eval_phonon[k2][js];
@@ -1674,16 +1673,14 @@ void ModeAnalysis::calc_V3norm2(const unsigned int ik_in,
                                 double **ret)
 {
     int ib;
-    unsigned int ik;
-    unsigned int is, js;
     unsigned int k1, k2;
-    unsigned int arr[3];
     unsigned int knum, knum_minus;
     int ns = dynamical->neval;
 
     int ns2 = ns * ns;
 
     double factor = std::pow(0.5, 3) * std::pow(Hz_to_kayser / time_ry, 2);
+    double *v3norm_block;
     std::vector<KsListGroup> triplet;
 
     knum = kpoint->kpoint_irred_all[ik_in][0].knum;
@@ -1693,23 +1690,33 @@ void ModeAnalysis::calc_V3norm2(const unsigned int ik_in,
                                  anharmonic_core->use_triplet_symmetry,
                                  true,
                                  triplet);
+
+    const int npair_uniq = triplet.size();
+
 #ifdef _OPENMP
-#pragma omp parallel for private(is, js, ik, k1, k2, arr)
+#pragma omp parallel private(ib, k1, k2, v3norm_block)
 #endif
-    for (ib = 0; ib < ns2; ++ib) {
-        is = ib / ns;
-        js = ib % ns;
+    {
+        memory->allocate(v3norm_block, ns2);
 
-        for (ik = 0; ik < triplet.size(); ++ik) {
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+        for (int ik = 0; ik < npair_uniq; ++ik) {
             k1 = triplet[ik].group[0].ks[0];
             k2 = triplet[ik].group[0].ks[1];
 
-            arr[0] = ns * knum_minus + snum;
-            arr[1] = ns * k1 + is;
-            arr[2] = ns * k2 + js;
+            anharmonic_core->calc_V3norm2_block(ns * knum_minus + snum, k1, k2,
+                                                dynamical->eval_phonon,
+                                                dynamical->evec_phonon,
+                                                v3norm_block);
 
-            ret[ik][ib] = std::norm(anharmonic_core->V3(arr)) * factor;
+            for (ib = 0; ib < ns2; ++ib) {
+                ret[ik][ib] = v3norm_block[ib] * factor;
+            }
         }
+
+        memory->deallocate(v3norm_block);
     }
 }
 
@@ -1870,7 +1877,7 @@ void ModeAnalysis::print_spectral_function(const int NT,
     double Omega_min = dos->emin;
     double Omega_max = dos->emax;
     double delta_omega = dos->delta_e;
-    double T_now, omega2[2];
+    double T_now;
     double omega;
 
     int nomega = static_cast<unsigned int>((Omega_max - Omega_min) / delta_omega) + 1;
@@ -1937,16 +1944,7 @@ void ModeAnalysis::print_spectral_function(const int NT,
                                                          self3_imag[iT]);
 
             // Calculate real part of the self-energy by Kramers-Kronig relation
-            for (iomega = 0; iomega < nomega; ++iomega) {
-                double self_tmp = 0.0;
-                omega2[0] = omega_array[iomega] * omega_array[iomega];
-                for (int jomega = 0; jomega < nomega; ++jomega) {
-                    if (jomega == iomega) continue;
-                    omega2[1] = omega_array[jomega] * omega_array[jomega];
-                    self_tmp += omega_array[jomega] * self3_imag[iT][jomega] / (omega2[1] - omega2[0]);
-                }
-                self3_real[iT][iomega] = 2.0 * delta_omega * time_ry * self_tmp / (pi * Hz_to_kayser);
-            }
+            selfenergy->kramers_kronig(nomega, omega_array, self3_imag[iT], self3_real[iT]);
 
             if (mympi->my_rank == 0) {
                 for (iomega = 0; iomega < nomega; ++iomega) {
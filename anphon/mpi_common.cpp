@@ -9,8 +9,11 @@
 */
 
 #include "mpi_common.h"
+#include <algorithm>
+#include <climits>
 #include <string>
 #include <cstring>
+#include <vector>
 
 using namespace PHON_NS;
 
@@ -37,3 +40,62 @@ void MyMPI::MPI_Bcast_string(std::string &str,
     MPI_Bcast(&ctmp, len + 1, MPI_CHAR, 0, comm);
     str = std::string(ctmp);
 }
+
+void MyMPI::get_block_range(const unsigned int n,
+                            unsigned int &begin,
+                            unsigned int &end) const
+{
+    // Range [begin, end) of the items 0, ..., n - 1 assigned to this process
+    // when they are divided into nprocs contiguous blocks.
+
+    begin = static_cast<unsigned long long>(n) * my_rank / nprocs;
+    end = static_cast<unsigned long long>(n) * (my_rank + 1) / nprocs;
+}
+
+void MyMPI::MPI_Allgather_blocks(void *buf,
+                                 const unsigned int n,
+                                 const int count_per_item,
+                                 MPI_Datatype type) const
+{
+    // buf holds n items of count_per_item elements of the given type.
+    // Each process provides the items in its get_block_range() and
+    // receives all the others in place.
+    // Counts are given in units of items to avoid the int overflow
+    // for large arrays.
+
+    MPI_Datatype type_item;
+    std::vector<int> counts(nprocs), displs(nprocs);
+
+    for (auto i = 0; i < nprocs; ++i) {
+        displs[i] = static_cast<unsigned long long>(n) * i / nprocs;
+        counts[i] = static_cast<unsigned long long>(n) * (i + 1) / nprocs - displs[i];
+    }
+
+    MPI_Type_contiguous(count_per_item, type, &type_item);
+    MPI_Type_commit(&type_item);
+    MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL,
+                   buf, &counts[0], &displs[0], type_item, MPI_COMM_WORLD);
+    MPI_Type_free(&type_item);
+}
+
+void MyMPI::MPI_Allreduce_inplace(void *buf,
+                                  const size_t count,
+                                  MPI_Datatype type,
+                                  MPI_Op op) const
+{
+    // In-place MPI_Allreduce of count elements of the given type.
+    // The array is reduced in chunks so that neither the element count
+    // nor the byte count of each call exceeds INT_MAX.
+
+    int size_type;
+    MPI_Type_size(type, &size_type);
+
+    const size_t nchunk = INT_MAX / size_type;
+    auto ptr = static_cast<char *>(buf);
+
+    for (size_t offset = 0; offset < count; offset += nchunk) {
+        const int n = std::min(count - offset, nchunk);
+        MPI_Allreduce(MPI_IN_PLACE, ptr + offset * size_type, n,
+                      type, op, MPI_COMM_WORLD);
+    }
+}
@@ -33,6 +33,20 @@ namespace PHON_NS
                               int,
                               MPI_Comm);
 
+        void get_block_range(unsigned int,
+                             unsigned int &,
+                             unsigned int &) const;
+
+        void MPI_Allgather_blocks(void *,
+                                  unsigned int,
+                                  int,
+                                  MPI_Datatype) const;
+
+        void MPI_Allreduce_inplace(void *,
+                                   size_t,
+                                   MPI_Datatype,
+                                   MPI_Op) const;
+
         int my_rank;
         int nprocs;
     };
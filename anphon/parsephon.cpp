@@ -25,6 +25,7 @@
 #include "anharmonic_core.h"
 #include "mode_analysis.h"
 #include "scph.h"
+#include "selfenergy.h"
 #include "symmetry_core.h"
 #include "system.h"
 #include "thermodynamics.h"
@@ -111,7 +112,8 @@ void Input::parse_general_vars()
         "PREFIX", "MODE", "NSYM", "TOLERANCE", "PRINTSYM", "FCSXML", "FC2XML",
         "TMIN", "TMAX", "DT", "NBANDS", "NONANALYTIC", "BORNINFO", "NA_SIGMA",
         "ISMEAR", "EPSILON", "EMIN", "EMAX", "DELTA_E", "RESTART", "TREVSYM",
-        "NKD", "KD", "MASS", "TRISYM", "PREC_EWALD", "CLASSICAL", "BCONNECT", "BORNSYM"
+        "NKD", "KD", "MASS", "TRISYM", "PREC_EWALD", "CLASSICAL", "BCONNECT", "BORNSYM",
+        "DELTA_CUTOFF", "DIAG_IRRED"
     };
 
     std::vector<std::string> no_defaults{"PREFIX", "MODE", "FCSXML", "NKD", "KD"};
@@ -192,6 +194,7 @@ void Input::parse_general_vars()
     bool classical = false;
     unsigned int band_connection = 0;
     unsigned int bornsym = 0;
+    auto diag_irred = false;
 
     double prec_ewald = 1.0e-12;
 
@@ -205,6 +208,7 @@ void Input::parse_general_vars()
 
     int ismear = -1;
     double epsilon = 10.0;
+    double delta_cutoff = 0.0;
     double na_sigma = 0.1;
 
     // Assign given values
@@ -231,16 +235,23 @@ void Input::parse_general_vars()
 
     assign_val(ismear, "ISMEAR", general_var_dict);
     assign_val(epsilon, "EPSILON", general_var_dict);
+    assign_val(delta_cutoff, "DELTA_CUTOFF", general_var_dict);
     assign_val(na_sigma, "NA_SIGMA", general_var_dict);
     assign_val(classical, "CLASSICAL", general_var_dict);
     assign_val(band_connection, "BCONNECT", general_var_dict);
     assign_val(use_triplet_symmetry, "TRISYM", general_var_dict);
     assign_val(bornsym, "BORNSYM", general_var_dict);
+    assign_val(diag_irred, "DIAG_IRRED", general_var_dict);
 
     if (band_connection > 2) {
         error->exit("parse_general_vars", "BCONNECT-tag can take 0, 1, or 2.");
     }
 
+    if (delta_cutoff < 0.0 || delta_cutoff >= 1.0) {
+        error->exit("parse_general_vars",
+                    "DELTA_CUTOFF should be a small non-negative value.");
+    }
+
     if (nonanalytic == 3) {
         assign_val(prec_ewald, "PREC_EWALD", general_var_dict);
         if (prec_ewald <= 0.0 || prec_ewald >= 1.0) {
@@ -312,7 +323,9 @@ void Input::parse_general_vars()
     writes->nbands = nbands;
     dynamical->file_born = borninfo;
     dynamical->band_connection = band_connection;
+    dynamical->diag_irreducible = diag_irred;
     integration->epsilon = epsilon;
+    integration->delta_cutoff = delta_cutoff;
     fcs_phonon->file_fcs = fcsinfo;
     fcs_phonon->file_fc2 = fc2info;
     fcs_phonon->update_fc2 = !fc2info.empty();
@@ -334,7 +347,8 @@ void Input::parse_scph_vars()
     std::vector<std::string> input_list{
         "KMESH_SCPH", "KMESH_INTERPOLATE", "MIXALPHA", "MAXITER",
         "RESTART_SCPH", "IALGO", "SELF_OFFDIAG", "TOL_SCPH",
-        "LOWER_TEMP", "WARMSTART"
+        "LOWER_TEMP", "WARMSTART", "NCHAIN", "MIXTYPE", "MIXHIST",
+        "DISTRIBUTE_V4", "V4STORE"
     };
     std::vector<std::string> no_defaults{"KMESH_SCPH", "KMESH_INTERPOLATE"};
     std::vector<int> kmesh_v, kmesh_interpolate_v;
@@ -363,10 +377,15 @@ void Input::parse_scph_vars()
     double tolerance_scph = 1.0e-10;
     unsigned int maxiter = 1000;
     double mixalpha = 0.1;
+    unsigned int mixtype = 0;
+    unsigned int mixhist = 5;
     bool selenergy_offdiagonal = true;
     unsigned int ialgo_scph = 0;
     bool lower_temp = true;
     bool warm_start = true;
+    unsigned int nchain = 1;
+    bool distribute_v4 = false;
+    int v4_store = 0;
 
     // if file_dymat exists in the current directory, 
     // restart mode will be automatically turned on for SCPH calculations.
@@ -378,11 +397,29 @@ void Input::parse_scph_vars()
     assign_val(restart_scph, "RESTART_SCPH", scph_var_dict);
     assign_val(maxiter, "MAXITER", scph_var_dict);
     assign_val(mixalpha, "MIXALPHA", scph_var_dict);
+    assign_val(mixtype, "MIXTYPE", scph_var_dict);
+    assign_val(mixhist, "MIXHIST", scph_var_dict);
     assign_val(selenergy_offdiagonal, "SELF_OFFDIAG", scph_var_dict);
     assign_val(ialgo_scph, "IALGO", scph_var_dict);
     assign_val(tolerance_scph, "TOL_SCPH", scph_var_dict);
     assign_val(lower_temp, "LOWER_TEMP", scph_var_dict);
     assign_val(warm_start, "WARMSTART", scph_var_dict);
+    assign_val(nchain, "NCHAIN", scph_var_dict);
+    assign_val(distribute_v4, "DISTRIBUTE_V4", scph_var_dict);
+    assign_val(v4_store, "V4STORE", scph_var_dict);
+
+    if (nchain == 0) {
+        error->exit("parse_scph_vars", "NCHAIN must be a positive integer.");
+    }
+    if (mixtype > 1) {
+        error->exit("parse_scph_vars", "MIXTYPE must be 0 or 1.");
+    }
+    if (v4_store < 0 || v4_store > 1) {
+        error->exit("parse_scph_vars", "V4STORE must be 0 or 1.");
+    }
+    if (mixhist == 0) {
+        error->exit("parse_scph_vars", "MIXHIST must be a positive integer.");
+    }
 
     str_tmp = scph_var_dict["KMESH_SCPH"];
 
@@ -438,6 +475,8 @@ void Input::parse_scph_vars()
         scph->kmesh_interpolate[i] = kmesh_interpolate_v[i];
     }
     scph->mixalpha = mixalpha;
+    scph->mixtype = mixtype;
+    scph->mixhist = mixhist;
     scph->maxiter = maxiter;
     scph->restart_scph = restart_scph;
     scph->selfenergy_offdiagonal = selenergy_offdiagonal;
@@ -445,6 +484,9 @@ void Input::parse_scph_vars()
     scph->tolerance_scph = tolerance_scph;
     scph->lower_temp = lower_temp;
     scph->warmstart_scph = warm_start;
+    scph->nchain_scph = nchain;
+    scph->distribute_v4 = distribute_v4;
+    scph->v4_store = v4_store;
 
     kmesh_v.clear();
     kmesh_interpolate_v.clear();
@@ -464,7 +506,7 @@ void Input::parse_analysis_vars(const bool use_default_values)
         "FSTATE_W", "FSTATE_K", "PRIMTMSD", "DOS", "PDOS", "TDOS",
         "GRUNEISEN", "NEWFCS", "DELTA_A", "ANIME", "ANIME_CELLSIZE",
         "ANIME_FORMAT", "SPS", "PRINTV3", "PRINTPR", "FC2_EWALD",
-        "KAPPA_SPEC", "SELF_W", "FE_BUBBLE"
+        "KAPPA_SPEC", "SELF_W", "KK_FFT", "FE_BUBBLE", "RTA_UNIT", "RTA_CKPT", "V3STORE", "RTA_KERNEL"
     };
 
     unsigned int cellsize[3];
@@ -500,8 +542,13 @@ void Input::parse_analysis_vars(const bool use_default_values)
     bool fstate_omega = false;
     bool fstate_k = false;
     bool bubble_omega = false;
+    bool kk_fft = true;
 
     int calculate_kappa_spec = 0;
+    int rta_unit = 0;
+    int rta_checkpoint = 0;
+    int rta_kernel = 0;
+    int v3_store = 0;
 
     bool print_fc2_ewald = false;
     bool print_self_consistent_fc2 = false;
@@ -532,7 +579,12 @@ void Input::parse_analysis_vars(const bool use_default_values)
         assign_val(fstate_k, "FSTATE_K", analysis_var_dict);
         assign_val(ks_input, "KS_INPUT", analysis_var_dict);
         assign_val(calculate_kappa_spec, "KAPPA_SPEC", analysis_var_dict);
+        assign_val(rta_unit, "RTA_UNIT", analysis_var_dict);
+        assign_val(rta_checkpoint, "RTA_CKPT", analysis_var_dict);
+        assign_val(rta_kernel, "RTA_KERNEL", analysis_var_dict);
+        assign_val(v3_store, "V3STORE", analysis_var_dict);
         assign_val(bubble_omega, "SELF_W", analysis_var_dict);
+        assign_val(kk_fft, "KK_FFT", analysis_var_dict);
 
         assign_val(print_xsf, "PRINTXSF", analysis_var_dict);
         assign_val(print_V3, "PRINTV3", analysis_var_dict);
@@ -630,7 +682,11 @@ void Input::parse_analysis_vars(const bool use_default_values)
     dos->scattering_phase_space = scattering_phase_space;
 
     conductivity->calc_kappa_spec = calculate_kappa_spec;
+    conductivity->rta_unit = rta_unit;
+    conductivity->rta_checkpoint = rta_checkpoint;
+    conductivity->rta_kernel = rta_kernel;
     anharmonic_core->quartic_mode = quartic_mode;
+    anharmonic_core->v3_store = v3_store;
 
     mode_analysis->ks_input = ks_input;
     mode_analysis->calc_realpart = calc_realpart;
@@ -638,6 +694,7 @@ void Input::parse_analysis_vars(const bool use_default_values)
     mode_analysis->calc_fstate_k = fstate_k;
     mode_analysis->print_V3 = print_V3;
     mode_analysis->spectral_func = bubble_omega;
+    selfenergy->kk_fft = kk_fft;
     isotope->include_isotope = include_isotope;
 
     gruneisen->print_gruneisen = print_gruneisen;
@@ -172,7 +172,7 @@ void Dos::calc_dos_all()
     }
 
     if (compute_dos) {
-        calc_dos(nk_irreducible, kmap_irreducible, eval, n_energy, energy_dos,
+        calc_dos(nk_irreducible, eval, n_energy, energy_dos,
                  dos_phonon, neval, integration->ismear, kpoint->kpoint_irred_all);
     }
 
@@ -198,7 +198,6 @@ void Dos::calc_dos_all()
 }
 
 void Dos::calc_dos(const unsigned int nk_irreducible,
-                   int *map_k,
                    double **eval,
                    const unsigned int n,
                    double *energy,
@@ -211,6 +210,31 @@ void Dos::calc_dos(const unsigned int nk_irreducible,
     double *weight;
 
     if (mympi->my_rank == 0) std::cout << " Calculating phonon DOS ...";
+
+    if (smearing_method == -1) {
+
+        // The tetrahedron weights for all energies are obtained in one sweep
+        // for each band. The bands are summed in a fixed order afterwards.
+        double **dos_band;
+
+        memory->allocate(dos_band, neval, n);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+        for (k = 0; k < neval; ++k) {
+            integration->integrate_tetrahedron_multi(eval[k], nullptr, n, energy, dos_band[k]);
+        }
+
+        for (i = 0; i < n; ++i) {
+            ret[i] = 0.0;
+            for (k = 0; k < neval; ++k) ret[i] += dos_band[k][i];
+        }
+        memory->deallocate(dos_band);
+
+        if (mympi->my_rank == 0) std::cout << " done." << std::endl;
+        return;
+    }
+
 #ifdef _OPENMP
 #pragma omp parallel private (weight, k)
 #endif
@@ -224,13 +248,8 @@ void Dos::calc_dos(const unsigned int nk_irreducible,
             ret[i] = 0.0;
 
             for (k = 0; k < neval; ++k) {
-                if (smearing_method == -1) {
-                    integration->calc_weight_tetrahedron(nk_irreducible, map_k,
-                                                         weight, eval[k], energy[i]);
-                } else {
-                    integration->calc_weight_smearing(kpinfo, weight,
-                                                      eval[k], energy[i], smearing_method);
-                }
+                integration->calc_weight_smearing(kpinfo, weight,
+                                                  eval[k], energy[i], smearing_method);
 
                 for (j = 0; j < nk_irreducible; ++j) {
                     ret[i] += weight[j];
@@ -282,6 +301,25 @@ void Dos::calc_atom_projected_dos(const unsigned int nk,
                 }
             }
         }
+        if (smearing_method == -1) {
+            double **pdos_band;
+
+            memory->allocate(pdos_band, neval, n);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+            for (k = 0; k < neval; ++k) {
+                integration->integrate_tetrahedron_multi(eval[k], proj[k], n, energy, pdos_band[k]);
+            }
+
+            for (i = 0; i < n; ++i) {
+                ret[iat][i] = 0.0;
+                for (k = 0; k < neval; ++k) ret[iat][i] += pdos_band[k][i];
+            }
+            memory->deallocate(pdos_band);
+            continue;
+        }
+
 #ifdef _OPENMP
 #pragma omp parallel private (weight, k, j)
 #endif
@@ -294,14 +332,9 @@ void Dos::calc_atom_projected_dos(const unsigned int nk,
                 ret[iat][i] = 0.0;
 
                 for (k = 0; k < neval; ++k) {
-                    if (smearing_method == -1) {
-                        integration->calc_weight_tetrahedron(nk, kmap_identity,
-                                                             weight, eval[k], energy[i]);
-                    } else {
-                        integration->calc_weight_smearing(nk, nk, kmap_identity,
-                                                          weight, eval[k], energy[i],
-                                                          smearing_method);
-                    }
+                    integration->calc_weight_smearing(nk, nk, kmap_identity,
+                                                      weight, eval[k], energy[i],
+                                                      smearing_method);
 
                     for (j = 0; j < nk; ++j) {
                         ret[iat][i] += proj[k][j] * weight[j];
@@ -326,26 +359,17 @@ void Dos::calc_two_phonon_dos(const unsigned int n,
                               const std::vector<std::vector<KpointList>> &kpinfo)
 {
     int i, j;
-    int is, js, ik, jk;
-    int k;
+    int ik, jk;
     int ib;
     int knum;
 
     unsigned int nk = kpoint->nk;
     unsigned int ns = dynamical->neval;
     unsigned int nk_reduced = kpoint->nk_irred;
+    unsigned int ik_begin, ik_end;
 
     int ns2 = ns * ns;
 
-    int *kmap_identity;
-
-    double **e_tmp;
-    double **weight;
-    double emax2 = 2.0 * emax;
-
-    double xk_tmp[3];
-
-    int loc;
     int *k_pair;
 
     if (mympi->my_rank == 0) {
@@ -353,84 +377,95 @@ void Dos::calc_two_phonon_dos(const unsigned int n,
         std::cout << "            This may take a while ... ";
     }
 
-    memory->allocate(kmap_identity, nk);
-    memory->allocate(e_tmp, 2, nk);
-    memory->allocate(weight, n, nk);
     memory->allocate(k_pair, nk);
 
+    // The irreducible k points are distributed over the MPI processes.
+    // For each band pair, the two-phonon energies are deposited into the
+    // energy grid in a single sweep over k (or the tetrahedra).
 
-    for (i = 0; i < nk; ++i) kmap_identity[i] = i;
+    mympi->get_block_range(nk_reduced, ik_begin, ik_end);
 
     for (ik = 0; ik < nk_reduced; ++ik) {
-
-        knum = kpinfo[ik][0].knum;
-
-        for (jk = 0; jk < nk; ++jk) {
-            for (i = 0; i < 3; ++i) xk_tmp[i] = kpoint->xk[knum][i] + kpoint->xk[jk][i];
-            k_pair[jk] = kpoint->get_knum(xk_tmp[0], xk_tmp[1], xk_tmp[2]);
-        }
-
         for (i = 0; i < n; ++i) {
-            for (j = 0; j < 2; ++j) {
+            for (j = 0; j < 4; ++j) {
                 ret[ik][i][j] = 0.0;
             }
         }
+    }
 
-        for (ib = 0; ib < ns2; ++ib) {
+    for (ik = ik_begin; ik < ik_end; ++ik) {
+
+        knum = kpinfo[ik][0].knum;
+
+        for (jk = 0; jk < nk; ++jk) {
+            k_pair[jk] = kpoint->knum_sum(knum, jk, 1, 1);
+        }
 
-            is = ib / ns;
-            js = ib % ns;
 #ifdef _OPENMP
-#pragma omp parallel for private(loc)
+#pragma omp parallel private(i, j, jk)
 #endif
-            for (jk = 0; jk < nk; ++jk) {
-                loc = k_pair[jk];
-                e_tmp[0][jk]
-                    = writes->in_kayser(dynamical->eval_phonon[jk][is]
-                        + dynamical->eval_phonon[loc][js]);
-                e_tmp[1][jk]
-                    = writes->in_kayser(dynamical->eval_phonon[jk][is]
-                        - dynamical->eval_phonon[loc][js]);
-            }
+        {
+            double **e_tmp, **dos_tmp, **dos_sum;
+            int is, js, loc;
 
+            memory->allocate(e_tmp, 2, nk);
+            memory->allocate(dos_tmp, 2, n);
+            memory->allocate(dos_sum, 2, n);
 
-            if (smearing_method == -1) {
+            for (j = 0; j < 2; ++j) {
+                for (i = 0; i < n; ++i) dos_sum[j][i] = 0.0;
+            }
 
-                for (j = 0; j < 2; ++j) {
 #ifdef _OPENMP
-#pragma omp parallel for private(k)
+#pragma omp for
 #endif
-                    for (i = 0; i < n; ++i) {
-                        integration->calc_weight_tetrahedron(nk, kmap_identity,
-                                                             weight[i], e_tmp[j], energy[i]);
-                        for (k = 0; k < nk; ++k) {
-                            ret[ik][i][j] += weight[i][k];
-                        }
-                    }
+            for (ib = 0; ib < ns2; ++ib) {
+
+                is = ib / ns;
+                js = ib % ns;
+
+                for (jk = 0; jk < nk; ++jk) {
+                    loc = k_pair[jk];
+                    e_tmp[0][jk]
+                        = writes->in_kayser(dynamical->eval_phonon[jk][is]
+                            + dynamical->eval_phonon[loc][js]);
+                    e_tmp[1][jk]
+                        = writes->in_kayser(dynamical->eval_phonon[jk][is]
+                            - dynamical->eval_phonon[loc][js]);
                 }
 
-            } else {
-
                 for (j = 0; j < 2; ++j) {
+                    if (smearing_method == -1) {
+                        integration->integrate_tetrahedron_multi(e_tmp[j], nullptr, n,
+                                                                 energy, dos_tmp[j]);
+                    } else {
+                        integration->integrate_smearing_multi(nk, e_tmp[j], nullptr, n,
+                                                              energy, smearing_method,
+                                                              dos_tmp[j]);
+                    }
+                    for (i = 0; i < n; ++i) dos_sum[j][i] += dos_tmp[j][i];
+                }
+            }
+
 #ifdef _OPENMP
-#pragma omp parallel for private(k)
+#pragma omp critical
 #endif
-                    for (i = 0; i < n; ++i) {
-                        integration->calc_weight_smearing(nk, nk, kmap_identity,
-                                                          weight[i], e_tmp[j], energy[i],
-                                                          smearing_method);
-                        for (k = 0; k < nk; ++k) {
-                            ret[ik][i][j] += weight[i][k];
-                        }
+            {
+                for (i = 0; i < n; ++i) {
+                    for (j = 0; j < 2; ++j) {
+                        ret[ik][i][j] += dos_sum[j][i];
                     }
                 }
             }
+
+            memory->deallocate(e_tmp);
+            memory->deallocate(dos_tmp);
+            memory->deallocate(dos_sum);
         }
     }
 
-    memory->deallocate(e_tmp);
-    memory->deallocate(weight);
-    memory->deallocate(kmap_identity);
+    mympi->MPI_Allgather_blocks(&ret[0][0][0], nk_reduced, 4 * n, MPI_DOUBLE);
+
     memory->deallocate(k_pair);
 
     if (mympi->my_rank == 0) {
@@ -450,104 +485,125 @@ void Dos::calc_total_scattering_phase_space(double **omega,
 
     unsigned int nk = kpoint->nk;
     unsigned int ns = dynamical->neval;
+    unsigned int nk_irred = kpinfo.size();
+    unsigned int ik_begin, ik_end;
     int ns2 = ns * ns;
     int ib;
 
-    int *kmap_identity;
+    int *k_pair;
+    double *omega0;
+    std::vector<int> mode_sorted(ns);
 
     double multi;
-    double omega0;
-    double sps_tmp1, sps_tmp2;
 
     if (mympi->my_rank == 0) {
         std::cout << " SPS = 1 : Calculating three-phonon scattering phase space ... ";
     }
 
-    memory->allocate(kmap_identity, nk);
+    memory->allocate(k_pair, nk);
+    memory->allocate(omega0, ns);
 
-    for (i = 0; i < nk; ++i) kmap_identity[i] = i;
+    for (int ik = 0; ik < nk_irred; ++ik) {
+        for (is = 0; is < ns; ++is) {
+            ret_mode[ik][is][0] = 0.0;
+            ret_mode[ik][is][1] = 0.0;
+        }
+    }
 
-    ret = 0.0;
-    double sps_sum1 = 0.0;
-    double sps_sum2 = 0.0;
+    // The delta functions for all the modes at k are obtained together
+    // for each band pair of (k', k+k'). The energies of the modes are
+    // sorted so that they can be used as the reference energy grid.
+
+    mympi->get_block_range(nk_irred, ik_begin, ik_end);
 
-    for (int ik = 0; ik < kpinfo.size(); ++ik) {
+    for (int ik = ik_begin; ik < ik_end; ++ik) {
 
         knum = kpinfo[ik][0].knum;
-        multi = static_cast<double>(kpinfo[ik].size()) / static_cast<double>(nk);
 
-        for (is = 0; is < ns; ++is) {
+        for (is = 0; is < ns; ++is) mode_sorted[is] = is;
+        std::sort(mode_sorted.begin(), mode_sorted.end(),
+                  [&omega, knum](const int a, const int b) { return omega[knum][a] < omega[knum][b]; });
+        for (is = 0; is < ns; ++is) omega0[is] = writes->in_kayser(omega[knum][mode_sorted[is]]);
 
-            omega0 = writes->in_kayser(omega[knum][is]);
+        for (int jk = 0; jk < nk; ++jk) {
+            k_pair[jk] = kpoint->knum_sum(knum, jk, 1, 1);
+        }
 
-            sps_tmp1 = 0.0;
-            sps_tmp2 = 0.0;
 #ifdef _OPENMP
-#pragma omp parallel
+#pragma omp parallel private(i, j)
 #endif
-            {
-                double **e_tmp;
-                double *weight;
-                int js, ks;
-                int jk, loc;
-                double xk_tmp[3];
-
-                memory->allocate(weight, nk);
-                memory->allocate(e_tmp, 2, nk);
-#ifdef _OPENMP
-#pragma omp for private(i, j), reduction(+: sps_tmp1, sps_tmp2)
-#endif
-                for (ib = 0; ib < ns2; ++ib) {
+        {
+            double **e_tmp, **sps_tmp, **sps_sum;
+            int js, ks;
+            int jk, loc;
 
-                    js = ib / ns;
-                    ks = ib % ns;
+            memory->allocate(e_tmp, 2, nk);
+            memory->allocate(sps_tmp, 2, ns);
+            memory->allocate(sps_sum, 2, ns);
 
-                    for (jk = 0; jk < nk; ++jk) {
+            for (j = 0; j < 2; ++j) {
+                for (i = 0; i < ns; ++i) sps_sum[j][i] = 0.0;
+            }
 
-                        for (i = 0; i < 3; ++i) xk_tmp[i] = kpoint->xk[knum][i] + kpoint->xk[jk][i];
-                        loc = kpoint->get_knum(xk_tmp[0], xk_tmp[1], xk_tmp[2]);
+#ifdef _OPENMP
+#pragma omp for
+#endif
+            for (ib = 0; ib < ns2; ++ib) {
 
-                        e_tmp[0][jk] = writes->in_kayser(omega[jk][js] + omega[loc][ks]);
-                        e_tmp[1][jk] = writes->in_kayser(omega[jk][js] - omega[loc][ks]);
+                js = ib / ns;
+                ks = ib % ns;
 
-                    }
+                for (jk = 0; jk < nk; ++jk) {
+                    loc = k_pair[jk];
+                    e_tmp[0][jk] = writes->in_kayser(omega[jk][js] + omega[loc][ks]);
+                    e_tmp[1][jk] = writes->in_kayser(omega[jk][js] - omega[loc][ks]);
+                }
 
+                for (j = 0; j < 2; ++j) {
                     if (smearing_method == -1) {
-
-                        integration->calc_weight_tetrahedron(nk, kmap_identity,
-                                                             weight, e_tmp[0], omega0);
-                        for (j = 0; j < nk; ++j) sps_tmp1 += weight[j];
-                        integration->calc_weight_tetrahedron(nk, kmap_identity,
-                                                             weight, e_tmp[1], omega0);
-                        for (j = 0; j < nk; ++j) sps_tmp2 += weight[j];
-
-
+                        integration->integrate_tetrahedron_multi(e_tmp[j], nullptr, ns,
+                                                                 omega0, sps_tmp[j]);
                     } else {
-
-                        integration->calc_weight_smearing(nk, nk, kmap_identity,
-                                                          weight, e_tmp[0], omega0,
-                                                          smearing_method);
-                        for (j = 0; j < nk; ++j) sps_tmp1 += weight[j];
-                        integration->calc_weight_smearing(nk, nk, kmap_identity,
-                                                          weight, e_tmp[1], omega0,
-                                                          smearing_method);
-                        for (j = 0; j < nk; ++j) sps_tmp2 += weight[j];
-
+                        integration->integrate_smearing_multi(nk, e_tmp[j], nullptr, ns,
+                                                              omega0, smearing_method,
+                                                              sps_tmp[j]);
                     }
+                    for (i = 0; i < ns; ++i) sps_sum[j][i] += sps_tmp[j][i];
+                }
+            }
 
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+            {
+                for (i = 0; i < ns; ++i) {
+                    for (j = 0; j < 2; ++j) {
+                        ret_mode[ik][mode_sorted[i]][j] += sps_sum[j][i];
+                    }
                 }
-                memory->deallocate(e_tmp);
-                memory->deallocate(weight);
             }
-            sps_sum1 += multi * sps_tmp1;
-            sps_sum2 += multi * sps_tmp2;
 
-            ret_mode[ik][is][0] = sps_tmp1;
-            ret_mode[ik][is][1] = sps_tmp2;
+            memory->deallocate(e_tmp);
+            memory->deallocate(sps_tmp);
+            memory->deallocate(sps_sum);
         }
     }
 
-    memory->deallocate(kmap_identity);
+    mympi->MPI_Allgather_blocks(&ret_mode[0][0][0], nk_irred, 2 * ns, MPI_DOUBLE);
+
+    memory->deallocate(k_pair);
+    memory->deallocate(omega0);
+
+    double sps_sum1 = 0.0;
+    double sps_sum2 = 0.0;
+
+    for (int ik = 0; ik < nk_irred; ++ik) {
+        multi = static_cast<double>(kpinfo[ik].size()) / static_cast<double>(nk);
+        for (is = 0; is < ns; ++is) {
+            sps_sum1 += multi * ret_mode[ik][is][0];
+            sps_sum2 += multi * ret_mode[ik][is][1];
+        }
+    }
 
     ret = (sps_sum1 + 2.0 * sps_sum2)
         / (3.0 * static_cast<double>(std::pow(ns, 3.0)));
@@ -582,7 +638,7 @@ void Dos::calc_dos_scph(double ***eval_anharm,
             }
         }
 
-        calc_dos(nk_irreducible, kmap_irreducible, eval, n_energy, energy_dos,
+        calc_dos(nk_irreducible, eval, n_energy, energy_dos,
                  dos_scph[iT], neval, integration->ismear, kpoint->kpoint_irred_all);
     }
 }
@@ -593,10 +649,9 @@ void Dos::calc_scattering_phase_space_with_Bose(double **eval,
                                                 double ****ret)
 {
     unsigned int i, j, k;
-    unsigned int knum, snum;
-    double xk_tmp[3];
-    double **ret_mode;
-    double omega0;
+    unsigned int knum;
+    double ***ret_k;
+    double *omega0;
     double Tmin = system->Tmin;
     double Tmax = system->Tmax;
     double dT = system->dT;
@@ -606,16 +661,13 @@ void Dos::calc_scattering_phase_space_with_Bose(double **eval,
     unsigned int nk_irred = kpoint->nk_irred;
     unsigned int nk = kpoint->nk;
     unsigned int ns = dynamical->neval;
-    unsigned int k1, k2;
-    unsigned int imode;
+    unsigned int k1;
+    unsigned int imode, nmode;
     unsigned int *k2_arr;
-    unsigned int ns2 = ns * ns;
-    double **recv_buf;
+    unsigned int ik_begin, ik_end;
     double omega_max = emax;
     double omega_min = emin;
-
-    std::vector<int> ks_g, ks_l;
-    int iks;
+    std::vector<int> mode_list;
 
     if (mympi->my_rank == 0) {
         std::cout << " SPS = 2 : Calculating three-phonon scattering phase space" << std::endl;
@@ -627,6 +679,8 @@ void Dos::calc_scattering_phase_space_with_Bose(double **eval,
     for (i = 0; i < N; ++i) temperature[i] = Tmin + static_cast<double>(i) * dT;
 
     memory->allocate(k2_arr, nk);
+    memory->allocate(omega0, ns);
+    memory->allocate(ret_k, ns, N, 2);
 
     for (i = 0; i < nk_irred; ++i) {
         for (j = 0; j < ns; ++j) {
@@ -637,101 +691,51 @@ void Dos::calc_scattering_phase_space_with_Bose(double **eval,
         }
     }
 
-    memory->allocate(ret_mode, N, 2);
+    // The irreducible k points are distributed over the MPI processes,
+    // and all the modes at k within [emin, emax] are treated together.
 
-    unsigned int nks_total = nk_irred * ns;
-    unsigned int nks_each_thread = nks_total / mympi->nprocs;
-    unsigned int nrem = nks_total - nks_each_thread * mympi->nprocs;
+    mympi->get_block_range(nk_irred, ik_begin, ik_end);
 
-    if (nrem > 0) {
-        memory->allocate(recv_buf, (nks_each_thread + 1) * mympi->nprocs, 2 * N);
-    } else {
-        memory->allocate(recv_buf, nks_total, 2 * N);
-    }
-
-    ks_g.clear();
-    for (ik = 0; ik < nk_irred; ++ik) {
+    for (ik = ik_begin; ik < ik_end; ++ik) {
 
         knum = kp_info[ik][0].knum;
 
+        mode_list.clear();
         for (imode = 0; imode < ns; ++imode) {
-
-            omega0 = writes->in_kayser(eval[knum][imode]);
-            if (omega0 < omega_min || omega0 > omega_max) continue;
-
-            ks_g.push_back(ik * ns + imode);
+            const auto omega_tmp = writes->in_kayser(eval[knum][imode]);
+            if (omega_tmp < omega_min || omega_tmp > omega_max) continue;
+            mode_list.push_back(imode);
         }
-    }
+        if (mode_list.empty()) continue;
 
-    ks_l.clear();
-    unsigned int count = 0;
-    for (auto it = ks_g.begin(); it != ks_g.end(); ++it) {
-        if (count % mympi->nprocs == mympi->my_rank) {
-            ks_l.push_back(*it);
-        }
-        ++count;
-    }
+        std::sort(mode_list.begin(), mode_list.end(),
+                  [&eval, knum](const int a, const int b) { return eval[knum][a] < eval[knum][b]; });
 
-    unsigned int nks_tmp;
-    if (ks_g.size() % mympi->nprocs > 0) {
-        nks_tmp = ks_g.size() / mympi->nprocs + 1;
-    } else {
-        nks_tmp = ks_g.size() / mympi->nprocs;
-    }
-    if (ks_l.size() < nks_tmp) ks_l.push_back(-1);
-
-    for (i = 0; i < nks_tmp; ++i) {
-
-        iks = ks_l[i];
+        nmode = mode_list.size();
+        for (i = 0; i < nmode; ++i) omega0[i] = writes->in_kayser(eval[knum][mode_list[i]]);
 
-        if (iks == -1) {
-
-            for (iT = 0; iT < N; ++iT) {
-                ret_mode[iT][0] = 0.0;
-                ret_mode[iT][1] = 0.0;
-            }
-
-        } else {
-
-            knum = kp_info[iks / ns][0].knum;
-            snum = iks % ns;
-
-            for (k1 = 0; k1 < nk; ++k1) {
-                for (j = 0; j < 3; ++j) xk_tmp[j] = kpoint->xk[knum][j] - kpoint->xk[k1][j];
-                k2 = kpoint->get_knum(xk_tmp[0], xk_tmp[1], xk_tmp[2]);
-                k2_arr[k1] = k2;
-            }
-
-            omega0 = eval[knum][snum];
-            calc_scattering_phase_space_with_Bose_mode(nk, ns, N, omega0, eval,
-                                                       temperature, k2_arr,
-                                                       smearing_method, ret_mode);
+        for (k1 = 0; k1 < nk; ++k1) {
+            k2_arr[k1] = kpoint->knum_sum(knum, k1, 1, -1);
         }
-        MPI_Gather(&ret_mode[0][0], 2 * N, MPI_DOUBLE, &recv_buf[mympi->nprocs * i][0],
-                   2 * N, MPI_DOUBLE, 0, MPI_COMM_WORLD);
-    }
-
-    count = 0;
-    for (ik = 0; ik < nk_irred; ++ik) {
-
-        knum = kp_info[ik][0].knum;
-
-        for (imode = 0; imode < ns; ++imode) {
 
-            omega0 = writes->in_kayser(eval[knum][imode]);
-            if (omega0 < omega_min || omega0 > omega_max) continue;
+        calc_scattering_phase_space_with_Bose_k(nk, ns, N, nmode, omega0, eval,
+                                                temperature, k2_arr,
+                                                smearing_method, ret_k);
 
+        for (i = 0; i < nmode; ++i) {
+            imode = mode_list[i];
             for (iT = 0; iT < N; ++iT) {
-                ret[ik][imode][iT][0] = recv_buf[count][2 * iT];
-                ret[ik][imode][iT][1] = recv_buf[count][2 * iT + 1];
+                ret[ik][imode][iT][0] = ret_k[i][iT][0];
+                ret[ik][imode][iT][1] = ret_k[i][iT][1];
             }
-            ++count;
         }
     }
 
-    memory->deallocate(ret_mode);
+    mympi->MPI_Allgather_blocks(&ret[0][0][0][0], nk_irred, 2 * ns * N, MPI_DOUBLE);
+
+    memory->deallocate(ret_k);
+    memory->deallocate(omega0);
     memory->deallocate(k2_arr);
-    memory->deallocate(recv_buf);
     memory->deallocate(temperature);
 
     if (mympi->my_rank == 0) {
@@ -739,44 +743,63 @@ void Dos::calc_scattering_phase_space_with_Bose(double **eval,
     }
 }
 
-void Dos::calc_scattering_phase_space_with_Bose_mode(const unsigned int nk,
-                                                     const unsigned int ns,
-                                                     const unsigned int N,
-                                                     const double omega,
-                                                     double **eval,
-                                                     double *temperature,
-                                                     unsigned int *k_pair,
-                                                     const int smearing_method,
-                                                     double **ret)
+void Dos::calc_scattering_phase_space_with_Bose_k(const unsigned int nk,
+                                                  const unsigned int ns,
+                                                  const unsigned int N,
+                                                  const unsigned int nmode,
+                                                  const double *omega0,
+                                                  double **eval,
+                                                  double *temperature,
+                                                  unsigned int *k_pair,
+                                                  const int smearing_method,
+                                                  double ***ret)
 {
+    // Scattering phase space with the Bose factors for nmode phonons at
+    // the same k point whose frequencies omega0 (in cm^-1) are in ascending order.
+    // For each band pair, the delta functions of all the modes are obtained
+    // in one sweep, and the occupation factors of (k1, k - k1) are evaluated
+    // only where any of the delta functions is nonzero.
+
     int ib;
-    unsigned int i, is, js, k1, k2;
-    unsigned int iT;
+    unsigned int i, iT;
     unsigned int ns2 = ns * ns;
-    double omega1, omega2;
-    double temp;
-    double ret1, ret2;
-    double n1, n2, f1, f2;
-
-    double **energy_tmp;
-    double **weight;
-    double ***delta_arr;
-
     int *kmap_identity;
 
-    memory->allocate(delta_arr, nk, ns2, 2);
-
     memory->allocate(kmap_identity, nk);
     for (i = 0; i < nk; ++i) kmap_identity[i] = i;
 
-    double omega0 = writes->in_kayser(omega);
+    for (i = 0; i < nmode; ++i) {
+        for (iT = 0; iT < N; ++iT) {
+            ret[i][iT][0] = 0.0;
+            ret[i][iT][1] = 0.0;
+        }
+    }
 
 #ifdef _OPENMP
-#pragma omp parallel private(i, is, js, k1, k2, omega1, omega2, energy_tmp, weight)
+#pragma omp parallel private(i, iT)
 #endif
     {
+        unsigned int is, js, k1, k2;
+        double omega1, omega2;
+        double f1, f2;
+        double **energy_tmp;
+        double ***weight;
+        double **n_bose;
+        double ***ret_sum;
+        bool needs_bose;
+
         memory->allocate(energy_tmp, 2, nk);
-        memory->allocate(weight, 2, nk);
+        memory->allocate(weight, 2, nmode, nk);
+        memory->allocate(n_bose, N, 2);
+        memory->allocate(ret_sum, nmode, N, 2);
+
+        for (i = 0; i < nmode; ++i) {
+            for (iT = 0; iT < N; ++iT) {
+                ret_sum[i][iT][0] = 0.0;
+                ret_sum[i][iT][1] = 0.0;
+            }
+        }
+
 #ifdef _OPENMP
 #pragma omp for
 #endif
@@ -795,43 +818,18 @@ void Dos::calc_scattering_phase_space_with_Bose_mode(const unsigned int nk,
                 energy_tmp[1][k1] = writes->in_kayser(omega1 - omega2);
             }
 
-            if (smearing_method == -1) {
-                for (i = 0; i < 2; ++i) {
-                    integration->calc_weight_tetrahedron(nk, kmap_identity,
-                                                         weight[i], energy_tmp[i], omega0);
-                }
-            } else {
-                for (i = 0; i < 2; ++i) {
-                    integration->calc_weight_smearing(nk, nk, kmap_identity,
-                                                      weight[i], energy_tmp[i], omega0,
-                                                      smearing_method);
+            for (i = 0; i < 2; ++i) {
+                if (smearing_method == -1) {
+                    integration->calc_weight_tetrahedron_multi(nk, kmap_identity,
+                                                               energy_tmp[i], nmode,
+                                                               omega0, weight[i]);
+                } else {
+                    integration->calc_weight_smearing_multi(nk, energy_tmp[i], nmode,
+                                                            omega0, smearing_method,
+                                                            weight[i]);
                 }
             }
 
-
-            for (k1 = 0; k1 < nk; ++k1) {
-                delta_arr[k1][ib][0] = weight[0][k1];
-                delta_arr[k1][ib][1] = weight[1][k1];
-            }
-        }
-
-        memory->deallocate(energy_tmp);
-        memory->deallocate(weight);
-    }
-
-
-    for (iT = 0; iT < N; ++iT) {
-        temp = temperature[iT];
-        ret1 = 0.0;
-        ret2 = 0.0;
-#ifdef _OPENMP
-#pragma omp parallel for private(k1, k2, is, js, omega1, omega2, n1, n2, f1, f2), reduction(+:ret1, ret2)
-#endif
-        for (ib = 0; ib < ns2; ++ib) {
-
-            is = ib / ns;
-            js = ib % ns;
-
             for (k1 = 0; k1 < nk; ++k1) {
 
                 k2 = k_pair[k1];
@@ -841,27 +839,54 @@ void Dos::calc_scattering_phase_space_with_Bose_mode(const unsigned int nk,
 
                 if (omega1 < eps12 || omega2 < eps12) continue;
 
-                if (thermodynamics->classical) {
-                    f1 = thermodynamics->fC(omega1, temp);
-                    f2 = thermodynamics->fC(omega2, temp);
-                    n1 = f1 + f2;
-                    n2 = f1 - f2;
-                } else {
-                    f1 = thermodynamics->fB(omega1, temp);
-                    f2 = thermodynamics->fB(omega2, temp);
-                    n1 = f1 + f2 + 1.0;
-                    n2 = f1 - f2;
-                }
+                needs_bose = true;
+
+                for (i = 0; i < nmode; ++i) {
+
+                    if (weight[0][i][k1] == 0.0 && weight[1][i][k1] == 0.0) continue;
+
+                    if (needs_bose) {
+                        for (iT = 0; iT < N; ++iT) {
+                            if (thermodynamics->classical) {
+                                f1 = thermodynamics->fC(omega1, temperature[iT]);
+                                f2 = thermodynamics->fC(omega2, temperature[iT]);
+                                n_bose[iT][0] = f1 + f2;
+                                n_bose[iT][1] = f1 - f2;
+                            } else {
+                                f1 = thermodynamics->fB(omega1, temperature[iT]);
+                                f2 = thermodynamics->fB(omega2, temperature[iT]);
+                                n_bose[iT][0] = f1 + f2 + 1.0;
+                                n_bose[iT][1] = f1 - f2;
+                            }
+                        }
+                        needs_bose = false;
+                    }
 
+                    for (iT = 0; iT < N; ++iT) {
+                        ret_sum[i][iT][0] += weight[0][i][k1] * n_bose[iT][0];
+                        ret_sum[i][iT][1] += -weight[1][i][k1] * n_bose[iT][1];
+                    }
+                }
+            }
+        }
 
-                ret1 += delta_arr[k1][ib][0] * n1;
-                ret2 += -delta_arr[k1][ib][1] * n2;
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+        {
+            for (i = 0; i < nmode; ++i) {
+                for (iT = 0; iT < N; ++iT) {
+                    ret[i][iT][0] += ret_sum[i][iT][0];
+                    ret[i][iT][1] += ret_sum[i][iT][1];
+                }
             }
         }
-        ret[iT][0] = ret1;
-        ret[iT][1] = ret2;
+
+        memory->deallocate(energy_tmp);
+        memory->deallocate(weight);
+        memory->deallocate(n_bose);
+        memory->deallocate(ret_sum);
     }
 
-    memory->deallocate(delta_arr);
     memory->deallocate(kmap_identity);
 }
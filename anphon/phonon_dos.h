@@ -55,7 +55,6 @@ namespace PHON_NS
         std::vector<int> k_irreducible;
 
         void calc_dos(unsigned int,
-                      int *,
                       double **,
                       unsigned int,
                       double *,
@@ -91,14 +90,15 @@ namespace PHON_NS
                                                    const std::vector<std::vector<KpointList>> &,
                                                    double ****);
 
-        void calc_scattering_phase_space_with_Bose_mode(unsigned int,
-                                                        unsigned int,
-                                                        unsigned int,
-                                                        double,
-                                                        double **,
-                                                        double *,
-                                                        unsigned int *,
-                                                        int,
-                                                        double **);
+        void calc_scattering_phase_space_with_Bose_k(unsigned int,
+                                                     unsigned int,
+                                                     unsigned int,
+                                                     unsigned int,
+                                                     const double *,
+                                                     double **,
+                                                     double *,
+                                                     unsigned int *,
+                                                     int,
+                                                     double ***);
     };
 }
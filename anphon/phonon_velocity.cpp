@@ -178,37 +178,79 @@ void Phonon_velocity::calc_phonon_vel_band(double **phvel_out)
 void Phonon_velocity::calc_phonon_vel_mesh(double **phvel_out,
                                            double ***phvel3_out)
 {
+    // Group velocities in Cartesian coordinates on the uniform k grid.
+    // The analytic derivative of the dynamical matrix is used when
+    // the eigenvectors are available and no nonanalytic correction is applied.
+    // Otherwise, or at k points with (nearly) zero frequencies,
+    // the finite-difference method is used. phvel_out may be nullptr.
+
     unsigned int j, k;
     unsigned int nk = kpoint->nk;
     unsigned int ns = dynamical->neval;
     double **vel;
 
+    const auto use_analytic = dynamical->eigenvectors && !dynamical->nonanalytic;
+
     if (mympi->my_rank == 0) {
-        std::cout << " Calculating group velocities of phonons on uniform grid ... ";
+        std::cout << " Calculating group velocities of phonons on uniform grid ";
+        if (use_analytic) {
+            std::cout << "(analytic) ... ";
+        } else {
+            std::cout << "(finite difference) ... ";
+        }
     }
 
-    memory->allocate(vel, ns, 3);
+    // The k points are divided into contiguous blocks over MPI processes
+    // and the velocities are gathered afterwards.
+    unsigned int ibegin, iend;
+    mympi->get_block_range(nk, ibegin, iend);
+
+#ifdef _OPENMP
+#pragma omp parallel private (j, k, vel)
+#endif
+    {
+        memory->allocate(vel, ns, 3);
+
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+        for (int i = ibegin; i < static_cast<int>(iend); ++i) {
+
+            auto analytic_k = use_analytic;
+            for (j = 0; j < ns; ++j) {
+                if (std::abs(dynamical->eval_phonon[i][j]) < eps6) analytic_k = false;
+            }
 
-    for (unsigned int i = 0; i < nk; ++i) {
-        phonon_vel_k(kpoint->xk[i], vel);
-        //        phonon_vel_k2(kpoint->xk[i],
-        //                      dynamical->eval_phonon[i],
-        //                      dynamical->evec_phonon[i],
-        //                      vel);
+            if (analytic_k) {
+                phonon_vel_k2(kpoint->xk[i],
+                              dynamical->eval_phonon[i],
+                              dynamical->evec_phonon[i],
+                              vel);
+            } else {
+                phonon_vel_k(kpoint->xk[i], vel);
+            }
 
-        for (j = 0; j < ns; ++j) {
-            rotvec(vel[j], vel[j], system->lavec_p);
-            for (k = 0; k < 3; ++k) {
-                vel[j][k] /= 2.0 * pi;
-                phvel3_out[i][j][k] = vel[j][k];
+            for (j = 0; j < ns; ++j) {
+                rotvec(vel[j], vel[j], system->lavec_p);
+                for (k = 0; k < 3; ++k) {
+                    vel[j][k] /= 2.0 * pi;
+                    phvel3_out[i][j][k] = vel[j][k];
+                }
+                if (phvel_out) {
+                    phvel_out[i][j] = std::sqrt(std::pow(vel[j][0], 2)
+                        + std::pow(vel[j][1], 2)
+                        + std::pow(vel[j][2], 2));
+                }
             }
-            phvel_out[i][j] = std::sqrt(std::pow(vel[j][0], 2)
-                + std::pow(vel[j][1], 2)
-                + std::pow(vel[j][2], 2));
         }
+
+        memory->deallocate(vel);
     }
 
-    memory->deallocate(vel);
+    if (mympi->nprocs > 1) {
+        if (phvel_out) mympi->MPI_Allgather_blocks(&phvel_out[0][0], nk, ns, MPI_DOUBLE);
+        mympi->MPI_Allgather_blocks(&phvel3_out[0][0][0], nk, 3 * ns, MPI_DOUBLE);
+    }
 
     if (mympi->my_rank == 0) {
         std::cout << "done!" << std::endl;
@@ -312,166 +354,113 @@ void Phonon_velocity::phonon_vel_k2(const double *xk_in,
                                     std::complex<double> **evec_in,
                                     double **vel_out)
 {
-    unsigned int i, j, k, l, m;
+    // Calculate group velocities from the analytic derivative of the
+    // dynamical matrix as v = <e|dD/dk|e> / (2 omega) (Hellmann-Feynman).
+    // For a degenerate subspace, the projection of dD/dk onto the subspace
+    // is diagonalized for each direction, giving the slopes of the
+    // individual branches in ascending order. At band crossings, these differ
+    // from the central difference of the sorted eigenvalues in phonon_vel_k,
+    // which averages the slopes of the crossing branches.
+    // The velocities are symmetrized with the small group of k as in the
+    // original implementation. The result is in the same (fractional) basis
+    // as phonon_vel_k.
+
+    int i, j, k;
     unsigned int icrd;
     int nmode = 3 * system->natmin;
+    const double tol_omega = 1.0e-7; // Approximately equal to 0.01 cm^{-1}
 
     std::complex<double> ***ddyn;
-    std::complex<double> ctmp;
-    std::complex<double> **vel_tmp;
-    std::complex<double> ***mat_tmp;
-    std::complex<double> czero(0.0, 0.0);
+    std::complex<double> *dmat_evec;
     std::vector<int> smallgroup_k;
-    double **eval_tmp;
+    double symmetrizer_k[3][3];
+    std::complex<double> **mat_tmp;
+    double *eval_tmp;
+    std::complex<double> ctmp;
+    std::complex<double> alpha(1.0, 0.0);
+    std::complex<double> beta(0.0, 0.0);
+    char TRANSN[] = "N";
+    char TRANST[] = "T";
 
     if (dynamical->nonanalytic) {
-
         error->exit("phonon_vel_k2",
-                    "Sorry. Analytic calculation of \
-            group velocity is not supported for NONANALYTIC>0.");
-
+                    "Sorry. Analytic calculation of group velocity is not supported for NONANALYTIC>0.");
     }
 
     memory->allocate(ddyn, 3, nmode, nmode);
-    memory->allocate(vel_tmp, 3, nmode);
-    calc_derivative_dynmat_k(xk_in, fcs_phonon->fc2_ext, ddyn);
-
-    bool do_diagonalize = false;
-
+    memory->allocate(dmat_evec, nmode * nmode);
+    memory->allocate(mat_tmp, nmode, nmode);
+    memory->allocate(eval_tmp, nmode);
 
-    if (do_diagonalize) {
-        // Detect degeneracy at the given k
-        double tol_omega = 1.0e-7; // Approximately equal to 0.01 cm^{-1}
-
-        std::vector<int> degeneracy_at_k;
-        double omega_now, omega_prev;
-
-        degeneracy_at_k.clear();
+    calc_derivative_dynmat_k(xk_in, fcs_phonon->fc2_ext, ddyn);
 
-        omega_prev = omega_in[0];
-        int ideg = 1;
+    // Group the branches into degenerate subspaces
 
-        for (i = 1; i < nmode; ++i) {
-            omega_now = omega_in[i];
+    std::vector<int> degeneracy_at_k;
+    auto ideg = 1;
+    auto omega_prev = omega_in[0];
 
-            if (std::abs(omega_now - omega_prev) < tol_omega) {
-                ++ideg;
-            } else {
-                degeneracy_at_k.push_back(ideg);
-                ideg = 1;
-                omega_prev = omega_now;
-            }
+    for (i = 1; i < nmode; ++i) {
+        if (std::abs(omega_in[i] - omega_prev) < tol_omega) {
+            ++ideg;
+        } else {
+            degeneracy_at_k.push_back(ideg);
+            ideg = 1;
+            omega_prev = omega_in[i];
         }
-        degeneracy_at_k.push_back(ideg);
+    }
+    degeneracy_at_k.push_back(ideg);
 
-        int is = 0;
+    for (icrd = 0; icrd < 3; ++icrd) {
 
-        for (i = 0; i < degeneracy_at_k.size(); ++i) {
-            ideg = degeneracy_at_k[i];
+        // The arrays are stored in the row-major order. With the column-major
+        // zgemm, dmat_evec[is][l] = (dD/dk e_is)_l in the row-major order.
 
-            if (ideg == 1) {
+        zgemm_(TRANST, TRANSN, &nmode, &nmode, &nmode, &alpha,
+               &ddyn[icrd][0][0], &nmode, &evec_in[0][0], &nmode,
+               &beta, dmat_evec, &nmode);
 
-                // When the branch is non-degenerate, the velocity can be calculated 
-                // from the diagonal element of e^{*} * DDYN * e.
+        auto is = 0;
 
-                for (icrd = 0; icrd < 3; ++icrd) {
-                    vel_tmp[icrd][is] = czero;
+        for (const auto ndeg : degeneracy_at_k) {
 
-                    for (l = 0; l < nmode; ++l) {
-                        ctmp = czero;
-                        for (m = 0; m < nmode; ++m) {
-                            ctmp += ddyn[icrd][l][m] * evec_in[is][m];
-                        }
-                        vel_tmp[icrd][is] += std::conj(evec_in[is][l]) * ctmp;
-                    }
-                    vel_tmp[icrd][is] /= 2.0 * omega_in[is];
+            if (ndeg == 1) {
+                ctmp = std::complex<double>(0.0, 0.0);
+                for (k = 0; k < nmode; ++k) {
+                    ctmp += std::conj(evec_in[is][k]) * dmat_evec[nmode * is + k];
                 }
-
-            } else if (ideg > 1) {
-
-                // When the branch is degenerated with two or more branches, 
-                // we have to construct a MxM matrix and diagonalize it to obtain 
-                // group velocities.
-
-                memory->allocate(mat_tmp, 3, ideg, ideg);
-                memory->allocate(eval_tmp, 3, ideg);
-
-                for (icrd = 0; icrd < 3; ++icrd) {
-
-                    for (j = 0; j < ideg; ++j) {
-                        for (k = 0; k < ideg; ++k) {
-                            mat_tmp[icrd][j][k] = czero;
-
-                            for (l = 0; l < nmode; ++l) {
-                                ctmp = czero;
-                                for (m = 0; m < nmode; ++m) {
-                                    ctmp += ddyn[icrd][l][m] * evec_in[j + is][m];
-                                }
-                                mat_tmp[icrd][j][k] += std::conj(evec_in[k + is][l]) * ctmp;
-                            }
+                vel_out[is][icrd] = ctmp.real() / (2.0 * std::abs(omega_in[is]));
+            } else {
+                for (i = 0; i < ndeg; ++i) {
+                    for (j = 0; j < ndeg; ++j) {
+                        ctmp = std::complex<double>(0.0, 0.0);
+                        for (k = 0; k < nmode; ++k) {
+                            ctmp += std::conj(evec_in[is + i][k]) * dmat_evec[nmode * (is + j) + k];
                         }
-                    }
-                    // Diagonalize the matrix here
-
-                    diagonalize_hermite_mat(ideg, mat_tmp[icrd], eval_tmp[icrd]);
-
-                    for (j = 0; j < ideg; ++j) {
-                        vel_tmp[icrd][j + is] = eval_tmp[icrd][j] / (2.0 * omega_in[j + is]);
+                        mat_tmp[i][j] = ctmp;
                     }
                 }
 
-                memory->deallocate(mat_tmp);
-                memory->deallocate(eval_tmp);
-
-            } else {
-                error->exit("phonon_vel_k2", "This cannot happen.");
-            }
-
-            is += ideg;
-        }
-    } else {
-
-        for (icrd = 0; icrd < 3; ++icrd) {
-
-            for (j = 0; j < nmode; ++j) {
-                vel_tmp[icrd][j] = czero;
+                diagonalize_hermite_mat(ndeg, mat_tmp, eval_tmp);
 
-                for (l = 0; l < nmode; ++l) {
-                    ctmp = czero;
-                    for (m = 0; m < nmode; ++m) {
-                        ctmp += ddyn[icrd][l][m] * evec_in[j][m];
-                    }
-                    vel_tmp[icrd][j] += std::conj(evec_in[j][l]) * ctmp;
+                for (i = 0; i < ndeg; ++i) {
+                    vel_out[is + i][icrd] = eval_tmp[i] / (2.0 * std::abs(omega_in[is + i]));
                 }
             }
-            for (j = 0; j < nmode; ++j) {
-                vel_tmp[icrd][j] /= 2.0 * omega_in[j];
-            }
-        }
-    }
-
-
-    for (icrd = 0; icrd < 3; ++icrd) {
-        for (i = 0; i < nmode; ++i) {
-            vel_out[i][icrd] = vel_tmp[icrd][i].real();
+            is += ndeg;
         }
     }
 
-
-    if (ddyn) {
-        memory->deallocate(ddyn);
-    }
-    if (vel_tmp) {
-        memory->deallocate(vel_tmp);
-    }
-
-    double symmetrizer_k[3][3];
-
     kpoint->get_small_group_k(xk_in, smallgroup_k, symmetrizer_k);
 
     for (i = 0; i < nmode; ++i) {
         rotvec(vel_out[i], vel_out[i], symmetrizer_k, 'T');
     }
+
+    memory->deallocate(ddyn);
+    memory->deallocate(dmat_evec);
+    memory->deallocate(mat_tmp);
+    memory->deallocate(eval_tmp);
 }
 
 
@@ -29,6 +29,9 @@ namespace PHON_NS
         void phonon_vel_k(const double *,
                           double **);
 
+        void calc_phonon_vel_mesh(double **,
+                                  double ***);
+
         bool print_velocity;
         double **phvel;
         double ***phvel_xyz;
@@ -46,9 +49,6 @@ namespace PHON_NS
 
         void calc_phonon_vel_band(double **);
 
-        void calc_phonon_vel_mesh(double **,
-                                  double ***);
-
         void phonon_vel_k2(const double *,
                            const double *,
                            std::complex<double> **,
@@ -25,17 +25,31 @@
 #include "symmetry_core.h"
 #include <iostream>
 #include <iomanip>
+#include <sstream>
+#include <string>
 #include <complex>
 #include <algorithm>
 #include <fftw3.h>
 #include <Eigen/Core>
 #include <Eigen/Eigenvalues>
+#include <Eigen/LU>
 #include <boost/lexical_cast.hpp>
 #include "timer.h"
 #include <cmath>
 #include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <sys/stat.h>
 #include <vector>
 
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
 #if defined(WIN32) || defined(_WIN32)
 #pragma comment(lib, "libfftw3-3.lib")
 #pragma comment(lib, "libfftw3f-3.lib")
@@ -61,33 +75,30 @@ void Scph::set_default_variables()
     restart_scph = false;
     warmstart_scph = false;
     lower_temp = true;
+    nchain_scph = 1;
     tolerance_scph = 1.0e-10;
     mixalpha = 0.1;
     maxiter = 100;
+    mixtype = 0;
+    mixhist = 5;
     print_self_consistent_fc2 = false;
     selfenergy_offdiagonal = true;
     relax_coordinate = false;
+    distribute_v4 = false;
+    v4_store = 0;
 
     xk_scph = nullptr;
     kvec_na_scph = nullptr;
     xk_interpolate = nullptr;
-    vec_for_v3 = nullptr;
-    vec_for_v4 = nullptr;
-    invmass_for_v3 = nullptr;
-    invmass_for_v4 = nullptr;
     evec_index3 = nullptr;
     evec_index4 = nullptr;
     kmap_interpolate_to_scph = nullptr;
     evec_harmonic = nullptr;
-    fcs_group = nullptr;
-    fcs_group2 = nullptr;
     omega2_harmonic = nullptr;
     mat_transform_sym = nullptr;
     small_group_at_k = nullptr;
     symop_minus_at_k = nullptr;
     kpoint_map_symmetry = nullptr;
-    exp_phase = nullptr;
-    exp_phase3 = nullptr;
     mindist_list_scph = nullptr;
 }
 
@@ -115,36 +126,12 @@ void Scph::deallocate_variables()
     if (omega2_harmonic) {
         memory->deallocate(omega2_harmonic);
     }
-    if (vec_for_v3) {
-        memory->deallocate(vec_for_v3);
-    }
-    if (vec_for_v4) {
-        memory->deallocate(vec_for_v4);
-    }
-    if (invmass_for_v3) {
-        memory->deallocate(invmass_for_v3);
-    }
-    if (invmass_for_v4) {
-        memory->deallocate(invmass_for_v4);
-    }
     if (evec_index3) {
         memory->deallocate(evec_index3);
     }
     if (evec_index4) {
         memory->deallocate(evec_index4);
     }
-    if (fcs_group) {
-        memory->deallocate(fcs_group);
-    }
-    if (fcs_group2) {
-        memory->deallocate(fcs_group2);
-    }
-    if (exp_phase) {
-        memory->deallocate(exp_phase);
-    }
-    if (exp_phase3) {
-        memory->deallocate(exp_phase3);
-    }
     if (mat_transform_sym) {
         memory->deallocate(mat_transform_sym);
     }
@@ -188,6 +175,16 @@ void Scph::exec_scph()
     MPI_Bcast(&restart_scph, 1, MPI_LOGICAL, 0, MPI_COMM_WORLD);
     MPI_Bcast(&selfenergy_offdiagonal, 1, MPI_LOGICAL, 0, MPI_COMM_WORLD);
     MPI_Bcast(&ialgo, 1, MPI_UNSIGNED, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&nchain_scph, 1, MPI_UNSIGNED, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&lower_temp, 1, MPI_LOGICAL, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&warmstart_scph, 1, MPI_LOGICAL, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&tolerance_scph, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&mixalpha, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&maxiter, 1, MPI_UNSIGNED, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&mixtype, 1, MPI_UNSIGNED, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&mixhist, 1, MPI_UNSIGNED, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&distribute_v4, 1, MPI_LOGICAL, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&v4_store, 1, MPI_INT, 0, MPI_COMM_WORLD);
 
     memory->allocate(delta_dymat_scph, NT, ns, ns, nk_interpolate);
 
@@ -250,6 +247,9 @@ void Scph::exec_scph()
 }
 
 
+static const char scph_dymat_magic[8] = {'A', 'N', 'P', 'H', 'D', 'Y', 'M', 'T'};
+static const int scph_dymat_version = 1;
+
 void Scph::load_scph_dymat_from_file(std::complex<double> ****dymat_out)
 {
     const auto ns = dynamical->neval;
@@ -282,13 +282,27 @@ void Scph::load_scph_dymat_from_file(std::complex<double> ****dymat_out)
         std::cout << " RESTART_SCPH is true." << std::endl;
         std::cout << " Dynamical matrix is read from file ...";
 
-        ifs_dymat.open(file_dymat.c_str(), std::ios::in);
+        ifs_dymat.open(file_dymat.c_str(), std::ios::in | std::ios::binary);
 
         if (!ifs_dymat) {
             error->exit("load_scph_dymat_from_file",
                         "Cannot open scph_dymat file");
         }
 
+        char magic[8] = {};
+        ifs_dymat.read(magic, 8);
+        ifs_dymat.close();
+
+        if (std::memcmp(magic, scph_dymat_magic, 8) == 0) {
+            load_scph_dymat_binary(file_dymat, Temp_array, dymat_out);
+            std::cout << " done." << std::endl;
+            mpi_bcast_complex(dymat_out, NT, nk_interpolate, ns);
+            return;
+        }
+
+        // Text format written by older versions
+        ifs_dymat.open(file_dymat.c_str(), std::ios::in);
+
         // Read computational settings from file and check the consistency.
         ifs_dymat >> nk_interpolate_ref[0] >> nk_interpolate_ref[1] >> nk_interpolate_ref[2];
         ifs_dymat >> nk_scph_tmp[0] >> nk_scph_tmp[1] >> nk_scph_tmp[2];
@@ -363,55 +377,184 @@ void Scph::load_scph_dymat_from_file(std::complex<double> ****dymat_out)
 
 void Scph::store_scph_dymat_to_file(std::complex<double> ****dymat_in)
 {
-    int i;
-    int iT, ik, is, js;
-    unsigned int ns = dynamical->neval;
-    double Tmin = system->Tmin;
-    double Tmax = system->Tmax;
-    double dT = system->dT;
-    double temp;
-    unsigned int NT;
+    // Write the dynamical matrices in the binary format described above
+    // load_scph_dymat_binary.
+
+    const int ns = dynamical->neval;
+    const double Tmin = system->Tmin;
+    const double Tmax = system->Tmax;
+    const double dT = system->dT;
+    const int NT = static_cast<unsigned int>((Tmax - Tmin) / dT) + 1;
+    const size_t size_block = static_cast<size_t>(ns) * ns * nk_interpolate;
     std::ofstream ofs_dymat;
     std::string file_dymat = input->job_title + ".scph_dymat";
 
-    NT = static_cast<unsigned int>((Tmax - Tmin) / dT) + 1;
-
-    ofs_dymat.open(file_dymat.c_str(), std::ios::out);
+    ofs_dymat.open(file_dymat.c_str(), std::ios::out | std::ios::binary);
 
     if (!ofs_dymat) {
         error->exit("store_scph_dymat_to_file",
                     "Cannot open scph_dymat file");
     }
-    for (i = 0; i < 3; ++i) {
-        ofs_dymat << std::setw(5) << kmesh_interpolate[i];
+
+    const int ival[14] = {scph_dymat_version,
+                          static_cast<int>(kmesh_interpolate[0]),
+                          static_cast<int>(kmesh_interpolate[1]),
+                          static_cast<int>(kmesh_interpolate[2]),
+                          static_cast<int>(kmesh_scph[0]),
+                          static_cast<int>(kmesh_scph[1]),
+                          static_cast<int>(kmesh_scph[2]),
+                          static_cast<int>(dynamical->nonanalytic),
+                          static_cast<int>(selfenergy_offdiagonal),
+                          ns, static_cast<int>(nk_interpolate), NT, 0, 0};
+    const double dval[3] = {Tmin, Tmax, dT};
+    std::vector<unsigned long long> checksum(NT);
+
+    for (auto iT = 0; iT < NT; ++iT) {
+        checksum[iT] = checksum_scph_dymat(&dymat_in[iT][0][0][0], size_block);
     }
-    ofs_dymat << std::endl;
-    for (i = 0; i < 3; ++i) {
-        ofs_dymat << std::setw(5) << kmesh_scph[i];
+
+    ofs_dymat.write(scph_dymat_magic, 8);
+    ofs_dymat.write(reinterpret_cast<const char *>(ival), 14 * sizeof(int));
+    ofs_dymat.write(reinterpret_cast<const char *>(dval), 3 * sizeof(double));
+    ofs_dymat.write(reinterpret_cast<const char *>(&checksum[0]), NT * sizeof(unsigned long long));
+    ofs_dymat.write(reinterpret_cast<const char *>(&dymat_in[0][0][0][0]),
+                    NT * size_block * sizeof(std::complex<double>));
+    ofs_dymat.close();
+
+    if (!ofs_dymat) {
+        error->exit("store_scph_dymat_to_file",
+                    "Cannot write scph_dymat file");
     }
-    ofs_dymat << std::endl;
-    ofs_dymat << std::setw(10) << Tmin;
-    ofs_dymat << std::setw(10) << Tmax;
-    ofs_dymat << std::setw(10) << dT << std::endl;
-    ofs_dymat << std::setw(5) << dynamical->nonanalytic;
-    ofs_dymat << std::setw(5) << selfenergy_offdiagonal << std::endl;
+}
 
-    for (iT = 0; iT < NT; ++iT) {
-        temp = Tmin + static_cast<double>(iT) * dT;
-        ofs_dymat << "# " << temp << std::endl;
-        for (is = 0; is < ns; ++is) {
-            for (js = 0; js < ns; ++js) {
-                for (ik = 0; ik < nk_interpolate; ++ik) {
-                    ofs_dymat << std::setprecision(15)
-                        << std::setw(25) << dymat_in[iT][is][js][ik].real();
-                    ofs_dymat << std::setprecision(15)
-                        << std::setw(25) << dymat_in[iT][is][js][ik].imag();
-                    ofs_dymat << std::endl;
-                }
+// The binary .scph_dymat file consists of the header
+//   char[8] "ANPHDYMT", int version, int kmesh_interpolate[3], int kmesh_scph[3],
+//   int nonanalytic, int selfenergy_offdiagonal, int ns, int nk_interpolate,
+//   int NT, int (reserved)[2], double Tmin, double Tmax, double dT,
+//   uint64 checksum[NT]
+// followed by NT blocks of dymat[ns][ns][nk_interpolate] (complex<double>).
+// Each block starts at a fixed offset so that the dynamical matrices at
+// a single temperature can be read without touching the rest of the file.
+
+unsigned long long Scph::checksum_scph_dymat(const std::complex<double> *dymat_in,
+                                             const size_t n) const
+{
+    // 64-bit FNV-1a hash over the 64-bit words of the data
+    unsigned long long hash = 14695981039346656037ULL;
+    unsigned long long word;
+
+    const auto ptr = reinterpret_cast<const double *>(dymat_in);
+    for (size_t i = 0; i < 2 * n; ++i) {
+        std::memcpy(&word, &ptr[i], sizeof(unsigned long long));
+        hash ^= word;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+void Scph::load_scph_dymat_binary(const std::string &file_dymat,
+                                  const std::vector<double> &Temp_array,
+                                  std::complex<double> ****dymat_out) const
+{
+    // Copy the blocks of the temperatures in Temp_array from the binary
+    // .scph_dymat file. The file is mapped to memory, so that only the
+    // requested blocks are actually read.
+
+    struct stat st;
+    int ival[14];
+    double dval[3];
+    const char *data;
+
+    const int ns = dynamical->neval;
+    const size_t size_block = static_cast<size_t>(ns) * ns * nk_interpolate;
+    const size_t size_header = 8 + 14 * sizeof(int) + 3 * sizeof(double);
+
+    stat(file_dymat.c_str(), &st);
+    const size_t size_file = static_cast<size_t>(st.st_size);
+
+    if (size_file < size_header) {
+        error->exit("load_scph_dymat_binary", "The scph_dymat file is broken");
+    }
+
+#if defined(_WIN32)
+    std::vector<char> buffer(size_file);
+    std::ifstream ifs_dymat(file_dymat.c_str(), std::ios::in | std::ios::binary);
+    ifs_dymat.read(&buffer[0], size_file);
+    ifs_dymat.close();
+    data = &buffer[0];
+#else
+    const int fd = open(file_dymat.c_str(), O_RDONLY);
+    if (fd == -1) {
+        error->exit("load_scph_dymat_binary", "Cannot open scph_dymat file");
+    }
+    void *addr = mmap(nullptr, size_file, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        error->exit("load_scph_dymat_binary", "mmap failed for scph_dymat file");
+    }
+    data = static_cast<const char *>(addr);
+#endif
+
+    std::memcpy(ival, data + 8, 14 * sizeof(int));
+    std::memcpy(dval, data + 8 + 14 * sizeof(int), 3 * sizeof(double));
+
+    const int NT_ref = ival[11];
+
+    if (ival[0] != scph_dymat_version || ival[9] != ns
+        || ival[10] != static_cast<int>(nk_interpolate) || NT_ref <= 0
+        || size_file != size_header + NT_ref * (sizeof(unsigned long long)
+            + size_block * sizeof(std::complex<double>))) {
+        error->exit("load_scph_dymat_binary", "The scph_dymat file is broken");
+    }
+
+    // Check the computational settings
+    for (auto i = 0; i < 3; ++i) {
+        if (ival[1 + i] != static_cast<int>(kmesh_interpolate[i])) {
+            error->exit("load_scph_dymat_binary",
+                        "The number of KMESH_INTERPOLATE is not consistent");
+        }
+        if (ival[4 + i] != static_cast<int>(kmesh_scph[i])) {
+            error->exit("load_scph_dymat_binary",
+                        "The number of KMESH_SCPH is not consistent");
+        }
+    }
+    if (ival[7] != dynamical->nonanalytic) {
+        error->exit("load_scph_dymat_binary",
+                    "The NONANALYTIC tag is not consistent");
+    }
+    if (ival[8] != static_cast<int>(selfenergy_offdiagonal)) {
+        error->exit("load_scph_dymat_binary",
+                    "The SELF_OFFDIAG tag is not consistent");
+    }
+
+    const auto checksum = reinterpret_cast<const unsigned long long *>(data + size_header);
+    const auto dymat_all = reinterpret_cast<const std::complex<double> *>(data + size_header
+        + NT_ref * sizeof(unsigned long long));
+
+    for (auto iT = 0; iT < Temp_array.size(); ++iT) {
+
+        auto iT_ref = -1;
+        for (auto i = 0; i < NT_ref; ++i) {
+            if (std::abs(dval[0] + dval[2] * static_cast<double>(i) - Temp_array[iT]) < eps6) {
+                iT_ref = i;
+                break;
             }
         }
+        if (iT_ref == -1) {
+            error->exit("load_scph_dymat_binary",
+                        "The temperature information is not consistent");
+        }
+
+        const auto dymat_ref = dymat_all + iT_ref * size_block;
+        if (checksum_scph_dymat(dymat_ref, size_block) != checksum[iT_ref]) {
+            error->exit("load_scph_dymat_binary", "Checksum mismatch in the scph_dymat file");
+        }
+        std::memcpy(&dymat_out[iT][0][0][0], dymat_ref, size_block * sizeof(std::complex<double>));
     }
-    ofs_dymat.close();
+
+#if !defined(_WIN32)
+    munmap(addr, size_file);
+#endif
 }
 
 void Scph::exec_scph_main(std::complex<double> ****dymat_anharm)
@@ -420,7 +563,6 @@ void Scph::exec_scph_main(std::complex<double> ****dymat_anharm)
     auto nk = nk_scph;
     auto ns = dynamical->neval;
     auto nk_reduced_scph = kp_irred_scph.size();
-    auto nk_irred_interpolate = kp_irred_interpolate.size();
     auto Tmin = system->Tmin;
     auto Tmax = system->Tmax;
     auto dT = system->dT;
@@ -448,12 +590,28 @@ void Scph::exec_scph_main(std::complex<double> ****dymat_anharm)
 
     memory->allocate(omega2_anharm, NT, nk, ns);
     memory->allocate(evec_anharm_tmp, nk, ns, ns);
-    memory->allocate(v4_array_all, nk_irred_interpolate * nk_scph,
-                     ns * ns, ns * ns);
+    setup_v4_layout();
+    memory->allocate(v4_array_all, std::max(nblock_v4, 1u), nrow_v4, ncol_v4);
 
     // Calculate v4 array. 
     // This operation is the most expensive part of the calculation.
-    if (selfenergy_offdiagonal & (ialgo == 1)) {
+    // With V4STORE = 1, the array is read from the store if available.
+    const auto file_v4store = input->job_title + ".v4store";
+    unsigned long long hash_v4store = 0;
+    auto v4_loaded = false;
+
+    if (v4_store) {
+        hash_v4store = get_hash_v4store();
+        v4_loaded = load_v4store(file_v4store, hash_v4store, v4_array_all);
+    }
+
+    if (v4_loaded) {
+        // Nothing to do
+    } else if (selfenergy_offdiagonal & (ialgo == 1)) {
+        if (distribute_v4) {
+            error->exit("exec_scph_main",
+                        "IALGO = 1 cannot be used with DISTRIBUTE_V4 = 1.");
+        }
         compute_V4_elements_mpi_over_band(v4_array_all,
                                           evec_harmonic,
                                           selfenergy_offdiagonal);
@@ -464,6 +622,8 @@ void Scph::exec_scph_main(std::complex<double> ****dymat_anharm)
                                             relax_coordinate);
     }
 
+    if (v4_store && !v4_loaded) save_v4store(file_v4store, hash_v4store, v4_array_all);
+
     if (relax_coordinate) {
         memory->allocate(v3_array_all, nk, ns, ns * ns);
         compute_V3_elements_mpi_over_kpoint(v3_array_all,
@@ -471,26 +631,73 @@ void Scph::exec_scph_main(std::complex<double> ****dymat_anharm)
                                             selfenergy_offdiagonal);
     }
 
-    if (mympi->my_rank == 0) {
+    vec_temp.clear();
 
-        std::complex<double> ***cmat_convert;
-        memory->allocate(cmat_convert, nk, ns, ns);
+    if (lower_temp) {
+        for (iT = NT - 1; iT >= 0; --iT) {
+            vec_temp.push_back(Tmin + static_cast<double>(iT) * dT);
+        }
+    } else {
+        for (iT = 0; iT < NT; ++iT) {
+            vec_temp.push_back(Tmin + static_cast<double>(iT) * dT);
+        }
+    }
 
-        vec_temp.clear();
+    // The temperature list is divided into nchain contiguous chains,
+    // which are distributed over MPI processes in a round-robin way.
+    // The warm start is used only within each chain.
+    // When the V4 elements are distributed, all processes take part in
+    // the SCPH iteration of every temperature and only one chain is used.
 
-        if (lower_temp) {
-            for (iT = NT - 1; iT >= 0; --iT) {
-                vec_temp.push_back(Tmin + static_cast<double>(iT) * dT);
-            }
-        } else {
-            for (iT = 0; iT < NT; ++iT) {
-                vec_temp.push_back(Tmin + static_cast<double>(iT) * dT);
+    if (distribute_v4 && nchain_scph > 1 && mympi->my_rank == 0) {
+        std::cout << " NCHAIN > 1 is ignored because DISTRIBUTE_V4 = 1." << std::endl;
+    }
+
+    const auto nchain = distribute_v4 ? 1 : std::min(nchain_scph, NT);
+    const auto ichain_start = distribute_v4 ? 0 : mympi->my_rank;
+    const auto ichain_stride = distribute_v4 ? 1 : mympi->nprocs;
+    std::vector<int> chain_begin(nchain + 1), owner_temp(NT);
+    std::vector<std::string> log_temp(NT);
+    std::vector<unsigned int> niter_temp(NT, 0);
+
+    for (i = 0; i <= nchain; ++i) chain_begin[i] = (NT * i) / nchain;
+    for (i = 0; i < nchain; ++i) {
+        for (iT = chain_begin[i]; iT < chain_begin[i + 1]; ++iT) {
+            owner_temp[iT] = i % mympi->nprocs;
+        }
+    }
+
+    if (nchain > 1) {
+        for (iT = 0; iT < NT; ++iT) {
+            for (ik = 0; ik < nk_interpolate; ++ik) {
+                for (is = 0; is < ns; ++is) {
+                    for (js = 0; js < ns; ++js) {
+                        dymat_anharm[iT][is][js][ik] = std::complex<double>(0.0, 0.0);
+                    }
+                }
             }
         }
+    }
+
+    if (nchain > 1) {
+        // Use the output format of rank 0 on all processes so that
+        // the collected logs look the same as those of the serial run.
+        long fmt_flags = static_cast<long>(std::cout.flags());
+        long fmt_precision = static_cast<long>(std::cout.precision());
+        MPI_Bcast(&fmt_flags, 1, MPI_LONG, 0, MPI_COMM_WORLD);
+        MPI_Bcast(&fmt_precision, 1, MPI_LONG, 0, MPI_COMM_WORLD);
+        std::cout.flags(static_cast<std::ios_base::fmtflags>(fmt_flags));
+        std::cout.precision(fmt_precision);
+    }
+
+    std::complex<double> ***cmat_convert;
+    memory->allocate(cmat_convert, nk, ns, ns);
+
+    for (int ichain = ichain_start; ichain < nchain; ichain += ichain_stride) {
 
         converged_prev = false;
 
-        for (i = 0; i < vec_temp.size(); ++i) {
+        for (i = chain_begin[ichain]; i < chain_begin[ichain + 1]; ++i) {
             temp = vec_temp[i];
 
             iT = static_cast<unsigned int>((temp - Tmin) / dT);
@@ -520,12 +727,20 @@ void Scph::exec_scph_main(std::complex<double> ****dymat_anharm)
                 }
             }
 
+            // The log of each temperature is printed in order by rank 0 afterwards.
+            // With DISTRIBUTE_V4 = 1, the logs of the other processes are discarded.
+            const auto capture_log = nchain > 1 || (distribute_v4 && mympi->my_rank > 0);
+            std::ostringstream ss_log;
+            std::streambuf *buf_cout = nullptr;
+            if (capture_log) buf_cout = std::cout.rdbuf(ss_log.rdbuf());
+
             compute_anharmonic_frequency(v4_array_all,
                                          omega2_anharm[iT],
                                          evec_anharm_tmp,
                                          temp,
                                          degeneracy_at_k,
                                          converged_prev,
+                                         niter_temp[iT],
                                          cmat_convert,
                                          selfenergy_offdiagonal);
 
@@ -533,11 +748,74 @@ void Scph::exec_scph_main(std::complex<double> ****dymat_anharm)
                                      omega2_anharm[iT],
                                      evec_anharm_tmp);
 
+            if (capture_log) {
+                std::cout.rdbuf(buf_cout);
+                if (nchain > 1) log_temp[i] = ss_log.str();
+            }
+
             if (!warmstart_scph) converged_prev = false;
         }
+    }
+
+    memory->deallocate(cmat_convert);
+
+    if (nchain > 1) {
+
+        // Print the logs in the order of temperature and collect the
+        // dynamical matrices to rank 0.
+
+        int len_log;
 
-        memory->deallocate(cmat_convert);
+        for (i = 0; i < NT; ++i) {
+            if (mympi->my_rank == 0) {
+                if (owner_temp[i] != 0) {
+                    MPI_Recv(&len_log, 1, MPI_INT, owner_temp[i], i, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+                    log_temp[i].resize(len_log);
+                    if (len_log > 0) {
+                        MPI_Recv(&log_temp[i][0], len_log, MPI_CHAR, owner_temp[i], i,
+                                 MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+                    }
+                }
+                std::cout << log_temp[i];
+            } else if (owner_temp[i] == mympi->my_rank) {
+                len_log = log_temp[i].size();
+                MPI_Send(&len_log, 1, MPI_INT, 0, i, MPI_COMM_WORLD);
+                if (len_log > 0) {
+                    MPI_Send(&log_temp[i][0], len_log, MPI_CHAR, 0, i, MPI_COMM_WORLD);
+                }
+            }
+        }
 
+        const int ndata = NT * ns * ns * nk_interpolate;
+#ifdef MPI_CXX_DOUBLE_COMPLEX
+        const auto mpi_complex_type = MPI_CXX_DOUBLE_COMPLEX;
+#else
+        const auto mpi_complex_type = MPI_COMPLEX16;
+#endif
+        if (mympi->my_rank == 0) {
+            MPI_Reduce(MPI_IN_PLACE, &dymat_anharm[0][0][0][0], ndata,
+                       mpi_complex_type, MPI_SUM, 0, MPI_COMM_WORLD);
+        } else {
+            MPI_Reduce(&dymat_anharm[0][0][0][0], nullptr, ndata,
+                       mpi_complex_type, MPI_SUM, 0, MPI_COMM_WORLD);
+        }
+
+        if (mympi->my_rank == 0) {
+            MPI_Reduce(MPI_IN_PLACE, &niter_temp[0], NT,
+                       MPI_UNSIGNED, MPI_SUM, 0, MPI_COMM_WORLD);
+        } else {
+            MPI_Reduce(&niter_temp[0], nullptr, NT,
+                       MPI_UNSIGNED, MPI_SUM, 0, MPI_COMM_WORLD);
+        }
+    }
+
+    if (mympi->my_rank == 0) {
+        std::cout << " Number of SCPH iterations at each temperature" << std::endl;
+        for (iT = 0; iT < NT; ++iT) {
+            std::cout << "  Temp = " << std::setw(10) << Tmin + static_cast<double>(iT) * dT
+                << " : " << std::setw(5) << niter_temp[iT] << std::endl;
+        }
+        std::cout << std::endl;
     }
 
     mpi_bcast_complex(dymat_anharm, NT, nk_interpolate, ns);
@@ -560,16 +838,13 @@ void Scph::compute_V3_elements_mpi_over_kpoint(std::complex<double> ***v3_out,
     auto ns2 = ns * ns;
     auto ns3 = ns * ns * ns;
     unsigned int ik, is, js, ks;
-    double phase, phase3[3];
-    int loc, loc3[3];
+    int coef[9];
     unsigned int **ind;
-    unsigned int i, j, ielem;
+    unsigned int i, j;
     std::complex<double> sum_tmp;
     std::complex<double> ret;
     long int ii;
 
-    auto inv2pi = 1.0 / (2.0 * pi);
-    auto dnk_represent = static_cast<double>(nk_represent);
     auto factor = std::pow(0.5, 2) / static_cast<double>(nk_scph);
     static auto complex_zero = std::complex<double>(0.0, 0.0);
     std::complex<double> *v3_array_at_kpair;
@@ -587,47 +862,25 @@ void Scph::compute_V3_elements_mpi_over_kpoint(std::complex<double> ***v3_out,
 
     memory->allocate(v3_array_at_kpair, ngroup);
     memory->allocate(ind, ngroup, 3);
+    std::vector<int> phase_index(3 * std::max(fcs_csr_v3.nelem(), 1u));
     memory->allocate(v3_mpi, nk_scph, ns, ns2);
 
     for (ik = mympi->my_rank; ik < nk_scph; ik += mympi->nprocs) {
 
         for (is = 0; is < ngroup; ++is) v3_array_at_kpair[is] = complex_zero;
 
-        ielem = 0;
-
-        for (i = 0; i < ngroup; ++i) {
-
-            sum_tmp = std::complex<double>(0.0, 0.0);
-            for (j = 0; j < 3; ++j) ind[i][j] = evec_index3[ielem][j];
-
-            if (tune_type == 0) {
-                for (j = 0; j < fcs_group[i].size(); ++j) {
-                    phase
-                        = xk_scph[ik][0] * (vec_for_v3[ielem][0][0] - vec_for_v3[ielem][1][0])
-                        + xk_scph[ik][1] * (vec_for_v3[ielem][0][1] - vec_for_v3[ielem][1][1])
-                        + xk_scph[ik][2] * (vec_for_v3[ielem][0][2] - vec_for_v3[ielem][1][2]);
-
-                    loc = nint(phase * dnk_represent * inv2pi) % nk_represent + nk_represent - 1;
-
-                    sum_tmp += fcs_group[i][j] * invmass_for_v3[ielem] * exp_phase[loc];
-
-                    ++ielem;
-                }
-            } else if (tune_type == 1) {
-                for (j = 0; j < fcs_group2[i].size(); ++j) {
-
-                    for (ii = 0; ii < 3; ++ii) {
-                        phase3[ii] = xk_scph[ik][ii] * (vec_for_v3[ielem][0][ii] - vec_for_v3[ielem][1][ii]);
-                        loc3[ii] = nint(phase3[ii] * dnk[ii] * inv2pi) % nk_grid[ii] + nk_grid[ii] - 1;
-                    }
+        if (!phase_factor.get_mesh_coordinate(xk_scph[ik], coef)) {
+            error->exit("compute_V3_elements_mpi_over_kpoint",
+                        "The k point is not on the SCPH mesh.");
+        }
+        for (j = 0; j < 3; ++j) coef[j + 3] = -coef[j];
 
-                    sum_tmp += fcs_group[i][j] * invmass_for_v3[ielem]
-                        * exp_phase3[loc3[0]][loc3[1]][loc3[2]];
+        phase_factor.calc_phase_index(fcs_csr_v3, coef, &phase_index[0]);
 
-                    ++ielem;
-                }
-            }
-            v3_array_at_kpair[i] = sum_tmp;
+#pragma omp parallel for private(j)
+        for (i = 0; i < ngroup; ++i) {
+            for (j = 0; j < 3; ++j) ind[i][j] = evec_index3[fcs_csr_v3.offset[i]][j];
+            v3_array_at_kpair[i] = phase_factor.sum_phase_factor(fcs_csr_v3, i, &phase_index[0]);
         }
 
 #pragma omp parallel for private(is)
@@ -728,6 +981,73 @@ void Scph::compute_V3_elements_mpi_over_kpoint(std::complex<double> ***v3_out,
     }
 }
 
+void Scph::setup_v4_layout()
+{
+    const auto ns = dynamical->neval;
+    const unsigned int nk2_prod = kp_irred_interpolate.size() * nk_scph;
+
+    // Only the diagonal elements are used in the SCPH loop when SELF_OFFDIAG = 0.
+    // The off-diagonal elements at Gamma are necessary when relax_coordinate = true.
+    v4_diagonal_only = !selfenergy_offdiagonal && !relax_coordinate;
+
+    if (v4_diagonal_only) {
+        nrow_v4 = ns;
+        ncol_v4 = ns;
+    } else {
+        nrow_v4 = ns * (ns + 1) / 2;
+        ncol_v4 = ns * ns;
+    }
+
+    if (distribute_v4) {
+        if (nk2_prod > mympi->my_rank) {
+            nblock_v4 = (nk2_prod - mympi->my_rank + mympi->nprocs - 1) / mympi->nprocs;
+        } else {
+            nblock_v4 = 0;
+        }
+    } else {
+        nblock_v4 = nk2_prod;
+    }
+
+    if (mympi->my_rank == 0) {
+        const auto nblock_max = distribute_v4 ? (nk2_prod + mympi->nprocs - 1) / mympi->nprocs : nk2_prod;
+        const auto flags_old = std::cout.flags();
+        const auto precision_old = std::cout.precision();
+        std::cout << " Memory for v4_array_all per process : "
+            << std::setw(10) << std::fixed << std::setprecision(1)
+            << static_cast<double>(nblock_max) * static_cast<double>(nrow_v4 * ncol_v4)
+            * sizeof(std::complex<double>) / (1024.0 * 1024.0) << " MB";
+        if (distribute_v4) std::cout << " (DISTRIBUTE_V4 = 1)";
+        std::cout << std::endl;
+        std::cout.flags(flags_old);
+        std::cout.precision(precision_old);
+    }
+}
+
+int Scph::get_v4_block(const unsigned int ik_prod) const
+{
+    // Return the local index of the (k, k') block, or -1 if the block
+    // is not kept by this process.
+
+    if (!distribute_v4) return ik_prod;
+    if (ik_prod % mympi->nprocs != mympi->my_rank) return -1;
+    return ik_prod / mympi->nprocs;
+}
+
+unsigned int Scph::get_v4_row(const unsigned int is,
+                              const unsigned int js) const
+{
+    // is >= js is assumed.
+    if (v4_diagonal_only) return is;
+    return is * (is + 1) / 2 + js;
+}
+
+unsigned int Scph::get_v4_col(const unsigned int ks,
+                              const unsigned int ls) const
+{
+    if (v4_diagonal_only) return ks;
+    return dynamical->neval * ks + ls;
+}
+
 void Scph::compute_V4_elements_mpi_over_kpoint(std::complex<double> ***v4_out,
                                                std::complex<double> ***evec_in,
                                                const bool self_offdiag,
@@ -743,20 +1063,23 @@ void Scph::compute_V4_elements_mpi_over_kpoint(std::complex<double> ***v4_out,
     auto ns4 = ns * ns * ns * ns;
     unsigned int ik, jk, is, js, ks, ls;
     unsigned int knum;
-    double phase, phase3[3];
-    int loc, loc3[3];
+    int coef[9];
     unsigned int **ind;
-    unsigned int i, j, ielem;
-    std::complex<double> sum_tmp;
-    std::complex<double> ret;
+    unsigned int i, j;
     long int ii;
 
-    auto inv2pi = 1.0 / (2.0 * pi);
-    auto dnk_represent = static_cast<double>(nk_represent);
     auto factor = std::pow(0.5, 2) / static_cast<double>(nk_scph);
     static std::complex<double> complex_zero = std::complex<double>(0.0, 0.0);
     std::complex<double> *v4_array_at_kpair;
-    std::complex<double> ***v4_mpi;
+    std::complex<double> *v4_tmp1, *v4_tmp2, *v4_tmp3, *evec_conj;
+
+    char TRANSN[] = "N";
+    char TRANST[] = "T";
+    std::complex<double> alpha = std::complex<double>(1.0, 0.0);
+    std::complex<double> beta = std::complex<double>(0.0, 0.0);
+    int ns_int = ns;
+    int ns2_int = ns2;
+    int ns3_int = ns3;
 
     auto nk2_prod = nk_reduced_interpolate * nk_scph;
 
@@ -770,141 +1093,136 @@ void Scph::compute_V4_elements_mpi_over_kpoint(std::complex<double> ***v4_out,
 
     memory->allocate(v4_array_at_kpair, ngroup2);
     memory->allocate(ind, ngroup2, 4);
-    memory->allocate(v4_mpi, nk2_prod, ns2, ns2);
+    std::vector<int> phase_index(3 * std::max(fcs_csr_v4.nelem(), 1u));
+    memory->allocate(v4_tmp1, v4_diagonal_only ? ns3 : ns4);
+    memory->allocate(v4_tmp2, v4_diagonal_only ? ns3 : ns4);
+    memory->allocate(v4_tmp3, ns2);
+    memory->allocate(evec_conj, ns2);
+
+    // The elements are stored directly in v4_out and summed up in place
+    // so that a second buffer of the same size is not necessary.
+
+    for (ik = 0; ik < nblock_v4; ++ik) {
+#pragma omp parallel for private(is)
+        for (ii = 0; ii < nrow_v4; ++ii) {
+            for (is = 0; is < ncol_v4; ++is) {
+                v4_out[ik][ii][is] = complex_zero;
+            }
+        }
+    }
 
     for (int ik_prod = mympi->my_rank; ik_prod < nk2_prod; ik_prod += mympi->nprocs) {
         ik = ik_prod / nk_scph;
         jk = ik_prod % nk_scph;
 
         knum = kmap_interpolate_to_scph[kp_irred_interpolate[ik][0].knum];
+        const auto iblock = get_v4_block(ik_prod);
 
         for (is = 0; is < ngroup2; ++is) v4_array_at_kpair[is] = complex_zero;
 
-        ielem = 0;
-
-        for (i = 0; i < ngroup2; ++i) {
-
-            sum_tmp = std::complex<double>(0.0, 0.0);
-            for (j = 0; j < 4; ++j) ind[i][j] = evec_index4[ielem][j];
-
-            if (tune_type == 0) {
-                for (j = 0; j < fcs_group2[i].size(); ++j) {
-                    phase
-                        = - xk_scph[knum][0] * vec_for_v4[ielem][0][0]
-                        - xk_scph[knum][1] * vec_for_v4[ielem][0][1]
-                        - xk_scph[knum][2] * vec_for_v4[ielem][0][2]
-                        + xk_scph[jk][0] * (vec_for_v4[ielem][1][0] - vec_for_v4[ielem][2][0])
-                        + xk_scph[jk][1] * (vec_for_v4[ielem][1][1] - vec_for_v4[ielem][2][1])
-                        + xk_scph[jk][2] * (vec_for_v4[ielem][1][2] - vec_for_v4[ielem][2][2]);
-
-                    loc = nint(phase * dnk_represent * inv2pi) % nk_represent + nk_represent - 1;
-
-                    sum_tmp += fcs_group2[i][j] * invmass_for_v4[ielem] * exp_phase[loc];
-
-                    ++ielem;
-                }
-            } else if (tune_type == 1) {
-                for (j = 0; j < fcs_group2[i].size(); ++j) {
-
-                    for (ii = 0; ii < 3; ++ii) {
-                        phase3[ii] = - xk_scph[knum][ii] * vec_for_v4[ielem][0][ii]
-                            + xk_scph[jk][ii] * (vec_for_v4[ielem][1][ii] - vec_for_v4[ielem][2][ii]);
-                        loc3[ii] = nint(phase3[ii] * dnk[ii] * inv2pi) % nk_grid[ii] + nk_grid[ii] - 1;
-                    }
-
-                    sum_tmp += fcs_group2[i][j] * invmass_for_v4[ielem]
-                        * exp_phase3[loc3[0]][loc3[1]][loc3[2]];
-
-                    ++ielem;
-                }
-            }
-            v4_array_at_kpair[i] = sum_tmp;
+        if (!phase_factor.get_mesh_coordinate(xk_scph[knum], coef)
+            || !phase_factor.get_mesh_coordinate(xk_scph[jk], coef + 3)) {
+            error->exit("compute_V4_elements_mpi_over_kpoint",
+                        "The k point is not on the SCPH mesh.");
+        }
+        for (j = 0; j < 3; ++j) {
+            coef[j] = -coef[j];
+            coef[j + 6] = -coef[j + 3];
         }
 
-#pragma omp parallel for private(is)
-        for (ii = 0; ii < ns2; ++ii) {
-            for (is = 0; is < ns2; ++is) {
-                v4_mpi[ik_prod][ii][is] = complex_zero;
-                v4_out[ik_prod][ii][is] = complex_zero;
-            }
+        phase_factor.calc_phase_index(fcs_csr_v4, coef, &phase_index[0]);
+
+#pragma omp parallel for private(j)
+        for (i = 0; i < ngroup2; ++i) {
+            for (j = 0; j < 4; ++j) ind[i][j] = evec_index4[fcs_csr_v4.offset[i]][j];
+            v4_array_at_kpair[i] = phase_factor.sum_phase_factor(fcs_csr_v4, i, &phase_index[0]);
         }
 
-        if (self_offdiag) {
+        if (self_offdiag || (relax && (knum == 0 || jk == 0))) {
 
             // All matrix elements will be calculated when considering the off-diagonal
             // elements of phonon selfenergy.
+            //
+            // V(is,js,ks,ls) = sum_g v4_array_at_kpair[g] * e(k)[is][a] * e(k)^*[js][b]
+            //                        * e(k')[ks][c] * e(k')^*[ls][d]
+            // is evaluated by staged contractions of O(ns^5) each.
+            // Each zgemm contracts the last index of the row-major tensor and
+            // puts the new index in front, i.e., X[p][q][r][d] -> Y[d'][p][q][r].
 
-#pragma omp parallel for private(is, js, ks, ls, ret, i)
-            for (ii = 0; ii < ns4; ++ii) {
-                is = ii / ns3;
-                js = (ii - ns3 * is) / ns2;
-                ks = (ii - ns3 * is - ns2 * js) / ns;
-                ls = ii % ns;
+            for (ii = 0; ii < ns4; ++ii) v4_tmp1[ii] = complex_zero;
 
-                if (is < js) continue;
-
-                ret = std::complex<double>(0.0, 0.0);
+            // v4_tmp1[ls][a][b][c] = sum_d phi4(a,b,c,d) * e(k')^*[ls][d]
 
+#pragma omp parallel for private(i)
+            for (ls = 0; ls < ns; ++ls) {
                 for (i = 0; i < ngroup2; ++i) {
-
-                    ret += v4_array_at_kpair[i]
-                        * evec_in[knum][is][ind[i][0]]
-                        * std::conj(evec_in[knum][js][ind[i][1]])
-                        * evec_in[jk][ks][ind[i][2]]
-                        * std::conj(evec_in[jk][ls][ind[i][3]]);
+                    v4_tmp1[ns3 * ls + ns2 * ind[i][0] + ns * ind[i][1] + ind[i][2]]
+                        += v4_array_at_kpair[i] * std::conj(evec_in[jk][ls][ind[i][3]]);
                 }
-
-                v4_mpi[ik_prod][ns * is + js][ns * ks + ls] = factor * ret;
             }
 
-        } else {
-
-            // Only diagonal elements will be computed when neglecting the polarization mixing.
-
-            if (relax && (knum == 0 || jk == 0)) {
-
-#pragma omp parallel for private(is, js, ks, ls, ret, i)
-                for (ii = 0; ii < ns4; ++ii) {
-                    is = ii / ns3;
-                    js = (ii - ns3 * is) / ns2;
-                    ks = (ii - ns3 * is - ns2 * js) / ns;
-                    ls = ii % ns;
-
-                    if (is < js) continue;
-
-                    ret = std::complex<double>(0.0, 0.0);
+            for (ii = 0; ii < ns2; ++ii) evec_conj[ii] = std::conj(evec_in[knum][0][ii]);
 
-                    for (i = 0; i < ngroup2; ++i) {
+            // v4_tmp2[ks][ls][a][b] = sum_c v4_tmp1[ls][a][b][c] * e(k')[ks][c]
+            zgemm_(TRANST, TRANSN, &ns3_int, &ns_int, &ns_int, &alpha,
+                   v4_tmp1, &ns_int, &evec_in[jk][0][0], &ns_int, &beta, v4_tmp2, &ns3_int);
+            // v4_tmp1[js][ks][ls][a] = sum_b v4_tmp2[ks][ls][a][b] * e(k)^*[js][b]
+            zgemm_(TRANST, TRANSN, &ns3_int, &ns_int, &ns_int, &alpha,
+                   v4_tmp2, &ns_int, evec_conj, &ns_int, &beta, v4_tmp1, &ns3_int);
+            // v4_tmp2[is][js][ks][ls] = sum_a v4_tmp1[js][ks][ls][a] * e(k)[is][a]
+            zgemm_(TRANST, TRANSN, &ns3_int, &ns_int, &ns_int, &alpha,
+                   v4_tmp1, &ns_int, &evec_in[knum][0][0], &ns_int, &beta, v4_tmp2, &ns3_int);
 
-                        ret += v4_array_at_kpair[i]
-                            * evec_in[knum][is][ind[i][0]]
-                            * std::conj(evec_in[knum][js][ind[i][1]])
-                            * evec_in[jk][ks][ind[i][2]]
-                            * std::conj(evec_in[jk][ls][ind[i][3]]);
+#pragma omp parallel for private(js, ks, ls)
+            for (is = 0; is < ns; ++is) {
+                for (js = 0; js <= is; ++js) {
+                    if (v4_diagonal_only && js != is) continue;
+                    const auto irow = get_v4_row(is, js);
+                    for (ks = 0; ks < ns; ++ks) {
+                        for (ls = 0; ls < ns; ++ls) {
+                            if (v4_diagonal_only && ls != ks) continue;
+                            v4_out[iblock][irow][get_v4_col(ks, ls)]
+                                = factor * v4_tmp2[ns3 * is + ns2 * js + ns * ks + ls];
+                        }
                     }
-
-                    v4_mpi[ik_prod][ns * is + js][ns * ks + ls] = factor * ret;
                 }
+            }
 
-            } else {
+        } else {
 
-#pragma omp parallel for private(is, js, ret, i)
-                for (ii = 0; ii < ns2; ++ii) {
-                    is = ii / ns;
-                    js = ii % ns;
+            // Only diagonal elements will be computed when neglecting the polarization mixing.
+            //
+            // v4_tmp1[ks][a][b] = sum_g phi4(a,b,c,d) * e(k')[ks][c] * e(k')^*[ks][d]
+            // v4_tmp2[is][a][b] = e(k)[is][a] * e(k)^*[is][b]
+            // V(is,is,ks,ks) = sum_(a,b) v4_tmp1[ks][a][b] * v4_tmp2[is][a][b]
 
-                    ret = std::complex<double>(0.0, 0.0);
+            for (ii = 0; ii < ns3; ++ii) v4_tmp1[ii] = complex_zero;
 
-                    for (i = 0; i < ngroup2; ++i) {
+#pragma omp parallel for private(i)
+            for (ks = 0; ks < ns; ++ks) {
+                for (i = 0; i < ngroup2; ++i) {
+                    v4_tmp1[ns2 * ks + ns * ind[i][0] + ind[i][1]]
+                        += v4_array_at_kpair[i] * evec_in[jk][ks][ind[i][2]]
+                        * std::conj(evec_in[jk][ks][ind[i][3]]);
+                }
+            }
 
-                        ret += v4_array_at_kpair[i]
-                            * evec_in[knum][is][ind[i][0]]
-                            * std::conj(evec_in[knum][is][ind[i][1]])
-                            * evec_in[jk][js][ind[i][2]]
-                            * std::conj(evec_in[jk][js][ind[i][3]]);
-                    }
+#pragma omp parallel for private(js)
+            for (is = 0; is < ns; ++is) {
+                for (js = 0; js < ns2; ++js) {
+                    v4_tmp2[ns2 * is + js] = evec_in[knum][is][js / ns]
+                        * std::conj(evec_in[knum][is][js % ns]);
+                }
+            }
 
-                    v4_mpi[ik_prod][(ns + 1) * is][(ns + 1) * js] = factor * ret;
+            // v4_tmp3[is][ks] (row-major)
+            zgemm_(TRANST, TRANSN, &ns_int, &ns_int, &ns2_int, &alpha,
+                   v4_tmp1, &ns2_int, v4_tmp2, &ns2_int, &beta, v4_tmp3, &ns_int);
+
+            for (is = 0; is < ns; ++is) {
+                const auto irow = get_v4_row(is, is);
+                for (ks = 0; ks < ns; ++ks) {
+                    v4_out[iblock][irow][get_v4_col(ks, ks)] = factor * v4_tmp3[ns * is + ks];
                 }
             }
         }
@@ -912,16 +1230,22 @@ void Scph::compute_V4_elements_mpi_over_kpoint(std::complex<double> ***v4_out,
 
     memory->deallocate(v4_array_at_kpair);
     memory->deallocate(ind);
+    memory->deallocate(v4_tmp1);
+    memory->deallocate(v4_tmp2);
+    memory->deallocate(v4_tmp3);
+    memory->deallocate(evec_conj);
+
+    if (!distribute_v4) {
 #ifdef MPI_CXX_DOUBLE_COMPLEX
-    MPI_Allreduce(&v4_mpi[0][0][0], &v4_out[0][0][0], nk2_prod*ns4, 
-        MPI_CXX_DOUBLE_COMPLEX, MPI_SUM, MPI_COMM_WORLD);
+        mympi->MPI_Allreduce_inplace(&v4_out[0][0][0],
+                                     static_cast<size_t>(nk2_prod) * nrow_v4 * ncol_v4,
+                                     MPI_CXX_DOUBLE_COMPLEX, MPI_SUM);
 #else
-    MPI_Allreduce(&v4_mpi[0][0][0], &v4_out[0][0][0], nk2_prod * ns4,
-                  MPI_COMPLEX16, MPI_SUM, MPI_COMM_WORLD);
+        mympi->MPI_Allreduce_inplace(&v4_out[0][0][0],
+                                     static_cast<size_t>(nk2_prod) * nrow_v4 * ncol_v4,
+                                     MPI_COMPLEX16, MPI_SUM);
 #endif
-
-    memory->deallocate(v4_mpi);
-
+    }
 
     zerofill_elements_acoustic_at_gamma(omega2_harmonic, v4_out, 4);
 
@@ -943,14 +1267,12 @@ void Scph::compute_V4_elements_mpi_over_band(std::complex<double> ***v4_out,
     auto nk_reduced_interpolate = kp_irred_interpolate.size();
     auto ns = dynamical->neval;
     auto ns2 = ns * ns;
-    auto ns4 = ns * ns * ns * ns;
     int is, js;
     unsigned int ks, ls;
     unsigned int knum;
-    double phase, phase3[3];
-    int loc, loc3[3];
+    int coef[9];
     unsigned int **ind;
-    unsigned int i, j, k, ielem;
+    unsigned int i, j;
     std::complex<double> sum_tmp;
     std::complex<double> ret;
     long int *nset_mpi;
@@ -958,12 +1280,9 @@ void Scph::compute_V4_elements_mpi_over_band(std::complex<double> ***v4_out,
     int ik_now, jk_now;
     int is_now, js_now, is_prod;
 
-    auto inv2pi = 1.0 / (2.0 * pi);
-    auto dnk_represent = static_cast<double>(nk_represent);
     auto factor = std::pow(0.5, 2) / static_cast<double>(nk_scph);
     static std::complex<double> complex_zero = std::complex<double>(0.0, 0.0);
     std::complex<double> *v4_array_at_kpair;
-    std::complex<double> ***v4_mpi;
 
     std::vector<int> ik_vec, jk_vec, is_vec, js_vec;
 
@@ -1025,13 +1344,12 @@ void Scph::compute_V4_elements_mpi_over_band(std::complex<double> ***v4_out,
 
     memory->allocate(v4_array_at_kpair, ngroup2);
     memory->allocate(ind, ngroup2, 4);
-    memory->allocate(v4_mpi, nk2_prod, ns2, ns2);
+    std::vector<int> phase_index(3 * std::max(fcs_csr_v4.nelem(), 1u));
 
     for (ik_prod = 0; ik_prod < nk2_prod; ++ik_prod) {
 #pragma omp parallel for private (js)
-        for (is = 0; is < ns2; ++is) {
-            for (js = 0; js < ns2; ++js) {
-                v4_mpi[ik_prod][is][js] = complex_zero;
+        for (is = 0; is < nrow_v4; ++is) {
+            for (js = 0; js < ncol_v4; ++js) {
                 v4_out[ik_prod][is][js] = complex_zero;
             }
         }
@@ -1059,52 +1377,29 @@ void Scph::compute_V4_elements_mpi_over_band(std::complex<double> ***v4_out,
 
             for (is = 0; is < ngroup2; ++is) v4_array_at_kpair[is] = complex_zero;
 
-            ielem = 0;
-
-            for (i = 0; i < ngroup2; ++i) {
-
-                sum_tmp = std::complex<double>(0.0, 0.0);
-                for (j = 0; j < 4; ++j) ind[i][j] = evec_index4[ielem][j];
-
-                if (tune_type == 0) {
-                    for (j = 0; j < fcs_group2[i].size(); ++j) {
-                        phase
-                            = - xk_scph[knum][0] * vec_for_v4[ielem][0][0]
-                            - xk_scph[knum][1] * vec_for_v4[ielem][0][1]
-                            - xk_scph[knum][2] * vec_for_v4[ielem][0][2]
-                            + xk_scph[jk_now][0] * (vec_for_v4[ielem][1][0] - vec_for_v4[ielem][2][0])
-                            + xk_scph[jk_now][1] * (vec_for_v4[ielem][1][1] - vec_for_v4[ielem][2][1])
-                            + xk_scph[jk_now][2] * (vec_for_v4[ielem][1][2] - vec_for_v4[ielem][2][2]);
-
-                        loc = nint(phase * dnk_represent * inv2pi) % nk_represent + nk_represent - 1;
-
-                        sum_tmp += fcs_group2[i][j] * invmass_for_v4[ielem] * exp_phase[loc];
-
-                        ++ielem;
-                    }
-                } else if (tune_type == 1) {
-                    for (j = 0; j < fcs_group2[i].size(); ++j) {
-
-                        for (k = 0; k < 3; ++k) {
-                            phase3[k] = - xk_scph[knum][k] * vec_for_v4[ielem][0][k]
-                                + xk_scph[jk_now][k] * (vec_for_v4[ielem][1][k] - vec_for_v4[ielem][2][k]);
-                            loc3[k] = nint(phase3[k] * dnk[k] * inv2pi) % nk_grid[k] + nk_grid[k] - 1;
-                        }
+            if (!phase_factor.get_mesh_coordinate(xk_scph[knum], coef)
+                || !phase_factor.get_mesh_coordinate(xk_scph[jk_now], coef + 3)) {
+                error->exit("compute_V4_elements_mpi_over_band",
+                            "The k point is not on the SCPH mesh.");
+            }
+            for (j = 0; j < 3; ++j) {
+                coef[j] = -coef[j];
+                coef[j + 6] = -coef[j + 3];
+            }
 
-                        sum_tmp += fcs_group2[i][j] * invmass_for_v4[ielem]
-                            * exp_phase3[loc3[0]][loc3[1]][loc3[2]];
+            phase_factor.calc_phase_index(fcs_csr_v4, coef, &phase_index[0]);
 
-                        ++ielem;
-                    }
-                }
-                v4_array_at_kpair[i] = sum_tmp;
+#pragma omp parallel for private(j)
+            for (i = 0; i < ngroup2; ++i) {
+                for (j = 0; j < 4; ++j) ind[i][j] = evec_index4[fcs_csr_v4.offset[i]][j];
+                v4_array_at_kpair[i] = phase_factor.sum_phase_factor(fcs_csr_v4, i, &phase_index[0]);
             }
             ik_old = ik_now;
             jk_old = jk_now;
         }
 
         ik_prod = ik_now * nk_scph + jk_now;
-        is_prod = ns * is_now + js_now;
+        is_prod = get_v4_row(is_now, js_now);
 
 #pragma omp parallel for private (ks, ls, ret, i)
         for (js = 0; js < ns2; ++js) {
@@ -1114,41 +1409,255 @@ void Scph::compute_V4_elements_mpi_over_band(std::complex<double> ***v4_out,
 
             ret = std::complex<double>(0.0, 0.0);
 
-            for (i = 0; i < ngroup2; ++i) {
+            for (i = 0; i < ngroup2; ++i) {
+
+                ret += v4_array_at_kpair[i]
+                    * evec_in[knum][is_now][ind[i][0]]
+                    * std::conj(evec_in[knum][js_now][ind[i][1]])
+                    * evec_in[jk_now][ks][ind[i][2]]
+                    * std::conj(evec_in[jk_now][ls][ind[i][3]]);
+            }
+
+            v4_out[ik_prod][is_prod][js] = factor * ret;
+        }
+
+        if (mympi->my_rank == 0) {
+            std::cout << " SET " << ii + 1 << " done. " << std::endl;
+        }
+
+    } // loop over nk2_prod*ns2
+
+    memory->deallocate(v4_array_at_kpair);
+    memory->deallocate(ind);
+
+#ifdef MPI_CXX_DOUBLE_COMPLEX
+    mympi->MPI_Allreduce_inplace(&v4_out[0][0][0],
+                                 static_cast<size_t>(nk2_prod) * nrow_v4 * ncol_v4,
+                                 MPI_CXX_DOUBLE_COMPLEX, MPI_SUM);
+#else
+    mympi->MPI_Allreduce_inplace(&v4_out[0][0][0],
+                                 static_cast<size_t>(nk2_prod) * nrow_v4 * ncol_v4,
+                                 MPI_COMPLEX16, MPI_SUM);
+#endif
+
+    zerofill_elements_acoustic_at_gamma(omega2_harmonic, v4_out, 4);
+
+    if (mympi->my_rank == 0) {
+        std::cout << " done !" << std::endl;
+        timer->print_elapsed();
+    }
+}
+
+// The V4 store consists of the shards PREFIX.v4store.0, ..., PREFIX.v4store.(nshard-1).
+// Each shard has a header
+//   char[8] "ANPHV4SC", int version, int nshard, int ishard, int ns,
+//   int nk_scph, int nk_irred_interpolate, int nrow_v4, int ncol_v4, uint64 hash
+// where the hash is computed from the force constant files, the masses, the
+// k meshes, ns, and the layout of v4_array_all. The shard 0 is followed by the
+// harmonic frequencies omega2 [nk_scph * ns] and eigenvectors [nk_scph * ns * ns]
+// the V4 elements were computed with, which are compared with the present ones
+// since the phases of the eigenvectors are not fixed by the inputs.
+// Then the (k, k') blocks ik_prod = ishard, ishard + nshard, ...
+// of nrow_v4 * ncol_v4 complex numbers each follow.
+// The number of shards is recorded in the header so that the shards can be
+// read by any number of MPI processes.
+
+static const char v4store_magic[8] = {'A', 'N', 'P', 'H', 'V', '4', 'S', 'C'};
+static const int v4store_version = 2;
+static const size_t v4store_header_size = 8 + 8 * sizeof(int) + sizeof(unsigned long long);
+static const double v4store_tol_evec = 1.0e-8;
+
+unsigned long long Scph::get_hash_v4store() const
+{
+    // 64-bit FNV-1a hash of the inputs which determine v4_array_all.
+    // It is computed on rank 0 and broadcast.
+
+    unsigned long long hash = 0;
+
+    const auto add_bytes = [&hash](const void *ptr, const size_t n) {
+        const auto bytes = static_cast<const unsigned char *>(ptr);
+        for (size_t i = 0; i < n; ++i) {
+            hash ^= bytes[i];
+            hash *= 1099511628211ULL;
+        }
+    };
+
+    if (mympi->my_rank == 0) {
+        hash = anharmonic_core->get_hash_force_constants(kmesh_scph);
+
+        add_bytes(kmesh_interpolate, 3 * sizeof(unsigned int));
+        const int layout[3] = {static_cast<int>(v4_diagonal_only),
+                               static_cast<int>(nrow_v4), static_cast<int>(ncol_v4)};
+        add_bytes(layout, 3 * sizeof(int));
+    }
+    MPI_Bcast(&hash, 1, MPI_UNSIGNED_LONG_LONG, 0, MPI_COMM_WORLD);
+
+    return hash;
+}
+
+bool Scph::load_v4store(const std::string &file_v4store,
+                        const unsigned long long hash,
+                        std::complex<double> ***v4_out)
+{
+    // Read the blocks kept by this process from the store.
+    // Returns false on all processes if the store is missing or incomplete.
+
+    struct stat st;
+    int ival[8];
+    char magic[8];
+    unsigned long long hash_file;
+
+    const int ns = dynamical->neval;
+    const int nk_irred = kp_irred_interpolate.size();
+    const unsigned int nk2_prod = nk_irred * nk_scph;
+    const size_t size_block = static_cast<size_t>(nrow_v4) * ncol_v4 * sizeof(std::complex<double>);
+    const size_t size_evec = static_cast<size_t>(nk_scph) * ns * (sizeof(double) + ns * sizeof(std::complex<double>));
+
+    // Check the headers and sizes of all the shards
+
+    int nshard = 0;
+    auto is_valid = true;
+
+    for (int ishard = 0; is_valid && (ishard == 0 || ishard < nshard); ++ishard) {
+        const auto file_shard = file_v4store + "." + std::to_string(ishard);
+        std::ifstream ifs(file_shard.c_str(), std::ios::in | std::ios::binary);
+
+        if (!ifs || stat(file_shard.c_str(), &st) != 0) {
+            is_valid = false;
+            break;
+        }
+        ifs.read(magic, 8);
+        ifs.read(reinterpret_cast<char *>(ival), 8 * sizeof(int));
+        ifs.read(reinterpret_cast<char *>(&hash_file), sizeof(unsigned long long));
+
+        if (ishard == 0) nshard = ival[1];
+
+        const size_t nblock_shard = nshard > ishard ? (nk2_prod - ishard + nshard - 1) / nshard : 0;
+        const size_t offset_block = v4store_header_size + (ishard == 0 ? size_evec : 0);
+
+        if (!ifs || std::memcmp(magic, v4store_magic, 8) != 0 || ival[0] != v4store_version
+            || ival[1] != nshard || ival[2] != ishard || ival[3] != ns
+            || ival[4] != static_cast<int>(nk_scph) || ival[5] != nk_irred
+            || ival[6] != static_cast<int>(nrow_v4) || ival[7] != static_cast<int>(ncol_v4)
+            || hash_file != hash || nshard <= 0
+            || static_cast<size_t>(st.st_size) != offset_block + nblock_shard * size_block) {
+            is_valid = false;
+        }
+
+        // The harmonic eigenvectors are identical on all MPI processes,
+        // so that only rank 0 compares them.
+
+        if (is_valid && ishard == 0 && mympi->my_rank == 0) {
+            std::vector<double> omega2_file(nk_scph * ns);
+            std::vector<std::complex<double>> evec_file(nk_scph * ns * ns);
+
+            ifs.read(reinterpret_cast<char *>(&omega2_file[0]), omega2_file.size() * sizeof(double));
+            ifs.read(reinterpret_cast<char *>(&evec_file[0]),
+                     evec_file.size() * sizeof(std::complex<double>));
+
+            double diff = 0.0;
+            for (size_t i = 0; i < omega2_file.size(); ++i) {
+                diff = std::max(diff, std::abs(omega2_file[i] - (&omega2_harmonic[0][0])[i]));
+            }
+            for (size_t i = 0; i < evec_file.size(); ++i) {
+                diff = std::max(diff, std::abs(evec_file[i] - (&evec_harmonic[0][0][0])[i]));
+            }
+            if (!ifs || diff > v4store_tol_evec) is_valid = false;
+        }
+    }
+
+    int ivalid = is_valid ? 1 : 0;
+    MPI_Allreduce(MPI_IN_PLACE, &ivalid, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+
+    if (!ivalid) {
+        if (mympi->my_rank == 0) {
+            std::cout << " V4STORE = 1: " << file_v4store
+                << ".* is not found, incomplete, or inconsistent. V4 elements will be computed." << std::endl;
+        }
+        return false;
+    }
+
+    if (mympi->my_rank == 0) {
+        std::cout << " V4STORE = 1: Reading V4 elements from " << file_v4store << ".* ("
+            << nshard << " shards) ...";
+    }
+
+    for (int ishard = 0; ishard < nshard; ++ishard) {
+        const auto file_shard = file_v4store + "." + std::to_string(ishard);
+        std::ifstream ifs(file_shard.c_str(), std::ios::in | std::ios::binary);
+
+        const size_t offset_block = v4store_header_size + (ishard == 0 ? size_evec : 0);
+
+        size_t iblock_file = 0;
+        for (unsigned int ik_prod = ishard; ik_prod < nk2_prod; ik_prod += nshard) {
+            const auto iblock = get_v4_block(ik_prod);
+            if (iblock >= 0) {
+                ifs.seekg(offset_block + iblock_file * size_block);
+                ifs.read(reinterpret_cast<char *>(&v4_out[iblock][0][0]), size_block);
+                if (!ifs) {
+                    error->exit("load_v4store", "Could not read the V4 store file ",
+                                file_shard.c_str());
+                }
+            }
+            ++iblock_file;
+        }
+    }
+
+    if (mympi->my_rank == 0) {
+        std::cout << " done !" << std::endl;
+        timer->print_elapsed();
+    }
+
+    return true;
+}
+
+void Scph::save_v4store(const std::string &file_v4store,
+                        const unsigned long long hash,
+                        std::complex<double> ***v4_in) const
+{
+    // Each process writes the blocks ik_prod = my_rank, my_rank + nprocs, ...
+    // to its own shard. The shards are renamed after all of them are complete
+    // so that an interrupted run does not leave a broken store.
+
+    const int ns = dynamical->neval;
+    const int nk_irred = kp_irred_interpolate.size();
+    const unsigned int nk2_prod = nk_irred * nk_scph;
+    const size_t size_block = static_cast<size_t>(nrow_v4) * ncol_v4 * sizeof(std::complex<double>);
 
-                ret += v4_array_at_kpair[i]
-                    * evec_in[knum][is_now][ind[i][0]]
-                    * std::conj(evec_in[knum][js_now][ind[i][1]])
-                    * evec_in[jk_now][ks][ind[i][2]]
-                    * std::conj(evec_in[jk_now][ls][ind[i][3]]);
-            }
+    const auto file_shard = file_v4store + "." + std::to_string(mympi->my_rank);
+    const auto file_tmp = file_shard + ".tmp";
 
-            v4_mpi[ik_prod][is_prod][js] = factor * ret;
-        }
+    std::ofstream ofs(file_tmp.c_str(), std::ios::out | std::ios::binary);
+    if (!ofs) error->exit("save_v4store", "Could not open the V4 store file ", file_tmp.c_str());
 
-        if (mympi->my_rank == 0) {
-            std::cout << " SET " << ii + 1 << " done. " << std::endl;
-        }
+    const int ival[8] = {v4store_version, mympi->nprocs, mympi->my_rank, ns,
+                         static_cast<int>(nk_scph), nk_irred,
+                         static_cast<int>(nrow_v4), static_cast<int>(ncol_v4)};
+    ofs.write(v4store_magic, 8);
+    ofs.write(reinterpret_cast<const char *>(ival), 8 * sizeof(int));
+    ofs.write(reinterpret_cast<const char *>(&hash), sizeof(unsigned long long));
 
-    } // loop over nk2_prod*ns2
+    if (mympi->my_rank == 0) {
+        ofs.write(reinterpret_cast<const char *>(&omega2_harmonic[0][0]),
+                  static_cast<size_t>(nk_scph) * ns * sizeof(double));
+        ofs.write(reinterpret_cast<const char *>(&evec_harmonic[0][0][0]),
+                  static_cast<size_t>(nk_scph) * ns * ns * sizeof(std::complex<double>));
+    }
 
-    memory->deallocate(v4_array_at_kpair);
-    memory->deallocate(ind);
-#ifdef MPI_CXX_DOUBLE_COMPLEX
-    MPI_Allreduce(&v4_mpi[0][0][0], &v4_out[0][0][0], nk2_prod*ns4, 
-        MPI_CXX_DOUBLE_COMPLEX, MPI_SUM, MPI_COMM_WORLD);
-#else
-    MPI_Allreduce(&v4_mpi[0][0][0], &v4_out[0][0][0], nk2_prod * ns4,
-                  MPI_COMPLEX16, MPI_SUM, MPI_COMM_WORLD);
-#endif
+    for (unsigned int ik_prod = mympi->my_rank; ik_prod < nk2_prod; ik_prod += mympi->nprocs) {
+        ofs.write(reinterpret_cast<const char *>(&v4_in[get_v4_block(ik_prod)][0][0]), size_block);
+    }
+    ofs.close();
+    if (!ofs) error->exit("save_v4store", "Could not write the V4 store file ", file_tmp.c_str());
 
-    memory->deallocate(v4_mpi);
+    MPI_Barrier(MPI_COMM_WORLD);
 
-    zerofill_elements_acoustic_at_gamma(omega2_harmonic, v4_out, 4);
+    if (std::rename(file_tmp.c_str(), file_shard.c_str()) != 0) {
+        error->exit("save_v4store", "Could not rename the V4 store file ", file_tmp.c_str());
+    }
 
     if (mympi->my_rank == 0) {
-        std::cout << " done !" << std::endl;
-        timer->print_elapsed();
+        std::cout << " V4STORE = 1: V4 elements are saved to " << file_v4store << ".*" << std::endl;
     }
 }
 
@@ -1222,35 +1731,33 @@ void Scph::zerofill_elements_acoustic_at_gamma(double **omega2,
 
     } else if (fc_order == 4) {
         // Set V4 to zeros so as to avoid mixing with gamma acoustic modes
-        // jk = 0;
+        // for the (k, k') blocks with jk = 0 or ik = 0.
+        // The layout of v_elems is given by get_v4_block, get_v4_row, and get_v4_col.
         for (ik = 0; ik < nk_reduced_interpolate; ++ik) {
-            for (is = 0; is < ns; ++is) {
-                for (js = 0; js < ns; ++js) {
-                    for (ks = 0; ks < ns; ++ks) {
-                        for (ls = 0; ls < ns; ++ls) {
-                            if (is_acoustic[ks] || is_acoustic[ls]) {
-                                v_elems[nk_scph * ik][ns * is + js][ns * ks + ls] = complex_zero;
-                            }
-                        }
-                    }
-                }
-            }
-        }
-        // ik = 0;
-        for (jk = 0; jk < nk_scph; ++jk) {
-            for (is = 0; is < ns; ++is) {
-                for (js = 0; js < ns; ++js) {
-                    if (is_acoustic[is] || is_acoustic[js]) {
+            for (jk = 0; jk < nk_scph; ++jk) {
+                if (ik != 0 && jk != 0) continue;
+
+                const auto iblock = get_v4_block(nk_scph * ik + jk);
+                if (iblock < 0) continue;
+
+                for (is = 0; is < ns; ++is) {
+                    for (js = 0; js <= is; ++js) {
+                        if (v4_diagonal_only && js != is) continue;
+                        const auto irow = get_v4_row(is, js);
+                        const auto zero_row = ik == 0 && (is_acoustic[is] || is_acoustic[js]);
+
                         for (ks = 0; ks < ns; ++ks) {
                             for (ls = 0; ls < ns; ++ls) {
-                                v_elems[jk][ns * is + js][ns * ks + ls] = complex_zero;
+                                if (v4_diagonal_only && ls != ks) continue;
+                                if (zero_row || (jk == 0 && (is_acoustic[ks] || is_acoustic[ls]))) {
+                                    v_elems[iblock][irow][get_v4_col(ks, ls)] = complex_zero;
+                                }
                             }
                         }
                     }
                 }
             }
         }
-
     }
 
     memory->deallocate(is_acoustic);
@@ -1347,21 +1854,14 @@ void Scph::setup_transform_symmetry()
     // mat_transport_sym.
 
     unsigned int ik;
-    unsigned int is, js;
-    unsigned int iat, jat, icrd, jcrd;
-    double phase;
-    double x1[3], x2[3], k[3], k_minus[3], Sk[3], xtmp[3];
-    double S_cart[3][3], S_frac[3][3], S_frac_inv[3][3];
+    unsigned int icrd, jcrd;
+    double k[3], k_minus[3], Sk[3];
     double S_recip[3][3];
-    std::complex<double> im(0.0, 1.0);
-    std::complex<double> **gamma_tmp;
     bool *flag;
 
-    const auto natmin = system->natmin;
     const auto ns = dynamical->neval;
     const auto nk_irred_interpolate = kp_irred_interpolate.size();
 
-    memory->allocate(gamma_tmp, ns, ns);
     memory->allocate(mat_transform_sym, nk_irred_interpolate,
                      symmetry->nsym, ns, ns);
     memory->allocate(small_group_at_k, nk_irred_interpolate);
@@ -1391,13 +1891,10 @@ void Scph::setup_transform_symmetry()
 
             for (icrd = 0; icrd < 3; ++icrd) {
                 for (jcrd = 0; jcrd < 3; ++jcrd) {
-                    S_cart[icrd][jcrd] = it.rot[3 * icrd + jcrd];
-                    S_frac[icrd][jcrd] = it.rot_real[3 * icrd + jcrd];
                     S_recip[icrd][jcrd] = it.rot_reciprocal[3 * icrd + jcrd];
                 }
             }
 
-            invmat3(S_frac_inv, S_frac);
             rotvec(Sk, k, S_recip);
 
             for (auto i = 0; i < 3; ++i) Sk[i] = Sk[i] - nint(Sk[i]);
@@ -1417,47 +1914,12 @@ void Scph::setup_transform_symmetry()
                 flag[knum_sym] = true;
             }
 
-            for (is = 0; is < ns; ++is) {
-                for (js = 0; js < ns; ++js) {
-                    gamma_tmp[is][js] = std::complex<double>(0.0, 0.0);
-                }
-            }
-
-            for (jat = 0; jat < natmin; ++jat) {
-                iat = it.mapping[jat];
-
-                // Fractional coordinates of x1 and x2
-                for (icrd = 0; icrd < 3; ++icrd) {
-                    x1[icrd] = system->xr_p[system->map_p2s[iat][0]][icrd];
-                    x2[icrd] = system->xr_p[system->map_p2s[jat][0]][icrd];
-                }
-
-                rotvec(xtmp, x1, S_frac_inv);
-                for (icrd = 0; icrd < 3; ++icrd) {
-                    xtmp[icrd] = xtmp[icrd] - x2[icrd];
-                }
-
-                phase = 2.0 * pi * (k[0] * xtmp[0] + k[1] * xtmp[1] + k[2] * xtmp[2]);
-
-                for (icrd = 0; icrd < 3; ++icrd) {
-                    for (jcrd = 0; jcrd < 3; ++jcrd) {
-                        gamma_tmp[3 * iat + icrd][3 * jat + jcrd]
-                            = S_cart[icrd][jcrd] * std::exp(im * phase);
-                    }
-                }
-            }
-
-            for (is = 0; is < ns; ++is) {
-                for (js = 0; js < ns; ++js) {
-                    mat_transform_sym[ik][isym][is][js] = gamma_tmp[is][js];
-                }
-            }
+            dynamical->calc_symmetry_transform(k, it, mat_transform_sym[ik][isym]);
 
             ++isym;
         }
     }
 
-    memory->deallocate(gamma_tmp);
     memory->deallocate(flag);
 }
 
@@ -1609,25 +2071,22 @@ void Scph::setup_pp_interaction()
         std::sort(fcs_phonon->force_constant_with_cell[1].begin(),
                   fcs_phonon->force_constant_with_cell[1].end());
 
-        anharmonic_core->prepare_group_of_force_constants(fcs_phonon->force_constant_with_cell[1], 3,
-                                                          ngroup, fcs_group);
+        anharmonic_core->prepare_fcs_csr(fcs_phonon->force_constant_with_cell[1], 3, fcs_csr_v3);
+        ngroup = fcs_csr_v3.ngroup;
 
-        memory->allocate(vec_for_v3, fcs_phonon->force_constant_with_cell[1].size(), 2, 3);
-        memory->allocate(invmass_for_v3, fcs_phonon->force_constant_with_cell[1].size());
         memory->allocate(evec_index3, fcs_phonon->force_constant_with_cell[1].size(), 3);
 
 
+        // The mass factors are included in the force constants.
         j = 0;
         for (const auto &it : fcs_phonon->force_constant_with_cell[1]) {
-            invmass_for_v3[j]
-                = invsqrt_mass_p[it.pairs[0].index / 3]
+            fcs_csr_v3.fcs[j]
+                *= invsqrt_mass_p[it.pairs[0].index / 3]
                 * invsqrt_mass_p[it.pairs[1].index / 3]
                 * invsqrt_mass_p[it.pairs[2].index / 3];
 
             ++j;
         }
-        anharmonic_core->prepare_relative_vector(fcs_phonon->force_constant_with_cell[1],
-                                                 3, vec_for_v3);
 
         for (i = 0; i < fcs_phonon->force_constant_with_cell[1].size(); ++i) {
             for (j = 0; j < 3; ++j) {
@@ -1641,26 +2100,22 @@ void Scph::setup_pp_interaction()
     std::sort(fcs_phonon->force_constant_with_cell[2].begin(),
               fcs_phonon->force_constant_with_cell[2].end());
 
-    anharmonic_core->prepare_group_of_force_constants(fcs_phonon->force_constant_with_cell[2], 4,
-                                                      ngroup2, fcs_group2);
+    anharmonic_core->prepare_fcs_csr(fcs_phonon->force_constant_with_cell[2], 4, fcs_csr_v4);
+    ngroup2 = fcs_csr_v4.ngroup;
 
-    memory->allocate(vec_for_v4, fcs_phonon->force_constant_with_cell[2].size(), 3, 3);
-    memory->allocate(invmass_for_v4, fcs_phonon->force_constant_with_cell[2].size());
     memory->allocate(evec_index4, fcs_phonon->force_constant_with_cell[2].size(), 4);
 
 
     j = 0;
     for (const auto &it : fcs_phonon->force_constant_with_cell[2]) {
-        invmass_for_v4[j]
-            = invsqrt_mass_p[it.pairs[0].index / 3]
+        fcs_csr_v4.fcs[j]
+            *= invsqrt_mass_p[it.pairs[0].index / 3]
             * invsqrt_mass_p[it.pairs[1].index / 3]
             * invsqrt_mass_p[it.pairs[2].index / 3]
             * invsqrt_mass_p[it.pairs[3].index / 3];
 
         ++j;
     }
-    anharmonic_core->prepare_relative_vector(fcs_phonon->force_constant_with_cell[2],
-                                             4, vec_for_v4);
 
     for (i = 0; i < fcs_phonon->force_constant_with_cell[2].size(); ++i) {
         for (j = 0; j < 4; ++j) {
@@ -1672,73 +2127,14 @@ void Scph::setup_pp_interaction()
 
     memory->deallocate(invsqrt_mass_p);
 
-    nk_grid[0] = kmesh_scph[0];
-    nk_grid[1] = kmesh_scph[1];
-    nk_grid[2] = kmesh_scph[2];
-
-    for (i = 0; i < 3; ++i) dnk[i] = static_cast<double>(nk_grid[i]);
-
-    if (nk_grid[0] == nk_grid[1] && nk_grid[1] == nk_grid[2]) {
-        nk_represent = nk_grid[0];
-        tune_type = 0;
-
-    } else if (nk_grid[0] == nk_grid[1] && nk_grid[2] == 1) {
-        nk_represent = nk_grid[0];
-        tune_type = 0;
-
-    } else if (nk_grid[1] == nk_grid[2] && nk_grid[0] == 1) {
-        nk_represent = nk_grid[1];
-        tune_type = 0;
-
-    } else if (nk_grid[2] == nk_grid[0] && nk_grid[1] == 1) {
-        nk_represent = nk_grid[2];
-        tune_type = 0;
-
-    } else if (nk_grid[0] == 1 && nk_grid[1] == 1) {
-        nk_represent = nk_grid[2];
-        tune_type = 0;
-
-    } else if (nk_grid[1] == 1 && nk_grid[2] == 1) {
-        nk_represent = nk_grid[0];
-        tune_type = 0;
-
-    } else if (nk_grid[2] == 1 && nk_grid[0] == 1) {
-        nk_represent = nk_grid[1];
-        tune_type = 0;
-
-    } else {
-        tune_type = 1;
-    }
-
-    int ii, jj, kk;
-
-    if (tune_type == 0) {
-
-        double phase;
-
-        memory->allocate(exp_phase, 2 * nk_represent - 1);
-        for (ii = 0; ii < 2 * nk_represent - 1; ++ii) {
-            phase = 2.0 * pi * static_cast<double>(ii - nk_represent + 1)
-                / static_cast<double>(nk_represent);
-            exp_phase[ii] = std::exp(im * phase);
-        }
-
-    } else if (tune_type == 1) {
-        double phase[3];
+    int nk_tmp[3];
+    for (i = 0; i < 3; ++i) nk_tmp[i] = kmesh_scph[i];
 
-        tune_type = 1;
-        memory->allocate(exp_phase3, 2 * nk_grid[0] - 1, 2 * nk_grid[1] - 1, 2 * nk_grid[2] - 1);
+    phase_factor.setup(nk_tmp, {&fcs_csr_v3, &fcs_csr_v4});
 
-        for (ii = 0; ii < 2 * nk_grid[0] - 1; ++ii) {
-            phase[0] = 2.0 * pi * static_cast<double>(ii - nk_grid[0] + 1) / dnk[0];
-            for (jj = 0; jj < 2 * nk_grid[1] - 1; ++jj) {
-                phase[1] = 2.0 * pi * static_cast<double>(jj - nk_grid[1] + 1) / dnk[1];
-                for (kk = 0; kk < 2 * nk_grid[2] - 1; ++kk) {
-                    phase[2] = 2.0 * pi * static_cast<double>(kk - nk_grid[2] + 1) / dnk[2];
-                    exp_phase3[ii][jj][kk] = std::exp(im * (phase[0] + phase[1] + phase[2]));
-                }
-            }
-        }
+    if (!phase_factor.ready) {
+        error->exit("setup_pp_interaction",
+                    "Relative vectors of anharmonic force constants are not lattice vectors.");
     }
 
     if (mympi->my_rank == 0) {
@@ -1865,6 +2261,33 @@ void Scph::setup_transform_ifc()
         }
     }
 
+    // Distinct lattice vectors appearing in mindist_list_scph and the index
+    // of each shift in the list, used by fold_dymat_r and r2q_batch.
+
+    std::map<std::vector<int>, unsigned int> shift_index;
+
+    shift_list_scph.clear();
+
+    for (iat = 0; iat < nat; ++iat) {
+        for (jat = 0; jat < nat; ++jat) {
+            for (icell = 0; icell < ncell; ++icell) {
+                auto &mindist = mindist_list_scph[iat][jat][icell];
+                mindist.shift_index.clear();
+                for (const auto &it : mindist.shift) {
+                    vec_tmp = {it.sx, it.sy, it.sz};
+                    const auto it_index = shift_index.find(vec_tmp);
+                    if (it_index == shift_index.end()) {
+                        shift_index[vec_tmp] = shift_list_scph.size();
+                        mindist.shift_index.push_back(shift_list_scph.size());
+                        shift_list_scph.push_back(it);
+                    } else {
+                        mindist.shift_index.push_back(it_index->second);
+                    }
+                }
+            }
+        }
+    }
+
     memory->deallocate(shift_cell);
     memory->deallocate(shift_cell_super);
     memory->deallocate(xf_p);
@@ -1901,15 +2324,32 @@ void Scph::exec_interpolation(const unsigned int kmesh_orig[3],
         memory->allocate(mat_harmonic_na, ns, ns);
     }
 
+    // The anharmonic correction is Fourier transformed for nk_block k points at once.
+    const unsigned int nk_block = std::min(nk_dense, 256u);
+    std::complex<double> ***mat_block;
+
+    std::vector<std::complex<double>> dymat_fold;
+
+    memory->allocate(mat_block, nk_block, ns, ns);
+
+    fold_dymat_r(nk1 * nk2 * nk3, ns, dymat_r, dymat_fold);
+
     for (unsigned int ik = 0; ik < nk_dense; ++ik) {
+
+        const auto ik_block = ik % nk_block;
+
+        if (ik_block == 0) {
+            r2q_batch(std::min(nk_block, nk_dense - ik), &xk_dense[ik],
+                      ns, dymat_fold, mat_block);
+        }
+
         dynamical->calc_analytic_k(xk_dense[ik],
                                    fcs_phonon->fc2_ext,
                                    mat_harmonic);
-        r2q(xk_dense[ik], nk1, nk2, nk3, ns, dymat_r, mat_tmp);
 
         for (i = 0; i < ns; ++i) {
             for (j = 0; j < ns; ++j) {
-                mat_tmp[i][j] += mat_harmonic[i][j];
+                mat_tmp[i][j] = mat_block[ik_block][i][j] + mat_harmonic[i][j];
             }
         }
 
@@ -1953,6 +2393,7 @@ void Scph::exec_interpolation(const unsigned int kmesh_orig[3],
     memory->deallocate(eval_real);
     memory->deallocate(mat_tmp);
     memory->deallocate(mat_harmonic);
+    memory->deallocate(mat_block);
 
     if (dynamical->nonanalytic) {
         memory->deallocate(mat_harmonic_na);
@@ -1960,58 +2401,107 @@ void Scph::exec_interpolation(const unsigned int kmesh_orig[3],
 }
 
 
-void Scph::r2q(const double *xk_in,
-               const unsigned int nx,
-               const unsigned int ny,
-               const unsigned int nz,
-               const unsigned int ns,
-               std::complex<double> ***dymat_r_in,
-               std::complex<double> **dymat_k_out)
+void Scph::fold_dymat_r(const unsigned int ncell,
+                        const unsigned int ns,
+                        std::complex<double> ***dymat_r_in,
+                        std::vector<std::complex<double>> &dymat_fold) const
 {
-    unsigned int icell;
-    unsigned int i, j;
-    double phase;
-    unsigned int iat, jat;
-    std::complex<double> im(0.0, 1.0);
-    std::complex<double> exp_phase;
+    // Fold the force constants dymat_r_in[ns][ns][ncell] onto the distinct
+    // lattice vectors shift_list_scph for r2q_batch.
+    // dymat_fold[ns2 * ishift + ns * i + j]
 
-    auto ncell = nx * ny * nz;
+    unsigned int i, j, iat, jat;
+    const auto ns2 = ns * ns;
 
-    for (i = 0; i < ns; ++i) {
+    dymat_fold.assign(shift_list_scph.size() * ns2, std::complex<double>(0.0, 0.0));
 
+    for (i = 0; i < ns; ++i) {
         iat = i / 3;
-
         for (j = 0; j < ns; ++j) {
-
             jat = j / 3;
-
-            dymat_k_out[i][j] = std::complex<double>(0.0, 0.0);
-
-            for (icell = 0; icell < ncell; ++icell) {
-
-                exp_phase = std::complex<double>(0.0, 0.0);
-
-                // This operation is necessary for the Hermiticity of the dynamical matrix.
-                for (auto it = mindist_list_scph[iat][jat][icell].shift.cbegin();
-                     it != mindist_list_scph[iat][jat][icell].shift.cend(); ++it) {
-
-                    phase = 2.0 * pi
-                        * (static_cast<double>((*it).sx) * xk_in[0]
-                            + static_cast<double>((*it).sy) * xk_in[1]
-                            + static_cast<double>((*it).sz) * xk_in[2]);
-
-                    exp_phase += std::exp(im * phase);
+            for (unsigned int icell = 0; icell < ncell; ++icell) {
+                const auto &shift_index = mindist_list_scph[iat][jat][icell].shift_index;
+                const auto dymat_tmp = dymat_r_in[i][j][icell] / static_cast<double>(shift_index.size());
+                for (const auto ishift : shift_index) {
+                    dymat_fold[ns2 * ishift + ns * i + j] += dymat_tmp;
                 }
-                exp_phase /= static_cast<double>(mindist_list_scph[iat][jat][icell].shift.size());
-
-                dymat_k_out[i][j] += dymat_r_in[i][j][icell] * exp_phase;
             }
-
         }
     }
 }
 
 
+void Scph::r2q_batch(const unsigned int nk_in,
+                     double **xk_in,
+                     const unsigned int ns,
+                     const std::vector<std::complex<double>> &dymat_fold,
+                     std::complex<double> ***dymat_k_out) const
+{
+    // Fourier transform the real-space force constants to the dynamical
+    // matrices at nk_in k points. The phases of equidistant images are
+    // averaged for the Hermiticity of the dynamical matrix.
+    // With the force constants folded by fold_dymat_r, the Fourier sum
+    // for all k points becomes a single matrix product
+    // dymat_k[ik][i][j] = sum_R exp(2 pi i k.R) * dymat_fold[R][i][j].
+
+    unsigned int j;
+    const auto nshift = shift_list_scph.size();
+
+    std::vector<std::complex<double>> exp_phase(nk_in * nshift);
+
+#pragma omp parallel for private(j)
+    for (int ik = 0; ik < static_cast<int>(nk_in); ++ik) {
+        for (j = 0; j < nshift; ++j) {
+            const auto phase = 2.0 * pi
+                * (static_cast<double>(shift_list_scph[j].sx) * xk_in[ik][0]
+                    + static_cast<double>(shift_list_scph[j].sy) * xk_in[ik][1]
+                    + static_cast<double>(shift_list_scph[j].sz) * xk_in[ik][2]);
+            exp_phase[nshift * ik + j] = std::polar(1.0, phase);
+        }
+    }
+
+    // dymat_k^T (ns2 x nk_in) = dymat_fold^T (ns2 x nshift) * exp_phase^T (nshift x nk_in)
+    // in column-major order.
+    char TRANSN[] = "N";
+    int m = ns * ns;
+    int n = nk_in;
+    int k = nshift;
+    std::complex<double> alpha(1.0, 0.0);
+    std::complex<double> beta(0.0, 0.0);
+
+    zgemm_(TRANSN, TRANSN, &m, &n, &k, &alpha,
+           const_cast<std::complex<double> *>(&dymat_fold[0]), &m, &exp_phase[0], &k,
+           &beta, &dymat_k_out[0][0][0], &m);
+}
+
+
+void Scph::q2r_fft(std::complex<double> ***dymat_q_in,
+                   std::complex<double> ***dymat_r_out) const
+{
+    // Fourier transform dymat_q_in[ns][ns][nk_interpolate] on the
+    // kmesh_interpolate grid to the real-space cells with a batched 3D FFT.
+    // dymat_r[icell] = 1/N sum_k dymat_q[k] exp(-2 pi i k.R_icell)
+
+    const int ns = dynamical->neval;
+    const int nk_grid[3] = {static_cast<int>(kmesh_interpolate[0]),
+                            static_cast<int>(kmesh_interpolate[1]),
+                            static_cast<int>(kmesh_interpolate[2])};
+    const int nk = nk_interpolate;
+
+    const auto plan = fftw_plan_many_dft(3, nk_grid, ns * ns,
+                                         reinterpret_cast<fftw_complex*>(dymat_q_in[0][0]),
+                                         nullptr, 1, nk,
+                                         reinterpret_cast<fftw_complex*>(dymat_r_out[0][0]),
+                                         nullptr, 1, nk,
+                                         FFTW_FORWARD, FFTW_ESTIMATE);
+    fftw_execute(plan);
+    fftw_destroy_plan(plan);
+
+    const auto factor = 1.0 / static_cast<double>(nk);
+    for (int i = 0; i < ns * ns * nk; ++i) dymat_r_out[0][0][i] *= factor;
+}
+
+
 void Scph::diagonalize_interpolated_matrix(std::complex<double> **mat_in,
                                            double *eval_out,
                                            std::complex<double> **evec_out,
@@ -2112,7 +2602,6 @@ void Scph::calc_new_dymat_with_evec(std::complex<double> ***dymat_out,
     std::complex<double> *eigval_matrix, *dmat;
     std::complex<double> *beta;
     std::complex<double> ***dymat_q, **dymat_harmonic;
-    std::complex<double> im(0.0, 1.0);
 
     unsigned int ik, is, js;
     int knum;
@@ -2198,62 +2687,7 @@ void Scph::calc_new_dymat_with_evec(std::complex<double> ***dymat_out,
     memory->deallocate(dmat);
     memory->deallocate(dymat_harmonic);
 
-    const auto nk1 = kmesh_interpolate[0];
-    const auto nk2 = kmesh_interpolate[1];
-    const auto nk3 = kmesh_interpolate[2];
-    unsigned int i;
-
-    double phase;
-    std::complex<double> cexp_phase;
-    std::vector<std::vector<double>> xk_dup;
-
-    int icell = 0;
-
-    for (int ix = 0; ix < nk1; ++ix) {
-        for (int iy = 0; iy < nk2; ++iy) {
-            for (int iz = 0; iz < nk3; ++iz) {
-
-                for (is = 0; is < ns; ++is) {
-                    for (js = 0; js < ns; ++js) {
-                        dymat_out[is][js][icell] = std::complex<double>(0.0, 0.0);
-                    }
-                }
-
-                for (ik = 0; ik < nk_interpolate; ++ik) {
-
-                    duplicate_xk_boundary(xk_interpolate[ik], xk_dup);
-
-                    cexp_phase = std::complex<double>(0.0, 0.0);
-
-                    for (i = 0; i < xk_dup.size(); ++i) {
-
-                        phase = 2.0 * pi * (xk_dup[i][0] * static_cast<double>(ix)
-                            + xk_dup[i][1] * static_cast<double>(iy)
-                            + xk_dup[i][2] * static_cast<double>(iz));
-                        cexp_phase += std::exp(-im * phase);
-
-                    }
-                    cexp_phase /= static_cast<double>(xk_dup.size());
-
-                    for (is = 0; is < ns; ++is) {
-                        for (js = 0; js < ns; ++js) {
-                            dymat_out[is][js][icell] += dymat_q[is][js][ik] * cexp_phase;
-                        }
-                    }
-
-
-                }
-                for (is = 0; is < ns; ++is) {
-                    for (js = 0; js < ns; ++js) {
-                        dymat_out[is][js][icell] /= static_cast<double>(nk_interpolate);
-                    }
-                }
-
-                ++icell;
-            }
-        }
-    }
-
+    q2r_fft(dymat_q, dymat_out);
 
     memory->deallocate(dymat_q);
 }
@@ -2265,6 +2699,7 @@ void Scph::compute_anharmonic_frequency(std::complex<double> ***v4_array_all,
                                         const double temp,
                                         std::vector<int> *degeneracy_info,
                                         bool &flag_converged,
+                                        unsigned int &niter_out,
                                         std::complex<double> ***cmat_convert,
                                         const bool offdiag)
 {
@@ -2277,14 +2712,10 @@ void Scph::compute_anharmonic_frequency(std::complex<double> ***v4_array_all,
     int ik, jk;
     unsigned int i;
     unsigned int is, js, ks, ls;
-    unsigned int kk;
     const auto nk = nk_scph;
     const auto ns = dynamical->neval;
     unsigned int knum, knum_interpolate;
     const auto nk_irred_interpolate = kp_irred_interpolate.size();
-    const auto nk1 = kmesh_interpolate[0];
-    const auto nk2 = kmesh_interpolate[1];
-    const auto nk3 = kmesh_interpolate[2];
     int icount;
     int iloop;
 
@@ -2317,6 +2748,7 @@ void Scph::compute_anharmonic_frequency(std::complex<double> ***v4_array_all,
     std::complex<double> ***dymat_new, ***dymat_harmonic;
     std::complex<double> ***dymat_q;
     std::complex<double> ***Fmat0;
+    std::complex<double> ***delta_fmat;
 
     static std::complex<double> complex_one = std::complex<double>(1.0, 0.0);
     static std::complex<double> complex_zero = std::complex<double>(0.0, 0.0);
@@ -2333,6 +2765,7 @@ void Scph::compute_anharmonic_frequency(std::complex<double> ***v4_array_all,
     memory->allocate(dymat_q, ns, ns, nk_interpolate);
     memory->allocate(dymat_harmonic, nk_interpolate, ns, ns);
     memory->allocate(Fmat0, nk_irred_interpolate, ns, ns);
+    memory->allocate(delta_fmat, nk_irred_interpolate, ns, ns);
 
     const auto T_in = temp;
 
@@ -2414,6 +2847,37 @@ void Scph::compute_anharmonic_frequency(std::complex<double> ***v4_array_all,
 
     icount = 0;
 
+    // Onsite V4 elements used for the treatment of imaginary frequencies
+
+    std::vector<double> v4_onsite(nk_irred_interpolate * ns, 0.0);
+
+    for (ik = 0; ik < nk_irred_interpolate; ++ik) {
+        knum = kmap_interpolate_to_scph[kp_irred_interpolate[ik][0].knum];
+        const auto iblock = get_v4_block(nk * ik + knum);
+        if (iblock < 0) continue;
+        for (is = 0; is < ns; ++is) {
+            v4_onsite[ns * ik + is] = v4_array_all[iblock][get_v4_row(is, is)][get_v4_col(is, is)].real();
+        }
+    }
+    if (distribute_v4) {
+        MPI_Allreduce(MPI_IN_PLACE, &v4_onsite[0], nk_irred_interpolate * ns,
+                      MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    }
+
+    // History of the Pulay mixing
+
+    const auto nhist = std::max(mixhist, 1u);
+    unsigned int nhist_stored = 0;
+    std::complex<double> ****dmat_hist = nullptr;
+    std::complex<double> ****resid_hist = nullptr;
+    MatrixXd bmat_hist;
+
+    if (mixtype == 1) {
+        memory->allocate(dmat_hist, nhist, nk, ns, ns);
+        memory->allocate(resid_hist, nhist, nk, ns, ns);
+        bmat_hist = MatrixXd::Zero(nhist, nhist);
+    }
+
     // Main loop
     for (iloop = 0; iloop < maxiter; ++iloop) {
 
@@ -2451,7 +2915,101 @@ void Scph::compute_anharmonic_frequency(std::complex<double> ***v4_array_all,
         }
 
         // Mixing dmat
-        if (iloop > 0) {
+        if (iloop > 0 && mixtype == 1) {
+
+            // Pulay (Anderson) mixing. The residual R = D_out - D_in of the
+            // last nhist iterations is stored, and the new input is given by
+            // D_in = sum_i c_i (D_in^(i) + alpha * R^(i)), where c_i minimizes
+            // |sum_i c_i R^(i)| under the constraint sum_i c_i = 1.
+
+            const auto islot = nhist_stored % nhist;
+            ++nhist_stored;
+            auto nused = std::min(nhist_stored, nhist);
+
+#pragma omp parallel for private(is, js)
+            for (ik = 0; ik < nk; ++ik) {
+                for (is = 0; is < ns; ++is) {
+                    for (js = 0; js < ns; ++js) {
+                        dmat_hist[islot][ik][is][js] = dmat_convert_old[ik][is][js];
+                        resid_hist[islot][ik][is][js] = dmat_convert[ik][is][js]
+                            - dmat_convert_old[ik][is][js];
+                    }
+                }
+            }
+
+            for (i = 0; i < nused; ++i) {
+                re_tmp = 0.0;
+#pragma omp parallel for private(is, js), reduction(+:re_tmp)
+                for (ik = 0; ik < nk; ++ik) {
+                    for (is = 0; is < ns; ++is) {
+                        for (js = 0; js < ns; ++js) {
+                            re_tmp += std::real(std::conj(resid_hist[i][ik][is][js])
+                                                * resid_hist[islot][ik][is][js]);
+                        }
+                    }
+                }
+                bmat_hist(i, islot) = re_tmp;
+                bmat_hist(islot, i) = re_tmp;
+            }
+
+            // The overlap matrix is normalized so that the constraint row
+            // does not dominate the pivoting near convergence.
+            auto bscale = 0.0;
+            for (i = 0; i < nused; ++i) bscale = std::max(bscale, bmat_hist(i, i));
+            if (bscale <= 0.0) bscale = 1.0;
+
+            MatrixXd amat = MatrixXd::Zero(nused + 1, nused + 1);
+            VectorXd bvec = VectorXd::Zero(nused + 1);
+            VectorXd coef_mix;
+
+            for (i = 0; i < nused; ++i) {
+                for (unsigned int j = 0; j < nused; ++j) {
+                    amat(i, j) = bmat_hist(i, j) / bscale;
+                }
+                amat(i, nused) = 1.0;
+                amat(nused, i) = 1.0;
+            }
+            bvec(nused) = 1.0;
+
+            FullPivLU<MatrixXd> lu_mix(amat);
+
+            if (lu_mix.isInvertible()) {
+                coef_mix = lu_mix.solve(bvec);
+            } else {
+                // The history is linearly dependent. Restart it from the latest pair,
+                // which is equivalent to the linear mixing in this iteration.
+                if (islot != 0) {
+#pragma omp parallel for private(is, js)
+                    for (ik = 0; ik < nk; ++ik) {
+                        for (is = 0; is < ns; ++is) {
+                            for (js = 0; js < ns; ++js) {
+                                dmat_hist[0][ik][is][js] = dmat_hist[islot][ik][is][js];
+                                resid_hist[0][ik][is][js] = resid_hist[islot][ik][is][js];
+                            }
+                        }
+                    }
+                    bmat_hist(0, 0) = bmat_hist(islot, islot);
+                }
+                nhist_stored = 1;
+                nused = 1;
+                coef_mix = VectorXd::Ones(1);
+            }
+
+#pragma omp parallel for private(i, is, js, ctmp)
+            for (ik = 0; ik < nk; ++ik) {
+                for (is = 0; is < ns; ++is) {
+                    for (js = 0; js < ns; ++js) {
+                        ctmp = complex_zero;
+                        for (i = 0; i < nused; ++i) {
+                            ctmp += coef_mix(i) * (dmat_hist[i][ik][is][js]
+                                + alpha * resid_hist[i][ik][is][js]);
+                        }
+                        dmat_convert[ik][is][js] = ctmp;
+                    }
+                }
+            }
+
+        } else if (iloop > 0) {
 #pragma omp parallel for private(is, js)
             for (ik = 0; ik < nk; ++ik) {
                 for (is = 0; is < ns; ++is) {
@@ -2463,72 +3021,90 @@ void Scph::compute_anharmonic_frequency(std::complex<double> ***v4_array_all,
             }
         }
 
-        for (ik = 0; ik < nk_irred_interpolate; ++ik) {
-
-            knum_interpolate = kp_irred_interpolate[ik][0].knum;
-            knum = kmap_interpolate_to_scph[knum_interpolate];
+        // Anharmonic correction to Fmat.
+        // Each process adds the contributions of the (k, k') blocks it keeps.
 
-            // Fmat harmonic
+        for (ik = 0; ik < nk_irred_interpolate; ++ik) {
 
             for (is = 0; is < ns; ++is) {
                 for (js = 0; js < ns; ++js) {
-                    Fmat(is, js) = Fmat0[ik][is][js];
+                    delta_fmat[ik][is][js] = complex_zero;
                 }
             }
 
-            // Anharmonic correction to Fmat
-
             if (!offdiag) {
                 for (is = 0; is < ns; ++is) {
-                    i = (ns + 1) * is;
+                    const auto irow = get_v4_row(is, is);
 
                     re_tmp = 0.0;
                     im_tmp = 0.0;
 
-#pragma omp parallel for private(jk,kk,ks,ls), reduction(+:re_tmp, im_tmp)
+#pragma omp parallel for private(ks), reduction(+:re_tmp, im_tmp)
                     for (jk = 0; jk < nk; ++jk) {
 
-                        kk = nk * ik + jk;
+                        const auto iblock = get_v4_block(nk * ik + jk);
+                        if (iblock < 0) continue;
 
                         for (ks = 0; ks < ns; ++ks) {
-                            ctmp = v4_array_all[kk][i][(ns + 1) * ks]
+                            const auto v4_dmat = v4_array_all[iblock][irow][get_v4_col(ks, ks)]
                                 * dmat_convert[jk][ks][ks];
-                            re_tmp += ctmp.real();
-                            im_tmp += ctmp.imag();
+                            re_tmp += v4_dmat.real();
+                            im_tmp += v4_dmat.imag();
                         }
                     }
-                    Fmat(is, is) += std::complex<double>(re_tmp, im_tmp);
+                    delta_fmat[ik][is][is] = std::complex<double>(re_tmp, im_tmp);
                 }
             } else {
-
-                // Anharmonic correction to Fmat
-
                 for (is = 0; is < ns; ++is) {
                     for (js = 0; js <= is; ++js) {
 
-                        i = ns * is + js;
+                        const auto irow = get_v4_row(is, js);
 
                         re_tmp = 0.0;
                         im_tmp = 0.0;
 
-#pragma omp parallel for private(jk,kk,ks,ls), reduction(+:re_tmp, im_tmp)
+#pragma omp parallel for private(ks, ls), reduction(+:re_tmp, im_tmp)
                         for (jk = 0; jk < nk; ++jk) {
 
-                            kk = nk * ik + jk;
+                            const auto iblock = get_v4_block(nk * ik + jk);
+                            if (iblock < 0) continue;
 
                             for (ks = 0; ks < ns; ++ks) {
                                 for (ls = 0; ls < ns; ++ls) {
-                                    ctmp = v4_array_all[kk][i][ns * ks + ls]
+                                    const auto v4_dmat = v4_array_all[iblock][irow][ns * ks + ls]
                                         * dmat_convert[jk][ks][ls];
-                                    re_tmp += ctmp.real();
-                                    im_tmp += ctmp.imag();
+                                    re_tmp += v4_dmat.real();
+                                    im_tmp += v4_dmat.imag();
                                 }
                             }
                         }
-                        Fmat(is, js) += std::complex<double>(re_tmp, im_tmp);
+                        delta_fmat[ik][is][js] = std::complex<double>(re_tmp, im_tmp);
                     }
                 }
+            }
+        }
+
+        if (distribute_v4) {
+#ifdef MPI_CXX_DOUBLE_COMPLEX
+            MPI_Allreduce(MPI_IN_PLACE, &delta_fmat[0][0][0], nk_irred_interpolate * ns * ns,
+                          MPI_CXX_DOUBLE_COMPLEX, MPI_SUM, MPI_COMM_WORLD);
+#else
+            MPI_Allreduce(MPI_IN_PLACE, &delta_fmat[0][0][0], nk_irred_interpolate * ns * ns,
+                          MPI_COMPLEX16, MPI_SUM, MPI_COMM_WORLD);
+#endif
+        }
+
+        for (ik = 0; ik < nk_irred_interpolate; ++ik) {
+
+            knum_interpolate = kp_irred_interpolate[ik][0].knum;
+            knum = kmap_interpolate_to_scph[knum_interpolate];
 
+            // Fmat harmonic + anharmonic correction
+
+            for (is = 0; is < ns; ++is) {
+                for (js = 0; js < ns; ++js) {
+                    Fmat(is, js) = Fmat0[ik][is][js] + delta_fmat[ik][is][js];
+                }
             }
 
             saes.compute(Fmat);
@@ -2547,7 +3123,7 @@ void Scph::compute_anharmonic_frequency(std::complex<double> ***v4_array_all,
                     }
                     std::cout << std::endl;
 
-                    if (v4_array_all[nk * ik + knum][(ns + 1) * is][(ns + 1) * is].real() > 0.0) {
+                    if (v4_onsite[ns * ik + is] > 0.0) {
                         std::cout << "  onsite V4 is positive" << std::endl;
                         std::cout << std::endl;
                         if (flag_converged) {
@@ -2654,21 +3230,7 @@ void Scph::compute_anharmonic_frequency(std::complex<double> ***v4_array_all,
         }
 
         // Inverse Fourier transform of delta Dymat.
-        fftw_plan plan;
-
-        for (is = 0; is < ns; ++is) {
-            for (js = 0; js < ns; ++js) {
-                plan = fftw_plan_dft_3d(nk1, nk2, nk3,
-                                        reinterpret_cast<fftw_complex*>(dymat_q[is][js]),
-                                        reinterpret_cast<fftw_complex*>(dymat_new[is][js]),
-                                        FFTW_FORWARD, FFTW_ESTIMATE);
-                fftw_execute(plan);
-                fftw_destroy_plan(plan);
-
-                for (ik = 0; ik < nk_interpolate; ++ik)
-                    dymat_new[is][js][ik] /= static_cast<double>(nk_interpolate);
-            }
-        }
+        q2r_fft(dymat_q, dymat_new);
 
         exec_interpolation(kmesh_interpolate,
                            dymat_new,
@@ -2752,6 +3314,11 @@ void Scph::compute_anharmonic_frequency(std::complex<double> ***v4_array_all,
         }
     } // end loop iteration
 
+    niter_out = std::min(static_cast<unsigned int>(iloop + 1), maxiter);
+
+    if (dmat_hist) memory->deallocate(dmat_hist);
+    if (resid_hist) memory->deallocate(resid_hist);
+
     if (std::sqrt(diff) < conv_tol) {
         std::cout << " Temp = " << T_in;
         std::cout << " : convergence achieved in " << std::setw(5)
@@ -2801,6 +3368,7 @@ void Scph::compute_anharmonic_frequency(std::complex<double> ***v4_array_all,
     memory->deallocate(dymat_q);
     memory->deallocate(dymat_harmonic);
     memory->deallocate(Fmat0);
+    memory->deallocate(delta_fmat);
 }
 
 
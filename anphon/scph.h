@@ -11,6 +11,7 @@
 #pragma once
 
 #include "pointers.h"
+#include "anharmonic_core.h"
 #include "kpoint.h"
 #include <complex>
 #include <Eigen/Dense>
@@ -45,6 +46,7 @@ namespace PHON_NS
     public:
         double dist;
         std::vector<ShiftCell> shift;
+        std::vector<unsigned int> shift_index; // index of each shift in shift_list_scph
     };
 
     struct KpointSymmetry
@@ -70,6 +72,7 @@ namespace PHON_NS
         bool restart_scph;
         bool warmstart_scph;
         bool lower_temp;
+        unsigned int nchain_scph;
         double tolerance_scph;
 
         double **xk_scph, **kvec_na_scph;
@@ -82,9 +85,13 @@ namespace PHON_NS
 
         double mixalpha;
         unsigned int maxiter;
+        unsigned int mixtype;
+        unsigned int mixhist;
         bool print_self_consistent_fc2;
         bool selfenergy_offdiagonal;
         bool relax_coordinate;
+        bool distribute_v4;
+        int v4_store;
 
     private:
 
@@ -94,24 +101,19 @@ namespace PHON_NS
         int *kmap_interpolate_to_scph;
 
         // Information for calculating the ph-ph interaction coefficients
-        double ***vec_for_v3, *invmass_for_v3;
-        double ***vec_for_v4, *invmass_for_v4;
+        // The force constants of fcs_csr_v3(v4) are divided by sqrt of the masses.
+        FcsArrayCSR fcs_csr_v3, fcs_csr_v4;
+        PhaseFactorTable phase_factor;
         int **evec_index3;
         int **evec_index4;
         int ngroup, ngroup2;
-        std::vector<double> *fcs_group;
-        std::vector<double> *fcs_group2;
-        std::complex<double> *exp_phase, ***exp_phase3;
-        int nk_grid[3];
-        int nk_represent;
-        unsigned int tune_type;
-        double dnk[3];
 
         // Information of harmonic dynamical matrix
         std::complex<double> im;
         double **omega2_harmonic;
         std::complex<double> ***evec_harmonic;
         MinimumDistList ***mindist_list_scph;
+        std::vector<ShiftCell> shift_list_scph;
 
         // Local variables for handling symmetry of dynamical matrix
         std::complex<double> ****mat_transform_sym;
@@ -139,8 +141,40 @@ namespace PHON_NS
         void load_scph_dymat_from_file(std::complex<double> ****);
         void store_scph_dymat_to_file(std::complex<double> ****);
 
+        void load_scph_dymat_binary(const std::string &,
+                                    const std::vector<double> &,
+                                    std::complex<double> ****) const;
+
+        unsigned long long checksum_scph_dymat(const std::complex<double> *,
+                                               size_t) const;
+
         void exec_scph_main(std::complex<double> ****);
 
+        // Layout of the V4 matrix elements (v4_array_all).
+        // The row index is packed as is >= js, and only the is == js rows
+        // and ks == ls columns are kept when v4_diagonal_only is true.
+        // With distribute_v4, each process keeps the (k, k') blocks it
+        // computes, i.e., those with (nk_scph * ik + jk) % nprocs == my_rank.
+        bool v4_diagonal_only;
+        unsigned int nrow_v4, ncol_v4;
+        unsigned int nblock_v4;
+
+        void setup_v4_layout();
+        int get_v4_block(unsigned int) const;
+        unsigned int get_v4_row(unsigned int,
+                                unsigned int) const;
+        unsigned int get_v4_col(unsigned int,
+                                unsigned int) const;
+
+        // On-disk store of the V4 elements (V4STORE = 1)
+        unsigned long long get_hash_v4store() const;
+        bool load_v4store(const std::string &,
+                          unsigned long long,
+                          std::complex<double> ***);
+        void save_v4store(const std::string &,
+                          unsigned long long,
+                          std::complex<double> ***) const;
+
         void compute_V4_elements_mpi_over_kpoint(std::complex<double> ***,
                                                  std::complex<double> ***,
                                                  bool,
@@ -168,6 +202,7 @@ namespace PHON_NS
                                           double,
                                           std::vector<int> *,
                                           bool &,
+                                          unsigned int &,
                                           std::complex<double> ***,
                                           bool);
 
@@ -179,13 +214,19 @@ namespace PHON_NS
                                 double **,
                                 std::complex<double> ***);
 
-        void r2q(const double *,
-                 unsigned int,
-                 unsigned int,
-                 unsigned int,
-                 unsigned int,
-                 std::complex<double> ***,
-                 std::complex<double> **);
+        void fold_dymat_r(unsigned int,
+                          unsigned int,
+                          std::complex<double> ***,
+                          std::vector<std::complex<double>> &) const;
+
+        void r2q_batch(unsigned int,
+                       double **,
+                       unsigned int,
+                       const std::vector<std::complex<double>> &,
+                       std::complex<double> ***) const;
+
+        void q2r_fft(std::complex<double> ***,
+                     std::complex<double> ***) const;
 
         void diagonalize_interpolated_matrix(std::complex<double> **,
                                              double *,
@@ -18,12 +18,19 @@
 #include "thermodynamics.h"
 #include "mathfunctions.h"
 #include "integration.h"
+#include <fftw3.h>
+#include <vector>
+
+#if defined(WIN32) || defined(_WIN32)
+#pragma comment(lib, "libfftw3-3.lib")
+#endif
 
 using namespace PHON_NS;
 
 Selfenergy::Selfenergy(PHON *phon): Pointers(phon)
 {
     im = std::complex<double>(0.0, 1.0);
+    kk_fft = true;
 }
 
 Selfenergy::~Selfenergy() {}
@@ -33,6 +40,156 @@ void Selfenergy::setup_selfenergy()
     nk = kpoint->nk;
     ns = dynamical->neval;
     epsilon = integration->epsilon;
+
+    MPI_Bcast(&kk_fft, 1, MPI_LOGICAL, 0, MPI_COMM_WORLD);
+}
+
+void Selfenergy::kramers_kronig(const unsigned int nomega,
+                                const double *omega,
+                                const double *self_imag,
+                                double *self_real) const
+{
+    // Real part of the self-energy from the imaginary part by the
+    // Kramers-Kronig relation
+    // Re S(w) = 2/pi P \int_0^\infty dw' w' Im S(w') / (w'^2 - w^2),
+    // where the integral is replaced by the sum over the uniform
+    // frequency grid omega[0], ..., omega[nomega - 1].
+    // KK_FFT = 1 evaluates the same sum in O(N log N) operations.
+
+    if (nomega == 0) return;
+    if (nomega == 1) {
+        self_real[0] = 0.0;
+        return;
+    }
+
+    if (kk_fft) {
+        kramers_kronig_fft(nomega, omega, self_imag, self_real);
+    } else {
+        kramers_kronig_direct(nomega, omega, self_imag, self_real);
+    }
+}
+
+void Selfenergy::kramers_kronig_direct(const unsigned int nomega,
+                                       const double *omega,
+                                       const double *self_imag,
+                                       double *self_real) const
+{
+    // The j = i term is excluded from the principal-value sum. For the pairs
+    // with w_j = -w_i, only the divergent part 1 / (2 (w_j + w_i)) of
+    // w_j / (w_j^2 - w_i^2) is excluded, as in kramers_kronig_fft.
+
+    unsigned int iomega;
+    const auto delta_omega = omega[1] - omega[0];
+    const auto tol_omega = 1.0e-8 * std::abs(delta_omega);
+
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+    for (iomega = 0; iomega < nomega; ++iomega) {
+        double self_tmp = 0.0;
+        const auto omega2 = omega[iomega] * omega[iomega];
+        for (unsigned int jomega = 0; jomega < nomega; ++jomega) {
+            if (jomega == iomega) continue;
+            if (std::abs(omega[jomega] + omega[iomega]) < tol_omega) {
+                self_tmp += 0.5 * self_imag[jomega] / (omega[jomega] - omega[iomega]);
+            } else {
+                self_tmp += omega[jomega] * self_imag[jomega]
+                    / (omega[jomega] * omega[jomega] - omega2);
+            }
+        }
+        self_real[iomega] = 2.0 * delta_omega * self_tmp / pi;
+    }
+}
+
+void Selfenergy::kramers_kronig_fft(const unsigned int nomega,
+                                    const double *omega,
+                                    const double *self_imag,
+                                    double *self_real) const
+{
+    // With w_j = w_0 + j dw, the kernel of the direct sum is split as
+    // w_j / (w_j^2 - w_i^2) = [1 / ((j - i) dw) + 1 / (2 w_0 + (i + j) dw)] / 2.
+    // The first term is a convolution in j - i and the second one is a
+    // convolution in i + j (after reversing Im S). Both are evaluated by
+    // FFT with zero padding to at least 2 * nomega points, so that the
+    // circular convolutions do not wrap around and the result agrees with
+    // the direct sum up to rounding errors. Pairs with w_j = -w_i, for which
+    // the direct sum diverges, are excluded.
+
+    int i;
+    const int n = nomega;
+    const auto delta_omega = omega[1] - omega[0];
+    const auto omega0 = omega[0];
+
+    int nfft = 1;
+    while (nfft < 2 * n) nfft *= 2;
+    const auto nfreq = nfft / 2 + 1;
+
+    std::vector<double> data_r(nfft), kernel_r(nfft), conv(nfft);
+    std::vector<std::complex<double>> data_q(nfreq), kernel_q(nfreq);
+
+    const auto plan_r2c_data = fftw_plan_dft_r2c_1d(nfft, &data_r[0],
+                                                    reinterpret_cast<fftw_complex*>(&data_q[0]),
+                                                    FFTW_ESTIMATE);
+    const auto plan_r2c_kernel = fftw_plan_dft_r2c_1d(nfft, &kernel_r[0],
+                                                      reinterpret_cast<fftw_complex*>(&kernel_q[0]),
+                                                      FFTW_ESTIMATE);
+    const auto plan_c2r = fftw_plan_dft_c2r_1d(nfft, reinterpret_cast<fftw_complex*>(&data_q[0]),
+                                               &conv[0], FFTW_ESTIMATE);
+
+    const auto hankel = [omega0, delta_omega](const int m)
+    {
+        const auto denom = 2.0 * omega0 + static_cast<double>(m) * delta_omega;
+        return std::abs(denom) < 1.0e-8 * std::abs(delta_omega) ? 0.0 : 1.0 / denom;
+    };
+
+    // Term 1: T_i = \sum_j Im S_j / ((j - i) dw) = \sum_j Im S_j g(i - j)
+    // with g(m) = -1 / (m dw) and g(0) = 0.
+
+    for (i = 0; i < nfft; ++i) {
+        data_r[i] = 0.0;
+        kernel_r[i] = 0.0;
+    }
+    for (i = 0; i < n; ++i) data_r[i] = self_imag[i];
+    for (i = 1; i < n; ++i) {
+        kernel_r[i] = -1.0 / (static_cast<double>(i) * delta_omega);
+        kernel_r[nfft - i] = -kernel_r[i];
+    }
+
+    fftw_execute(plan_r2c_data);
+    fftw_execute(plan_r2c_kernel);
+    for (i = 0; i < nfreq; ++i) data_q[i] *= kernel_q[i];
+    fftw_execute(plan_c2r);
+
+    for (i = 0; i < n; ++i) self_real[i] = conv[i];
+
+    // Term 2: H_i = \sum_j Im S_j h(i + j) = \sum_l Im S_{n-1-l} h(i + n - 1 - l)
+    // with h(m) = 1 / (2 w_0 + m dw).
+
+    for (i = 0; i < nfft; ++i) {
+        data_r[i] = 0.0;
+        kernel_r[i] = 0.0;
+    }
+    for (i = 0; i < n; ++i) data_r[i] = self_imag[n - 1 - i];
+    for (i = 0; i < 2 * n - 1; ++i) kernel_r[i] = hankel(i);
+
+    fftw_execute(plan_r2c_data);
+    fftw_execute(plan_r2c_kernel);
+    for (i = 0; i < nfreq; ++i) data_q[i] *= kernel_q[i];
+    fftw_execute(plan_c2r);
+
+    fftw_destroy_plan(plan_r2c_data);
+    fftw_destroy_plan(plan_r2c_kernel);
+    fftw_destroy_plan(plan_c2r);
+
+    // The j = i term is excluded from the principal-value sum.
+    // The backward FFT of FFTW is not normalized.
+
+    const auto factor = delta_omega / (pi * static_cast<double>(nfft));
+
+    for (i = 0; i < n; ++i) {
+        self_real[i] = factor * (self_real[i] + conv[i + n - 1])
+            - delta_omega * self_imag[i] * hankel(2 * i) / pi;
+    }
 }
 
 
@@ -107,27 +264,47 @@ void Selfenergy::selfenergy_tadpole(const unsigned int N,
 
         for (i = 0; i < N; ++i) ret_mpi[i] = std::complex<double>(0.0, 0.0);
 
-        for (ik2 = mympi->my_rank; ik2 < nk; ik2 += mympi->nprocs) {
-            for (is2 = 0; is2 < ns; ++is2) {
-                arr_cubic2[1] = ns * ik2 + is2;
-                arr_cubic2[2] = ns * kpoint->knum_minus[ik2] + is2;
+#ifdef _OPENMP
+#pragma omp parallel private(i, is2, T_tmp, n2, omega2, v3_tmp2) firstprivate(arr_cubic2)
+#endif
+        {
+            std::complex<double> *ret_omp;
+            memory->allocate(ret_omp, N);
+            for (i = 0; i < N; ++i) ret_omp[i] = std::complex<double>(0.0, 0.0);
+
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+            for (ik2 = mympi->my_rank; ik2 < nk; ik2 += mympi->nprocs) {
+                for (is2 = 0; is2 < ns; ++is2) {
+                    arr_cubic2[1] = ns * ik2 + is2;
+                    arr_cubic2[2] = ns * kpoint->knum_minus[ik2] + is2;
 
-                v3_tmp2 = anharmonic_core->V3(arr_cubic2);
-                omega2 = dynamical->eval_phonon[ik2][is2];
+                    v3_tmp2 = anharmonic_core->V3(arr_cubic2);
+                    omega2 = dynamical->eval_phonon[ik2][is2];
 
-                if (omega2 < eps8) continue;
+                    if (omega2 < eps8) continue;
 
-                for (i = 0; i < N; ++i) {
-                    T_tmp = T[i];
-                    if (thermodynamics->classical) {
-                        n2 = thermodynamics->fC(omega2, T_tmp);
-                        ret_mpi[i] += v3_tmp2 * 2.0 * n2;
-                    } else {
-                        n2 = thermodynamics->fB(omega2, T_tmp);
-                        ret_mpi[i] += v3_tmp2 * (2.0 * n2 + 1.0);
+                    for (i = 0; i < N; ++i) {
+                        T_tmp = T[i];
+                        if (thermodynamics->classical) {
+                            n2 = thermodynamics->fC(omega2, T_tmp);
+                            ret_omp[i] += v3_tmp2 * 2.0 * n2;
+                        } else {
+                            n2 = thermodynamics->fB(omega2, T_tmp);
+                            ret_omp[i] += v3_tmp2 * (2.0 * n2 + 1.0);
+                        }
                     }
                 }
             }
+
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+            {
+                for (i = 0; i < N; ++i) ret_mpi[i] += ret_omp[i];
+            }
+            memory->deallocate(ret_omp);
         }
         mpi_reduce_complex(N, ret_mpi, ret_tmp);
 
@@ -188,50 +365,71 @@ void Selfenergy::selfenergy_a(const unsigned int N,
 
     for (i = 0; i < N; ++i) ret_mpi[i] = std::complex<double>(0.0, 0.0);
 
-    for (ik1 = mympi->my_rank; ik1 < nk; ik1 += mympi->nprocs) {
+#ifdef _OPENMP
+#pragma omp parallel private(i, ik1, ik2, is1, is2, xk_tmp, v3_tmp, omega_sum, iloc, jloc, kloc, \
+                     T_tmp, n1, n2, f1, f2, omega1, omega2) firstprivate(arr_cubic)
+#endif
+    {
+        std::complex<double> *ret_omp;
+        memory->allocate(ret_omp, N);
+        for (i = 0; i < N; ++i) ret_omp[i] = std::complex<double>(0.0, 0.0);
+
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+        for (ik1 = mympi->my_rank; ik1 < nk; ik1 += mympi->nprocs) {
 
-        xk_tmp[0] = kpoint->xk[knum][0] - kpoint->xk[ik1][0];
-        xk_tmp[1] = kpoint->xk[knum][1] - kpoint->xk[ik1][1];
-        xk_tmp[2] = kpoint->xk[knum][2] - kpoint->xk[ik1][2];
+            xk_tmp[0] = kpoint->xk[knum][0] - kpoint->xk[ik1][0];
+            xk_tmp[1] = kpoint->xk[knum][1] - kpoint->xk[ik1][1];
+            xk_tmp[2] = kpoint->xk[knum][2] - kpoint->xk[ik1][2];
 
-        iloc = (nint(xk_tmp[0] * static_cast<double>(nkx) + static_cast<double>(2 * nkx))) % nkx;
-        jloc = (nint(xk_tmp[1] * static_cast<double>(nky) + static_cast<double>(2 * nky))) % nky;
-        kloc = (nint(xk_tmp[2] * static_cast<double>(nkz) + static_cast<double>(2 * nkz))) % nkz;
+            iloc = (nint(xk_tmp[0] * static_cast<double>(nkx) + static_cast<double>(2 * nkx))) % nkx;
+            jloc = (nint(xk_tmp[1] * static_cast<double>(nky) + static_cast<double>(2 * nky))) % nky;
+            kloc = (nint(xk_tmp[2] * static_cast<double>(nkz) + static_cast<double>(2 * nkz))) % nkz;
 
-        ik2 = kloc + nkz * jloc + nky * nkz * iloc;
+            ik2 = kloc + nkz * jloc + nky * nkz * iloc;
 
-        for (is1 = 0; is1 < ns; ++is1) {
+            for (is1 = 0; is1 < ns; ++is1) {
 
-            arr_cubic[1] = ns * ik1 + is1;
-            omega1 = dynamical->eval_phonon[ik1][is1];
+                arr_cubic[1] = ns * ik1 + is1;
+                omega1 = dynamical->eval_phonon[ik1][is1];
 
-            for (is2 = 0; is2 < ns; ++is2) {
+                for (is2 = 0; is2 < ns; ++is2) {
 
-                arr_cubic[2] = ns * ik2 + is2;
-                omega2 = dynamical->eval_phonon[ik2][is2];
+                    arr_cubic[2] = ns * ik2 + is2;
+                    omega2 = dynamical->eval_phonon[ik2][is2];
 
-                v3_tmp = std::norm(anharmonic_core->V3(arr_cubic));
+                    v3_tmp = std::norm(anharmonic_core->V3(arr_cubic));
 
-                omega_sum[0] = 1.0 / (omega_shift + omega1 + omega2) - 1.0 / (omega_shift - omega1 - omega2);
-                omega_sum[1] = 1.0 / (omega_shift + omega1 - omega2) - 1.0 / (omega_shift - omega1 + omega2);
+                    omega_sum[0] = 1.0 / (omega_shift + omega1 + omega2) - 1.0 / (omega_shift - omega1 - omega2);
+                    omega_sum[1] = 1.0 / (omega_shift + omega1 - omega2) - 1.0 / (omega_shift - omega1 + omega2);
 
-                for (i = 0; i < N; ++i) {
-                    T_tmp = T[i];
-                    if (thermodynamics->classical) {
-                        n1 = thermodynamics->fC(omega1, T_tmp);
-                        n2 = thermodynamics->fC(omega2, T_tmp);
-                        f1 = n1 + n2;
-                        f2 = n2 - n1;
-                    } else {
-                        n1 = thermodynamics->fB(omega1, T_tmp);
-                        n2 = thermodynamics->fB(omega2, T_tmp);
-                        f1 = n1 + n2 + 1.0;
-                        f2 = n2 - n1;
+                    for (i = 0; i < N; ++i) {
+                        T_tmp = T[i];
+                        if (thermodynamics->classical) {
+                            n1 = thermodynamics->fC(omega1, T_tmp);
+                            n2 = thermodynamics->fC(omega2, T_tmp);
+                            f1 = n1 + n2;
+                            f2 = n2 - n1;
+                        } else {
+                            n1 = thermodynamics->fB(omega1, T_tmp);
+                            n2 = thermodynamics->fB(omega2, T_tmp);
+                            f1 = n1 + n2 + 1.0;
+                            f2 = n2 - n1;
+                        }
+                        ret_omp[i] += v3_tmp * (f1 * omega_sum[0] + f2 * omega_sum[1]);
                     }
-                    ret_mpi[i] += v3_tmp * (f1 * omega_sum[0] + f2 * omega_sum[1]);
                 }
             }
         }
+
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+        {
+            for (i = 0; i < N; ++i) ret_mpi[i] += ret_omp[i];
+        }
+        memory->deallocate(ret_omp);
     }
 
     factor = 1.0 / (static_cast<double>(nk) * std::pow(2.0, 4));
@@ -276,30 +474,50 @@ void Selfenergy::selfenergy_b(const unsigned int N,
     arr_quartic[3] = ns * knum + snum;
 
 
-    for (ik1 = mympi->my_rank; ik1 < nk; ik1 += mympi->nprocs) {
-        for (is1 = 0; is1 < ns; ++is1) {
+#ifdef _OPENMP
+#pragma omp parallel private(i, ik1, is1, omega1, n1, v4_tmp) firstprivate(arr_quartic)
+#endif
+    {
+        std::complex<double> *ret_omp;
+        memory->allocate(ret_omp, N);
+        for (i = 0; i < N; ++i) ret_omp[i] = std::complex<double>(0.0, 0.0);
+
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+        for (ik1 = mympi->my_rank; ik1 < nk; ik1 += mympi->nprocs) {
+            for (is1 = 0; is1 < ns; ++is1) {
 
-            arr_quartic[1] = ns * ik1 + is1;
-            arr_quartic[2] = ns * kpoint->knum_minus[ik1] + is1;
+                arr_quartic[1] = ns * ik1 + is1;
+                arr_quartic[2] = ns * kpoint->knum_minus[ik1] + is1;
 
-            omega1 = dynamical->eval_phonon[ik1][is1];
-            if (omega1 < eps8) continue;
+                omega1 = dynamical->eval_phonon[ik1][is1];
+                if (omega1 < eps8) continue;
 
-            v4_tmp = anharmonic_core->V4(arr_quartic);
+                v4_tmp = anharmonic_core->V4(arr_quartic);
 
-            if (thermodynamics->classical) {
-                for (i = 0; i < N; ++i) {
-                    n1 = thermodynamics->fC(omega1, T[i]);
-                    ret_mpi[i] += v4_tmp * 2.0 * n1;
-                }
-            } else {
-                for (i = 0; i < N; ++i) {
-                    n1 = thermodynamics->fB(omega1, T[i]);
-                    ret_mpi[i] += v4_tmp * (2.0 * n1 + 1.0);
+                if (thermodynamics->classical) {
+                    for (i = 0; i < N; ++i) {
+                        n1 = thermodynamics->fC(omega1, T[i]);
+                        ret_omp[i] += v4_tmp * 2.0 * n1;
+                    }
+                } else {
+                    for (i = 0; i < N; ++i) {
+                        n1 = thermodynamics->fB(omega1, T[i]);
+                        ret_omp[i] += v4_tmp * (2.0 * n1 + 1.0);
+                    }
                 }
+
             }
+        }
 
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+        {
+            for (i = 0; i < N; ++i) ret_mpi[i] += ret_omp[i];
         }
+        memory->deallocate(ret_omp);
     }
 
     factor = -1.0 / (static_cast<double>(nk) * std::pow(2.0, 3));
@@ -356,70 +574,92 @@ void Selfenergy::selfenergy_c(const unsigned int N,
 
     arr_quartic[0] = ns * kpoint->knum_minus[knum] + snum;
 
-    for (ik1 = mympi->my_rank; ik1 < nk; ik1 += mympi->nprocs) {
-        for (ik2 = 0; ik2 < nk; ++ik2) {
+#ifdef _OPENMP
+#pragma omp parallel private(i, ik1, ik2, ik3, is1, is2, is3, iloc, jloc, kloc, xk_tmp, v4_tmp, \
+                     omega1, omega2, omega3, n1, n2, n3, n12, n23, n31, T_tmp, omega_sum) \
+                     firstprivate(arr_quartic)
+#endif
+    {
+        std::complex<double> *ret_omp;
+        memory->allocate(ret_omp, N);
+        for (i = 0; i < N; ++i) ret_omp[i] = std::complex<double>(0.0, 0.0);
 
-            xk_tmp[0] = kpoint->xk[knum][0] - kpoint->xk[ik1][0] - kpoint->xk[ik2][0];
-            xk_tmp[1] = kpoint->xk[knum][1] - kpoint->xk[ik1][1] - kpoint->xk[ik2][1];
-            xk_tmp[2] = kpoint->xk[knum][2] - kpoint->xk[ik1][2] - kpoint->xk[ik2][2];
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+        for (ik1 = mympi->my_rank; ik1 < nk; ik1 += mympi->nprocs) {
+            for (ik2 = 0; ik2 < nk; ++ik2) {
 
-            iloc = (nint(xk_tmp[0] * static_cast<double>(nkx) + static_cast<double>(2 * nkx))) % nkx;
-            jloc = (nint(xk_tmp[1] * static_cast<double>(nky) + static_cast<double>(2 * nky))) % nky;
-            kloc = (nint(xk_tmp[2] * static_cast<double>(nkz) + static_cast<double>(2 * nkz))) % nkz;
+                xk_tmp[0] = kpoint->xk[knum][0] - kpoint->xk[ik1][0] - kpoint->xk[ik2][0];
+                xk_tmp[1] = kpoint->xk[knum][1] - kpoint->xk[ik1][1] - kpoint->xk[ik2][1];
+                xk_tmp[2] = kpoint->xk[knum][2] - kpoint->xk[ik1][2] - kpoint->xk[ik2][2];
 
-            ik3 = kloc + nkz * jloc + nky * nkz * iloc;
+                iloc = (nint(xk_tmp[0] * static_cast<double>(nkx) + static_cast<double>(2 * nkx))) % nkx;
+                jloc = (nint(xk_tmp[1] * static_cast<double>(nky) + static_cast<double>(2 * nky))) % nky;
+                kloc = (nint(xk_tmp[2] * static_cast<double>(nkz) + static_cast<double>(2 * nkz))) % nkz;
 
-            for (is1 = 0; is1 < ns; ++is1) {
+                ik3 = kloc + nkz * jloc + nky * nkz * iloc;
 
-                arr_quartic[1] = ns * ik1 + is1;
-                omega1 = dynamical->eval_phonon[ik1][is1];
+                for (is1 = 0; is1 < ns; ++is1) {
 
-                for (is2 = 0; is2 < ns; ++is2) {
+                    arr_quartic[1] = ns * ik1 + is1;
+                    omega1 = dynamical->eval_phonon[ik1][is1];
 
-                    arr_quartic[2] = ns * ik2 + is2;
-                    omega2 = dynamical->eval_phonon[ik2][is2];
+                    for (is2 = 0; is2 < ns; ++is2) {
 
-                    for (is3 = 0; is3 < ns; ++is3) {
+                        arr_quartic[2] = ns * ik2 + is2;
+                        omega2 = dynamical->eval_phonon[ik2][is2];
 
-                        arr_quartic[3] = ns * ik3 + is3;
-                        omega3 = dynamical->eval_phonon[ik3][is3];
+                        for (is3 = 0; is3 < ns; ++is3) {
 
-                        v4_tmp = std::norm(anharmonic_core->V4(arr_quartic));
+                            arr_quartic[3] = ns * ik3 + is3;
+                            omega3 = dynamical->eval_phonon[ik3][is3];
 
-                        omega_sum[0]
-                            = 1.0 / (omega_shift - omega1 - omega2 - omega3)
-                            - 1.0 / (omega_shift + omega1 + omega2 + omega3);
-                        omega_sum[1]
-                            = 1.0 / (omega_shift - omega1 - omega2 + omega3)
-                            - 1.0 / (omega_shift + omega1 + omega2 - omega3);
-                        omega_sum[2]
-                            = 1.0 / (omega_shift + omega1 - omega2 - omega3)
-                            - 1.0 / (omega_shift - omega1 + omega2 + omega3);
-                        omega_sum[3]
-                            = 1.0 / (omega_shift - omega1 + omega2 - omega3)
-                            - 1.0 / (omega_shift + omega1 - omega2 + omega3);
+                            v4_tmp = std::norm(anharmonic_core->V4(arr_quartic));
 
-                        for (i = 0; i < N; ++i) {
-                            T_tmp = T[i];
+                            omega_sum[0]
+                                = 1.0 / (omega_shift - omega1 - omega2 - omega3)
+                                - 1.0 / (omega_shift + omega1 + omega2 + omega3);
+                            omega_sum[1]
+                                = 1.0 / (omega_shift - omega1 - omega2 + omega3)
+                                - 1.0 / (omega_shift + omega1 + omega2 - omega3);
+                            omega_sum[2]
+                                = 1.0 / (omega_shift + omega1 - omega2 - omega3)
+                                - 1.0 / (omega_shift - omega1 + omega2 + omega3);
+                            omega_sum[3]
+                                = 1.0 / (omega_shift - omega1 + omega2 - omega3)
+                                - 1.0 / (omega_shift + omega1 - omega2 + omega3);
 
-                            n1 = thermodynamics->fB(omega1, T_tmp);
-                            n2 = thermodynamics->fB(omega2, T_tmp);
-                            n3 = thermodynamics->fB(omega3, T_tmp);
+                            for (i = 0; i < N; ++i) {
+                                T_tmp = T[i];
 
-                            n12 = n1 * n2;
-                            n23 = n2 * n3;
-                            n31 = n3 * n1;
+                                n1 = thermodynamics->fB(omega1, T_tmp);
+                                n2 = thermodynamics->fB(omega2, T_tmp);
+                                n3 = thermodynamics->fB(omega3, T_tmp);
+
+                                n12 = n1 * n2;
+                                n23 = n2 * n3;
+                                n31 = n3 * n1;
 
-                            ret_mpi[i] += v4_tmp
-                                * ((n12 + n23 + n31 + n1 + n2 + n3 + 1.0) * omega_sum[0]
-                                    + (n31 + n23 + n3 - n12) * omega_sum[1]
-                                    + (n12 + n31 + n1 - n23) * omega_sum[2]
-                                    + (n23 + n12 + n2 - n31) * omega_sum[3]);
+                                ret_omp[i] += v4_tmp
+                                    * ((n12 + n23 + n31 + n1 + n2 + n3 + 1.0) * omega_sum[0]
+                                        + (n31 + n23 + n3 - n12) * omega_sum[1]
+                                        + (n12 + n31 + n1 - n23) * omega_sum[2]
+                                        + (n23 + n12 + n2 - n31) * omega_sum[3]);
+                            }
                         }
                     }
                 }
             }
         }
+
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+        {
+            for (i = 0; i < N; ++i) ret_mpi[i] += ret_omp[i];
+        }
+        memory->deallocate(ret_omp);
     }
 
     factor = -1.0 / (std::pow(static_cast<double>(nk), 2) * std::pow(2.0, 5) * 3.0);
@@ -473,100 +713,122 @@ void Selfenergy::selfenergy_d(const unsigned int N,
 
     omega_shift = omega + im * epsilon;
 
-    for (i = 0; i < N; ++i) ret[i] = std::complex<double>(0.0, 0.0);
+    for (i = 0; i < N; ++i) ret_mpi[i] = std::complex<double>(0.0, 0.0);
 
     arr_cubic1[0] = ns * kpoint->knum_minus[knum] + snum;
     arr_cubic2[2] = ns * knum + snum;
 
-    for (ik1 = mympi->my_rank; ik1 < nk; ik1 += mympi->nprocs) {
-
-        xk_tmp[0] = kpoint->xk[knum][0] - kpoint->xk[ik1][0];
-        xk_tmp[1] = kpoint->xk[knum][1] - kpoint->xk[ik1][1];
-        xk_tmp[2] = kpoint->xk[knum][2] - kpoint->xk[ik1][2];
-
-        iloc = (nint(xk_tmp[0] * static_cast<double>(nkx) + static_cast<double>(2 * nkx))) % nkx;
-        jloc = (nint(xk_tmp[1] * static_cast<double>(nky) + static_cast<double>(2 * nky))) % nky;
-        kloc = (nint(xk_tmp[2] * static_cast<double>(nkz) + static_cast<double>(2 * nkz))) % nkz;
-
-        ik2 = kloc + nkz * jloc + nky * nkz * iloc;
+#ifdef _OPENMP
+#pragma omp parallel private(i, ik1, ik2, ik3, ik4, is1, is2, is3, is4, iloc, jloc, kloc, xk_tmp, \
+                     n1, n2, n3, n4, omega1, omega2, omega3, omega4, T_tmp, v3_tmp1, v3_tmp2, \
+                     v4_tmp, v_prod, omega_sum) firstprivate(arr_cubic1, arr_cubic2, arr_quartic)
+#endif
+    {
+        std::complex<double> *ret_omp;
+        memory->allocate(ret_omp, N);
+        for (i = 0; i < N; ++i) ret_omp[i] = std::complex<double>(0.0, 0.0);
 
-        for (ik3 = 0; ik3 < nk; ++ik3) {
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+        for (ik1 = mympi->my_rank; ik1 < nk; ik1 += mympi->nprocs) {
 
-            xk_tmp[0] = kpoint->xk[knum][0] - kpoint->xk[ik3][0];
-            xk_tmp[1] = kpoint->xk[knum][1] - kpoint->xk[ik3][1];
-            xk_tmp[2] = kpoint->xk[knum][2] - kpoint->xk[ik3][2];
+            xk_tmp[0] = kpoint->xk[knum][0] - kpoint->xk[ik1][0];
+            xk_tmp[1] = kpoint->xk[knum][1] - kpoint->xk[ik1][1];
+            xk_tmp[2] = kpoint->xk[knum][2] - kpoint->xk[ik1][2];
 
             iloc = (nint(xk_tmp[0] * static_cast<double>(nkx) + static_cast<double>(2 * nkx))) % nkx;
             jloc = (nint(xk_tmp[1] * static_cast<double>(nky) + static_cast<double>(2 * nky))) % nky;
             kloc = (nint(xk_tmp[2] * static_cast<double>(nkz) + static_cast<double>(2 * nkz))) % nkz;
 
-            ik4 = kloc + nkz * jloc + nky * nkz * iloc;
+            ik2 = kloc + nkz * jloc + nky * nkz * iloc;
 
-            for (is1 = 0; is1 < ns; ++is1) {
+            for (ik3 = 0; ik3 < nk; ++ik3) {
 
-                omega1 = dynamical->eval_phonon[ik1][is1];
+                xk_tmp[0] = kpoint->xk[knum][0] - kpoint->xk[ik3][0];
+                xk_tmp[1] = kpoint->xk[knum][1] - kpoint->xk[ik3][1];
+                xk_tmp[2] = kpoint->xk[knum][2] - kpoint->xk[ik3][2];
 
-                arr_cubic2[0] = ns * kpoint->knum_minus[ik1] + is1;
-                arr_quartic[0] = ns * ik1 + is1;
+                iloc = (nint(xk_tmp[0] * static_cast<double>(nkx) + static_cast<double>(2 * nkx))) % nkx;
+                jloc = (nint(xk_tmp[1] * static_cast<double>(nky) + static_cast<double>(2 * nky))) % nky;
+                kloc = (nint(xk_tmp[2] * static_cast<double>(nkz) + static_cast<double>(2 * nkz))) % nkz;
 
-                for (is2 = 0; is2 < ns; ++is2) {
+                ik4 = kloc + nkz * jloc + nky * nkz * iloc;
 
-                    omega2 = dynamical->eval_phonon[ik2][is2];
+                for (is1 = 0; is1 < ns; ++is1) {
 
-                    arr_cubic2[1] = ns * kpoint->knum_minus[ik2] + is2;
-                    arr_quartic[1] = ns * ik2 + is2;
+                    omega1 = dynamical->eval_phonon[ik1][is1];
 
-                    v3_tmp2 = anharmonic_core->V3(arr_cubic2);
+                    arr_cubic2[0] = ns * kpoint->knum_minus[ik1] + is1;
+                    arr_quartic[0] = ns * ik1 + is1;
 
-                    for (is3 = 0; is3 < ns; ++is3) {
+                    for (is2 = 0; is2 < ns; ++is2) {
 
-                        omega3 = dynamical->eval_phonon[ik3][is3];
+                        omega2 = dynamical->eval_phonon[ik2][is2];
 
-                        arr_cubic1[1] = ns * ik3 + is3;
-                        arr_quartic[2] = ns * kpoint->knum_minus[ik3] + is3;
+                        arr_cubic2[1] = ns * kpoint->knum_minus[ik2] + is2;
+                        arr_quartic[1] = ns * ik2 + is2;
 
-                        for (is4 = 0; is4 < ns; ++is4) {
+                        v3_tmp2 = anharmonic_core->V3(arr_cubic2);
 
-                            omega4 = dynamical->eval_phonon[ik4][is4];
+                        for (is3 = 0; is3 < ns; ++is3) {
 
-                            arr_cubic1[2] = ns * ik4 + is4;
-                            arr_quartic[3] = ns * kpoint->knum_minus[ik4] + is4;
+                            omega3 = dynamical->eval_phonon[ik3][is3];
 
-                            v3_tmp1 = anharmonic_core->V3(arr_cubic1);
-                            v4_tmp = anharmonic_core->V4(arr_quartic);
+                            arr_cubic1[1] = ns * ik3 + is3;
+                            arr_quartic[2] = ns * kpoint->knum_minus[ik3] + is3;
 
-                            v_prod = v3_tmp1 * v3_tmp2 * v4_tmp;
+                            for (is4 = 0; is4 < ns; ++is4) {
 
-                            omega_sum[0]
-                                = 1.0 / (omega_shift + omega1 + omega2)
-                                - 1.0 / (omega_shift - omega1 - omega2);
-                            omega_sum[1]
-                                = 1.0 / (omega_shift + omega1 - omega2)
-                                - 1.0 / (omega_shift - omega1 + omega2);
-                            omega_sum[2]
-                                = 1.0 / (omega_shift + omega3 + omega4)
-                                - 1.0 / (omega_shift - omega3 - omega4);
-                            omega_sum[3]
-                                = 1.0 / (omega_shift + omega3 - omega4)
-                                - 1.0 / (omega_shift - omega3 + omega4);
+                                omega4 = dynamical->eval_phonon[ik4][is4];
 
-                            for (i = 0; i < N; ++i) {
-                                T_tmp = T[i];
+                                arr_cubic1[2] = ns * ik4 + is4;
+                                arr_quartic[3] = ns * kpoint->knum_minus[ik4] + is4;
 
-                                n1 = thermodynamics->fB(omega1, T_tmp);
-                                n2 = thermodynamics->fB(omega2, T_tmp);
-                                n3 = thermodynamics->fB(omega3, T_tmp);
-                                n4 = thermodynamics->fB(omega4, T_tmp);
+                                v3_tmp1 = anharmonic_core->V3(arr_cubic1);
+                                v4_tmp = anharmonic_core->V4(arr_quartic);
+
+                                v_prod = v3_tmp1 * v3_tmp2 * v4_tmp;
+
+                                omega_sum[0]
+                                    = 1.0 / (omega_shift + omega1 + omega2)
+                                    - 1.0 / (omega_shift - omega1 - omega2);
+                                omega_sum[1]
+                                    = 1.0 / (omega_shift + omega1 - omega2)
+                                    - 1.0 / (omega_shift - omega1 + omega2);
+                                omega_sum[2]
+                                    = 1.0 / (omega_shift + omega3 + omega4)
+                                    - 1.0 / (omega_shift - omega3 - omega4);
+                                omega_sum[3]
+                                    = 1.0 / (omega_shift + omega3 - omega4)
+                                    - 1.0 / (omega_shift - omega3 + omega4);
+
+                                for (i = 0; i < N; ++i) {
+                                    T_tmp = T[i];
+
+                                    n1 = thermodynamics->fB(omega1, T_tmp);
+                                    n2 = thermodynamics->fB(omega2, T_tmp);
+                                    n3 = thermodynamics->fB(omega3, T_tmp);
+                                    n4 = thermodynamics->fB(omega4, T_tmp);
 
-                                ret_mpi[i] += v_prod
-                                    * ((1.0 + n1 + n2) * omega_sum[0] + (n2 - n1) * omega_sum[1])
-                                    * ((1.0 + n3 + n4) * omega_sum[2] + (n4 - n3) * omega_sum[3]);
+                                    ret_omp[i] += v_prod
+                                        * ((1.0 + n1 + n2) * omega_sum[0] + (n2 - n1) * omega_sum[1])
+                                        * ((1.0 + n3 + n4) * omega_sum[2] + (n4 - n3) * omega_sum[3]);
+                                }
                             }
                         }
                     }
                 }
             }
         }
+
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+        {
+            for (i = 0; i < N; ++i) ret_mpi[i] += ret_omp[i];
+        }
+        memory->deallocate(ret_omp);
     }
 
     factor = -1.0 / (std::pow(static_cast<double>(nk), 2) * std::pow(2.0, 7));
@@ -625,7 +887,6 @@ void Selfenergy::selfenergy_e(const unsigned int N,
     std::complex<double> *ret_mpi;
 
     memory->allocate(ret_mpi, N);
-    memory->allocate(prod_tmp, N);
 
     omega_shift = omega + im * epsilon;
 
@@ -634,173 +895,199 @@ void Selfenergy::selfenergy_e(const unsigned int N,
     arr_cubic1[0] = ns * kpoint->knum_minus[knum] + snum;
     arr_cubic2[2] = ns * knum + snum;
 
-    for (ik1 = mympi->my_rank; ik1 < nk; ik1 += mympi->nprocs) {
+#ifdef _OPENMP
+#pragma omp parallel private(i, ik1, ik2, ik3, ik4, is1, is2, is3, is4, iloc, jloc, kloc, ip1, ip4, \
+                     T_tmp, omega1, omega2, omega3, omega4, dp1, dp4, dp1_inv, n1, n2, n3, n4, \
+                     xk_tmp, D12, T_inv, v3_tmp1, v3_tmp2, v4_tmp, v_prod, omega_sum, omega_sum14, \
+                     omega_sum24, omega_prod, prod_tmp) firstprivate(arr_cubic1, arr_cubic2, \
+                     arr_quartic)
+#endif
+    {
+        std::complex<double> *ret_omp;
+        memory->allocate(ret_omp, N);
+        memory->allocate(prod_tmp, N);
+        for (i = 0; i < N; ++i) ret_omp[i] = std::complex<double>(0.0, 0.0);
+
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+        for (ik1 = mympi->my_rank; ik1 < nk; ik1 += mympi->nprocs) {
 
-        ik2 = ik1;
+            ik2 = ik1;
 
-        xk_tmp[0] = kpoint->xk[knum][0] - kpoint->xk[ik1][0];
-        xk_tmp[1] = kpoint->xk[knum][1] - kpoint->xk[ik1][1];
-        xk_tmp[2] = kpoint->xk[knum][2] - kpoint->xk[ik1][2];
+            xk_tmp[0] = kpoint->xk[knum][0] - kpoint->xk[ik1][0];
+            xk_tmp[1] = kpoint->xk[knum][1] - kpoint->xk[ik1][1];
+            xk_tmp[2] = kpoint->xk[knum][2] - kpoint->xk[ik1][2];
 
-        iloc = (nint(xk_tmp[0] * static_cast<double>(nkx) + static_cast<double>(2 * nkx))) % nkx;
-        jloc = (nint(xk_tmp[1] * static_cast<double>(nky) + static_cast<double>(2 * nky))) % nky;
-        kloc = (nint(xk_tmp[2] * static_cast<double>(nkz) + static_cast<double>(2 * nkz))) % nkz;
+            iloc = (nint(xk_tmp[0] * static_cast<double>(nkx) + static_cast<double>(2 * nkx))) % nkx;
+            jloc = (nint(xk_tmp[1] * static_cast<double>(nky) + static_cast<double>(2 * nky))) % nky;
+            kloc = (nint(xk_tmp[2] * static_cast<double>(nkz) + static_cast<double>(2 * nkz))) % nkz;
 
-        ik4 = kloc + nkz * jloc + nky * nkz * iloc;
+            ik4 = kloc + nkz * jloc + nky * nkz * iloc;
 
-        for (ik3 = 0; ik3 < nk; ++ik3) {
+            for (ik3 = 0; ik3 < nk; ++ik3) {
 
-            for (is1 = 0; is1 < ns; ++is1) {
+                for (is1 = 0; is1 < ns; ++is1) {
 
-                omega1 = dynamical->eval_phonon[ik1][is1];
+                    omega1 = dynamical->eval_phonon[ik1][is1];
 
-                arr_cubic1[1] = ns * ik1 + is1;
-                arr_quartic[0] = ns * kpoint->knum_minus[ik1] + is1;
+                    arr_cubic1[1] = ns * ik1 + is1;
+                    arr_quartic[0] = ns * kpoint->knum_minus[ik1] + is1;
 
-                for (is2 = 0; is2 < ns; ++is2) {
+                    for (is2 = 0; is2 < ns; ++is2) {
 
-                    omega2 = dynamical->eval_phonon[ik2][is2];
+                        omega2 = dynamical->eval_phonon[ik2][is2];
 
-                    arr_cubic2[0] = ns * kpoint->knum_minus[ik2] + is2;
-                    arr_quartic[3] = ns * ik2 + is2;
+                        arr_cubic2[0] = ns * kpoint->knum_minus[ik2] + is2;
+                        arr_quartic[3] = ns * ik2 + is2;
 
-                    if (std::abs(omega1 - omega2) < eps) {
+                        if (std::abs(omega1 - omega2) < eps) {
 
-                        for (is3 = 0; is3 < ns; ++is3) {
+                            for (is3 = 0; is3 < ns; ++is3) {
 
-                            omega3 = dynamical->eval_phonon[ik3][is3];
+                                omega3 = dynamical->eval_phonon[ik3][is3];
 
-                            arr_quartic[1] = ns * ik3 + is3;
-                            arr_quartic[2] = ns * kpoint->knum_minus[ik3] + is3;
+                                arr_quartic[1] = ns * ik3 + is3;
+                                arr_quartic[2] = ns * kpoint->knum_minus[ik3] + is3;
 
-                            v4_tmp = anharmonic_core->V4(arr_quartic);
+                                v4_tmp = anharmonic_core->V4(arr_quartic);
 
-                            for (is4 = 0; is4 < ns; ++is4) {
+                                for (is4 = 0; is4 < ns; ++is4) {
 
-                                omega4 = dynamical->eval_phonon[ik4][is4];
+                                    omega4 = dynamical->eval_phonon[ik4][is4];
 
-                                arr_cubic1[2] = ns * ik4 + is4;
-                                arr_cubic2[1] = ns * kpoint->knum_minus[ik4] + is4;
+                                    arr_cubic1[2] = ns * ik4 + is4;
+                                    arr_cubic2[1] = ns * kpoint->knum_minus[ik4] + is4;
 
-                                v3_tmp1 = anharmonic_core->V3(arr_cubic1);
-                                v3_tmp2 = anharmonic_core->V3(arr_cubic2);
+                                    v3_tmp1 = anharmonic_core->V3(arr_cubic1);
+                                    v3_tmp2 = anharmonic_core->V3(arr_cubic2);
 
-                                v_prod = v3_tmp1 * v3_tmp2 * v4_tmp;
+                                    v_prod = v3_tmp1 * v3_tmp2 * v4_tmp;
 
-                                for (i = 0; i < N; ++i) prod_tmp[i] = std::complex<double>(0.0, 0.0);
+                                    for (i = 0; i < N; ++i) prod_tmp[i] = std::complex<double>(0.0, 0.0);
 
-                                for (ip1 = 1; ip1 >= -1; ip1 -= 2) {
-                                    dp1 = static_cast<double>(ip1) * omega1;
-                                    dp1_inv = 1.0 / dp1;
+                                    for (ip1 = 1; ip1 >= -1; ip1 -= 2) {
+                                        dp1 = static_cast<double>(ip1) * omega1;
+                                        dp1_inv = 1.0 / dp1;
+
+                                        for (ip4 = 1; ip4 >= -1; ip4 -= 2) {
+                                            dp4 = static_cast<double>(ip4) * omega4;
 
-                                    for (ip4 = 1; ip4 >= -1; ip4 -= 2) {
-                                        dp4 = static_cast<double>(ip4) * omega4;
+                                            omega_sum = 1.0 / (omega_shift + dp1 + dp4);
 
-                                        omega_sum = 1.0 / (omega_shift + dp1 + dp4);
+                                            for (i = 0; i < N; ++i) {
+                                                T_tmp = T[i];
 
-                                        for (i = 0; i < N; ++i) {
-                                            T_tmp = T[i];
+                                                n1 = thermodynamics->fB(dp1, T_tmp);
+                                                n4 = thermodynamics->fB(dp4, T_tmp);
 
-                                            n1 = thermodynamics->fB(dp1, T_tmp);
-                                            n4 = thermodynamics->fB(dp4, T_tmp);
 
+                                                if (std::abs(T_tmp) < eps) {
+                                                    //special treatment for T = 0
+                                                    // This is valid since beta always appears as a product beta*n
+                                                    // which is zero when T = 0.
+                                                    T_inv = 0.0;
+                                                } else {
+                                                    T_inv = 1.0 / (thermodynamics->T_to_Ryd * T_tmp);
+                                                }
 
-                                            if (std::abs(T_tmp) < eps) {
-                                                //special treatment for T = 0
-                                                // This is valid since beta always appears as a product beta*n
-                                                // which is zero when T = 0.
-                                                T_inv = 0.0;
-                                            } else {
-                                                T_inv = 1.0 / (thermodynamics->T_to_Ryd * T_tmp);
+                                                prod_tmp[i] += static_cast<double>(ip4) * omega_sum
+                                                    * ((1.0 + n1 + n4) * omega_sum
+                                                        + (1.0 + n1 + n4) * dp1_inv + n1 * (1.0 + n1) * T_inv);
                                             }
-
-                                            prod_tmp[i] += static_cast<double>(ip4) * omega_sum
-                                                * ((1.0 + n1 + n4) * omega_sum
-                                                    + (1.0 + n1 + n4) * dp1_inv + n1 * (1.0 + n1) * T_inv);
                                         }
                                     }
-                                }
 
-                                for (i = 0; i < N; ++i) {
-                                    T_tmp = T[i];
+                                    for (i = 0; i < N; ++i) {
+                                        T_tmp = T[i];
 
-                                    n3 = thermodynamics->fB(omega3, T_tmp);
-                                    ret_mpi[i] += v_prod * (2.0 * n3 + 1.0) * prod_tmp[i];
+                                        n3 = thermodynamics->fB(omega3, T_tmp);
+                                        ret_omp[i] += v_prod * (2.0 * n3 + 1.0) * prod_tmp[i];
+                                    }
                                 }
                             }
-                        }
 
-                    } else {
+                        } else {
 
-                        D12[0] = 1.0 / (omega1 + omega2) - 1.0 / (omega1 - omega2);
-                        D12[1] = 1.0 / (omega1 + omega2) + 1.0 / (omega1 - omega2);
+                            D12[0] = 1.0 / (omega1 + omega2) - 1.0 / (omega1 - omega2);
+                            D12[1] = 1.0 / (omega1 + omega2) + 1.0 / (omega1 - omega2);
 
-                        for (is3 = 0; is3 < ns; ++is3) {
+                            for (is3 = 0; is3 < ns; ++is3) {
 
-                            omega3 = dynamical->eval_phonon[ik3][is3];
+                                omega3 = dynamical->eval_phonon[ik3][is3];
 
-                            arr_quartic[1] = ns * ik3 + is3;
-                            arr_quartic[2] = ns * kpoint->knum_minus[ik3] + is3;
+                                arr_quartic[1] = ns * ik3 + is3;
+                                arr_quartic[2] = ns * kpoint->knum_minus[ik3] + is3;
 
-                            v4_tmp = anharmonic_core->V4(arr_quartic);
+                                v4_tmp = anharmonic_core->V4(arr_quartic);
 
-                            for (is4 = 0; is4 < ns; ++is4) {
+                                for (is4 = 0; is4 < ns; ++is4) {
 
-                                omega4 = dynamical->eval_phonon[ik4][is4];
+                                    omega4 = dynamical->eval_phonon[ik4][is4];
 
-                                arr_cubic1[2] = ns * ik4 + is4;
-                                arr_cubic2[1] = ns * kpoint->knum_minus[ik4] + is4;
+                                    arr_cubic1[2] = ns * ik4 + is4;
+                                    arr_cubic2[1] = ns * kpoint->knum_minus[ik4] + is4;
 
-                                v3_tmp1 = anharmonic_core->V3(arr_cubic1);
-                                v3_tmp2 = anharmonic_core->V3(arr_cubic2);
+                                    v3_tmp1 = anharmonic_core->V3(arr_cubic1);
+                                    v3_tmp2 = anharmonic_core->V3(arr_cubic2);
 
-                                v_prod = v3_tmp1 * v3_tmp2 * v4_tmp;
+                                    v_prod = v3_tmp1 * v3_tmp2 * v4_tmp;
 
-                                omega_sum14[0] = 1.0 / (omega_shift + omega1 + omega4);
-                                omega_sum14[1] = 1.0 / (omega_shift + omega1 - omega4);
-                                omega_sum14[2] = 1.0 / (omega_shift - omega1 + omega4);
-                                omega_sum14[3] = 1.0 / (omega_shift - omega1 - omega4);
-
-                                omega_sum24[0] = 1.0 / (omega_shift + omega2 + omega4);
-                                omega_sum24[1] = 1.0 / (omega_shift + omega2 - omega4);
-                                omega_sum24[2] = 1.0 / (omega_shift - omega2 + omega4);
-                                omega_sum24[3] = 1.0 / (omega_shift - omega2 - omega4);
-
-                                omega_prod[0] = D12[0] * (omega_sum14[0] - omega_sum14[1]);
-                                omega_prod[1] = D12[0] * (omega_sum14[2] - omega_sum14[3]);
-                                omega_prod[2] = D12[1] * (omega_sum24[0] - omega_sum24[1]);
-                                omega_prod[3] = D12[1] * (omega_sum24[2] - omega_sum24[3]);
-                                omega_prod[4] = (omega_sum14[1] - omega_sum14[3])
-                                    * (omega_sum24[1] - omega_sum24[3]);
-                                omega_prod[5] = (omega_sum14[0] - omega_sum14[2])
-                                    * (omega_sum24[0] - omega_sum24[2]);
+                                    omega_sum14[0] = 1.0 / (omega_shift + omega1 + omega4);
+                                    omega_sum14[1] = 1.0 / (omega_shift + omega1 - omega4);
+                                    omega_sum14[2] = 1.0 / (omega_shift - omega1 + omega4);
+                                    omega_sum14[3] = 1.0 / (omega_shift - omega1 - omega4);
 
-                                for (i = 0; i < N; ++i) {
-                                    T_tmp = T[i];
+                                    omega_sum24[0] = 1.0 / (omega_shift + omega2 + omega4);
+                                    omega_sum24[1] = 1.0 / (omega_shift + omega2 - omega4);
+                                    omega_sum24[2] = 1.0 / (omega_shift - omega2 + omega4);
+                                    omega_sum24[3] = 1.0 / (omega_shift - omega2 - omega4);
 
-                                    n1 = thermodynamics->fB(omega1, T_tmp);
-                                    n2 = thermodynamics->fB(omega2, T_tmp);
-                                    n3 = thermodynamics->fB(omega3, T_tmp);
-                                    n4 = thermodynamics->fB(omega4, T_tmp);
+                                    omega_prod[0] = D12[0] * (omega_sum14[0] - omega_sum14[1]);
+                                    omega_prod[1] = D12[0] * (omega_sum14[2] - omega_sum14[3]);
+                                    omega_prod[2] = D12[1] * (omega_sum24[0] - omega_sum24[1]);
+                                    omega_prod[3] = D12[1] * (omega_sum24[2] - omega_sum24[3]);
+                                    omega_prod[4] = (omega_sum14[1] - omega_sum14[3])
+                                        * (omega_sum24[1] - omega_sum24[3]);
+                                    omega_prod[5] = (omega_sum14[0] - omega_sum14[2])
+                                        * (omega_sum24[0] - omega_sum24[2]);
+
+                                    for (i = 0; i < N; ++i) {
+                                        T_tmp = T[i];
+
+                                        n1 = thermodynamics->fB(omega1, T_tmp);
+                                        n2 = thermodynamics->fB(omega2, T_tmp);
+                                        n3 = thermodynamics->fB(omega3, T_tmp);
+                                        n4 = thermodynamics->fB(omega4, T_tmp);
 
-                                    ret_mpi[i] += v_prod * (2.0 * n3 + 1.0)
-                                        * ((1.0 + n1) * omega_prod[0] + n1 * omega_prod[1]
-                                            + (1.0 + n2) * omega_prod[2] + n2 * omega_prod[3]
-                                            + (1.0 + n4) * omega_prod[4] + n4 * omega_prod[5]);
+                                        ret_omp[i] += v_prod * (2.0 * n3 + 1.0)
+                                            * ((1.0 + n1) * omega_prod[0] + n1 * omega_prod[1]
+                                                + (1.0 + n2) * omega_prod[2] + n2 * omega_prod[3]
+                                                + (1.0 + n4) * omega_prod[4] + n4 * omega_prod[5]);
 
-                                    /*
-                                    ret[i] *= v3_tmp1 * v3_tmp2 * v4_tmp * (2.0 * n3 + 1.0) * (2.0 * omega2) / (omega1 * omega1 - omega2 * omega2)
-                                    * ((1.0 + n1 + n4) * (1.0 / (omega - omega1 - omega4 + im * epsilon) - 1.0 / (omega + omega1 + omega4 + im * epsilon)) 
-                                    + (n4 - n1) * (1.0 / (omega - omega1 + omega4 + im * epsilon) - 1.0 / (omega + omega1 - omega4 + im * epsilon)));
-                                    */
+                                        /*
+                                        ret[i] *= v3_tmp1 * v3_tmp2 * v4_tmp * (2.0 * n3 + 1.0) * (2.0 * omega2) / (omega1 * omega1 - omega2 * omega2)
+                                        * ((1.0 + n1 + n4) * (1.0 / (omega - omega1 - omega4 + im * epsilon) - 1.0 / (omega + omega1 + omega4 + im * epsilon)) 
+                                        + (n4 - n1) * (1.0 / (omega - omega1 + omega4 + im * epsilon) - 1.0 / (omega + omega1 - omega4 + im * epsilon)));
+                                        */
+                                    }
                                 }
                             }
-                        }
 
+                        }
                     }
                 }
             }
         }
+
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+        {
+            for (i = 0; i < N; ++i) ret_mpi[i] += ret_omp[i];
+        }
+        memory->deallocate(ret_omp);
+        memory->deallocate(prod_tmp);
     }
 
     factor = -1.0 / (std::pow(static_cast<double>(nk), 2) * std::pow(2.0, 6));
@@ -809,7 +1096,6 @@ void Selfenergy::selfenergy_e(const unsigned int N,
 
     mpi_reduce_complex(N, ret_mpi, ret);
 
-    memory->deallocate(prod_tmp);
     memory->deallocate(ret_mpi);
 }
 
@@ -863,168 +1149,184 @@ void Selfenergy::selfenergy_f(const unsigned int N,
     arr_cubic1[0] = ns * kpoint->knum_minus[knum] + snum;
     arr_cubic4[2] = ns * knum + snum;
 
-    for (ik1 = mympi->my_rank; ik1 < nk; ik1 += mympi->nprocs) {
-
-        ik5 = ik1;
-
-        xk_tmp[0] = kpoint->xk[knum][0] - kpoint->xk[ik1][0];
-        xk_tmp[1] = kpoint->xk[knum][1] - kpoint->xk[ik1][1];
-        xk_tmp[2] = kpoint->xk[knum][2] - kpoint->xk[ik1][2];
-
-        iloc = (nint(xk_tmp[0] * static_cast<double>(nkx) + static_cast<double>(2 * nkx))) % nkx;
-        jloc = (nint(xk_tmp[1] * static_cast<double>(nky) + static_cast<double>(2 * nky))) % nky;
-        kloc = (nint(xk_tmp[2] * static_cast<double>(nkz) + static_cast<double>(2 * nkz))) % nkz;
+#ifdef _OPENMP
+#pragma omp parallel private(i, ik1, ik2, ik3, ik4, ik5, is1, is2, is3, is4, is5, iloc, jloc, kloc, \
+                     ip1, ip2, ip3, ip4, ip5, omega1, omega2, omega3, omega4, omega5, n1, n2, n3, \
+                     n4, n5, xk_tmp, dp1, dp2, dp3, dp4, dp5, T_tmp, dp1_inv, D15, D134, D345, \
+                     T_inv, omega_sum, v3_tmp1, v3_tmp2, v3_tmp3, v3_tmp4, v3_prod) \
+                     firstprivate(arr_cubic1, arr_cubic2, arr_cubic3, arr_cubic4)
+#endif
+    {
+        std::complex<double> *ret_omp;
+        memory->allocate(ret_omp, N);
+        for (i = 0; i < N; ++i) ret_omp[i] = std::complex<double>(0.0, 0.0);
 
-        ik2 = kloc + nkz * jloc + nky * nkz * iloc;
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+        for (ik1 = mympi->my_rank; ik1 < nk; ik1 += mympi->nprocs) {
 
-        for (ik3 = 0; ik3 < nk; ++ik3) {
+            ik5 = ik1;
 
-            xk_tmp[0] = kpoint->xk[ik1][0] - kpoint->xk[ik3][0];
-            xk_tmp[1] = kpoint->xk[ik1][1] - kpoint->xk[ik3][1];
-            xk_tmp[2] = kpoint->xk[ik1][2] - kpoint->xk[ik3][2];
+            xk_tmp[0] = kpoint->xk[knum][0] - kpoint->xk[ik1][0];
+            xk_tmp[1] = kpoint->xk[knum][1] - kpoint->xk[ik1][1];
+            xk_tmp[2] = kpoint->xk[knum][2] - kpoint->xk[ik1][2];
 
             iloc = (nint(xk_tmp[0] * static_cast<double>(nkx) + static_cast<double>(2 * nkx))) % nkx;
             jloc = (nint(xk_tmp[1] * static_cast<double>(nky) + static_cast<double>(2 * nky))) % nky;
             kloc = (nint(xk_tmp[2] * static_cast<double>(nkz) + static_cast<double>(2 * nkz))) % nkz;
 
-            ik4 = kloc + nkz * jloc + nky * nkz * iloc;
+            ik2 = kloc + nkz * jloc + nky * nkz * iloc;
 
-            for (is1 = 0; is1 < ns; ++is1) {
+            for (ik3 = 0; ik3 < nk; ++ik3) {
 
-                omega1 = dynamical->eval_phonon[ik1][is1];
+                xk_tmp[0] = kpoint->xk[ik1][0] - kpoint->xk[ik3][0];
+                xk_tmp[1] = kpoint->xk[ik1][1] - kpoint->xk[ik3][1];
+                xk_tmp[2] = kpoint->xk[ik1][2] - kpoint->xk[ik3][2];
 
-                arr_cubic1[1] = ns * ik1 + is1;
-                arr_cubic2[0] = ns * kpoint->knum_minus[ik1] + is1;
+                iloc = (nint(xk_tmp[0] * static_cast<double>(nkx) + static_cast<double>(2 * nkx))) % nkx;
+                jloc = (nint(xk_tmp[1] * static_cast<double>(nky) + static_cast<double>(2 * nky))) % nky;
+                kloc = (nint(xk_tmp[2] * static_cast<double>(nkz) + static_cast<double>(2 * nkz))) % nkz;
 
-                for (is2 = 0; is2 < ns; ++is2) {
+                ik4 = kloc + nkz * jloc + nky * nkz * iloc;
 
-                    omega2 = dynamical->eval_phonon[ik2][is2];
+                for (is1 = 0; is1 < ns; ++is1) {
 
-                    arr_cubic1[2] = ns * ik2 + is2;
-                    arr_cubic4[1] = ns * kpoint->knum_minus[ik2] + is2;
+                    omega1 = dynamical->eval_phonon[ik1][is1];
 
-                    v3_tmp1 = anharmonic_core->V3(arr_cubic1);
+                    arr_cubic1[1] = ns * ik1 + is1;
+                    arr_cubic2[0] = ns * kpoint->knum_minus[ik1] + is1;
 
-                    for (is5 = 0; is5 < ns; ++is5) {
+                    for (is2 = 0; is2 < ns; ++is2) {
 
-                        omega5 = dynamical->eval_phonon[ik5][is5];
+                        omega2 = dynamical->eval_phonon[ik2][is2];
 
-                        arr_cubic3[2] = ns * ik5 + is5;
-                        arr_cubic4[0] = ns * kpoint->knum_minus[ik5] + is5;
+                        arr_cubic1[2] = ns * ik2 + is2;
+                        arr_cubic4[1] = ns * kpoint->knum_minus[ik2] + is2;
 
-                        v3_tmp4 = anharmonic_core->V3(arr_cubic4);
+                        v3_tmp1 = anharmonic_core->V3(arr_cubic1);
 
-                        for (is3 = 0; is3 < ns; ++is3) {
+                        for (is5 = 0; is5 < ns; ++is5) {
 
-                            omega3 = dynamical->eval_phonon[ik3][is3];
+                            omega5 = dynamical->eval_phonon[ik5][is5];
 
-                            arr_cubic2[1] = ns * ik3 + is3;
-                            arr_cubic3[0] = ns * kpoint->knum_minus[ik3] + is3;
+                            arr_cubic3[2] = ns * ik5 + is5;
+                            arr_cubic4[0] = ns * kpoint->knum_minus[ik5] + is5;
 
-                            for (is4 = 0; is4 < ns; ++is4) {
+                            v3_tmp4 = anharmonic_core->V3(arr_cubic4);
 
-                                omega4 = dynamical->eval_phonon[ik4][is4];
+                            for (is3 = 0; is3 < ns; ++is3) {
 
-                                arr_cubic2[2] = ns * ik4 + is4;
-                                arr_cubic3[1] = ns * kpoint->knum_minus[ik4] + is4;
+                                omega3 = dynamical->eval_phonon[ik3][is3];
 
-                                v3_tmp2 = anharmonic_core->V3(arr_cubic2);
-                                v3_tmp3 = anharmonic_core->V3(arr_cubic3);
+                                arr_cubic2[1] = ns * ik3 + is3;
+                                arr_cubic3[0] = ns * kpoint->knum_minus[ik3] + is3;
 
-                                v3_prod = v3_tmp1 * v3_tmp2 * v3_tmp3 * v3_tmp4;
+                                for (is4 = 0; is4 < ns; ++is4) {
 
-                                if (std::abs(omega1 - omega5) < eps) {
+                                    omega4 = dynamical->eval_phonon[ik4][is4];
 
-                                    for (ip1 = 1; ip1 >= -1; ip1 -= 2) {
-                                        dp1 = static_cast<double>(ip1) * omega1;
-                                        dp1_inv = 1.0 / dp1;
+                                    arr_cubic2[2] = ns * ik4 + is4;
+                                    arr_cubic3[1] = ns * kpoint->knum_minus[ik4] + is4;
 
-                                        for (ip2 = 1; ip2 >= -1; ip2 -= 2) {
-                                            dp2 = static_cast<double>(ip2) * omega2;
-                                            omega_sum[0] = 1.0 / (omega_shift + dp1 + dp2);
+                                    v3_tmp2 = anharmonic_core->V3(arr_cubic2);
+                                    v3_tmp3 = anharmonic_core->V3(arr_cubic3);
 
-                                            for (ip3 = 1; ip3 >= -1; ip3 -= 2) {
-                                                dp3 = static_cast<double>(ip3) * omega3;
+                                    v3_prod = v3_tmp1 * v3_tmp2 * v3_tmp3 * v3_tmp4;
 
-                                                for (ip4 = 1; ip4 >= -1; ip4 -= 2) {
-                                                    dp4 = static_cast<double>(ip4) * omega4;
+                                    if (std::abs(omega1 - omega5) < eps) {
 
-                                                    D134 = 1.0 / (dp1 + dp3 + dp4);
-                                                    omega_sum[1] = 1.0 / (omega_shift + dp2 + dp3 + dp4);
+                                        for (ip1 = 1; ip1 >= -1; ip1 -= 2) {
+                                            dp1 = static_cast<double>(ip1) * omega1;
+                                            dp1_inv = 1.0 / dp1;
 
-                                                    for (i = 0; i < N; ++i) {
-                                                        T_tmp = T[i];
+                                            for (ip2 = 1; ip2 >= -1; ip2 -= 2) {
+                                                dp2 = static_cast<double>(ip2) * omega2;
+                                                omega_sum[0] = 1.0 / (omega_shift + dp1 + dp2);
 
-                                                        n1 = thermodynamics->fB(dp1, T_tmp);
-                                                        n2 = thermodynamics->fB(dp2, T_tmp);
-                                                        n3 = thermodynamics->fB(dp3, T_tmp);
-                                                        n4 = thermodynamics->fB(dp4, T_tmp);
+                                                for (ip3 = 1; ip3 >= -1; ip3 -= 2) {
+                                                    dp3 = static_cast<double>(ip3) * omega3;
 
-                                                        if (std::abs(T_tmp) < eps) {
-                                                            T_inv = 0.0;
-                                                        } else {
-                                                            T_inv = 1.0 / (thermodynamics->T_to_Ryd * T_tmp);
-                                                        }
+                                                    for (ip4 = 1; ip4 >= -1; ip4 -= 2) {
+                                                        dp4 = static_cast<double>(ip4) * omega4;
+
+                                                        D134 = 1.0 / (dp1 + dp3 + dp4);
+                                                        omega_sum[1] = 1.0 / (omega_shift + dp2 + dp3 + dp4);
 
-                                                        ret_mpi[i]
-                                                            += v3_prod * static_cast<double>(ip2 * ip3 * ip4)
-                                                            * (omega_sum[1]
-                                                                * (n2 * omega_sum[0]
-                                                                    * ((1.0 + n3 + n4) * omega_sum[0] + (1.0 + n2 + n4)
-                                                                        * dp1_inv)
-                                                                    + (1.0 + n3) * (1.0 + n4) * D134 * (D134 + dp1_inv))
-                                                                + (1.0 + n1) * (1.0 + n3 + n4) * D134
-                                                                * omega_sum[0] * (omega_sum[0] + D134 + dp1_inv + n1 *
-                                                                    T_inv));
+                                                        for (i = 0; i < N; ++i) {
+                                                            T_tmp = T[i];
+
+                                                            n1 = thermodynamics->fB(dp1, T_tmp);
+                                                            n2 = thermodynamics->fB(dp2, T_tmp);
+                                                            n3 = thermodynamics->fB(dp3, T_tmp);
+                                                            n4 = thermodynamics->fB(dp4, T_tmp);
+
+                                                            if (std::abs(T_tmp) < eps) {
+                                                                T_inv = 0.0;
+                                                            } else {
+                                                                T_inv = 1.0 / (thermodynamics->T_to_Ryd * T_tmp);
+                                                            }
+
+                                                            ret_omp[i]
+                                                                += v3_prod * static_cast<double>(ip2 * ip3 * ip4)
+                                                                * (omega_sum[1]
+                                                                    * (n2 * omega_sum[0]
+                                                                        * ((1.0 + n3 + n4) * omega_sum[0] + (1.0 + n2 + n4)
+                                                                            * dp1_inv)
+                                                                        + (1.0 + n3) * (1.0 + n4) * D134 * (D134 + dp1_inv))
+                                                                    + (1.0 + n1) * (1.0 + n3 + n4) * D134
+                                                                    * omega_sum[0] * (omega_sum[0] + D134 + dp1_inv + n1 *
+                                                                        T_inv));
+                                                        }
                                                     }
                                                 }
                                             }
                                         }
-                                    }
 
-                                } else {
+                                    } else {
 
-                                    for (ip1 = 1; ip1 >= -1; ip1 -= 2) {
-                                        dp1 = static_cast<double>(ip1) * omega1;
+                                        for (ip1 = 1; ip1 >= -1; ip1 -= 2) {
+                                            dp1 = static_cast<double>(ip1) * omega1;
 
-                                        for (ip5 = 1; ip5 >= -1; ip5 -= 2) {
-                                            dp5 = static_cast<double>(ip5) * omega5;
+                                            for (ip5 = 1; ip5 >= -1; ip5 -= 2) {
+                                                dp5 = static_cast<double>(ip5) * omega5;
 
-                                            D15 = 1.0 / (dp1 - dp5);
+                                                D15 = 1.0 / (dp1 - dp5);
 
-                                            for (ip2 = 1; ip2 >= -1; ip2 -= 2) {
-                                                dp2 = static_cast<double>(ip2) * omega2;
+                                                for (ip2 = 1; ip2 >= -1; ip2 -= 2) {
+                                                    dp2 = static_cast<double>(ip2) * omega2;
 
-                                                omega_sum[0] = 1.0 / (omega_shift + dp1 + dp2);
-                                                omega_sum[1] = 1.0 / (omega_shift + dp5 + dp2);
+                                                    omega_sum[0] = 1.0 / (omega_shift + dp1 + dp2);
+                                                    omega_sum[1] = 1.0 / (omega_shift + dp5 + dp2);
 
-                                                for (ip3 = 1; ip3 >= -1; ip3 -= 2) {
-                                                    dp3 = static_cast<double>(ip3) * omega3;
+                                                    for (ip3 = 1; ip3 >= -1; ip3 -= 2) {
+                                                        dp3 = static_cast<double>(ip3) * omega3;
 
-                                                    for (ip4 = 1; ip4 >= -1; ip4 -= 2) {
-                                                        dp4 = static_cast<double>(ip4) * omega4;
+                                                        for (ip4 = 1; ip4 >= -1; ip4 -= 2) {
+                                                            dp4 = static_cast<double>(ip4) * omega4;
 
-                                                        D134 = 1.0 / (dp1 + dp3 + dp4);
-                                                        D345 = 1.0 / (dp5 + dp3 + dp4);
-                                                        omega_sum[2] = 1.0 / (omega_shift + dp2 + dp3 + dp4);
+                                                            D134 = 1.0 / (dp1 + dp3 + dp4);
+                                                            D345 = 1.0 / (dp5 + dp3 + dp4);
+                                                            omega_sum[2] = 1.0 / (omega_shift + dp2 + dp3 + dp4);
 
-                                                        for (i = 0; i < N; ++i) {
-                                                            T_tmp = T[i];
+                                                            for (i = 0; i < N; ++i) {
+                                                                T_tmp = T[i];
 
-                                                            n1 = thermodynamics->fB(dp1, T_tmp);
-                                                            n2 = thermodynamics->fB(dp2, T_tmp);
-                                                            n3 = thermodynamics->fB(dp3, T_tmp);
-                                                            n4 = thermodynamics->fB(dp4, T_tmp);
-                                                            n5 = thermodynamics->fB(dp5, T_tmp);
+                                                                n1 = thermodynamics->fB(dp1, T_tmp);
+                                                                n2 = thermodynamics->fB(dp2, T_tmp);
+                                                                n3 = thermodynamics->fB(dp3, T_tmp);
+                                                                n4 = thermodynamics->fB(dp4, T_tmp);
+                                                                n5 = thermodynamics->fB(dp5, T_tmp);
 
-                                                            ret_mpi[i]
-                                                                += v3_prod * static_cast<double>(ip1 * ip2 * ip3 * ip4 *
-                                                                    ip5)
-                                                                * ((1.0 + n3 + n4)
-                                                                    * (-(1.0 + n1 + n2) * D15 * D134 * omega_sum[0]
-                                                                        + (1.0 + n5 + n2) * D15 * D345 * omega_sum[1])
-                                                                    + (1.0 + n2 + n3 + n4 + n2 * n3 + n3 * n4 + n4 * n2)
-                                                                    * D15 * (D345 - D134) * omega_sum[2]);
+                                                                ret_omp[i]
+                                                                    += v3_prod * static_cast<double>(ip1 * ip2 * ip3 * ip4 *
+                                                                        ip5)
+                                                                    * ((1.0 + n3 + n4)
+                                                                        * (-(1.0 + n1 + n2) * D15 * D134 * omega_sum[0]
+                                                                            + (1.0 + n5 + n2) * D15 * D345 * omega_sum[1])
+                                                                        + (1.0 + n2 + n3 + n4 + n2 * n3 + n3 * n4 + n4 * n2)
+                                                                        * D15 * (D345 - D134) * omega_sum[2]);
+                                                            }
                                                         }
                                                     }
                                                 }
@@ -1038,6 +1340,14 @@ void Selfenergy::selfenergy_f(const unsigned int N,
                 }
             }
         }
+
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+        {
+            for (i = 0; i < N; ++i) ret_mpi[i] += ret_omp[i];
+        }
+        memory->deallocate(ret_omp);
     }
 
     factor = 1.0 / (std::pow(static_cast<double>(nk), 2) * std::pow(2.0, 7));
@@ -1100,91 +1410,106 @@ void Selfenergy::selfenergy_g(const unsigned int N,
     arr_quartic[0] = ns * kpoint->knum_minus[knum] + snum;
     arr_cubic2[2] = ns * knum + snum;
 
-    for (ik1 = mympi->my_rank; ik1 < nk; ik1 += mympi->nprocs) {
+#ifdef _OPENMP
+#pragma omp parallel private(i, ik1, ik2, ik3, ik4, is1, is2, is3, is4, iloc, jloc, kloc, ip1, ip2, \
+                     ip3, ip4, omega1, omega2, omega3, omega4, dp1, dp2, dp3, dp4, n1, n2, n3, n4, \
+                     D124, xk_tmp, T_tmp, omega_sum, v3_tmp1, v3_tmp2, v4_tmp, v_prod) \
+                     firstprivate(arr_quartic, arr_cubic1, arr_cubic2)
+#endif
+    {
+        std::complex<double> *ret_omp;
+        memory->allocate(ret_omp, N);
+        for (i = 0; i < N; ++i) ret_omp[i] = std::complex<double>(0.0, 0.0);
 
-        for (ik2 = 0; ik2 < nk; ++ik2) {
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+        for (ik1 = mympi->my_rank; ik1 < nk; ik1 += mympi->nprocs) {
 
-            xk_tmp[0] = kpoint->xk[knum][0] - kpoint->xk[ik1][0] - kpoint->xk[ik2][0];
-            xk_tmp[1] = kpoint->xk[knum][1] - kpoint->xk[ik1][1] - kpoint->xk[ik2][1];
-            xk_tmp[2] = kpoint->xk[knum][2] - kpoint->xk[ik1][2] - kpoint->xk[ik2][2];
+            for (ik2 = 0; ik2 < nk; ++ik2) {
 
-            iloc = (nint(xk_tmp[0] * static_cast<double>(nkx) + static_cast<double>(2 * nkx))) % nkx;
-            jloc = (nint(xk_tmp[1] * static_cast<double>(nky) + static_cast<double>(2 * nky))) % nky;
-            kloc = (nint(xk_tmp[2] * static_cast<double>(nkz) + static_cast<double>(2 * nkz))) % nkz;
+                xk_tmp[0] = kpoint->xk[knum][0] - kpoint->xk[ik1][0] - kpoint->xk[ik2][0];
+                xk_tmp[1] = kpoint->xk[knum][1] - kpoint->xk[ik1][1] - kpoint->xk[ik2][1];
+                xk_tmp[2] = kpoint->xk[knum][2] - kpoint->xk[ik1][2] - kpoint->xk[ik2][2];
 
-            ik3 = kloc + nkz * jloc + nky * nkz * iloc;
+                iloc = (nint(xk_tmp[0] * static_cast<double>(nkx) + static_cast<double>(2 * nkx))) % nkx;
+                jloc = (nint(xk_tmp[1] * static_cast<double>(nky) + static_cast<double>(2 * nky))) % nky;
+                kloc = (nint(xk_tmp[2] * static_cast<double>(nkz) + static_cast<double>(2 * nkz))) % nkz;
 
-            xk_tmp[0] = kpoint->xk[knum][0] - kpoint->xk[ik3][0];
-            xk_tmp[1] = kpoint->xk[knum][1] - kpoint->xk[ik3][1];
-            xk_tmp[2] = kpoint->xk[knum][2] - kpoint->xk[ik3][2];
+                ik3 = kloc + nkz * jloc + nky * nkz * iloc;
 
-            iloc = (nint(xk_tmp[0] * static_cast<double>(nkx) + static_cast<double>(2 * nkx))) % nkx;
-            jloc = (nint(xk_tmp[1] * static_cast<double>(nky) + static_cast<double>(2 * nky))) % nky;
-            kloc = (nint(xk_tmp[2] * static_cast<double>(nkz) + static_cast<double>(2 * nkz))) % nkz;
+                xk_tmp[0] = kpoint->xk[knum][0] - kpoint->xk[ik3][0];
+                xk_tmp[1] = kpoint->xk[knum][1] - kpoint->xk[ik3][1];
+                xk_tmp[2] = kpoint->xk[knum][2] - kpoint->xk[ik3][2];
 
-            ik4 = kloc + nkz * jloc + nky * nkz * iloc;
+                iloc = (nint(xk_tmp[0] * static_cast<double>(nkx) + static_cast<double>(2 * nkx))) % nkx;
+                jloc = (nint(xk_tmp[1] * static_cast<double>(nky) + static_cast<double>(2 * nky))) % nky;
+                kloc = (nint(xk_tmp[2] * static_cast<double>(nkz) + static_cast<double>(2 * nkz))) % nkz;
 
-            for (is1 = 0; is1 < ns; ++is1) {
-                omega1 = dynamical->eval_phonon[ik1][is1];
+                ik4 = kloc + nkz * jloc + nky * nkz * iloc;
 
-                arr_quartic[1] = ns * ik1 + is1;
-                arr_cubic1[0] = ns * kpoint->knum_minus[ik1] + is1;
+                for (is1 = 0; is1 < ns; ++is1) {
+                    omega1 = dynamical->eval_phonon[ik1][is1];
 
-                for (is2 = 0; is2 < ns; ++is2) {
-                    omega2 = dynamical->eval_phonon[ik2][is2];
+                    arr_quartic[1] = ns * ik1 + is1;
+                    arr_cubic1[0] = ns * kpoint->knum_minus[ik1] + is1;
 
-                    arr_quartic[2] = ns * ik2 + is2;
-                    arr_cubic1[1] = ns * kpoint->knum_minus[ik2] + is2;
+                    for (is2 = 0; is2 < ns; ++is2) {
+                        omega2 = dynamical->eval_phonon[ik2][is2];
 
-                    for (is3 = 0; is3 < ns; ++is3) {
-                        omega3 = dynamical->eval_phonon[ik3][is3];
+                        arr_quartic[2] = ns * ik2 + is2;
+                        arr_cubic1[1] = ns * kpoint->knum_minus[ik2] + is2;
 
-                        arr_quartic[3] = ns * ik3 + is3;
-                        arr_cubic2[0] = ns * kpoint->knum_minus[ik3] + is3;
+                        for (is3 = 0; is3 < ns; ++is3) {
+                            omega3 = dynamical->eval_phonon[ik3][is3];
 
-                        v4_tmp = anharmonic_core->V4(arr_quartic);
+                            arr_quartic[3] = ns * ik3 + is3;
+                            arr_cubic2[0] = ns * kpoint->knum_minus[ik3] + is3;
+
+                            v4_tmp = anharmonic_core->V4(arr_quartic);
 
-                        for (is4 = 0; is4 < ns; ++is4) {
-                            omega4 = dynamical->eval_phonon[ik4][is4];
+                            for (is4 = 0; is4 < ns; ++is4) {
+                                omega4 = dynamical->eval_phonon[ik4][is4];
 
-                            arr_cubic1[2] = ns * ik4 + is4;
-                            arr_cubic2[1] = ns * kpoint->knum_minus[ik4] + is4;
+                                arr_cubic1[2] = ns * ik4 + is4;
+                                arr_cubic2[1] = ns * kpoint->knum_minus[ik4] + is4;
 
-                            v3_tmp1 = anharmonic_core->V3(arr_cubic1);
-                            v3_tmp2 = anharmonic_core->V3(arr_cubic2);
+                                v3_tmp1 = anharmonic_core->V3(arr_cubic1);
+                                v3_tmp2 = anharmonic_core->V3(arr_cubic2);
 
-                            v_prod = v4_tmp * v3_tmp1 * v3_tmp2;
+                                v_prod = v4_tmp * v3_tmp1 * v3_tmp2;
 
-                            for (ip1 = 1; ip1 >= -1; ip1 -= 2) {
-                                dp1 = static_cast<double>(ip1) * omega1;
-                                for (ip2 = 1; ip2 >= -1; ip2 -= 2) {
-                                    dp2 = static_cast<double>(ip2) * omega2;
-                                    for (ip3 = 1; ip3 >= -1; ip3 -= 2) {
-                                        dp3 = static_cast<double>(ip3) * omega3;
+                                for (ip1 = 1; ip1 >= -1; ip1 -= 2) {
+                                    dp1 = static_cast<double>(ip1) * omega1;
+                                    for (ip2 = 1; ip2 >= -1; ip2 -= 2) {
+                                        dp2 = static_cast<double>(ip2) * omega2;
+                                        for (ip3 = 1; ip3 >= -1; ip3 -= 2) {
+                                            dp3 = static_cast<double>(ip3) * omega3;
 
-                                        omega_sum[1] = 1.0 / (omega_shift + dp1 + dp2 + dp3);
+                                            omega_sum[1] = 1.0 / (omega_shift + dp1 + dp2 + dp3);
 
-                                        for (ip4 = 1; ip4 >= -1; ip4 -= 2) {
-                                            dp4 = static_cast<double>(ip4) * omega4;
+                                            for (ip4 = 1; ip4 >= -1; ip4 -= 2) {
+                                                dp4 = static_cast<double>(ip4) * omega4;
 
-                                            omega_sum[0] = 1.0 / (omega_shift + dp3 + dp4);
-                                            D124 = 1.0 / (dp1 + dp2 - dp4);
+                                                omega_sum[0] = 1.0 / (omega_shift + dp3 + dp4);
+                                                D124 = 1.0 / (dp1 + dp2 - dp4);
 
-                                            for (i = 0; i < N; ++i) {
-                                                T_tmp = T[i];
+                                                for (i = 0; i < N; ++i) {
+                                                    T_tmp = T[i];
 
-                                                n1 = thermodynamics->fB(dp1, T_tmp);
-                                                n2 = thermodynamics->fB(dp2, T_tmp);
-                                                n3 = thermodynamics->fB(dp3, T_tmp);
-                                                n4 = thermodynamics->fB(dp4, T_tmp);
+                                                    n1 = thermodynamics->fB(dp1, T_tmp);
+                                                    n2 = thermodynamics->fB(dp2, T_tmp);
+                                                    n3 = thermodynamics->fB(dp3, T_tmp);
+                                                    n4 = thermodynamics->fB(dp4, T_tmp);
 
-                                                ret_mpi[i]
-                                                    += v_prod * static_cast<double>(ip1 * ip2 * ip3 * ip4) * D124
-                                                    * ((1.0 + n1 + n2 + n3 + n4 + n1 * n3 + n1 * n4 + n2 * n3 + n2 * n4)
-                                                        * omega_sum[0]
-                                                        - (1.0 + n1 + n2 + n3 + n1 * n2 + n2 * n3 + n1 * n3) * omega_sum
-                                                        [1]);
+                                                    ret_omp[i]
+                                                        += v_prod * static_cast<double>(ip1 * ip2 * ip3 * ip4) * D124
+                                                        * ((1.0 + n1 + n2 + n3 + n4 + n1 * n3 + n1 * n4 + n2 * n3 + n2 * n4)
+                                                            * omega_sum[0]
+                                                            - (1.0 + n1 + n2 + n3 + n1 * n2 + n2 * n3 + n1 * n3) * omega_sum
+                                                            [1]);
 
+                                                }
                                             }
                                         }
                                     }
@@ -1195,6 +1520,14 @@ void Selfenergy::selfenergy_g(const unsigned int N,
                 }
             }
         }
+
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+        {
+            for (i = 0; i < N; ++i) ret_mpi[i] += ret_omp[i];
+        }
+        memory->deallocate(ret_omp);
     }
 
     factor = -1.0 / (std::pow(static_cast<double>(nk), 2) * std::pow(2.0, 6));
@@ -1256,135 +1589,151 @@ void Selfenergy::selfenergy_h(const unsigned int N,
     arr_cubic1[0] = ns * kpoint->knum_minus[knum] + snum;
     arr_cubic4[2] = ns * knum + snum;
 
-    for (ik1 = mympi->my_rank; ik1 < nk; ik1 += mympi->nprocs) {
-
-        xk_tmp[0] = kpoint->xk[knum][0] - kpoint->xk[ik1][0];
-        xk_tmp[1] = kpoint->xk[knum][1] - kpoint->xk[ik1][1];
-        xk_tmp[2] = kpoint->xk[knum][2] - kpoint->xk[ik1][2];
-
-        iloc = (nint(xk_tmp[0] * static_cast<double>(nkx) + static_cast<double>(2 * nkx))) % nkx;
-        jloc = (nint(xk_tmp[1] * static_cast<double>(nky) + static_cast<double>(2 * nky))) % nky;
-        kloc = (nint(xk_tmp[2] * static_cast<double>(nkz) + static_cast<double>(2 * nkz))) % nkz;
-
-        ik2 = kloc + nkz * jloc + nky * nkz * iloc;
+#ifdef _OPENMP
+#pragma omp parallel private(i, ik1, ik2, ik3, ik4, ik5, is1, is2, is3, is4, is5, iloc, jloc, kloc, \
+                     ip1, ip2, ip3, ip4, ip5, T_tmp, xk_tmp, omega1, omega2, omega3, omega4, omega5, \
+                     dp1, dp2, dp3, dp4, dp5, n1, n2, n3, n4, n5, D1, D2, D1_inv, D2_inv, D12_inv, \
+                     N12, N35, N34, N_prod, v3_tmp1, v3_tmp2, v3_tmp3, v3_tmp4, v_prod, omega_sum) \
+                     firstprivate(arr_cubic1, arr_cubic2, arr_cubic3, arr_cubic4)
+#endif
+    {
+        std::complex<double> *ret_omp;
+        memory->allocate(ret_omp, N);
+        for (i = 0; i < N; ++i) ret_omp[i] = std::complex<double>(0.0, 0.0);
 
-        for (ik3 = 0; ik3 < nk; ++ik3) {
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+        for (ik1 = mympi->my_rank; ik1 < nk; ik1 += mympi->nprocs) {
 
-            xk_tmp[0] = kpoint->xk[ik1][0] - kpoint->xk[ik3][0];
-            xk_tmp[1] = kpoint->xk[ik1][1] - kpoint->xk[ik3][1];
-            xk_tmp[2] = kpoint->xk[ik1][2] - kpoint->xk[ik3][2];
+            xk_tmp[0] = kpoint->xk[knum][0] - kpoint->xk[ik1][0];
+            xk_tmp[1] = kpoint->xk[knum][1] - kpoint->xk[ik1][1];
+            xk_tmp[2] = kpoint->xk[knum][2] - kpoint->xk[ik1][2];
 
             iloc = (nint(xk_tmp[0] * static_cast<double>(nkx) + static_cast<double>(2 * nkx))) % nkx;
             jloc = (nint(xk_tmp[1] * static_cast<double>(nky) + static_cast<double>(2 * nky))) % nky;
             kloc = (nint(xk_tmp[2] * static_cast<double>(nkz) + static_cast<double>(2 * nkz))) % nkz;
 
-            ik5 = kloc + nkz * jloc + nky * nkz * iloc;
+            ik2 = kloc + nkz * jloc + nky * nkz * iloc;
 
-            xk_tmp[0] = kpoint->xk[knum][0] - kpoint->xk[ik5][0];
-            xk_tmp[1] = kpoint->xk[knum][1] - kpoint->xk[ik5][1];
-            xk_tmp[2] = kpoint->xk[knum][2] - kpoint->xk[ik5][2];
+            for (ik3 = 0; ik3 < nk; ++ik3) {
 
-            iloc = (nint(xk_tmp[0] * static_cast<double>(nkx) + static_cast<double>(2 * nkx))) % nkx;
-            jloc = (nint(xk_tmp[1] * static_cast<double>(nky) + static_cast<double>(2 * nky))) % nky;
-            kloc = (nint(xk_tmp[2] * static_cast<double>(nkz) + static_cast<double>(2 * nkz))) % nkz;
+                xk_tmp[0] = kpoint->xk[ik1][0] - kpoint->xk[ik3][0];
+                xk_tmp[1] = kpoint->xk[ik1][1] - kpoint->xk[ik3][1];
+                xk_tmp[2] = kpoint->xk[ik1][2] - kpoint->xk[ik3][2];
 
-            ik4 = kloc + nkz * jloc + nky * nkz * iloc;
+                iloc = (nint(xk_tmp[0] * static_cast<double>(nkx) + static_cast<double>(2 * nkx))) % nkx;
+                jloc = (nint(xk_tmp[1] * static_cast<double>(nky) + static_cast<double>(2 * nky))) % nky;
+                kloc = (nint(xk_tmp[2] * static_cast<double>(nkz) + static_cast<double>(2 * nkz))) % nkz;
 
+                ik5 = kloc + nkz * jloc + nky * nkz * iloc;
 
-            for (is1 = 0; is1 < ns; ++is1) {
-                omega1 = dynamical->eval_phonon[ik1][is1];
+                xk_tmp[0] = kpoint->xk[knum][0] - kpoint->xk[ik5][0];
+                xk_tmp[1] = kpoint->xk[knum][1] - kpoint->xk[ik5][1];
+                xk_tmp[2] = kpoint->xk[knum][2] - kpoint->xk[ik5][2];
 
-                arr_cubic1[1] = ns * ik1 + is1;
-                arr_cubic2[0] = ns * kpoint->knum_minus[ik1] + is1;
+                iloc = (nint(xk_tmp[0] * static_cast<double>(nkx) + static_cast<double>(2 * nkx))) % nkx;
+                jloc = (nint(xk_tmp[1] * static_cast<double>(nky) + static_cast<double>(2 * nky))) % nky;
+                kloc = (nint(xk_tmp[2] * static_cast<double>(nkz) + static_cast<double>(2 * nkz))) % nkz;
 
-                for (is2 = 0; is2 < ns; ++is2) {
-                    omega2 = dynamical->eval_phonon[ik2][is2];
+                ik4 = kloc + nkz * jloc + nky * nkz * iloc;
 
-                    arr_cubic1[2] = ns * ik2 + is2;
-                    arr_cubic3[0] = ns * kpoint->knum_minus[ik2] + is2;
 
-                    v3_tmp1 = anharmonic_core->V3(arr_cubic1);
+                for (is1 = 0; is1 < ns; ++is1) {
+                    omega1 = dynamical->eval_phonon[ik1][is1];
 
-                    for (is3 = 0; is3 < ns; ++ is3) {
-                        omega3 = dynamical->eval_phonon[ik3][is3];
+                    arr_cubic1[1] = ns * ik1 + is1;
+                    arr_cubic2[0] = ns * kpoint->knum_minus[ik1] + is1;
 
-                        arr_cubic2[1] = ns * ik3 + is3;
-                        arr_cubic3[1] = ns * kpoint->knum_minus[ik3] + is3;
+                    for (is2 = 0; is2 < ns; ++is2) {
+                        omega2 = dynamical->eval_phonon[ik2][is2];
 
-                        for (is4 = 0; is4 < ns; ++is4) {
-                            omega4 = dynamical->eval_phonon[ik4][is4];
+                        arr_cubic1[2] = ns * ik2 + is2;
+                        arr_cubic3[0] = ns * kpoint->knum_minus[ik2] + is2;
 
-                            arr_cubic3[2] = ns * ik4 + is4;
-                            arr_cubic4[0] = ns * kpoint->knum_minus[ik4] + is4;
+                        v3_tmp1 = anharmonic_core->V3(arr_cubic1);
 
-                            v3_tmp3 = anharmonic_core->V3(arr_cubic3);
+                        for (is3 = 0; is3 < ns; ++ is3) {
+                            omega3 = dynamical->eval_phonon[ik3][is3];
 
-                            for (is5 = 0; is5 < ns; ++is5) {
-                                omega5 = dynamical->eval_phonon[ik5][is5];
+                            arr_cubic2[1] = ns * ik3 + is3;
+                            arr_cubic3[1] = ns * kpoint->knum_minus[ik3] + is3;
 
-                                arr_cubic2[2] = ns * ik5 + is5;
-                                arr_cubic4[1] = ns * kpoint->knum_minus[ik5] + is5;
+                            for (is4 = 0; is4 < ns; ++is4) {
+                                omega4 = dynamical->eval_phonon[ik4][is4];
 
-                                v3_tmp2 = anharmonic_core->V3(arr_cubic2);
-                                v3_tmp4 = anharmonic_core->V3(arr_cubic4);
+                                arr_cubic3[2] = ns * ik4 + is4;
+                                arr_cubic4[0] = ns * kpoint->knum_minus[ik4] + is4;
 
-                                v_prod = v3_tmp1 * v3_tmp2 * v3_tmp3 * v3_tmp4;
+                                v3_tmp3 = anharmonic_core->V3(arr_cubic3);
 
-                                for (ip1 = 1; ip1 >= -1; ip1 -= 2) {
-                                    dp1 = static_cast<double>(ip1) * omega1;
+                                for (is5 = 0; is5 < ns; ++is5) {
+                                    omega5 = dynamical->eval_phonon[ik5][is5];
 
-                                    for (ip2 = 1; ip2 >= -1; ip2 -= 2) {
-                                        dp2 = static_cast<double>(ip2) * omega2;
-                                        omega_sum[0] = 1.0 / (omega_shift + dp1 - dp2);
+                                    arr_cubic2[2] = ns * ik5 + is5;
+                                    arr_cubic4[1] = ns * kpoint->knum_minus[ik5] + is5;
 
-                                        for (ip3 = 1; ip3 >= -1; ip3 -= 2) {
-                                            dp3 = static_cast<double>(ip3) * omega3;
+                                    v3_tmp2 = anharmonic_core->V3(arr_cubic2);
+                                    v3_tmp4 = anharmonic_core->V3(arr_cubic4);
 
-                                            for (ip4 = 1; ip4 >= -1; ip4 -= 2) {
-                                                dp4 = static_cast<double>(ip4) * omega4;
+                                    v_prod = v3_tmp1 * v3_tmp2 * v3_tmp3 * v3_tmp4;
 
-                                                D2 = dp4 - dp3 - dp2;
-                                                D2_inv = 1.0 / D2;
-                                                omega_sum[3] = 1.0 / (omega_shift + dp1 + dp3 - dp4);
+                                    for (ip1 = 1; ip1 >= -1; ip1 -= 2) {
+                                        dp1 = static_cast<double>(ip1) * omega1;
 
-                                                for (ip5 = 1; ip5 >= -1; ip5 -= 2) {
-                                                    dp5 = static_cast<double>(ip5) * omega5;
+                                        for (ip2 = 1; ip2 >= -1; ip2 -= 2) {
+                                            dp2 = static_cast<double>(ip2) * omega2;
+                                            omega_sum[0] = 1.0 / (omega_shift + dp1 - dp2);
 
-                                                    D1 = dp5 - dp3 - dp1;
-                                                    D1_inv = 1.0 / D1;
-                                                    D12_inv = D1_inv * D2_inv;
+                                            for (ip3 = 1; ip3 >= -1; ip3 -= 2) {
+                                                dp3 = static_cast<double>(ip3) * omega3;
 
-                                                    omega_sum[1] = 1.0 / (omega_shift - dp4 + dp5);
-                                                    omega_sum[2] = 1.0 / (omega_shift - dp2 - dp3 + dp5);
+                                                for (ip4 = 1; ip4 >= -1; ip4 -= 2) {
+                                                    dp4 = static_cast<double>(ip4) * omega4;
 
-                                                    for (i = 0; i < N; ++i) {
-                                                        T_tmp = T[i];
+                                                    D2 = dp4 - dp3 - dp2;
+                                                    D2_inv = 1.0 / D2;
+                                                    omega_sum[3] = 1.0 / (omega_shift + dp1 + dp3 - dp4);
 
-                                                        n1 = thermodynamics->fB(dp1, T_tmp);
-                                                        n2 = thermodynamics->fB(dp2, T_tmp);
-                                                        n3 = thermodynamics->fB(dp3, T_tmp);
-                                                        n4 = thermodynamics->fB(dp4, T_tmp);
-                                                        n5 = thermodynamics->fB(dp5, T_tmp);
-
-                                                        N12 = n1 - n2;
-                                                        N34 = n3 - n4;
-                                                        N35 = n3 - n5;
-
-                                                        N_prod[0] = N12 * (1.0 + n3);
-                                                        N_prod[1] = (1.0 + n2 + n3) * (1.0 + n5) - (1.0 + n1 + n3) * (
-                                                            1.0 + n4);
-                                                        N_prod[2] = ((1.0 + n2) * N35 - n3 * (1.0 + n5));
-                                                        N_prod[3] = -((1.0 + n1) * N34 - n3 * (1.0 + n4));
-
-                                                        ret_mpi[i]
-                                                            += v_prod * static_cast<double>(ip1 * ip2 * ip3 * ip4 * ip5)
-                                                            * (D12_inv
-                                                                * (N_prod[0] * omega_sum[0]
-                                                                    + N_prod[1] * omega_sum[1]
-                                                                    + N_prod[2] * omega_sum[2]
-                                                                    + N_prod[3] * omega_sum[3])
-                                                                + N12 * ((1.0 + n5) * D1_inv - (1.0 + n4) * D2_inv)
-                                                                * omega_sum[0] * omega_sum[1]);
+                                                    for (ip5 = 1; ip5 >= -1; ip5 -= 2) {
+                                                        dp5 = static_cast<double>(ip5) * omega5;
+
+                                                        D1 = dp5 - dp3 - dp1;
+                                                        D1_inv = 1.0 / D1;
+                                                        D12_inv = D1_inv * D2_inv;
+
+                                                        omega_sum[1] = 1.0 / (omega_shift - dp4 + dp5);
+                                                        omega_sum[2] = 1.0 / (omega_shift - dp2 - dp3 + dp5);
+
+                                                        for (i = 0; i < N; ++i) {
+                                                            T_tmp = T[i];
+
+                                                            n1 = thermodynamics->fB(dp1, T_tmp);
+                                                            n2 = thermodynamics->fB(dp2, T_tmp);
+                                                            n3 = thermodynamics->fB(dp3, T_tmp);
+                                                            n4 = thermodynamics->fB(dp4, T_tmp);
+                                                            n5 = thermodynamics->fB(dp5, T_tmp);
+
+                                                            N12 = n1 - n2;
+                                                            N34 = n3 - n4;
+                                                            N35 = n3 - n5;
+
+                                                            N_prod[0] = N12 * (1.0 + n3);
+                                                            N_prod[1] = (1.0 + n2 + n3) * (1.0 + n5) - (1.0 + n1 + n3) * (
+                                                                1.0 + n4);
+                                                            N_prod[2] = ((1.0 + n2) * N35 - n3 * (1.0 + n5));
+                                                            N_prod[3] = -((1.0 + n1) * N34 - n3 * (1.0 + n4));
+
+                                                            ret_omp[i]
+                                                                += v_prod * static_cast<double>(ip1 * ip2 * ip3 * ip4 * ip5)
+                                                                * (D12_inv
+                                                                    * (N_prod[0] * omega_sum[0]
+                                                                        + N_prod[1] * omega_sum[1]
+                                                                        + N_prod[2] * omega_sum[2]
+                                                                        + N_prod[3] * omega_sum[3])
+                                                                    + N12 * ((1.0 + n5) * D1_inv - (1.0 + n4) * D2_inv)
+                                                                    * omega_sum[0] * omega_sum[1]);
+                                                        }
                                                     }
                                                 }
                                             }
@@ -1397,6 +1746,14 @@ void Selfenergy::selfenergy_h(const unsigned int N,
                 }
             }
         }
+
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+        {
+            for (i = 0; i < N; ++i) ret_mpi[i] += ret_omp[i];
+        }
+        memory->deallocate(ret_omp);
     }
 
     factor = 1.0 / (std::pow(static_cast<double>(nk), 2) * std::pow(2.0, 7));
@@ -1459,140 +1816,155 @@ void Selfenergy::selfenergy_i(const unsigned int N,
     arr_quartic[0] = ns * kpoint->knum_minus[knum] + snum;
     arr_quartic[3] = ns * knum + snum;
 
-    for (ik1 = mympi->my_rank; ik1 < nk; ik1 += mympi->nprocs) {
-        for (ik2 = 0; ik2 < nk; ++ik2) {
+#ifdef _OPENMP
+#pragma omp parallel private(i, ik1, ik2, ik3, ik4, is1, is2, is3, is4, iloc, jloc, kloc, ip1, ip2, \
+                     ip3, ip4, omega1, omega2, omega3, omega4, n1, n2, n3, n4, dp1, dp2, dp3, dp4, \
+                     D24, D123, D134, dp2_inv, T_tmp, xk_tmp, N_prod, T_inv, v4_tmp, v3_tmp1, \
+                     v3_tmp2, v_prod) firstprivate(arr_quartic, arr_cubic1, arr_cubic2)
+#endif
+    {
+        std::complex<double> *ret_omp;
+        memory->allocate(ret_omp, N);
+        for (i = 0; i < N; ++i) ret_omp[i] = std::complex<double>(0.0, 0.0);
 
-            ik4 = ik2;
-            xk_tmp[0] = kpoint->xk[ik2][0] - kpoint->xk[ik1][0];
-            xk_tmp[1] = kpoint->xk[ik2][1] - kpoint->xk[ik1][1];
-            xk_tmp[2] = kpoint->xk[ik2][2] - kpoint->xk[ik1][2];
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+        for (ik1 = mympi->my_rank; ik1 < nk; ik1 += mympi->nprocs) {
+            for (ik2 = 0; ik2 < nk; ++ik2) {
 
-            iloc = (nint(xk_tmp[0] * static_cast<double>(nkx) + static_cast<double>(2 * nkx))) % nkx;
-            jloc = (nint(xk_tmp[1] * static_cast<double>(nky) + static_cast<double>(2 * nky))) % nky;
-            kloc = (nint(xk_tmp[2] * static_cast<double>(nkz) + static_cast<double>(2 * nkz))) % nkz;
+                ik4 = ik2;
+                xk_tmp[0] = kpoint->xk[ik2][0] - kpoint->xk[ik1][0];
+                xk_tmp[1] = kpoint->xk[ik2][1] - kpoint->xk[ik1][1];
+                xk_tmp[2] = kpoint->xk[ik2][2] - kpoint->xk[ik1][2];
 
-            ik3 = kloc + nkz * jloc + nky * nkz * iloc;
+                iloc = (nint(xk_tmp[0] * static_cast<double>(nkx) + static_cast<double>(2 * nkx))) % nkx;
+                jloc = (nint(xk_tmp[1] * static_cast<double>(nky) + static_cast<double>(2 * nky))) % nky;
+                kloc = (nint(xk_tmp[2] * static_cast<double>(nkz) + static_cast<double>(2 * nkz))) % nkz;
 
-            for (is2 = 0; is2 < ns; ++is2) {
-                omega2 = dynamical->eval_phonon[ik2][is2];
+                ik3 = kloc + nkz * jloc + nky * nkz * iloc;
 
-                arr_quartic[1] = ns * ik2 + is2;
-                arr_cubic2[0] = ns * kpoint->knum_minus[ik2] + is2;
+                for (is2 = 0; is2 < ns; ++is2) {
+                    omega2 = dynamical->eval_phonon[ik2][is2];
 
-                for (is4 = 0; is4 < ns; ++is4) {
-                    omega4 = dynamical->eval_phonon[ik4][is4];
+                    arr_quartic[1] = ns * ik2 + is2;
+                    arr_cubic2[0] = ns * kpoint->knum_minus[ik2] + is2;
 
-                    arr_quartic[2] = ns * kpoint->knum_minus[ik4] + is4;
-                    arr_cubic1[2] = ns * ik4 + is4;
+                    for (is4 = 0; is4 < ns; ++is4) {
+                        omega4 = dynamical->eval_phonon[ik4][is4];
 
-                    v4_tmp = anharmonic_core->V4(arr_quartic);
+                        arr_quartic[2] = ns * kpoint->knum_minus[ik4] + is4;
+                        arr_cubic1[2] = ns * ik4 + is4;
 
-                    if (std::abs(omega2 - omega4) < eps) {
+                        v4_tmp = anharmonic_core->V4(arr_quartic);
 
-                        for (is3 = 0; is3 < ns; ++is3) {
-                            omega3 = dynamical->eval_phonon[ik3][is3];
+                        if (std::abs(omega2 - omega4) < eps) {
 
-                            arr_cubic1[1] = ns * kpoint->knum_minus[ik3] + is3;
-                            arr_cubic2[2] = ns * ik3 + is3;
+                            for (is3 = 0; is3 < ns; ++is3) {
+                                omega3 = dynamical->eval_phonon[ik3][is3];
 
-                            for (is1 = 0; is1 < ns; ++is1) {
-                                omega1 = dynamical->eval_phonon[ik1][is1];
+                                arr_cubic1[1] = ns * kpoint->knum_minus[ik3] + is3;
+                                arr_cubic2[2] = ns * ik3 + is3;
 
-                                arr_cubic1[0] = ns * kpoint->knum_minus[ik1] + is1;
-                                arr_cubic2[1] = ns * ik1 + is1;
+                                for (is1 = 0; is1 < ns; ++is1) {
+                                    omega1 = dynamical->eval_phonon[ik1][is1];
 
-                                v3_tmp1 = anharmonic_core->V3(arr_cubic1);
-                                v3_tmp2 = anharmonic_core->V3(arr_cubic2);
+                                    arr_cubic1[0] = ns * kpoint->knum_minus[ik1] + is1;
+                                    arr_cubic2[1] = ns * ik1 + is1;
 
-                                v_prod = v4_tmp * v3_tmp1 * v3_tmp2;
+                                    v3_tmp1 = anharmonic_core->V3(arr_cubic1);
+                                    v3_tmp2 = anharmonic_core->V3(arr_cubic2);
 
-                                for (ip1 = 1; ip1 >= -1; ip1 -= 2) {
-                                    dp1 = static_cast<double>(ip1) * omega1;
+                                    v_prod = v4_tmp * v3_tmp1 * v3_tmp2;
 
-                                    for (ip2 = 1; ip2 >= -1; ip2 -= 2) {
-                                        dp2 = static_cast<double>(ip2) * omega2;
+                                    for (ip1 = 1; ip1 >= -1; ip1 -= 2) {
+                                        dp1 = static_cast<double>(ip1) * omega1;
 
-                                        dp2_inv = 1.0 / dp2;
+                                        for (ip2 = 1; ip2 >= -1; ip2 -= 2) {
+                                            dp2 = static_cast<double>(ip2) * omega2;
 
-                                        for (ip3 = 1; ip3 >= -1; ip3 -= 2) {
-                                            dp3 = static_cast<double>(ip3) * omega3;
+                                            dp2_inv = 1.0 / dp2;
 
-                                            D123 = 1.0 / (dp1 + dp2 + dp3);
+                                            for (ip3 = 1; ip3 >= -1; ip3 -= 2) {
+                                                dp3 = static_cast<double>(ip3) * omega3;
 
-                                            for (i = 0; i < N; ++i) {
-                                                T_tmp = T[i];
+                                                D123 = 1.0 / (dp1 + dp2 + dp3);
 
-                                                n1 = thermodynamics->fB(dp1, T_tmp);
-                                                n2 = thermodynamics->fB(dp2, T_tmp);
-                                                n3 = thermodynamics->fB(dp3, T_tmp);
+                                                for (i = 0; i < N; ++i) {
+                                                    T_tmp = T[i];
+
+                                                    n1 = thermodynamics->fB(dp1, T_tmp);
+                                                    n2 = thermodynamics->fB(dp2, T_tmp);
+                                                    n3 = thermodynamics->fB(dp3, T_tmp);
 
-                                                N_prod[0] = (1.0 + n1) * (1.0 + n3) + n2 * (1.0 + n2 + n3);
-                                                N_prod[1] = n2 * (1.0 + n2) * (1.0 + n2 + n3);
+                                                    N_prod[0] = (1.0 + n1) * (1.0 + n3) + n2 * (1.0 + n2 + n3);
+                                                    N_prod[1] = n2 * (1.0 + n2) * (1.0 + n2 + n3);
 
-                                                if (std::abs(T_tmp) < eps) {
-                                                    T_inv = 0.0;
-                                                } else {
-                                                    T_inv = 1.0 / (thermodynamics->T_to_Ryd * T_tmp);
-                                                }
+                                                    if (std::abs(T_tmp) < eps) {
+                                                        T_inv = 0.0;
+                                                    } else {
+                                                        T_inv = 1.0 / (thermodynamics->T_to_Ryd * T_tmp);
+                                                    }
 
-                                                ret_mpi[i]
-                                                    += v_prod * static_cast<double>(ip1 * ip3)
-                                                    * (D123 * (N_prod[0] * D123 + N_prod[1] * T_inv + N_prod[0] *
-                                                        dp2_inv));
+                                                    ret_omp[i]
+                                                        += v_prod * static_cast<double>(ip1 * ip3)
+                                                        * (D123 * (N_prod[0] * D123 + N_prod[1] * T_inv + N_prod[0] *
+                                                            dp2_inv));
+                                                }
                                             }
                                         }
                                     }
                                 }
                             }
-                        }
 
-                    } else {
-                        for (is3 = 0; is3 < ns; ++is3) {
-                            omega3 = dynamical->eval_phonon[ik3][is3];
+                        } else {
+                            for (is3 = 0; is3 < ns; ++is3) {
+                                omega3 = dynamical->eval_phonon[ik3][is3];
 
-                            arr_cubic1[1] = ns * kpoint->knum_minus[ik3] + is3;
-                            arr_cubic2[2] = ns * ik3 + is3;
+                                arr_cubic1[1] = ns * kpoint->knum_minus[ik3] + is3;
+                                arr_cubic2[2] = ns * ik3 + is3;
 
-                            for (is1 = 0; is1 < ns; ++is1) {
-                                omega1 = dynamical->eval_phonon[ik1][is1];
+                                for (is1 = 0; is1 < ns; ++is1) {
+                                    omega1 = dynamical->eval_phonon[ik1][is1];
 
-                                arr_cubic1[0] = ns * kpoint->knum_minus[ik1] + is1;
-                                arr_cubic2[1] = ns * ik1 + is1;
+                                    arr_cubic1[0] = ns * kpoint->knum_minus[ik1] + is1;
+                                    arr_cubic2[1] = ns * ik1 + is1;
 
-                                v3_tmp1 = anharmonic_core->V3(arr_cubic1);
-                                v3_tmp2 = anharmonic_core->V3(arr_cubic2);
+                                    v3_tmp1 = anharmonic_core->V3(arr_cubic1);
+                                    v3_tmp2 = anharmonic_core->V3(arr_cubic2);
 
-                                v_prod = v4_tmp * v3_tmp1 * v3_tmp2;
+                                    v_prod = v4_tmp * v3_tmp1 * v3_tmp2;
 
-                                for (ip1 = 1; ip1 >= -1; ip1 -= 2) {
-                                    dp1 = static_cast<double>(ip1) * omega1;
+                                    for (ip1 = 1; ip1 >= -1; ip1 -= 2) {
+                                        dp1 = static_cast<double>(ip1) * omega1;
 
-                                    for (ip2 = 1; ip2 >= -1; ip2 -= 2) {
-                                        dp2 = static_cast<double>(ip2) * omega2;
+                                        for (ip2 = 1; ip2 >= -1; ip2 -= 2) {
+                                            dp2 = static_cast<double>(ip2) * omega2;
 
-                                        for (ip3 = 1; ip3 >= -1; ip3 -= 2) {
+                                            for (ip3 = 1; ip3 >= -1; ip3 -= 2) {
 
-                                            dp3 = static_cast<double>(ip3) * omega3;
-                                            D123 = 1.0 / (dp1 - dp2 + dp3);
+                                                dp3 = static_cast<double>(ip3) * omega3;
+                                                D123 = 1.0 / (dp1 - dp2 + dp3);
 
-                                            for (ip4 = 1; ip4 >= -1; ip4 -= 2) {
-                                                dp4 = static_cast<double>(ip4) * omega4;
+                                                for (ip4 = 1; ip4 >= -1; ip4 -= 2) {
+                                                    dp4 = static_cast<double>(ip4) * omega4;
 
-                                                D24 = 1.0 / (dp2 - dp4);
-                                                D134 = 1.0 / (dp1 + dp3 - dp4);
+                                                    D24 = 1.0 / (dp2 - dp4);
+                                                    D134 = 1.0 / (dp1 + dp3 - dp4);
 
-                                                for (i = 0; i < N; ++i) {
-                                                    T_tmp = T[i];
+                                                    for (i = 0; i < N; ++i) {
+                                                        T_tmp = T[i];
 
-                                                    n1 = thermodynamics->fB(dp1, T_tmp);
-                                                    n2 = thermodynamics->fB(dp2, T_tmp);
-                                                    n3 = thermodynamics->fB(dp3, T_tmp);
-                                                    n4 = thermodynamics->fB(dp4, T_tmp);
+                                                        n1 = thermodynamics->fB(dp1, T_tmp);
+                                                        n2 = thermodynamics->fB(dp2, T_tmp);
+                                                        n3 = thermodynamics->fB(dp3, T_tmp);
+                                                        n4 = thermodynamics->fB(dp4, T_tmp);
 
-                                                    ret_mpi[i]
-                                                        += v_prod * static_cast<double>(ip1 * ip2 * ip3 * ip4)
-                                                        * ((1.0 + n1 + n3) * D24 * (n4 * D134 - n2 * D123)
-                                                            + D123 * D134 * n1 * n3);
+                                                        ret_omp[i]
+                                                            += v_prod * static_cast<double>(ip1 * ip2 * ip3 * ip4)
+                                                            * ((1.0 + n1 + n3) * D24 * (n4 * D134 - n2 * D123)
+                                                                + D123 * D134 * n1 * n3);
+                                                    }
                                                 }
                                             }
                                         }
@@ -1604,6 +1976,14 @@ void Selfenergy::selfenergy_i(const unsigned int N,
                 }
             }
         }
+
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+        {
+            for (i = 0; i < N; ++i) ret_mpi[i] += ret_omp[i];
+        }
+        memory->deallocate(ret_omp);
     }
 
     factor = -1.0 / (std::pow(static_cast<double>(nk), 2) * std::pow(2.0, 7));
@@ -1658,89 +2038,111 @@ void Selfenergy::selfenergy_j(const unsigned int N,
     arr_quartic1[0] = ns * kpoint->knum_minus[knum] + snum;
     arr_quartic1[3] = ns * knum + snum;
 
-    for (ik1 = mympi->my_rank; ik1 < nk; ik1 += mympi->nprocs) {
+#ifdef _OPENMP
+#pragma omp parallel private(i, ik1, ik2, ik3, is1, is2, is3, T_tmp, n1, n2, n3, omega1, omega2, \
+                     omega3, omega1_inv, D13, T_inv, v4_tmp1, v4_tmp2, v_prod) \
+                     firstprivate(arr_quartic1, arr_quartic2)
+#endif
+    {
+        std::complex<double> *ret_omp;
+        memory->allocate(ret_omp, N);
+        for (i = 0; i < N; ++i) ret_omp[i] = std::complex<double>(0.0, 0.0);
 
-        ik3 = ik1;
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+        for (ik1 = mympi->my_rank; ik1 < nk; ik1 += mympi->nprocs) {
 
-        for (ik2 = 0; ik2 < nk; ++ik2) {
+            ik3 = ik1;
 
-            for (is1 = 0; is1 < ns; ++is1) {
-                omega1 = dynamical->eval_phonon[ik1][is1];
+            for (ik2 = 0; ik2 < nk; ++ik2) {
 
-                arr_quartic1[1] = ns * ik1 + is1;
-                arr_quartic2[0] = ns * kpoint->knum_minus[ik1] + is1;
+                for (is1 = 0; is1 < ns; ++is1) {
+                    omega1 = dynamical->eval_phonon[ik1][is1];
 
+                    arr_quartic1[1] = ns * ik1 + is1;
+                    arr_quartic2[0] = ns * kpoint->knum_minus[ik1] + is1;
 
-                for (is3 = 0; is3 < ns; ++is3) {
-                    omega3 = dynamical->eval_phonon[ik1][is3];
 
-                    arr_quartic1[2] = ns * kpoint->knum_minus[ik3] + is3;
-                    arr_quartic2[3] = ns * ik3 + is3;
+                    for (is3 = 0; is3 < ns; ++is3) {
+                        omega3 = dynamical->eval_phonon[ik1][is3];
 
-                    v4_tmp1 = anharmonic_core->V4(arr_quartic1);
+                        arr_quartic1[2] = ns * kpoint->knum_minus[ik3] + is3;
+                        arr_quartic2[3] = ns * ik3 + is3;
 
-                    if (std::abs(omega1 - omega3) < eps) {
-                        omega1_inv = 1.0 / omega1;
+                        v4_tmp1 = anharmonic_core->V4(arr_quartic1);
 
-                        for (is2 = 0; is2 < ns; ++is2) {
-                            omega2 = dynamical->eval_phonon[ik2][is2];
+                        if (std::abs(omega1 - omega3) < eps) {
+                            omega1_inv = 1.0 / omega1;
 
-                            arr_quartic2[1] = ns * ik2 + is2;
-                            arr_quartic2[2] = ns * kpoint->knum_minus[ik2] + is2;
+                            for (is2 = 0; is2 < ns; ++is2) {
+                                omega2 = dynamical->eval_phonon[ik2][is2];
 
-                            v4_tmp2 = anharmonic_core->V4(arr_quartic2);
+                                arr_quartic2[1] = ns * ik2 + is2;
+                                arr_quartic2[2] = ns * kpoint->knum_minus[ik2] + is2;
 
-                            v_prod = v4_tmp1 * v4_tmp2;
+                                v4_tmp2 = anharmonic_core->V4(arr_quartic2);
 
-                            for (i = 0; i < N; ++i) {
-                                T_tmp = T[i];
+                                v_prod = v4_tmp1 * v4_tmp2;
 
-                                n1 = thermodynamics->fB(omega1, T_tmp);
-                                n2 = thermodynamics->fB(omega2, T_tmp);
+                                for (i = 0; i < N; ++i) {
+                                    T_tmp = T[i];
 
-                                if (std::abs(T_tmp) < eps) {
-                                    T_inv = 0.0;
-                                } else {
-                                    T_inv = 1.0 / (thermodynamics->T_to_Ryd * T_tmp);
-                                }
+                                    n1 = thermodynamics->fB(omega1, T_tmp);
+                                    n2 = thermodynamics->fB(omega2, T_tmp);
+
+                                    if (std::abs(T_tmp) < eps) {
+                                        T_inv = 0.0;
+                                    } else {
+                                        T_inv = 1.0 / (thermodynamics->T_to_Ryd * T_tmp);
+                                    }
 
-                                ret_mpi[i]
-                                    += v_prod * (2.0 * n2 + 1.0)
-                                    * (-2.0 * (1.0 + n1) * n1 * T_inv
-                                        - (2.0 * n1 + 1.0) * omega1_inv);
+                                    ret_omp[i]
+                                        += v_prod * (2.0 * n2 + 1.0)
+                                        * (-2.0 * (1.0 + n1) * n1 * T_inv
+                                            - (2.0 * n1 + 1.0) * omega1_inv);
+                                }
                             }
-                        }
-                    } else {
+                        } else {
 
-                        D13[0] = 1.0 / (omega1 - omega3);
-                        D13[1] = 1.0 / (omega1 + omega3);
+                            D13[0] = 1.0 / (omega1 - omega3);
+                            D13[1] = 1.0 / (omega1 + omega3);
 
-                        for (is2 = 0; is2 < ns; ++is2) {
-                            omega2 = dynamical->eval_phonon[ik2][is2];
+                            for (is2 = 0; is2 < ns; ++is2) {
+                                omega2 = dynamical->eval_phonon[ik2][is2];
 
-                            arr_quartic2[1] = ns * ik2 + is2;
-                            arr_quartic2[2] = ns * kpoint->knum_minus[ik2] + is2;
+                                arr_quartic2[1] = ns * ik2 + is2;
+                                arr_quartic2[2] = ns * kpoint->knum_minus[ik2] + is2;
 
-                            v4_tmp2 = anharmonic_core->V4(arr_quartic2);
+                                v4_tmp2 = anharmonic_core->V4(arr_quartic2);
 
-                            v_prod = v4_tmp1 * v4_tmp2;
+                                v_prod = v4_tmp1 * v4_tmp2;
 
-                            for (i = 0; i < N; ++i) {
-                                T_tmp = T[i];
+                                for (i = 0; i < N; ++i) {
+                                    T_tmp = T[i];
 
-                                n1 = thermodynamics->fB(omega1, T_tmp);
-                                n2 = thermodynamics->fB(omega2, T_tmp);
-                                n3 = thermodynamics->fB(omega3, T_tmp);
+                                    n1 = thermodynamics->fB(omega1, T_tmp);
+                                    n2 = thermodynamics->fB(omega2, T_tmp);
+                                    n3 = thermodynamics->fB(omega3, T_tmp);
 
-                                ret_mpi[i]
-                                    += v_prod * 2.0
-                                    * ((n1 - n3) * D13[0] - (1.0 + n1 + n3) * D13[1]);
+                                    ret_omp[i]
+                                        += v_prod * 2.0
+                                        * ((n1 - n3) * D13[0] - (1.0 + n1 + n3) * D13[1]);
+                                }
                             }
                         }
                     }
                 }
             }
         }
+
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+        {
+            for (i = 0; i < N; ++i) ret_mpi[i] += ret_omp[i];
+        }
+        memory->deallocate(ret_omp);
     }
 
     factor = -1.0 / (std::pow(static_cast<double>(nk), 2) * std::pow(2.0, 6));
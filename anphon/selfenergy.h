@@ -24,8 +24,15 @@ namespace PHON_NS
 
         ~Selfenergy();
 
+        bool kk_fft;
+
         void setup_selfenergy();
 
+        void kramers_kronig(unsigned int,
+                            const double *,
+                            const double *,
+                            double *) const;
+
         void selfenergy_tadpole(const unsigned int,
                                 double *,
                                 const double,
@@ -111,5 +118,15 @@ namespace PHON_NS
         void mpi_reduce_complex(unsigned int,
                                 std::complex<double> *,
                                 std::complex<double> *);
+
+        void kramers_kronig_direct(unsigned int,
+                                   const double *,
+                                   const double *,
+                                   double *) const;
+
+        void kramers_kronig_fft(unsigned int,
+                                const double *,
+                                const double *,
+                                double *) const;
     };
 }
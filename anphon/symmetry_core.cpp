@@ -77,8 +77,11 @@ void Symmetry::setup_symmetry()
     if (mympi->my_rank == 0) {
         std::cout << "  Number of symmetry operations : "
             << nsym << std::endl << std::endl;
-        gensym_withmap(xtmp, kdtmp);
     }
+
+    // The symmetry operations with atom mappings are needed on all MPI processes
+    // because the SCPH equation may be solved by processes other than rank 0.
+    gensym_withmap(xtmp, kdtmp);
     memory->deallocate(xtmp);
     memory->deallocate(kdtmp);
 }
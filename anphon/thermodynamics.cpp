@@ -336,6 +336,8 @@ void Thermodynamics::compute_free_energy_bubble()
 
     memory->allocate(FE_bubble, NT);
 
+    anharmonic_core->setup_v3store();
+
     compute_FE_bubble(dynamical->eval_phonon,
                       dynamical->evec_phonon,
                       FE_bubble);
@@ -361,7 +363,6 @@ void Thermodynamics::compute_FE_bubble(double **eval,
     unsigned int ns = dynamical->neval;
     double v3_tmp;
     unsigned int ik0, ik1, ik2, is0, is1, is2, i0, iT;
-    unsigned int arr_cubic[3];
     int nks0 = nk_reduced * ns;
     unsigned int NT = static_cast<unsigned int>((system->Tmax - system->Tmin) / system->dT) + 1;
     double temp;
@@ -369,6 +370,8 @@ void Thermodynamics::compute_FE_bubble(double **eval,
 
     double *FE_local;
     double *FE_tmp;
+    double *FE_omp;
+    double *v3norm_block;
 
     memory->allocate(FE_local, NT);
     memory->allocate(FE_tmp, NT);
@@ -410,47 +413,66 @@ void Thermodynamics::compute_FE_bubble(double **eval,
 
             int npair_uniq = triplet.size();
 
-            arr_cubic[0] = ns * ik0 + is0;
-
             for (iT = 0; iT < NT; ++iT) FE_tmp[iT] = 0.0;
 
-            for (ik = 0; ik < npair_uniq; ++ik) {
-                multi = static_cast<double>(triplet[ik].group.size());
+#ifdef _OPENMP
+#pragma omp parallel private(multi, ik1, ik2, is1, is2, omega0, omega1, omega2, omega_sum, \
+                             v3_tmp, iT, temp, n0, n1, n2, nsum, v3norm_block, FE_omp)
+#endif
+            {
+                memory->allocate(v3norm_block, ns * ns);
+                memory->allocate(FE_omp, NT);
 
-                arr_cubic[0] = ns * ik0 + is0;
+                for (iT = 0; iT < NT; ++iT) FE_omp[iT] = 0.0;
 
-                ik1 = triplet[ik].group[0].ks[0];
-                ik2 = triplet[ik].group[0].ks[1];
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+                for (ik = 0; ik < npair_uniq; ++ik) {
+                    multi = static_cast<double>(triplet[ik].group.size());
 
-                for (is1 = 0; is1 < ns; ++is1) {
-                    arr_cubic[1] = ns * ik1 + is1;
+                    ik1 = triplet[ik].group[0].ks[0];
+                    ik2 = triplet[ik].group[0].ks[1];
 
-                    for (is2 = 0; is2 < ns; ++is2) {
-                        arr_cubic[2] = ns * ik2 + is2;
+                    anharmonic_core->calc_V3norm2_block(ns * ik0 + is0, ik1, ik2,
+                                                        eval, evec, v3norm_block);
 
-                        omega0 = eval[ik0][is0];
-                        omega1 = eval[ik1][is1];
-                        omega2 = eval[ik2][is2];
+                    for (is1 = 0; is1 < ns; ++is1) {
+                        for (is2 = 0; is2 < ns; ++is2) {
 
-                        omega_sum[0] = 1.0 / (omega0 + omega1 + omega2);
-                        omega_sum[1] = 1.0 / (-omega0 + omega1 + omega2);
+                            omega0 = eval[ik0][is0];
+                            omega1 = eval[ik1][is1];
+                            omega2 = eval[ik2][is2];
 
-                        v3_tmp = std::norm(anharmonic_core->V3(arr_cubic)) * static_cast<double>(multi);
+                            omega_sum[0] = 1.0 / (omega0 + omega1 + omega2);
+                            omega_sum[1] = 1.0 / (-omega0 + omega1 + omega2);
 
+                            v3_tmp = v3norm_block[ns * is1 + is2] * static_cast<double>(multi);
 
-                        for (iT = 0; iT < NT; ++iT) {
-                            temp = system->Tmin + static_cast<double>(iT) * system->dT;
-                            n0 = thermodynamics->fB(omega0, temp);
-                            n1 = thermodynamics->fB(omega1, temp);
-                            n2 = thermodynamics->fB(omega2, temp);
+                            for (iT = 0; iT < NT; ++iT) {
+                                temp = system->Tmin + static_cast<double>(iT) * system->dT;
+                                n0 = thermodynamics->fB(omega0, temp);
+                                n1 = thermodynamics->fB(omega1, temp);
+                                n2 = thermodynamics->fB(omega2, temp);
 
-                            nsum[0] = (1.0 + n0) * (1.0 + n1 + n2) + n1 * n2;
-                            nsum[1] = n0 * n1 - n1 * n2 + n2 * n0 + n0;
+                                nsum[0] = (1.0 + n0) * (1.0 + n1 + n2) + n1 * n2;
+                                nsum[1] = n0 * n1 - n1 * n2 + n2 * n0 + n0;
 
-                            FE_tmp[iT] += v3_tmp * (nsum[0] * omega_sum[0] + 3.0 * nsum[1] * omega_sum[1]);
+                                FE_omp[iT] += v3_tmp * (nsum[0] * omega_sum[0] + 3.0 * nsum[1] * omega_sum[1]);
+                            }
                         }
                     }
                 }
+
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+                {
+                    for (iT = 0; iT < NT; ++iT) FE_tmp[iT] += FE_omp[iT];
+                }
+
+                memory->deallocate(v3norm_block);
+                memory->deallocate(FE_omp);
             }
             double weight = static_cast<double>(kpoint->kpoint_irred_all[vks_l[i0] / ns].size());
             for (iT = 0; iT < NT; ++iT) FE_local[iT] += FE_tmp[iT] * weight;
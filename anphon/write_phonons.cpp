@@ -99,9 +99,11 @@ void Writes::write_input_vars()
 
     std::cout << "  ISMEAR = " << integration->ismear
         << "; EPSILON = " << integration->epsilon << std::endl;
+    std::cout << "  DELTA_CUTOFF = " << integration->delta_cutoff << std::endl;
     std::cout << std::endl;
     std::cout << "  CLASSICAL = " << thermodynamics->classical << std::endl;
     std::cout << "  BCONNECT = " << dynamical->band_connection << std::endl;
+    std::cout << "  DIAG_IRRED = " << dynamical->diag_irreducible << std::endl;
     std::cout << std::endl;
 
     if (phon->mode == "RTA") {
@@ -117,13 +119,19 @@ void Writes::write_input_vars()
         for (i = 0; i < 3; ++i) std::cout << std::setw(5) << scph->kmesh_scph[i];
         std::cout << std::endl;
         std::cout << "  SELF_OFFDIAG = " << scph->selfenergy_offdiagonal << std::endl;
-        std::cout << "  IALGO = " << scph->ialgo << std::endl << std::endl;
+        std::cout << "  IALGO = " << scph->ialgo << std::endl;
+        std::cout << "  DISTRIBUTE_V4 = " << scph->distribute_v4 << std::endl;
+        std::cout << "  V4STORE = " << scph->v4_store << std::endl << std::endl;
         std::cout << "  RESTART_SCPH = " << scph->restart_scph << std::endl;
         std::cout << "  LOWER_TEMP = " << scph->lower_temp << std::endl;
-        std::cout << "  WARMSTART = " << scph->warmstart_scph << std::endl << std::endl;
+        std::cout << "  WARMSTART = " << scph->warmstart_scph << std::endl;
+        std::cout << "  NCHAIN = " << scph->nchain_scph << std::endl << std::endl;
         std::cout << "  TOL_SCPH = " << scph->tolerance_scph << std::endl;
         std::cout << "  MAXITER = " << scph->maxiter << std::endl;
         std::cout << "  MIXALPHA = " << scph->mixalpha << std::endl;
+        std::cout << "  MIXTYPE = " << scph->mixtype;
+        if (scph->mixtype == 1) std::cout << " (MIXHIST = " << scph->mixhist << ")";
+        std::cout << std::endl;
     }
     std::cout << std::endl;
 
@@ -180,6 +188,10 @@ void Writes::write_input_vars()
         }
 
         std::cout << "  KAPPA_SPEC = " << conductivity->calc_kappa_spec << std::endl;
+        std::cout << "  RTA_UNIT = " << conductivity->rta_unit << std::endl;
+        std::cout << "  RTA_CKPT = " << conductivity->rta_checkpoint << std::endl;
+        std::cout << "  RTA_KERNEL = " << conductivity->rta_kernel << std::endl;
+        std::cout << "  V3STORE = " << anharmonic_core->v3_store << std::endl;
 
         //        std::cout << "  KS_INPUT = " << anharmonic_core->ks_input << std::endl;
         //        std::cout << "  QUARTIC = " << anharmonic_core->quartic_mode << std::endl;